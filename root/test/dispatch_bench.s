@@ -0,0 +1,78 @@
+#
+# Copyright (c) 2020 Jie Zheng
+#
+#      A dispatch benchmark: every iteration calls a small function through
+#      a pointer and takes a back edge, each of them leaves one translation
+#      unit for another, so the cost of the vmm dispatch dominates, e.g.
+#          /test/dispatch_bench
+#          /test/dispatch_bench 50000000
+#
+
+.include "bench.inc"
+
+.equ DEFAULT_ROUNDS,    10000000
+# the per call time is taken in microseconds per thousand calls.
+.equ MIN_ROUNDS,        1000
+
+.section .text
+.globl _start
+_start:
+    li a0, DEFAULT_ROUNDS
+    mv a1, sp
+    call bench_argument
+    li t0, MIN_ROUNDS
+    bgeu a0, t0, 1f
+    mv a0, t0
+1:  mv s1, a0
+    call bench_now
+    mv s4, a0
+    li s0, 0
+    li s2, 0
+    la s3, steps
+2:  # the pointers are loaded on each call, like volatile function pointers.
+    andi t0, s0, 1
+    slli t0, t0, 2
+    add t0, t0, s3
+    lw t0, 0(t0)
+    mv a0, s2
+    jalr t0
+    mv s2, a0
+    addi s0, s0, 1
+    bne s0, s1, 2b
+    call bench_now
+    sub s4, a0, s4
+
+    mv a0, s1
+    call bench_print_number
+    BENCH_PRINT calls_in, 10
+    li t0, 1000
+    divu a0, s4, t0
+    call bench_print_number
+    BENCH_PRINT ms, 5
+    li t0, 1000
+    divu t0, s1, t0
+    divu a0, s4, t0
+    call bench_print_number
+    BENCH_PRINT ns_per_call, 13
+    BENCH_EXIT
+
+step_even:
+    addi a0, a0, 1
+    ret
+
+step_odd:
+    li t1, 0x5a5a5a5a
+    xor a0, a0, t1
+    ret
+
+.section .data
+.align 2
+steps:
+    .word step_even
+    .word step_odd
+calls_in:
+    .ascii " calls in "
+ms:
+    .ascii " ms, "
+ns_per_call:
+    .ascii " ns per call\n"
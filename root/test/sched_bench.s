@@ -0,0 +1,141 @@
+#
+# Copyright (c) 2020 Jie Zheng
+#
+#      A scheduler benchmark: thousands of threads sleep in nanosleep() while
+#      two threads ping-pong the cpu with sched_yield(). a context switch
+#      should cost the same no matter how many tasks are idle, e.g.
+#          /test/sched_bench 0
+#          /test/sched_bench 4000
+#
+
+.include "bench.inc"
+
+.equ DEFAULT_SLEEPERS,  1000
+.equ NR_ROUNDS,         100000
+
+.section .text
+.globl _start
+_start:
+    li a0, DEFAULT_SLEEPERS
+    mv a1, sp
+    call bench_argument
+    mv s1, a0
+    la s0, nr_started
+    li s2, 0
+1:  beq s2, s1, 2f
+    la a0, sleeper
+    call start_thread
+    addi s2, s2, 1
+    j 1b
+2:  lw t0, 0(s0)
+    beq t0, s1, 3f
+    li a7, SYS_SCHED_YIELD
+    ecall
+    j 2b
+
+3:  la a0, yielder
+    call start_thread
+    call bench_now
+    mv s4, a0
+    li s2, NR_ROUNDS
+4:  li a7, SYS_SCHED_YIELD
+    ecall
+    addi s2, s2, -1
+    bnez s2, 4b
+    call bench_now
+    sub s4, a0, s4
+
+    mv a0, s1
+    call bench_print_number
+    BENCH_PRINT sleepers, 11
+    li a0, NR_ROUNDS
+    call bench_print_number
+    BENCH_PRINT yields_in, 11
+    li t0, 1000
+    divu a0, s4, t0
+    call bench_print_number
+    BENCH_PRINT ms, 5
+    # two switches per round
+    li t0, 2 * NR_ROUNDS / 1000
+    divu a0, s4, t0
+    call bench_print_number
+    BENCH_PRINT ns_per_switch, 15
+
+    # NOTE: the threads are not joined, they are just waited for.
+    la t0, done
+    li t1, 1
+    sw t1, 0(t0)
+    la s0, nr_exited
+    addi s1, s1, 1
+5:  lw t0, 0(s0)
+    beq t0, s1, 6f
+    li a7, SYS_SCHED_YIELD
+    ecall
+    j 5b
+6:  BENCH_EXIT
+
+# a0: the entry of the thread, it must not touch its stack.
+start_thread:
+    mv t0, a0
+    li a0, CLONE_THREAD_FLAGS
+    la a1, shared_stack_top
+    li a2, 0
+    li a3, 0
+    li a4, 0
+    li a7, SYS_CLONE
+    ecall
+    beqz a0, 1f
+    ret
+1:  jr t0
+
+sleeper:
+    la t0, nr_started
+    li t1, 1
+    amoadd.w zero, t1, (t0)
+1:  la a0, interval
+    li a1, 0
+    li a7, SYS_NANOSLEEP
+    ecall
+    la t0, done
+    lw t0, 0(t0)
+    beqz t0, 1b
+    j thread_exit
+
+yielder:
+    li a7, SYS_SCHED_YIELD
+    ecall
+    la t0, done
+    lw t0, 0(t0)
+    beqz t0, yielder
+
+thread_exit:
+    la t0, nr_exited
+    li t1, 1
+    amoadd.w zero, t1, (t0)
+    BENCH_EXIT
+
+.section .data
+.align 4
+# NOTE: the vmm reads a host struct timespec.
+interval:
+    .dword 0
+    .dword 200 * 1000 * 1000
+nr_started:
+    .word 0
+nr_exited:
+    .word 0
+done:
+    .word 0
+sleepers:
+    .ascii " sleepers: "
+yields_in:
+    .ascii " yields in "
+ms:
+    .ascii " ms, "
+ns_per_switch:
+    .ascii " ns per switch\n"
+# the threads never touch their stacks, they share one.
+.align 4
+shared_stack:
+    .space 64
+shared_stack_top:
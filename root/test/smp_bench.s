@@ -0,0 +1,105 @@
+#
+# Copyright (c) 2020 Jie Zheng
+#
+#      An SMP benchmark: the given number of threads run the same amount of
+#      pure computation, they never trap. with SMP set to as many host cpus
+#      as threads the elapsed time should stay flat as threads are added, e.g.
+#          SMP=1 /test/smp_bench 4
+#          SMP=4 /test/smp_bench 4
+#
+
+.include "bench.inc"
+
+.equ DEFAULT_THREADS,   4
+.equ NR_ROUNDS,         10000000
+
+.section .text
+.globl _start
+_start:
+    li a0, DEFAULT_THREADS
+    mv a1, sp
+    call bench_argument
+    bnez a0, 1f
+    li a0, 1
+1:  mv s1, a0
+    call bench_now
+    mv s4, a0
+    li s2, 0
+2:  beq s2, s1, 3f
+    li a0, CLONE_THREAD_FLAGS
+    la a1, shared_stack_top
+    li a2, 0
+    li a3, 0
+    li a4, 0
+    li a7, SYS_CLONE
+    ecall
+    beqz a0, worker
+    addi s2, s2, 1
+    j 2b
+    # the main thread polls, it takes no cpu time from the workers.
+3:  la s0, nr_done
+4:  lw t0, 0(s0)
+    beq t0, s1, 5f
+    la a0, poll_interval
+    li a1, 0
+    li a7, SYS_NANOSLEEP
+    ecall
+    j 4b
+5:  call bench_now
+    sub s4, a0, s4
+
+    mv a0, s1
+    call bench_print_number
+    BENCH_PRINT threads_in, 12
+    li t0, 1000
+    divu a0, s4, t0
+    call bench_print_number
+    BENCH_PRINT ms, 5
+    # the rounds of all the threads, in units of a million
+    li t0, NR_ROUNDS / 1000000
+    mul t0, t0, s1
+    divu a0, s4, t0
+    call bench_print_number
+    BENCH_PRINT ps_per_round, 14
+    BENCH_EXIT
+
+# a xorshift generator, the result is stored so the work can't be skipped.
+worker:
+    li t0, NR_ROUNDS
+    li t1, 0x12345678
+1:  slli t2, t1, 13
+    xor t1, t1, t2
+    srli t2, t1, 17
+    xor t1, t1, t2
+    slli t2, t1, 5
+    xor t1, t1, t2
+    addi t0, t0, -1
+    bnez t0, 1b
+    la t0, checksum
+    amoxor.w zero, t1, (t0)
+    la t0, nr_done
+    li t1, 1
+    amoadd.w zero, t1, (t0)
+    BENCH_EXIT
+
+.section .data
+.align 4
+# NOTE: the vmm reads a host struct timespec.
+poll_interval:
+    .dword 0
+    .dword 1000 * 1000
+nr_done:
+    .word 0
+checksum:
+    .word 0
+threads_in:
+    .ascii " threads in "
+ms:
+    .ascii " ms, "
+ps_per_round:
+    .ascii " ps per round\n"
+# the threads never touch their stacks, they share one.
+.align 4
+shared_stack:
+    .space 64
+shared_stack_top:
@@ -12,6 +12,7 @@
 #include <tinyprintf.h>
 #include <debug.h>
 #include <task.h>
+#include <vdso.h>
 
 static void
 cpu_init(struct virtual_machine * vm)
@@ -213,8 +214,11 @@ program_init(struct virtual_machine * vm, const char * app_path)
             prog_break = pmr.addr_high;
         }
     }
+    hle_init(vm, fd_app, &elf_hdr);
+    elf_close(fd_app);
     stack_init(vm);
     heap_init(vm, prog_break);
+    vdso_setup(vm);
     dump_memory_regions(vm);
 }
 
@@ -277,6 +281,7 @@ env_setup(struct virtual_machine * vm, char ** argv, char ** envp)
     }__attribute__((packed)) aux_vector[] = {
         {25, stack_top}, // XXX:random. GLIBC needs it.
         {9, hartptr->pc}, // entry point
+        {AUX_SYSINFO_EHDR, VDSO_ADDRESS}, // the vDSO image, see vdso.c
         {0, 0}, // end of vector
     };
     int nr_aux = sizeof(aux_vector)/sizeof(aux_vector[0]);   
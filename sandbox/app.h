@@ -5,6 +5,9 @@
 #define _APP_H
 #include <vm.h>
 
+uint64_t
+vma_generic_read(uint64_t addr, int access_size, struct hart * hartptr,
+                 struct pm_region_operation * pmr);
 
 void
 mmap_setup(struct virtual_machine * vm, uint32_t addr_low, uint32_t len,
@@ -26,6 +26,26 @@ struct csr_entry {
 
 #define NR_CSRS 4096
 
+static inline uint64_t
+get_host_tsc(void)
+{
+    uint32_t eax = 0;
+    uint32_t edx = 0;
+    __asm__ volatile("rdtsc;"
+                     :"=a"(eax), "=d"(edx)
+                     :
+                     :"memory");
+    return ((uint64_t)eax) | (((uint64_t)edx) << 32);
+}
+
+void
+riscv_generic_csr_callback(struct hart * hartptr, uint32_t operation,
+                           uint32_t rd_index, uint32_t rs1_index,
+                           uint32_t csr_addr);
+
+int
+csr_counter_shift(uint32_t operation, uint32_t rs1_index, uint32_t csr_addr);
+
 
 struct csr_registery_entry {
     struct csr_registery_entry * next;
@@ -50,4 +70,12 @@ register_csr_entry(struct csr_registery_entry * entry)
 }
 
 
+// the unprivileged csrs(e.g. fcsr) are still in use by application emulation.
+static inline void
+register_unprivileged_csr_entry(struct csr_registery_entry * entry)
+{
+    entry->next = csr_registery_head;
+    csr_registery_head = entry;
+}
+
 #endif
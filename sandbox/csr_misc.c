@@ -4,18 +4,6 @@
 
 #include <csr.h>
 
-static uint64_t
-get_host_tsc(void)
-{
-    uint32_t eax = 0;
-    uint32_t edx = 0;
-    __asm__ volatile("rdtsc;"
-                     :"=a"(eax), "=d"(edx)
-                     :
-                     :"memory");
-    return ((uint64_t)eax) | (((uint64_t)edx) << 32);
-}
-
 static void
 csr_time_write(struct hart *hartptr, struct csr_entry * csr, uint32_t value)
 {
@@ -7,64 +7,55 @@
 #include <translation.h>
 #include <util.h>
 
-void
-riscv_generic_csr_callback(struct hart * hartptr, uint64_t instruction)
+// XXX: the operands are decoded at translation time, there is no need to
+// decode the instruction again when it's executed.
+static void
+riscv_csr_access(struct hart * hartptr, struct csr_entry * csr,
+                 uint32_t operation, uint32_t rd_index, uint32_t rs1_index)
 {
-    ASSERT(hartptr->hart_magic == HART_MAGIC_WORD);
-    ASSERT((instruction & 0x7f) ==  RISCV_OPCODE_SUPERVISOR_LEVEL);
-    struct decoding dec;
-    instruction_decoding_per_type(&dec, (uint32_t)instruction, ENCODING_TYPE_I);
-    struct csr_entry * csr = &((struct csr_entry *)hartptr->csrs_base)[dec.imm & 0xfff];
-    
-    if (!csr->is_valid) {
-        // This must be a panic in case we miss some CSRs
-        log_fatal("csr 0x%x is not implemented\n", dec.imm & 0xfff);
-        PANIC(hartptr);
-    }
-
-    switch (dec.funct3)
+    switch (operation)
     {
-        case 0x01:
-        case 0x05:
+        case RISCV_OP_CSRRW:
+        case RISCV_OP_CSRRWI:
             // CSRRW and CSRRWI
             {
                 // store rs1 reg in case rs1_index == rd_index
-                uint32_t rs1_reg = HART_REG(hartptr, dec.rs1_index);
-                if (dec.rd_index) {
+                uint32_t rs1_reg = HART_REG(hartptr, rs1_index);
+                if (rd_index) {
                     // if RD register is zero(x0), don't read the csr to avoid read side effect
                     uint32_t value_to_read = 0;
                     if (csr->read) {
                         value_to_read = csr->read(hartptr, csr);
                     }
                     value_to_read &= csr->wpri_mask;
-                    HART_REG(hartptr, dec.rd_index) = value_to_read;
+                    HART_REG(hartptr, rd_index) = value_to_read;
                 }
-                uint32_t value_to_write = dec.funct3 == 0x01 ? rs1_reg: dec.rs1_index;
+                uint32_t value_to_write = operation == RISCV_OP_CSRRW ? rs1_reg: rs1_index;
                 value_to_write &= csr->wpri_mask;
                 if (csr->write) {
                     csr->write(hartptr, csr, value_to_write);
                 }
             }
             break;
-        case 0x2:
-        case 0x6:
+        case RISCV_OP_CSRRS:
+        case RISCV_OP_CSRRSI:
             // csrrs and csrrsi
             {
-                uint32_t rs1_reg = HART_REG(hartptr, dec.rs1_index);
+                uint32_t rs1_reg = HART_REG(hartptr, rs1_index);
                 uint32_t value_to_read = 0;
                 if (csr->read) {
                     value_to_read = csr->read(hartptr, csr);
                 }
                 value_to_read &= csr->wpri_mask;
-                HART_REG(hartptr, dec.rd_index) = value_to_read;
+                HART_REG(hartptr, rd_index) = value_to_read;
 
                 uint32_t value_to_set = 0;
                 uint8_t proceed_to_write = 0;
-                if (dec.funct3 == 0x2 && dec.rs1_index) {
+                if (operation == RISCV_OP_CSRRS && rs1_index) {
                     value_to_set = rs1_reg;
                     proceed_to_write = 1;
-                } else if(dec.funct3 == 0x6 && dec.rs1_index) {
-                    value_to_set = dec.rs1_index & 0x1f;
+                } else if(operation == RISCV_OP_CSRRSI && rs1_index) {
+                    value_to_set = rs1_index & 0x1f;
                     proceed_to_write = 1;
                 }
                 if (proceed_to_write && csr->write) {
@@ -74,26 +65,26 @@ riscv_generic_csr_callback(struct hart * hartptr, uint64_t instruction)
                 }
             }
             break;
-        case 0x3:
-        case 0x7:
+        case RISCV_OP_CSRRC:
+        case RISCV_OP_CSRRCI:
             // csrrc and csrrci
             {
-                uint32_t rs1_reg = HART_REG(hartptr, dec.rs1_index);
+                uint32_t rs1_reg = HART_REG(hartptr, rs1_index);
                 uint32_t value_to_read = 0;
                 if (csr->read) {
                     value_to_read = csr->read(hartptr, csr);
                 }
                 value_to_read &= csr->wpri_mask;
-                HART_REG(hartptr, dec.rd_index) = value_to_read;
+                HART_REG(hartptr, rd_index) = value_to_read;
 
                 uint32_t value_to_clear = 0;
                 uint8_t proceed_to_write = 0;
 
-                if (dec.funct3 == 0x3 && dec.rs1_index) {
+                if (operation == RISCV_OP_CSRRC && rs1_index) {
                     value_to_clear = rs1_reg;
                     proceed_to_write = 1;
-                } else if(dec.funct3 == 0x7 && dec.rs1_index){
-                    value_to_clear = dec.rs1_index & 0x1f;
+                } else if(operation == RISCV_OP_CSRRCI && rs1_index){
+                    value_to_clear = rs1_index & 0x1f;
                     proceed_to_write = 1;
                 }
                 if (proceed_to_write && csr->write) {
@@ -109,20 +100,166 @@ riscv_generic_csr_callback(struct hart * hartptr, uint64_t instruction)
 }
 
 void
-riscv_generic_csr_instructions_translator(struct decoding * dec,
-                                          struct prefetch_blob * blob,
-                                          uint32_t instruction)
+riscv_generic_csr_callback(struct hart * hartptr, uint32_t operation,
+                           uint32_t rd_index, uint32_t rs1_index,
+                           uint32_t csr_addr)
+{
+    ASSERT(hartptr->hart_magic == HART_MAGIC_WORD);
+    struct csr_entry * csr = &((struct csr_entry *)hartptr->csrs_base)[csr_addr & 0xfff];
+    
+    if (!csr->is_valid) {
+        // This must be a panic in case we miss some CSRs
+        log_fatal("csr 0x%x is not implemented\n", csr_addr & 0xfff);
+        PANIC(hartptr);
+    }
+    riscv_csr_access(hartptr, csr, operation, rd_index, rs1_index);
+}
+
+// the csr entry is resolved and validated at translation time.
+__attribute__((unused)) static void
+riscv_bound_csr_callback(struct hart * hartptr, uint32_t operation,
+                         uint32_t rd_index, uint32_t rs1_index,
+                         struct csr_entry * csr)
+{
+    riscv_csr_access(hartptr, csr, operation, rd_index, rs1_index);
+}
+
+// The user-level counters are read-only, a read is a csrrs/csrrc without
+// rs1(or uimm) which does not write. cycle, time and instret all read the
+// host TSC, there is no per-instruction retirement accounting in the
+// translation cache. returns the shift to apply to the TSC, or -1 if it's not
+// a plain counter read.
+int
+csr_counter_shift(uint32_t operation, uint32_t rs1_index, uint32_t csr_addr)
+{
+    if (rs1_index ||
+        (operation != RISCV_OP_CSRRS && operation != RISCV_OP_CSRRC &&
+         operation != RISCV_OP_CSRRSI && operation != RISCV_OP_CSRRCI)) {
+        return -1;
+    }
+    switch (csr_addr & 0xfff)
+    {
+        case CSR_ADDRESS_CYCLE:
+        case CSR_ADDRESS_TIME:
+        case CSR_ADDRESS_INSTRET:
+            return 0;
+        case CSR_ADDRESS_CYCLEH:
+        case CSR_ADDRESS_TIMEH:
+        case CSR_ADDRESS_INSTRETH:
+            return 32;
+        default:
+            break;
+    }
+    return -1;
+}
+
+static void
+riscv_csr_counter_translator(struct decoded_instruction * dec,
+                             struct prefetch_blob * blob, int shift)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    PRECHECK_TRANSLATION_CACHE(csr_counter, blob);
+    BEGIN_TRANSLATION(csr_counter);
+    __asm__ volatile("rdtsc;"
+                     "shlq $32, %%rdx;"
+                     "orq %%rdx, %%rax;"
+                     "movl "PIC_PARAM(1)", %%ecx;"
+                     "shrq %%cl, %%rax;"
+                     "movl "PIC_PARAM(0)", %%edx;"
+                     "shl $2, %%edx;"
+                     "addq %%r15, %%rdx;"
+                     "movl %%eax, (%%rdx);"
+                     RESET_ZERO_REGISTER()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     END_INSTRUCTION(csr_counter)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*rd index*/
+            PARAM32() /*shift*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(csr_counter);
+        BEGIN_PARAM(csr_counter)
+            dec->rd_index,
+            shift
+        END_PARAM()
+    COMMIT_TRANSLATION(csr_counter, hartptr, instruction_linear_address);
+    blob->next_instruction_to_fetch += dec->length;
+}
+
+static void
+riscv_bound_csr_translator(struct decoded_instruction * dec,
+                           struct prefetch_blob * blob,
+                           struct csr_entry * csr)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    PRECHECK_TRANSLATION_CACHE(bound_csr_instructions, blob);
+    BEGIN_TRANSLATION(bound_csr_instructions);
+    __asm__ volatile("movq %%r12, %%rdi;"
+                     "movl "PIC_PARAM(0)", %%esi;"
+                     "movl "PIC_PARAM(1)", %%edx;"
+                     "movl "PIC_PARAM(2)", %%ecx;"
+                     "movq "PIC_PARAM(3)", %%r8;"
+                     "movq $riscv_bound_csr_callback, %%rax;"
+                     CALL_HELPER_OUT_OF_LINE()
+                     RESET_ZERO_REGISTER()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     TRAP_TO_VMM(bound_csr_instructions)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*operation*/
+            PARAM32() /*rd index*/
+            PARAM32() /*rs1 index or uimm*/
+            PARAM32() /*csr entry: low 32 bits*/
+            PARAM32() /*csr entry: high 32 bits*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(bound_csr_instructions);
+        BEGIN_PARAM(bound_csr_instructions)
+            dec->operation,
+            dec->rd_index,
+            dec->rs1_index,
+            (uint32_t)(uint64_t)csr,
+            (uint32_t)(((uint64_t)csr) >> 32)
+        END_PARAM()
+    COMMIT_TRANSLATION(bound_csr_instructions, hartptr,
+                       instruction_linear_address);
+    blob->is_to_stop = 1;
+}
+
+void
+riscv_generic_csr_instructions_translator(struct decoded_instruction * dec,
+                                          struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
+    // resolve the csr at translation time: counters are read inline, valid
+    // csrs are bound to their entry, the others complain when executed.
+    int counter_shift = csr_counter_shift(dec->operation, dec->rs1_index,
+                                          dec->imm);
+    if (counter_shift >= 0) {
+        riscv_csr_counter_translator(dec, blob, counter_shift);
+        return;
+    }
+    struct csr_entry * csr =
+        &((struct csr_entry *)hartptr->csrs_base)[dec->imm & 0xfff];
+    if (csr->is_valid) {
+        riscv_bound_csr_translator(dec, blob, csr);
+        return;
+    }
     PRECHECK_TRANSLATION_CACHE(csr_instructions, blob);
     BEGIN_TRANSLATION(csr_instructions);
     __asm__ volatile("movq %%r12, %%rdi;"
                      "movl "PIC_PARAM(0)", %%esi;"
+                     "movl "PIC_PARAM(1)", %%edx;"
+                     "movl "PIC_PARAM(2)", %%ecx;"
+                     "movl "PIC_PARAM(3)", %%r8d;"
                      "movq $riscv_generic_csr_callback, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;"
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE()
                      RESET_ZERO_REGISTER()
                      PROCEED_TO_NEXT_INSTRUCTION()
                      TRAP_TO_VMM(csr_instructions)
@@ -131,14 +268,20 @@ riscv_generic_csr_instructions_translator(struct decoding * dec,
                      :
                      :"memory");
         BEGIN_PARAM_SCHEMA()
-            PARAM32() //the instruction itself
+            PARAM32() /*operation*/
+            PARAM32() /*rd index*/
+            PARAM32() /*rs1 index or uimm*/
+            PARAM32() /*csr address*/
         END_PARAM_SCHEMA()
     END_TRANSLATION(csr_instructions);
         BEGIN_PARAM(csr_instructions)
-            instruction
+            dec->operation,
+            dec->rd_index,
+            dec->rs1_index,
+            dec->imm
         END_PARAM()
     COMMIT_TRANSLATION(csr_instructions, hartptr, instruction_linear_address);
-    //blob->next_instruction_to_fetch += 4;
+    //blob->next_instruction_to_fetch += dec->length;
     blob->is_to_stop = 1;
 }
 
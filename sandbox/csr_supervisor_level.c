@@ -62,7 +62,9 @@ csr_satp_write(struct hart *hartptr, struct csr_entry * csr, uint32_t value)
     #endif
     invalidate_tlb(hartptr->itlb, hartptr->itlb_cap);
     invalidate_tlb(hartptr->dtlb, hartptr->dtlb_cap);
-    flush_translation_cache(hartptr);
+    // NOTE: translations are tagged with satp.ASID, the guest has to issue
+    // SFENCE.VMA if it reuses an ASID for another page table.
+    flush_dispatch_cache(hartptr);
 }
 
 static uint32_t
@@ -9,6 +9,7 @@
 #include <string.h>
 #include <util.h>
 #include <vm.h>
+#include <vmm_smp.h>
 
 static void
 print_hint(struct hart * hartptr)
@@ -54,6 +55,13 @@ dump_breakpoints_info(struct hart * hartptr, int argc, char *argv[])
     return ACTION_CONTINUE;
 }
 
+static int
+dump_watchpoints_info(struct hart * hartptr, int argc, char *argv[])
+{
+    dump_watchpoints();
+    return ACTION_CONTINUE;
+}
+
 static int
 debug_continue(struct hart * hartptr, int argc, char *argv[])
 {
@@ -144,6 +152,29 @@ inspect_virtual_memory(struct hart * hartptr, int argc, char *argv[])
         return ACTION_CONTINUE;
 }
 
+#include <decoder.h>
+
+static int
+inspect_instructions(struct hart * hartptr, int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        goto error_usage;
+    }
+    uint32_t addr = strtol(argv[0], NULL, 16) & ~0x1;
+    int count = argc == 2 ? atoi(argv[1]) : 8;
+    struct decoded_instruction dec;
+    for (; count > 0; count--, addr += dec.length) {
+        fetch_decoded_instruction(hartptr, addr, &dec);
+        printf("0x%08x: %-10s rd:%-2d rs1:%-2d rs2:%-2d imm:%d(0x%x)\n",
+               addr, riscv_operation_name(dec.operation), dec.rd_index,
+               dec.rs1_index, dec.rs2_index, dec.imm, dec.imm);
+    }
+    return ACTION_CONTINUE;
+    error_usage:
+        printf(ANSI_COLOR_RED"example: /i 0x10000 [count]\n"ANSI_COLOR_RESET);
+        return ACTION_CONTINUE;
+}
+
 static int
 backtrace_call(struct hart * hartptr, int argc, char *argv[])
 {
@@ -222,6 +253,11 @@ static struct cmd_registery_item cmds_items[] = {
         .func = dump_breakpoints_info,
         .desc = "dump all the breakpoints"
     },
+    {
+        .cmd_prefixs = {"info", "watchpoints", NULL},
+        .func = dump_watchpoints_info,
+        .desc = "dump all the watchpoints"
+    },
     {
         .cmd_prefixs = {"continue", NULL},
         .func = debug_continue,
@@ -230,7 +266,23 @@ static struct cmd_registery_item cmds_items[] = {
     {
         .cmd_prefixs = {"break", NULL},
         .func = add_breakpoint_command,
-        .desc = "add a break by following the address of the target address"
+        .desc = "add a break by following the address of the target address, "
+                "optionally with a condition: <reg index> <hex value>"
+    },
+    {
+        .cmd_prefixs = {"delete", NULL},
+        .func = remove_breakpoint_command,
+        .desc = "remove the breakpoint at the following address"
+    },
+    {
+        .cmd_prefixs = {"watch", NULL},
+        .func = add_watchpoint_command,
+        .desc = "watch guest memory: <addr> [len] [r|w|rw], by default 4 bytes written"
+    },
+    {
+        .cmd_prefixs = {"unwatch", NULL},
+        .func = remove_watchpoint_command,
+        .desc = "remove the watchpoint at the following address"
     },
     {
         .cmd_prefixs = {"/x", NULL},
@@ -242,6 +294,11 @@ static struct cmd_registery_item cmds_items[] = {
         .func = inspect_virtual_memory,
         .desc = "dump virtual memory segment(BE CAUTIOUS TO USE IT !!!)"
     },
+    {
+        .cmd_prefixs = {"/i", NULL},
+        .func = inspect_instructions,
+        .desc = "dump decoded instructions"
+    },
     {
         .cmd_prefixs = {"backtrace", NULL},
         .func = backtrace_call,
@@ -339,6 +396,10 @@ enter_vmm_dbg_shell(struct hart * hartptr, int check_bps)
         // The address is not tracked, go on.
         return;
     }
+    // the shell may be entered from guest code, e.g. a translated ebreak.
+    vmm_enter();
+    // the commands read guest memory through the mmu as the guest does.
+    suspend_watchpoints();
     char cmdline[CMDLINE_SIZE];
     char * tokens[TOKEN_SIZE];
     int nr_token;
@@ -399,6 +460,8 @@ enter_vmm_dbg_shell(struct hart * hartptr, int check_bps)
             __not_reach();            
         }
     }
+    resume_watchpoints();
+    vmm_leave();
 }
 
 
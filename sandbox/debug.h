@@ -17,9 +17,30 @@ void
 enter_vmm_dbg_shell(struct hart * hartptr, int check_bps);
 
 
+// A breakpoint is hit when the guest register `reg_index` equals `reg_value`,
+// an unconditional breakpoint is always `x0 == 0`.
+struct breakpoint {
+    uint32_t guest_addr;
+    uint32_t reg_index;
+    uint32_t reg_value;
+};
+
 int
 add_breakpoint(uint32_t guest_addr);
 
+int
+add_conditional_breakpoint(uint32_t guest_addr, uint32_t reg_index,
+                           uint32_t reg_value);
+
+int
+remove_breakpoint(uint32_t guest_addr);
+
+struct breakpoint *
+lookup_breakpoint(uint32_t guest_addr);
+
+void
+check_breakpoint(struct hart * hartptr);
+
 int
 is_address_breakpoint(uint32_t guest_addr);
 
@@ -29,4 +50,45 @@ dump_breakpoints(void);
 int
 add_breakpoint_command(struct hart * hartptr, int argc, char *argv[]);
 
+#define WATCH_READ  0x1
+#define WATCH_WRITE 0x2
+
+struct watchpoint {
+    uint32_t guest_addr;
+    uint32_t len;
+    uint32_t access;
+};
+
+// one bit per 4K guest page, it's NULL until the first watchpoint is set.
+extern uint8_t * watched_pages_bitmap;
+
+int
+add_watchpoint(uint32_t guest_addr, uint32_t len, uint32_t access);
+
+int
+remove_watchpoint(uint32_t guest_addr);
+
+void
+watched_page_accessed(struct hart * hartptr, uint32_t location, int size,
+                      uint32_t access);
+
+void
+dump_watchpoints(void);
+
+// watchpoints don't fire while the debug shell runs.
+void
+suspend_watchpoints(void);
+
+void
+resume_watchpoints(void);
+
+int
+add_watchpoint_command(struct hart * hartptr, int argc, char *argv[]);
+
+int
+remove_watchpoint_command(struct hart * hartptr, int argc, char *argv[]);
+
+int
+remove_breakpoint_command(struct hart * hartptr, int argc, char *argv[]);
+
 #endif
@@ -6,41 +6,106 @@
 #include <search.h>
 #include <sort.h>
 #include <util.h>
+#include <task.h>
 
 #define MAX_BREAKPOINTS 256
-static uint32_t breakpoints[MAX_BREAKPOINTS];
+static struct breakpoint breakpoints[MAX_BREAKPOINTS];
 static int nr_breakpoints = 0;
 
 static int
-addr_cmp(uint32_t * paddr0, uint32_t *paddr1)
+addr_cmp(struct breakpoint * bp0, struct breakpoint * bp1)
 {
-    return (int)(*paddr0 - *paddr1);
+    return (int)(bp0->guest_addr - bp1->guest_addr);
+}
+
+static void
+invalidate_breakpoint_translation(struct hart * hartptr, void * arg)
+{
+    uint32_t guest_addr = *(uint32_t *)arg;
+    invalidate_translation_range(hartptr, guest_addr, guest_addr + 4);
+}
+
+// XXX: the breakpoint checks are emitted at translation time, so the code
+// translated for the address must be dropped whenever the breakpoint changes.
+static void
+invalidate_breakpoint(uint32_t guest_addr)
+{
+    for_each_task(invalidate_breakpoint_translation, &guest_addr);
 }
 
 int
-add_breakpoint(uint32_t guest_addr)
+add_conditional_breakpoint(uint32_t guest_addr, uint32_t reg_index,
+                           uint32_t reg_value)
 {
-    if (guest_addr & 0x3) {
+    if (guest_addr & 0x1) {
         return -2;
     }
-    if (nr_breakpoints >= MAX_BREAKPOINTS) {
+    if (reg_index >= 32) {
+        return -3;
+    }
+    struct breakpoint * bp = lookup_breakpoint(guest_addr);
+    if (!bp) {
+        if (nr_breakpoints >= MAX_BREAKPOINTS) {
+            return -1;
+        }
+        bp = &breakpoints[nr_breakpoints];
+        bp->guest_addr = guest_addr;
+        nr_breakpoints += 1;
+    }
+    bp->reg_index = reg_index;
+    bp->reg_value = reg_value;
+    INSERTION_SORT(struct breakpoint, breakpoints, nr_breakpoints, addr_cmp);
+    invalidate_breakpoint(guest_addr);
+    return 0;
+}
+
+int
+add_breakpoint(uint32_t guest_addr)
+{
+    return add_conditional_breakpoint(guest_addr, 0, 0);
+}
+
+int
+remove_breakpoint(uint32_t guest_addr)
+{
+    struct breakpoint * bp = lookup_breakpoint(guest_addr);
+    if (!bp) {
         return -1;
     }
-    if (is_address_breakpoint(guest_addr)) {
-        return 0;
+    int idx = bp - breakpoints;
+    for (; idx < nr_breakpoints - 1; idx++) {
+        breakpoints[idx] = breakpoints[idx + 1];
     }
-    breakpoints[nr_breakpoints] = guest_addr;
-    nr_breakpoints += 1;
-    INSERTION_SORT(uint32_t, breakpoints, nr_breakpoints, addr_cmp);
+    nr_breakpoints -= 1;
+    invalidate_breakpoint(guest_addr);
     return 0;
 }
 
+struct breakpoint *
+lookup_breakpoint(uint32_t guest_addr)
+{
+    struct breakpoint key = {
+        .guest_addr = guest_addr
+    };
+    return SEARCH(struct breakpoint, breakpoints, nr_breakpoints, addr_cmp,
+                  &key);
+}
+
 int
 is_address_breakpoint(uint32_t guest_addr)
 {
-    uint32_t * pbp = SEARCH(uint32_t, breakpoints, nr_breakpoints, addr_cmp,
-                            &guest_addr);
-    return !!pbp;
+    return !!lookup_breakpoint(guest_addr);
+}
+
+// The interpreter tier's counterpart of the inline check in the translated
+// breakpoint prologue.
+void
+check_breakpoint(struct hart * hartptr)
+{
+    struct breakpoint * bp = lookup_breakpoint(hartptr->pc);
+    if (bp && ((uint32_t *)&hartptr->registers)[bp->reg_index] == bp->reg_value) {
+        enter_vmm_dbg_shell(hartptr, 0);
+    }
 }
 
 void
@@ -49,14 +114,13 @@ dump_breakpoints(void)
     printf(ANSI_COLOR_MAGENTA"There are %d breakpoints:\n", nr_breakpoints);
     int idx = 0;
     for (; idx < nr_breakpoints; idx++) {
-        printf("0x%08x    ", breakpoints[idx]);
-        if ((idx + 1) % 8 == 0) {
-            printf("\n");
+        if (breakpoints[idx].reg_index) {
+            printf("0x%08x if x%d == 0x%x\n", breakpoints[idx].guest_addr,
+                   breakpoints[idx].reg_index, breakpoints[idx].reg_value);
+        } else {
+            printf("0x%08x\n", breakpoints[idx].guest_addr);
         }
     }
-    if (idx % 8 != 0) {
-        printf("\n");
-    }
     printf(ANSI_COLOR_RESET);
 }
 
@@ -67,8 +131,28 @@ add_breakpoint_command(struct hart * hartptr, int argc, char *argv[])
      goto out;   
     }
     uint32_t addr = strtol(argv[0], NULL, 16);
-    int rc = add_breakpoint(addr);
+    int rc;
+    if (argc >= 3) {
+        // break <addr> <reg index> <value>
+        rc = add_conditional_breakpoint(addr, strtol(argv[1], NULL, 10),
+                                        strtoul(argv[2], NULL, 16));
+    } else {
+        rc = add_breakpoint(addr);
+    }
     printf("adding breakpoint: 0x%x %s\n", addr, rc ? "fails" : "succeeds");
     out:
         return ACTION_CONTINUE;
 }
+
+int
+remove_breakpoint_command(struct hart * hartptr, int argc, char *argv[])
+{
+    if (argc == 0) {
+        goto out;
+    }
+    uint32_t addr = strtol(argv[0], NULL, 16);
+    int rc = remove_breakpoint(addr);
+    printf("removing breakpoint: 0x%x %s\n", addr, rc ? "fails" : "succeeds");
+    out:
+        return ACTION_CONTINUE;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ */
+
+#include <debug.h>
+#include <util.h>
+#include <log.h>
+#include <vmm_smp.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define MAX_WATCHPOINTS 64
+static struct watchpoint watchpoints[MAX_WATCHPOINTS];
+static int nr_watchpoints = 0;
+
+uint8_t * watched_pages_bitmap = NULL;
+
+// the debug shell inspects guest memory with the same accessors, do not
+// trigger watchpoints from within the shell. it's a nesting counter, only
+// modified with the vmm lock held.
+static int watchpoints_suspended = 0;
+
+void
+suspend_watchpoints(void)
+{
+    watchpoints_suspended += 1;
+}
+
+void
+resume_watchpoints(void)
+{
+    ASSERT(watchpoints_suspended > 0);
+    watchpoints_suspended -= 1;
+}
+
+static void
+rebuild_watched_pages(void)
+{
+    if (!watched_pages_bitmap) {
+        watched_pages_bitmap = mmap(NULL, (1 << 20) / 8, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        ASSERT(watched_pages_bitmap != MAP_FAILED);
+    }
+    memset(watched_pages_bitmap, 0x0, (1 << 20) / 8);
+    int idx = 0;
+    for (; idx < nr_watchpoints; idx++) {
+        uint32_t page = watchpoints[idx].guest_addr >> 12;
+        uint32_t last_page =
+            (watchpoints[idx].guest_addr + watchpoints[idx].len - 1) >> 12;
+        for (; page <= last_page; page++) {
+            watched_pages_bitmap[page >> 3] |= 1 << (page & 7);
+        }
+    }
+}
+
+int
+add_watchpoint(uint32_t guest_addr, uint32_t len, uint32_t access)
+{
+    if (!len || guest_addr + len - 1 < guest_addr) {
+        return -2;
+    }
+    if (!(access & (WATCH_READ | WATCH_WRITE))) {
+        return -3;
+    }
+    int idx = 0;
+    for (; idx < nr_watchpoints; idx++) {
+        if (watchpoints[idx].guest_addr == guest_addr) {
+            break;
+        }
+    }
+    if (idx == nr_watchpoints) {
+        if (nr_watchpoints >= MAX_WATCHPOINTS) {
+            return -1;
+        }
+        nr_watchpoints += 1;
+    }
+    watchpoints[idx].guest_addr = guest_addr;
+    watchpoints[idx].len = len;
+    watchpoints[idx].access = access;
+    rebuild_watched_pages();
+    return 0;
+}
+
+int
+remove_watchpoint(uint32_t guest_addr)
+{
+    int idx = 0;
+    for (; idx < nr_watchpoints; idx++) {
+        if (watchpoints[idx].guest_addr == guest_addr) {
+            break;
+        }
+    }
+    if (idx == nr_watchpoints) {
+        return -1;
+    }
+    for (; idx < nr_watchpoints - 1; idx++) {
+        watchpoints[idx] = watchpoints[idx + 1];
+    }
+    nr_watchpoints -= 1;
+    rebuild_watched_pages();
+    return 0;
+}
+
+// XXX: the slow path, the page of the access is known to be watched, find
+// out whether the access really overlaps a watched range.
+void
+watched_page_accessed(struct hart * hartptr, uint32_t location, int size,
+                      uint32_t access)
+{
+    if (watchpoints_suspended) {
+        return;
+    }
+    vmm_enter();
+    int idx = 0;
+    for (; idx < nr_watchpoints; idx++) {
+        struct watchpoint * wp = &watchpoints[idx];
+        // NOTE: a range may end at the top of the 32-bit space.
+        if (!(wp->access & access) ||
+            (uint64_t)location + size <= wp->guest_addr ||
+            location >= (uint64_t)wp->guest_addr + wp->len) {
+            continue;
+        }
+        printf(ANSI_COLOR_MAGENTA"[watchpoint 0x%x hit: %s %d bytes at 0x%x]\n"
+               ANSI_COLOR_RESET, wp->guest_addr,
+               access == WATCH_READ ? "read" :
+               access == WATCH_WRITE ? "write" : "atomic access", size, location);
+        enter_vmm_dbg_shell(hartptr, 0);
+        break;
+    }
+    vmm_leave();
+}
+
+static const char *
+access_to_string(uint32_t access)
+{
+    switch (access)
+    {
+        case WATCH_READ:
+            return "r";
+        case WATCH_WRITE:
+            return "w";
+        default:
+            return "rw";
+    }
+}
+
+void
+dump_watchpoints(void)
+{
+    printf(ANSI_COLOR_MAGENTA"There are %d watchpoints:\n", nr_watchpoints);
+    int idx = 0;
+    for (; idx < nr_watchpoints; idx++) {
+        printf("0x%08x len:%d access:%s\n", watchpoints[idx].guest_addr,
+               watchpoints[idx].len, access_to_string(watchpoints[idx].access));
+    }
+    printf(ANSI_COLOR_RESET);
+}
+
+int
+add_watchpoint_command(struct hart * hartptr, int argc, char *argv[])
+{
+    if (argc == 0) {
+        goto out;
+    }
+    // watch <addr> [len] [r|w|rw]
+    uint32_t addr = strtoul(argv[0], NULL, 16);
+    uint32_t len = 4;
+    uint32_t access = WATCH_WRITE;
+    if (argc >= 2) {
+        len = strtoul(argv[1], NULL, 10);
+    }
+    if (argc >= 3) {
+        access = 0;
+        if (strchr(argv[2], 'r')) {
+            access |= WATCH_READ;
+        }
+        if (strchr(argv[2], 'w')) {
+            access |= WATCH_WRITE;
+        }
+    }
+    int rc = add_watchpoint(addr, len, access);
+    printf("adding watchpoint: 0x%x %s\n", addr, rc ? "fails" : "succeeds");
+    out:
+        return ACTION_CONTINUE;
+}
+
+int
+remove_watchpoint_command(struct hart * hartptr, int argc, char *argv[])
+{
+    if (argc == 0) {
+        goto out;
+    }
+    uint32_t addr = strtoul(argv[0], NULL, 16);
+    int rc = remove_watchpoint(addr);
+    printf("removing watchpoint: 0x%x %s\n", addr, rc ? "fails" : "succeeds");
+    out:
+        return ACTION_CONTINUE;
+}
@@ -0,0 +1,681 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      Table driven instruction decoder: an instruction is matched against
+ *      the rules of its major opcode, the fields are then extracted according
+ *      to the format of the matched rule.
+ */
+
+#include <decoder.h>
+#include <hart.h>
+#include <csr.h>
+#include <mmu.h>
+#include <vm.h>
+#include <pm_region.h>
+#include <util.h>
+#include <string.h>
+#include <stdlib.h>
+
+enum decoding_format {
+    FORMAT_NONE = 0,
+    FORMAT_R,
+    FORMAT_I,
+    FORMAT_S,
+    FORMAT_B,
+    FORMAT_U,
+    FORMAT_J,
+    FORMAT_SHAMT,
+    FORMAT_CSR,
+    FORMAT_AMO,
+    FORMAT_FP,
+    FORMAT_R4,
+};
+
+struct decoding_rule {
+    uint32_t mask;
+    uint32_t match;
+    uint8_t operation;
+    uint8_t format;
+    const char * name;
+};
+
+#define RULE(_mask, _match, _op, _format, _name) {                             \
+    .mask = _mask,                                                             \
+    .match = _match,                                                           \
+    .operation = RISCV_OP_##_op,                                               \
+    .format = FORMAT_##_format,                                                \
+    .name = _name                                                              \
+}
+
+// NOTE: rules of the same major opcode MUST be put together.
+static const struct decoding_rule decoding_rules[] = {
+    RULE(0x0000007f, 0x00000037, LUI, U, "lui"),
+    RULE(0x0000007f, 0x00000017, AUIPC, U, "auipc"),
+    RULE(0x0000007f, 0x0000006f, JAL, J, "jal"),
+    RULE(0x0000707f, 0x00000067, JALR, I, "jalr"),
+
+    RULE(0x0000707f, 0x00000063, BEQ, B, "beq"),
+    RULE(0x0000707f, 0x00001063, BNE, B, "bne"),
+    RULE(0x0000707f, 0x00004063, BLT, B, "blt"),
+    RULE(0x0000707f, 0x00005063, BGE, B, "bge"),
+    RULE(0x0000707f, 0x00006063, BLTU, B, "bltu"),
+    RULE(0x0000707f, 0x00007063, BGEU, B, "bgeu"),
+
+    RULE(0x0000707f, 0x00000003, LB, I, "lb"),
+    RULE(0x0000707f, 0x00001003, LH, I, "lh"),
+    RULE(0x0000707f, 0x00002003, LW, I, "lw"),
+    RULE(0x0000707f, 0x00004003, LBU, I, "lbu"),
+    RULE(0x0000707f, 0x00005003, LHU, I, "lhu"),
+
+    RULE(0x0000707f, 0x00000023, SB, S, "sb"),
+    RULE(0x0000707f, 0x00001023, SH, S, "sh"),
+    RULE(0x0000707f, 0x00002023, SW, S, "sw"),
+
+    RULE(0x0000707f, 0x00000013, ADDI, I, "addi"),
+    RULE(0x0000707f, 0x00002013, SLTI, I, "slti"),
+    RULE(0x0000707f, 0x00003013, SLTIU, I, "sltiu"),
+    RULE(0x0000707f, 0x00004013, XORI, I, "xori"),
+    RULE(0x0000707f, 0x00006013, ORI, I, "ori"),
+    RULE(0x0000707f, 0x00007013, ANDI, I, "andi"),
+    RULE(0xfe00707f, 0x00001013, SLLI, SHAMT, "slli"),
+    RULE(0xfe00707f, 0x00005013, SRLI, SHAMT, "srli"),
+    RULE(0xfe00707f, 0x40005013, SRAI, SHAMT, "srai"),
+    // Zbb: the unary operations are encoded in the rs2 field
+    RULE(0xfff0707f, 0x60001013, CLZ, R, "clz"),
+    RULE(0xfff0707f, 0x60101013, CTZ, R, "ctz"),
+    RULE(0xfff0707f, 0x60201013, CPOP, R, "cpop"),
+    RULE(0xfff0707f, 0x60401013, SEXT_B, R, "sext.b"),
+    RULE(0xfff0707f, 0x60501013, SEXT_H, R, "sext.h"),
+    RULE(0xfe00707f, 0x60005013, RORI, SHAMT, "rori"),
+    RULE(0xfff0707f, 0x28705013, ORC_B, R, "orc.b"),
+    RULE(0xfff0707f, 0x69805013, REV8, R, "rev8"),
+
+    RULE(0xfe00707f, 0x00000033, ADD, R, "add"),
+    RULE(0xfe00707f, 0x40000033, SUB, R, "sub"),
+    RULE(0xfe00707f, 0x00001033, SLL, R, "sll"),
+    RULE(0xfe00707f, 0x00002033, SLT, R, "slt"),
+    RULE(0xfe00707f, 0x00003033, SLTU, R, "sltu"),
+    RULE(0xfe00707f, 0x00004033, XOR, R, "xor"),
+    RULE(0xfe00707f, 0x00005033, SRL, R, "srl"),
+    RULE(0xfe00707f, 0x40005033, SRA, R, "sra"),
+    RULE(0xfe00707f, 0x00006033, OR, R, "or"),
+    RULE(0xfe00707f, 0x00007033, AND, R, "and"),
+    RULE(0xfe00707f, 0x02000033, MUL, R, "mul"),
+    RULE(0xfe00707f, 0x02001033, MULH, R, "mulh"),
+    RULE(0xfe00707f, 0x02002033, MULHSU, R, "mulhsu"),
+    RULE(0xfe00707f, 0x02003033, MULHU, R, "mulhu"),
+    RULE(0xfe00707f, 0x02004033, DIV, R, "div"),
+    RULE(0xfe00707f, 0x02005033, DIVU, R, "divu"),
+    RULE(0xfe00707f, 0x02006033, REM, R, "rem"),
+    RULE(0xfe00707f, 0x02007033, REMU, R, "remu"),
+    // Zba
+    RULE(0xfe00707f, 0x20002033, SH1ADD, R, "sh1add"),
+    RULE(0xfe00707f, 0x20004033, SH2ADD, R, "sh2add"),
+    RULE(0xfe00707f, 0x20006033, SH3ADD, R, "sh3add"),
+    // Zbb
+    RULE(0xfe00707f, 0x40007033, ANDN, R, "andn"),
+    RULE(0xfe00707f, 0x40006033, ORN, R, "orn"),
+    RULE(0xfe00707f, 0x40004033, XNOR, R, "xnor"),
+    RULE(0xfe00707f, 0x0a004033, MINS, R, "min"),
+    RULE(0xfe00707f, 0x0a005033, MINU, R, "minu"),
+    RULE(0xfe00707f, 0x0a006033, MAXS, R, "max"),
+    RULE(0xfe00707f, 0x0a007033, MAXU, R, "maxu"),
+    RULE(0xfff0707f, 0x08004033, ZEXT_H, R, "zext.h"),
+    RULE(0xfe00707f, 0x60001033, ROL, R, "rol"),
+    RULE(0xfe00707f, 0x60005033, ROR, R, "ror"),
+
+    RULE(0xffffffff, 0x0100000f, PAUSE, NONE, "pause"),
+    RULE(0x0000707f, 0x0000000f, FENCE, I, "fence"),
+    RULE(0x0000707f, 0x0000100f, FENCE_I, NONE, "fence.i"),
+
+    RULE(0xffffffff, 0x00000073, ECALL, NONE, "ecall"),
+    RULE(0xffffffff, 0x00100073, EBREAK, NONE, "ebreak"),
+    RULE(0xffffffff, 0x30200073, MRET, NONE, "mret"),
+    RULE(0xffffffff, 0x10200073, SRET, NONE, "sret"),
+    RULE(0xffffffff, 0x10500073, WFI, NONE, "wfi"),
+    RULE(0xfe007fff, 0x12000073, SFENCE_VMA, R, "sfence.vma"),
+    RULE(0x0000707f, 0x00001073, CSRRW, CSR, "csrrw"),
+    RULE(0x0000707f, 0x00002073, CSRRS, CSR, "csrrs"),
+    RULE(0x0000707f, 0x00003073, CSRRC, CSR, "csrrc"),
+    RULE(0x0000707f, 0x00005073, CSRRWI, CSR, "csrrwi"),
+    RULE(0x0000707f, 0x00006073, CSRRSI, CSR, "csrrsi"),
+    RULE(0x0000707f, 0x00007073, CSRRCI, CSR, "csrrci"),
+
+    RULE(0xf9f0707f, 0x1000202f, LR_W, AMO, "lr.w"),
+    RULE(0xf800707f, 0x1800202f, SC_W, AMO, "sc.w"),
+    RULE(0xf800707f, 0x0800202f, AMOSWAP_W, AMO, "amoswap.w"),
+    RULE(0xf800707f, 0x0000202f, AMOADD_W, AMO, "amoadd.w"),
+    RULE(0xf800707f, 0x2000202f, AMOXOR_W, AMO, "amoxor.w"),
+    RULE(0xf800707f, 0x6000202f, AMOAND_W, AMO, "amoand.w"),
+    RULE(0xf800707f, 0x4000202f, AMOOR_W, AMO, "amoor.w"),
+    RULE(0xf800707f, 0x8000202f, AMOMIN_W, AMO, "amomin.w"),
+    RULE(0xf800707f, 0xa000202f, AMOMAX_W, AMO, "amomax.w"),
+    RULE(0xf800707f, 0xc000202f, AMOMINU_W, AMO, "amominu.w"),
+    RULE(0xf800707f, 0xe000202f, AMOMAXU_W, AMO, "amomaxu.w"),
+
+    RULE(0x0000707f, 0x00002007, FLW, I, "flw"),
+    RULE(0x0000707f, 0x00003007, FLD, I, "fld"),
+
+    RULE(0x0000707f, 0x00002027, FSW, S, "fsw"),
+    RULE(0x0000707f, 0x00003027, FSD, S, "fsd"),
+
+    RULE(0x0600007f, 0x00000043, FMADD_S, R4, "fmadd.s"),
+    RULE(0x0600007f, 0x02000043, FMADD_D, R4, "fmadd.d"),
+    RULE(0x0600007f, 0x00000047, FMSUB_S, R4, "fmsub.s"),
+    RULE(0x0600007f, 0x02000047, FMSUB_D, R4, "fmsub.d"),
+    RULE(0x0600007f, 0x0000004b, FNMSUB_S, R4, "fnmsub.s"),
+    RULE(0x0600007f, 0x0200004b, FNMSUB_D, R4, "fnmsub.d"),
+    RULE(0x0600007f, 0x0000004f, FNMADD_S, R4, "fnmadd.s"),
+    RULE(0x0600007f, 0x0200004f, FNMADD_D, R4, "fnmadd.d"),
+
+    RULE(0xfe00007f, 0x00000053, FADD_S, FP, "fadd.s"),
+    RULE(0xfe00007f, 0x08000053, FSUB_S, FP, "fsub.s"),
+    RULE(0xfe00007f, 0x10000053, FMUL_S, FP, "fmul.s"),
+    RULE(0xfe00007f, 0x18000053, FDIV_S, FP, "fdiv.s"),
+    RULE(0xfff0007f, 0x58000053, FSQRT_S, FP, "fsqrt.s"),
+    RULE(0xfe00707f, 0x20000053, FSGNJ_S, FP, "fsgnj.s"),
+    RULE(0xfe00707f, 0x20001053, FSGNJN_S, FP, "fsgnjn.s"),
+    RULE(0xfe00707f, 0x20002053, FSGNJX_S, FP, "fsgnjx.s"),
+    RULE(0xfe00707f, 0x28000053, FMIN_S, FP, "fmin.s"),
+    RULE(0xfe00707f, 0x28001053, FMAX_S, FP, "fmax.s"),
+    RULE(0xfff0007f, 0xc0000053, FCVT_W_S, FP, "fcvt.w.s"),
+    RULE(0xfff0007f, 0xc0100053, FCVT_WU_S, FP, "fcvt.wu.s"),
+    RULE(0xfff0707f, 0xe0000053, FMV_X_W, FP, "fmv.x.w"),
+    RULE(0xfe00707f, 0xa0002053, FEQ_S, FP, "feq.s"),
+    RULE(0xfe00707f, 0xa0001053, FLT_S, FP, "flt.s"),
+    RULE(0xfe00707f, 0xa0000053, FLE_S, FP, "fle.s"),
+    RULE(0xfff0707f, 0xe0001053, FCLASS_S, FP, "fclass.s"),
+    RULE(0xfff0007f, 0xd0000053, FCVT_S_W, FP, "fcvt.s.w"),
+    RULE(0xfff0007f, 0xd0100053, FCVT_S_WU, FP, "fcvt.s.wu"),
+    RULE(0xfff0707f, 0xf0000053, FMV_W_X, FP, "fmv.w.x"),
+    RULE(0xfe00007f, 0x02000053, FADD_D, FP, "fadd.d"),
+    RULE(0xfe00007f, 0x0a000053, FSUB_D, FP, "fsub.d"),
+    RULE(0xfe00007f, 0x12000053, FMUL_D, FP, "fmul.d"),
+    RULE(0xfe00007f, 0x1a000053, FDIV_D, FP, "fdiv.d"),
+    RULE(0xfff0007f, 0x5a000053, FSQRT_D, FP, "fsqrt.d"),
+    RULE(0xfe00707f, 0x22000053, FSGNJ_D, FP, "fsgnj.d"),
+    RULE(0xfe00707f, 0x22001053, FSGNJN_D, FP, "fsgnjn.d"),
+    RULE(0xfe00707f, 0x22002053, FSGNJX_D, FP, "fsgnjx.d"),
+    RULE(0xfe00707f, 0x2a000053, FMIN_D, FP, "fmin.d"),
+    RULE(0xfe00707f, 0x2a001053, FMAX_D, FP, "fmax.d"),
+    RULE(0xfff0007f, 0x40100053, FCVT_S_D, FP, "fcvt.s.d"),
+    RULE(0xfff0007f, 0x42000053, FCVT_D_S, FP, "fcvt.d.s"),
+    RULE(0xfe00707f, 0xa2002053, FEQ_D, FP, "feq.d"),
+    RULE(0xfe00707f, 0xa2001053, FLT_D, FP, "flt.d"),
+    RULE(0xfe00707f, 0xa2000053, FLE_D, FP, "fle.d"),
+    RULE(0xfff0707f, 0xe2001053, FCLASS_D, FP, "fclass.d"),
+    RULE(0xfff0007f, 0xc2000053, FCVT_W_D, FP, "fcvt.w.d"),
+    RULE(0xfff0007f, 0xc2100053, FCVT_WU_D, FP, "fcvt.wu.d"),
+    RULE(0xfff0007f, 0xd2000053, FCVT_D_W, FP, "fcvt.d.w"),
+    RULE(0xfff0007f, 0xd2100053, FCVT_D_WU, FP, "fcvt.d.wu"),
+};
+
+#define NR_DECODING_RULES ((int)(sizeof(decoding_rules) / sizeof(decoding_rules[0])))
+
+// the range of rules per major opcode: [begin, end)
+static uint8_t rules_begin[128];
+static uint8_t rules_end[128];
+static const char * operation_names[RISCV_OP_MAX];
+
+// RVC: a compressed instruction is expanded into the 32-bit instruction it
+// stands for, which is then decoded by the rules above. reserved encodings and
+// the ones of RV64C/RV128C expand to zero which is illegal.
+#define IS_COMPRESSED_INSTRUCTION(instruction) (((instruction) & 0x3) != 0x3)
+
+static uint32_t
+encode_r(uint32_t opcode, uint32_t funct3, uint32_t funct7, uint32_t rd,
+         uint32_t rs1, uint32_t rs2)
+{
+    return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+           (rd << 7) | opcode;
+}
+
+static uint32_t
+encode_i(uint32_t opcode, uint32_t funct3, uint32_t rd, uint32_t rs1,
+         uint32_t imm)
+{
+    return ((imm & 0xfff) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) |
+           opcode;
+}
+
+static uint32_t
+encode_s(uint32_t opcode, uint32_t funct3, uint32_t rs1, uint32_t rs2,
+         uint32_t imm)
+{
+    return (((imm >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) |
+           (funct3 << 12) | ((imm & 0x1f) << 7) | opcode;
+}
+
+static uint32_t
+encode_b(uint32_t funct3, uint32_t rs1, uint32_t rs2, uint32_t imm)
+{
+    return (((imm >> 12) & 0x1) << 31) | (((imm >> 5) & 0x3f) << 25) |
+           (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+           (((imm >> 1) & 0xf) << 8) | (((imm >> 11) & 0x1) << 7) | 0x63;
+}
+
+static uint32_t
+encode_j(uint32_t rd, uint32_t imm)
+{
+    return (((imm >> 20) & 0x1) << 31) | (((imm >> 1) & 0x3ff) << 21) |
+           (((imm >> 11) & 0x1) << 20) | (((imm >> 12) & 0xff) << 12) |
+           (rd << 7) | 0x6f;
+}
+
+static uint32_t
+expand_compressed_instruction(uint16_t instruction)
+{
+    uint32_t funct3 = (instruction >> 13) & 0x7;
+    // the full register fields and the 3-bit ones which address x8-x15
+    uint32_t rd = (instruction >> 7) & 0x1f;
+    uint32_t rs2 = (instruction >> 2) & 0x1f;
+    uint32_t rd_short = 8 + ((instruction >> 7) & 0x7);
+    uint32_t rs2_short = 8 + ((instruction >> 2) & 0x7);
+    // imm[5] in bit 12, imm[4:0] in bits 6:2
+    int32_t imm6 = sign_extend32(((instruction >> 7) & 0x20) |
+                                 ((instruction >> 2) & 0x1f), 5);
+    uint32_t shamt = ((instruction >> 7) & 0x20) | ((instruction >> 2) & 0x1f);
+    // the offsets of c.lw/c.sw/c.flw/c.fsw and c.fld/c.fsd
+    uint32_t offset_word = ((instruction >> 7) & 0x38) |
+                           ((instruction >> 4) & 0x4) |
+                           ((instruction << 1) & 0x40);
+    uint32_t offset_double = ((instruction >> 7) & 0x38) |
+                             ((instruction << 1) & 0xc0);
+    int32_t imm = 0;
+    switch (((instruction & 0x3) << 3) | funct3)
+    {
+        // quadrant 0
+        case 0x00: // c.addi4spn
+            imm = ((instruction >> 7) & 0x30) | ((instruction >> 1) & 0x3c0) |
+                  ((instruction >> 4) & 0x4) | ((instruction >> 2) & 0x8);
+            if (!imm) {
+                return 0;
+            }
+            return encode_i(0x13, 0x0, rs2_short, 2, imm);
+        case 0x01: // c.fld
+            return encode_i(0x07, 0x3, rs2_short, rd_short, offset_double);
+        case 0x02: // c.lw
+            return encode_i(0x03, 0x2, rs2_short, rd_short, offset_word);
+        case 0x03: // c.flw
+            return encode_i(0x07, 0x2, rs2_short, rd_short, offset_word);
+        case 0x05: // c.fsd
+            return encode_s(0x27, 0x3, rd_short, rs2_short, offset_double);
+        case 0x06: // c.sw
+            return encode_s(0x23, 0x2, rd_short, rs2_short, offset_word);
+        case 0x07: // c.fsw
+            return encode_s(0x27, 0x2, rd_short, rs2_short, offset_word);
+        // quadrant 1
+        case 0x08: // c.addi, c.nop
+            return encode_i(0x13, 0x0, rd, rd, imm6);
+        case 0x09: // c.jal
+        case 0x0d: // c.j
+            imm = sign_extend32(((instruction >> 1) & 0x800) |
+                                ((instruction >> 7) & 0x10) |
+                                ((instruction >> 1) & 0x300) |
+                                ((instruction << 2) & 0x400) |
+                                ((instruction >> 1) & 0x40) |
+                                ((instruction << 1) & 0x80) |
+                                ((instruction >> 2) & 0xe) |
+                                ((instruction << 3) & 0x20), 11);
+            return encode_j(funct3 == 0x1 ? 1 : 0, imm);
+        case 0x0a: // c.li
+            return encode_i(0x13, 0x0, rd, 0, imm6);
+        case 0x0b:
+            if (rd == 2) { // c.addi16sp
+                imm = sign_extend32(((instruction >> 3) & 0x200) |
+                                    ((instruction >> 2) & 0x10) |
+                                    ((instruction << 1) & 0x40) |
+                                    ((instruction << 4) & 0x180) |
+                                    ((instruction << 3) & 0x20), 9);
+                if (!imm) {
+                    return 0;
+                }
+                return encode_i(0x13, 0x0, 2, 2, imm);
+            }
+            // c.lui
+            if (!imm6) {
+                return 0;
+            }
+            return ((uint32_t)imm6 << 12) | (rd << 7) | 0x37;
+        case 0x0c:
+            switch ((instruction >> 10) & 0x3)
+            {
+                case 0x0: // c.srli
+                    return shamt & 0x20 ? 0 :
+                           encode_i(0x13, 0x5, rd_short, rd_short, shamt);
+                case 0x1: // c.srai
+                    return shamt & 0x20 ? 0 :
+                           encode_i(0x13, 0x5, rd_short, rd_short,
+                                    0x400 | shamt);
+                case 0x2: // c.andi
+                    return encode_i(0x13, 0x7, rd_short, rd_short, imm6);
+                default:
+                    break;
+            }
+            if (instruction & 0x1000) {
+                return 0;
+            }
+            switch ((instruction >> 5) & 0x3)
+            {
+                case 0x0: // c.sub
+                    return encode_r(0x33, 0x0, 0x20, rd_short, rd_short,
+                                    rs2_short);
+                case 0x1: // c.xor
+                    return encode_r(0x33, 0x4, 0x0, rd_short, rd_short,
+                                    rs2_short);
+                case 0x2: // c.or
+                    return encode_r(0x33, 0x6, 0x0, rd_short, rd_short,
+                                    rs2_short);
+                default: // c.and
+                    return encode_r(0x33, 0x7, 0x0, rd_short, rd_short,
+                                    rs2_short);
+            }
+        case 0x0e: // c.beqz
+        case 0x0f: // c.bnez
+            imm = sign_extend32(((instruction >> 4) & 0x100) |
+                                ((instruction >> 7) & 0x18) |
+                                ((instruction << 1) & 0xc0) |
+                                ((instruction >> 2) & 0x6) |
+                                ((instruction << 3) & 0x20), 8);
+            return encode_b(funct3 & 0x1, rd_short, 0, imm);
+        // quadrant 2
+        case 0x10: // c.slli
+            return shamt & 0x20 ? 0 : encode_i(0x13, 0x1, rd, rd, shamt);
+        case 0x11: // c.fldsp
+            imm = ((instruction >> 7) & 0x20) | ((instruction >> 2) & 0x18) |
+                  ((instruction << 4) & 0x1c0);
+            return encode_i(0x07, 0x3, rd, 2, imm);
+        case 0x12: // c.lwsp
+        case 0x13: // c.flwsp
+            imm = ((instruction >> 7) & 0x20) | ((instruction >> 2) & 0x1c) |
+                  ((instruction << 4) & 0xc0);
+            if (funct3 == 0x2 && !rd) {
+                return 0;
+            }
+            return encode_i(funct3 == 0x2 ? 0x03 : 0x07, 0x2, rd, 2, imm);
+        case 0x14:
+            if (!(instruction & 0x1000)) {
+                if (!rs2) { // c.jr
+                    return rd ? encode_i(0x67, 0x0, 0, rd, 0) : 0;
+                }
+                // c.mv
+                return encode_r(0x33, 0x0, 0x0, rd, 0, rs2);
+            }
+            if (!rs2) {
+                // c.ebreak and c.jalr
+                return rd ? encode_i(0x67, 0x0, 1, rd, 0) : 0x00100073;
+            }
+            // c.add
+            return encode_r(0x33, 0x0, 0x0, rd, rd, rs2);
+        case 0x15: // c.fsdsp
+            imm = ((instruction >> 7) & 0x38) | ((instruction >> 1) & 0x1c0);
+            return encode_s(0x27, 0x3, 2, rs2, imm);
+        case 0x16: // c.swsp
+        case 0x17: // c.fswsp
+            imm = ((instruction >> 7) & 0x3c) | ((instruction >> 1) & 0xc0);
+            return encode_s(funct3 == 0x6 ? 0x23 : 0x27, 0x2, 2, rs2, imm);
+        default:
+            break;
+    }
+    return 0;
+}
+
+void
+decode_instruction(uint32_t instruction, struct decoded_instruction * dinstr)
+{
+    uint8_t length = 4;
+    if (IS_COMPRESSED_INSTRUCTION(instruction)) {
+        instruction = expand_compressed_instruction(instruction & 0xffff);
+        length = 2;
+    }
+    uint8_t opcode = instruction & 0x7f;
+    const struct decoding_rule * rule = NULL;
+    int index = rules_begin[opcode];
+    for (; index < rules_end[opcode]; index++) {
+        if ((instruction & decoding_rules[index].mask) ==
+            decoding_rules[index].match) {
+            rule = &decoding_rules[index];
+            break;
+        }
+    }
+    memset(dinstr, 0x0, sizeof(struct decoded_instruction));
+    dinstr->length = length;
+    if (!rule) {
+        dinstr->operation = RISCV_OP_ILLEGAL;
+        return;
+    }
+    dinstr->operation = rule->operation;
+    switch (rule->format)
+    {
+        case FORMAT_R:
+            dinstr->rd_index = (instruction >> 7) & 0x1f;
+            dinstr->rs1_index = (instruction >> 15) & 0x1f;
+            dinstr->rs2_index = (instruction >> 20) & 0x1f;
+            break;
+        case FORMAT_I:
+            dinstr->rd_index = (instruction >> 7) & 0x1f;
+            dinstr->rs1_index = (instruction >> 15) & 0x1f;
+            dinstr->imm = ((int32_t)instruction) >> 20;
+            break;
+        case FORMAT_S:
+            dinstr->rs1_index = (instruction >> 15) & 0x1f;
+            dinstr->rs2_index = (instruction >> 20) & 0x1f;
+            dinstr->imm = ((((int32_t)instruction) >> 20) & ~0x1f) |
+                          ((instruction >> 7) & 0x1f);
+            break;
+        case FORMAT_B:
+            dinstr->rs1_index = (instruction >> 15) & 0x1f;
+            dinstr->rs2_index = (instruction >> 20) & 0x1f;
+            dinstr->imm = ((((int32_t)instruction) >> 19) & ~0xfff) |
+                          (((instruction >> 7) & 0x1) << 11) |
+                          (((instruction >> 25) & 0x3f) << 5) |
+                          (((instruction >> 8) & 0xf) << 1);
+            break;
+        case FORMAT_U:
+            dinstr->rd_index = (instruction >> 7) & 0x1f;
+            dinstr->imm = instruction & 0xfffff000;
+            break;
+        case FORMAT_J:
+            dinstr->rd_index = (instruction >> 7) & 0x1f;
+            dinstr->imm = ((((int32_t)instruction) >> 11) & ~0xfffff) |
+                          (instruction & 0xff000) |
+                          (((instruction >> 20) & 0x1) << 11) |
+                          (((instruction >> 21) & 0x3ff) << 1);
+            break;
+        case FORMAT_SHAMT:
+            dinstr->rd_index = (instruction >> 7) & 0x1f;
+            dinstr->rs1_index = (instruction >> 15) & 0x1f;
+            dinstr->imm = (instruction >> 20) & 0x1f;
+            break;
+        case FORMAT_CSR:
+            dinstr->rd_index = (instruction >> 7) & 0x1f;
+            dinstr->rs1_index = (instruction >> 15) & 0x1f;
+            dinstr->imm = (instruction >> 20) & 0xfff;
+            break;
+        case FORMAT_AMO:
+            dinstr->rd_index = (instruction >> 7) & 0x1f;
+            dinstr->rs1_index = (instruction >> 15) & 0x1f;
+            dinstr->rs2_index = (instruction >> 20) & 0x1f;
+            dinstr->imm = (instruction >> 27) & 0x1f;
+            break;
+        case FORMAT_FP:
+            dinstr->rd_index = (instruction >> 7) & 0x1f;
+            dinstr->rs1_index = (instruction >> 15) & 0x1f;
+            dinstr->rs2_index = (instruction >> 20) & 0x1f;
+            dinstr->imm = (instruction >> 12) & 0x7;
+            break;
+        case FORMAT_R4:
+            dinstr->rd_index = (instruction >> 7) & 0x1f;
+            dinstr->rs1_index = (instruction >> 15) & 0x1f;
+            dinstr->rs2_index = (instruction >> 20) & 0x1f;
+            dinstr->imm = (((instruction >> 27) & 0x1f) << 3) |
+                          ((instruction >> 12) & 0x7);
+            break;
+        default:
+            break;
+    }
+}
+
+const char *
+riscv_operation_name(uint8_t operation)
+{
+    if (operation >= RISCV_OP_MAX || !operation_names[operation]) {
+        return "unknown";
+    }
+    return operation_names[operation];
+}
+
+// an instruction may begin at any halfword, so is a decoded page indexed.
+#define DECODED_PAGE_NR_INSTRUCTIONS    (4096 / 2)
+
+struct decoded_page {
+    uint32_t page_base;
+    uint32_t is_valid;
+    struct decoded_instruction instructions[DECODED_PAGE_NR_INSTRUCTIONS];
+};
+
+// XXX: the last halfword of a page may begin a 32-bit instruction whose upper
+// half lives in the next page, a decoded page thus covers 4096 + 2 bytes.
+#define DECODED_PAGE_SPAN               (4096 + 2)
+
+static void
+decode_page(struct hart * hartptr, struct decoded_page * page,
+            uint32_t page_base)
+{
+    struct virtual_machine * vm = get_linked_vm(hartptr->native_vmptr,
+                                                LINKAGE_HINT_VM);
+    struct pm_region_operation * pmr = NULL;
+    uint32_t addr = page_base;
+    uint32_t instruction = 0;
+    int index = 0;
+    page->page_base = page_base;
+    page->is_valid = 1;
+    mark_code_page(hartptr, page_base);
+    for (; index < DECODED_PAGE_NR_INSTRUCTIONS; index++, addr += 2) {
+        if (!pmr || addr < pmr->addr_low || (addr + 2) > pmr->addr_high) {
+            pmr = search_pm_region_callback(vm, addr);
+        }
+        // XXX: halfwords which are not backed by any region are decoded as
+        // illegal, the instruction fetch complains only when it's executed.
+        if (!pmr || (addr + 2) > pmr->addr_high) {
+            page->instructions[index].operation = RISCV_OP_ILLEGAL;
+            page->instructions[index].length = 2;
+            continue;
+        }
+        if ((addr + 4) <= pmr->addr_high) {
+            instruction = pmr->pmr_read(addr, 4, hartptr, pmr);
+        } else {
+            // the upper half is in another region, if there is one.
+            struct pm_region_operation * next_pmr =
+                search_pm_region_callback(vm, addr + 2);
+            instruction = pmr->pmr_read(addr, 2, hartptr, pmr);
+            if (!IS_COMPRESSED_INSTRUCTION(instruction)) {
+                instruction = next_pmr ?
+                    instruction |
+                    (next_pmr->pmr_read(addr + 2, 2, hartptr, next_pmr) << 16) :
+                    0;
+            }
+        }
+        decode_instruction(instruction, &page->instructions[index]);
+    }
+    if (page->instructions[DECODED_PAGE_NR_INSTRUCTIONS - 1].length == 4) {
+        mark_code_page(hartptr, page_base + 4096);
+    }
+}
+
+// the halves of an instruction are fetched separately when paging is enabled,
+// a compressed instruction at the end of a page is followed by nothing mapped
+// possibly.
+static uint32_t
+fetch_instruction_paging(struct hart * hartptr, uint32_t instruction_va)
+{
+    uint32_t instruction = instruction_va & 0x2 ?
+        mmu_instruction_read32(hartptr, instruction_va & ~0x3) >> 16 :
+        mmu_instruction_read32(hartptr, instruction_va);
+    if (IS_COMPRESSED_INSTRUCTION(instruction) || !(instruction_va & 0x2)) {
+        return instruction;
+    }
+    return (instruction & 0xffff) |
+           (mmu_instruction_read32(hartptr, instruction_va + 2) << 16);
+}
+
+void
+fetch_decoded_instruction(struct hart * hartptr, uint32_t instruction_va,
+                          struct decoded_instruction * dinstr)
+{
+    struct csr_entry * csr =
+        &((struct csr_entry *)hartptr->csrs_base)[CSR_ADDRESS_SATP];
+    if (hartptr->privilege_level < PRIVILEGE_LEVEL_MACHINE &&
+        csr->csr_blob & 0x80000000) {
+        // XXX: decoded pages are indexed by the untranslated address, don't
+        // cache them when paging is enabled.
+        mark_code_page(hartptr, instruction_va);
+        decode_instruction(fetch_instruction_paging(hartptr, instruction_va),
+                           dinstr);
+        return;
+    }
+    uint32_t page_base = instruction_va & ~4095;
+    struct decoded_page * page =
+        &((struct decoded_page *)hartptr->decoded_pages)[
+            (page_base >> 12) & (DECODED_PAGE_CACHE_SIZE - 1)];
+    if (!page->is_valid || page->page_base != page_base) {
+        decode_page(hartptr, page, page_base);
+    }
+    *dinstr = page->instructions[(instruction_va & 4095) >> 1];
+}
+
+void
+decoder_flush(struct hart * hartptr)
+{
+    struct decoded_page * pages = hartptr->decoded_pages;
+    int index = 0;
+    for (; index < DECODED_PAGE_CACHE_SIZE; index++) {
+        pages[index].is_valid = 0;
+    }
+}
+
+void
+decoder_invalidate_range(struct hart * hartptr, uint32_t addr_low,
+                         uint32_t addr_high)
+{
+    struct decoded_page * pages = hartptr->decoded_pages;
+    int index = 0;
+    for (; index < DECODED_PAGE_CACHE_SIZE; index++) {
+        if (pages[index].page_base < addr_high &&
+            (pages[index].page_base + DECODED_PAGE_SPAN) > addr_low) {
+            pages[index].is_valid = 0;
+        }
+    }
+}
+
+void
+decoder_init(struct hart * hartptr)
+{
+    hartptr->decoded_pages =
+        aligned_alloc(64, DECODED_PAGE_CACHE_SIZE *
+                          sizeof(struct decoded_page));
+    ASSERT(hartptr->decoded_pages);
+    decoder_flush(hartptr);
+}
+
+__attribute__((constructor)) static void
+decoder_constructor(void)
+{
+    int index = 0;
+    memset(rules_begin, 0x0, sizeof(rules_begin));
+    memset(rules_end, 0x0, sizeof(rules_end));
+    memset(operation_names, 0x0, sizeof(operation_names));
+    // the rule ranges are indexed by uint8_t
+    ASSERT(NR_DECODING_RULES <= 255);
+    for (index = 0; index < NR_DECODING_RULES; index++) {
+        uint8_t opcode = decoding_rules[index].match & 0x7f;
+        if (rules_begin[opcode] == rules_end[opcode]) {
+            rules_begin[opcode] = index;
+        }
+        // rules of an opcode are not put together
+        ASSERT(rules_end[opcode] == index || rules_begin[opcode] == index);
+        rules_end[opcode] = index + 1;
+        operation_names[decoding_rules[index].operation] =
+            decoding_rules[index].name;
+    }
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ */
+#ifndef _DECODER_H
+#define _DECODER_H
+#include <stdint.h>
+
+struct hart;
+
+enum riscv_operation {
+    RISCV_OP_ILLEGAL = 0,
+    RISCV_OP_LUI,
+    RISCV_OP_AUIPC,
+    RISCV_OP_JAL,
+    RISCV_OP_JALR,
+    RISCV_OP_BEQ,
+    RISCV_OP_BNE,
+    RISCV_OP_BLT,
+    RISCV_OP_BGE,
+    RISCV_OP_BLTU,
+    RISCV_OP_BGEU,
+    RISCV_OP_LB,
+    RISCV_OP_LH,
+    RISCV_OP_LW,
+    RISCV_OP_LBU,
+    RISCV_OP_LHU,
+    RISCV_OP_SB,
+    RISCV_OP_SH,
+    RISCV_OP_SW,
+    RISCV_OP_ADDI,
+    RISCV_OP_SLTI,
+    RISCV_OP_SLTIU,
+    RISCV_OP_XORI,
+    RISCV_OP_ORI,
+    RISCV_OP_ANDI,
+    RISCV_OP_SLLI,
+    RISCV_OP_SRLI,
+    RISCV_OP_SRAI,
+    RISCV_OP_ADD,
+    RISCV_OP_SUB,
+    RISCV_OP_SLL,
+    RISCV_OP_SLT,
+    RISCV_OP_SLTU,
+    RISCV_OP_XOR,
+    RISCV_OP_SRL,
+    RISCV_OP_SRA,
+    RISCV_OP_OR,
+    RISCV_OP_AND,
+    RISCV_OP_MUL,
+    RISCV_OP_MULH,
+    RISCV_OP_MULHSU,
+    RISCV_OP_MULHU,
+    RISCV_OP_DIV,
+    RISCV_OP_DIVU,
+    RISCV_OP_REM,
+    RISCV_OP_REMU,
+    RISCV_OP_FENCE,
+    RISCV_OP_FENCE_I,
+    // Zihintpause
+    RISCV_OP_PAUSE,
+    RISCV_OP_ECALL,
+    RISCV_OP_EBREAK,
+    RISCV_OP_MRET,
+    RISCV_OP_SRET,
+    RISCV_OP_WFI,
+    RISCV_OP_SFENCE_VMA,
+    RISCV_OP_CSRRW,
+    RISCV_OP_CSRRS,
+    RISCV_OP_CSRRC,
+    RISCV_OP_CSRRWI,
+    RISCV_OP_CSRRSI,
+    RISCV_OP_CSRRCI,
+    RISCV_OP_LR_W,
+    RISCV_OP_SC_W,
+    RISCV_OP_AMOSWAP_W,
+    RISCV_OP_AMOADD_W,
+    RISCV_OP_AMOXOR_W,
+    RISCV_OP_AMOAND_W,
+    RISCV_OP_AMOOR_W,
+    RISCV_OP_AMOMIN_W,
+    RISCV_OP_AMOMAX_W,
+    RISCV_OP_AMOMINU_W,
+    RISCV_OP_AMOMAXU_W,
+    // Zba
+    RISCV_OP_SH1ADD,
+    RISCV_OP_SH2ADD,
+    RISCV_OP_SH3ADD,
+    // Zbb
+    RISCV_OP_ANDN,
+    RISCV_OP_ORN,
+    RISCV_OP_XNOR,
+    RISCV_OP_CLZ,
+    RISCV_OP_CTZ,
+    RISCV_OP_CPOP,
+    // NOTE: signed min/max are suffixed, RISCV_OP_MAX is the sentinel.
+    RISCV_OP_MINS,
+    RISCV_OP_MINU,
+    RISCV_OP_MAXS,
+    RISCV_OP_MAXU,
+    RISCV_OP_SEXT_B,
+    RISCV_OP_SEXT_H,
+    RISCV_OP_ZEXT_H,
+    RISCV_OP_ROL,
+    RISCV_OP_ROR,
+    RISCV_OP_RORI,
+    RISCV_OP_ORC_B,
+    RISCV_OP_REV8,
+    // F
+    RISCV_OP_FLW,
+    RISCV_OP_FSW,
+    RISCV_OP_FMADD_S,
+    RISCV_OP_FMSUB_S,
+    RISCV_OP_FNMSUB_S,
+    RISCV_OP_FNMADD_S,
+    RISCV_OP_FADD_S,
+    RISCV_OP_FSUB_S,
+    RISCV_OP_FMUL_S,
+    RISCV_OP_FDIV_S,
+    RISCV_OP_FSQRT_S,
+    RISCV_OP_FSGNJ_S,
+    RISCV_OP_FSGNJN_S,
+    RISCV_OP_FSGNJX_S,
+    RISCV_OP_FMIN_S,
+    RISCV_OP_FMAX_S,
+    RISCV_OP_FCVT_W_S,
+    RISCV_OP_FCVT_WU_S,
+    RISCV_OP_FMV_X_W,
+    RISCV_OP_FEQ_S,
+    RISCV_OP_FLT_S,
+    RISCV_OP_FLE_S,
+    RISCV_OP_FCLASS_S,
+    RISCV_OP_FCVT_S_W,
+    RISCV_OP_FCVT_S_WU,
+    RISCV_OP_FMV_W_X,
+    // D
+    RISCV_OP_FLD,
+    RISCV_OP_FSD,
+    RISCV_OP_FMADD_D,
+    RISCV_OP_FMSUB_D,
+    RISCV_OP_FNMSUB_D,
+    RISCV_OP_FNMADD_D,
+    RISCV_OP_FADD_D,
+    RISCV_OP_FSUB_D,
+    RISCV_OP_FMUL_D,
+    RISCV_OP_FDIV_D,
+    RISCV_OP_FSQRT_D,
+    RISCV_OP_FSGNJ_D,
+    RISCV_OP_FSGNJN_D,
+    RISCV_OP_FSGNJX_D,
+    RISCV_OP_FMIN_D,
+    RISCV_OP_FMAX_D,
+    RISCV_OP_FCVT_S_D,
+    RISCV_OP_FCVT_D_S,
+    RISCV_OP_FEQ_D,
+    RISCV_OP_FLT_D,
+    RISCV_OP_FLE_D,
+    RISCV_OP_FCLASS_D,
+    RISCV_OP_FCVT_W_D,
+    RISCV_OP_FCVT_WU_D,
+    RISCV_OP_FCVT_D_W,
+    RISCV_OP_FCVT_D_WU,
+    RISCV_OP_MAX
+};
+
+// The compact form of a decoded instruction. the immediate is always sign
+// extended and shifted into its final position, except:
+//  - shift-immediate instructions: shift amount
+//  - CSR instructions: CSR address, rs1_index holds uimm for CSRR*I
+//  - AMO instructions: funct5
+//  - FENCE: fm, pred and succ as they are encoded
+//  - floating-point computational instructions: the rounding mode, the fused
+//    multiply-add instructions also carry rs3 in it: (rs3 << 3) | rm
+// a compressed instruction is decoded as its 32-bit equivalent, only the
+// length tells them apart.
+struct decoded_instruction {
+    uint8_t operation;
+    uint8_t rd_index;
+    uint8_t rs1_index;
+    uint8_t rs2_index;
+    int32_t imm;
+    // the length of the instruction in bytes: 2 or 4
+    uint8_t length;
+}__attribute__((packed));
+
+// the host is x86-TSO, a FENCE needs a host fence only if it orders earlier
+// stores against later loads, FENCE.TSO never does.
+#define FENCE_ORDERS_STORE_LOAD(imm)                                           \
+    (((imm) & 0xf00) != 0x800 && ((imm) & 0x10) && ((imm) & 0x02))
+
+// the instruction is compressed if the lowest two bits are not 0b11, only the
+// lower 16 bits are looked at then.
+void
+decode_instruction(uint32_t instruction, struct decoded_instruction * dinstr);
+
+// fetch the decoded instruction at guest pc, the whole page is decoded at
+// once and cached in the hart.
+void
+fetch_decoded_instruction(struct hart * hartptr, uint32_t instruction_va,
+                          struct decoded_instruction * dinstr);
+
+const char *
+riscv_operation_name(uint8_t operation);
+
+void
+decoder_init(struct hart * hartptr);
+
+void
+decoder_flush(struct hart * hartptr);
+
+// drop decoded pages which overlap guest range [addr_low, addr_high)
+void
+decoder_invalidate_range(struct hart * hartptr, uint32_t addr_low,
+                         uint32_t addr_high);
+
+#endif
@@ -51,19 +51,50 @@ struct elf32_program_header{
     uint32_t p_align;        /* Segment alignment */
 };
 
+struct elf32_dynamic {
+    int32_t d_tag;           /* Dynamic entry type */
+    uint32_t d_val;          /* Integer or address value */
+};
+
+struct elf32_symbol {
+    uint32_t st_name;        /* Symbol name (string tbl index) */
+    uint32_t st_value;       /* Symbol value */
+    uint32_t st_size;        /* Symbol size */
+    uint8_t st_info;         /* Symbol type and binding */
+    uint8_t st_other;        /* Symbol visibility */
+    uint16_t st_shndx;       /* Section index */
+};
+
 #define ELF32_IDENTITY_ELF 0x464c457f
 #define ELF32_MACHINE_RISCV 0xf3
 #define ELF32_CLASS_ELF32 0x1
 #define ELF32_ENDIAN_LITTLE 0x1
 
 #define ELF32_TYPE_EXEC 0x2
+#define ELF32_TYPE_DYN 0x3
 #define ELF32_MACHINE_I386 0x3 
 
+#define SECTION_TYPE_SYMTAB 2
+
+#define SYMBOL_TYPE(info) ((info) & 0xf)
+#define SYMBOL_TYPE_FUNC 2
+#define SYMBOL_BIND_GLOBAL 1
+#define SYMBOL_INFO(bind, type) (((bind) << 4) | ((type) & 0xf))
+#define SYMBOL_SECTION_UNDEFINED 0
+
 #define PROGRAM_TYPE_LOAD 1
+#define PROGRAM_TYPE_DYNAMIC 2
 #define PROGRAM_READ (1 << 2)
 #define PROGRAM_WRITE (1 << 1)
 #define PROGRAM_EXECUTE (1 << 0)
 
+#define DYNAMIC_TAG_NULL 0
+#define DYNAMIC_TAG_HASH 4
+#define DYNAMIC_TAG_STRTAB 5
+#define DYNAMIC_TAG_SYMTAB 6
+#define DYNAMIC_TAG_STRSZ 10
+#define DYNAMIC_TAG_SYMENT 11
+
 int
 elf_open(const char * elf_host_path);
 
@@ -80,4 +111,8 @@ int
 elf_program_header(int fd,  const struct elf32_elf_header * elf_hdr,
                    struct elf32_program_header * prog_hdr, int index);
 
+int
+elf_section_header(int fd,  const struct elf32_elf_header * elf_hdr,
+                   struct elf32_section_header * sect_hdr, int index);
+
 #endif
@@ -53,6 +53,18 @@ elf_program_header(int fd,  const struct elf32_elf_header * elf_hdr,
     return elf_read(fd, prog_hdr, offset, elf_hdr->e_phentsize);
 }
 
+int
+elf_section_header(int fd,  const struct elf32_elf_header * elf_hdr,
+                   struct elf32_section_header * sect_hdr, int index)
+{
+    if (index >= elf_hdr->e_shnum) {
+        return -1;
+    }
+    ASSERT(sizeof(struct elf32_section_header) == elf_hdr->e_shentsize);
+    int offset = elf_hdr->e_shoff + index * elf_hdr->e_shentsize;
+    return elf_read(fd, sect_hdr, offset, elf_hdr->e_shentsize);
+}
+
 void
 elf_close(int fd)
 {
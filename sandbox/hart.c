@@ -12,10 +12,16 @@
 #include <search.h>
 #include <sort.h>
 #include <csr.h>
+#include <interpreter.h>
+#include <decoder.h>
+#include <vm.h>
+#include <task.h>
+#include <vmm_smp.h>
 
 struct csr_registery_entry * csr_registery_head = NULL;
 
 uint64_t offset_of_vmm_stack = offsetof(struct hart, vmm_stack_ptr);
+uint64_t offset_of_dispatch_cache = offsetof(struct hart, dispatch_cache);
 
 static void
 csr_registery_init(struct hart * hartptr)
@@ -52,11 +58,24 @@ hart_init(struct hart * hart_instance, int hart_id)
     tc_base &= ~4095;
     hart_instance->translation_cache = (void *)tc_base;
     ASSERT(hart_instance->translation_cache);
+    // install the cold area which is shared by all translation units.
+    extern uint8_t translation_cache_stubs_begin[];
+    extern uint8_t translation_cache_stubs_end[];
+    ASSERT((translation_cache_stubs_end - translation_cache_stubs_begin) ==
+           TRANSLATION_CACHE_STUBS_SIZE);
+    memcpy(hart_instance->translation_cache + TRANSLATION_CACHE_HOT_SIZE,
+           translation_cache_stubs_begin, TRANSLATION_CACHE_STUBS_SIZE);
 
     hart_instance->pc_mappings =
         aligned_alloc(4096, MAX_INSTRUCTIONS_TOTRANSLATE *
                             sizeof(struct program_counter_mapping_item));
     ASSERT(hart_instance->pc_mappings);
+    hart_instance->dispatch_cache =
+        aligned_alloc(64, DISPATCH_CACHE_SIZE *
+                          sizeof(struct dispatch_cache_entry));
+    ASSERT(hart_instance->dispatch_cache);
+    decoder_init(hart_instance);
+    interpreter_init(hart_instance);
     flush_translation_cache(hart_instance);
 
     // grant exec privilege to the translation cache
@@ -89,12 +108,243 @@ flush_translation_cache(struct hart * hart_instance)
 {
     hart_instance->nr_translated_instructions = 0;
     hart_instance->translation_cache_ptr = 0;
+    hart_instance->nr_dirty_code_pages = 0;
+    flush_dispatch_cache(hart_instance);
+    decoder_flush(hart_instance);
+    interpreter_flush(hart_instance);
     #if defined(DEBUG_TRACE)
         log_trace("flush translation cache hartid:%d\n",
                   hart_instance->hart_id);
     #endif
 }
 
+// the dispatch cache holds translations of the current context only, it must
+// be flushed whenever a translation is invalidated or the context changes.
+void
+flush_dispatch_cache(struct hart * hart_instance)
+{
+    memset(hart_instance->dispatch_cache, 0xff,
+           DISPATCH_CACHE_SIZE * sizeof(struct dispatch_cache_entry));
+}
+
+void
+fill_dispatch_cache(struct hart * hart_instance, uint32_t guest_pc,
+                    uint32_t tc_offset)
+{
+    struct dispatch_cache_entry * entry =
+        &((struct dispatch_cache_entry *)hart_instance->dispatch_cache)[
+            (guest_pc >> 1) & (DISPATCH_CACHE_SIZE - 1)];
+    entry->guest_pc = guest_pc;
+    entry->tc_offset = tc_offset;
+}
+
+// XXX: the translated code of the range is not reclaimed, it's unreachable
+// once its mapping items are removed because a translation unit never crosses
+// a guest page boundary. the space is reclaimed at the next full flush.
+void
+invalidate_translation_range(struct hart * hart_instance, uint32_t addr_low,
+                             uint32_t addr_high)
+{
+    struct program_counter_mapping_item * mappings = hart_instance->pc_mappings;
+    int nr_items = hart_instance->nr_translated_instructions;
+    int first = 0;
+    int last = 0;
+    // the range is extended to page boundaries, so is a translation unit.
+    uint64_t range_low = addr_low & ~4095;
+    uint64_t range_high = (((uint64_t)addr_high) + 4095) & ~4095ULL;
+    // a 32-bit instruction at the last halfword of the preceding page reaches
+    // into the range, it's the only instruction of its translation unit.
+    uint64_t items_low = range_low >= 2 ? range_low - 2 : range_low;
+    if (range_high > 0xffffffffULL) {
+        range_high = 0xffffffffULL;
+    }
+    if (range_high <= range_low) {
+        return;
+    }
+    flush_dispatch_cache(hart_instance);
+    // the items of the range are not contiguous because they are sorted by
+    // context first, squeeze them out in one pass.
+    for (; first < nr_items; first++) {
+        if (mappings[first].guest_pc >= items_low &&
+            mappings[first].guest_pc < range_high) {
+            continue;
+        }
+        if (last != first) {
+            mappings[last] = mappings[first];
+        }
+        last++;
+    }
+    hart_instance->nr_translated_instructions = last;
+    decoder_invalidate_range(hart_instance, range_low, range_high);
+    interpreter_invalidate_range(hart_instance, range_low, range_high);
+}
+
+// XXX: translations are tagged with the privilege level and the address space
+// in which they are translated, so switching forth and back between privilege
+// levels or address spaces reuses existing translations.
+//  bit 0-1: privilege level
+//  bit 2: whether paging is enabled
+//  bit 3-11: satp.ASID if paging is enabled
+#define CONTEXT_PAGING 0x4
+#define CONTEXT_ASID_SHIFT 3
+uint32_t
+translation_context(struct hart * hart_instance)
+{
+    struct csr_entry * csr =
+        &((struct csr_entry *)hart_instance->csrs_base)[CSR_ADDRESS_SATP];
+    uint32_t context = hart_instance->privilege_level;
+    if (hart_instance->privilege_level < PRIVILEGE_LEVEL_MACHINE &&
+        csr->csr_blob & 0x80000000) {
+        context |= CONTEXT_PAGING;
+        context |= ((csr->csr_blob >> 22) & 0x1ff) << CONTEXT_ASID_SHIFT;
+    }
+    return context;
+}
+
+// SFENCE.VMA with rs2 != x0: the translations of the other address spaces
+// are kept.
+void
+invalidate_translation_asid(struct hart * hart_instance, uint32_t asid)
+{
+    struct program_counter_mapping_item * mappings = hart_instance->pc_mappings;
+    int nr_items = hart_instance->nr_translated_instructions;
+    int first = 0;
+    int last = 0;
+    for (; first < nr_items; first++) {
+        if (mappings[first].context & CONTEXT_PAGING &&
+            (mappings[first].context >> CONTEXT_ASID_SHIFT) == (asid & 0x1ff)) {
+            continue;
+        }
+        if (last != first) {
+            mappings[last] = mappings[first];
+        }
+        last++;
+    }
+    hart_instance->nr_translated_instructions = last;
+    flush_dispatch_cache(hart_instance);
+    // decoded pages are not cached when paging is enabled.
+    interpreter_flush(hart_instance);
+}
+
+void
+invalidate_translation_page(struct hart * hart_instance, uint32_t page_base)
+{
+    invalidate_translation_range(hart_instance, page_base, page_base + 1);
+}
+
+// FENCE.I only has to discard the pages which are written since they were
+// decoded.
+void
+invalidate_dirty_code_pages(struct hart * hart_instance)
+{
+    if (hart_instance->nr_dirty_code_pages > MAX_DIRTY_CODE_PAGES) {
+        flush_translation_cache(hart_instance);
+        return;
+    }
+    int index = 0;
+    for (; index < hart_instance->nr_dirty_code_pages; index++) {
+        invalidate_translation_page(hart_instance,
+                                    hart_instance->dirty_code_pages[index]);
+    }
+    hart_instance->nr_dirty_code_pages = 0;
+}
+
+#define CODE_PAGES_BITMAP_SIZE ((1 << 20) / 8)
+
+void
+mark_code_page(struct hart * hart_instance, uint32_t instruction_va)
+{
+    struct virtual_machine * vm = get_linked_vm(hart_instance->native_vmptr,
+                                                LINKAGE_HINT_VM);
+    if (!vm->code_pages_bitmap) {
+        // pages of the bitmap are not populated until they are touched.
+        vm->code_pages_bitmap = mmap(NULL, CODE_PAGES_BITMAP_SIZE,
+                                     PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        ASSERT(vm->code_pages_bitmap != MAP_FAILED);
+    }
+    uint32_t page = instruction_va >> 12;
+    vm->code_pages_bitmap[page >> 3] |= 1 << (page & 7);
+}
+
+static void
+mark_code_page_dirty(struct hart * hart_instance, void * arg)
+{
+    uint32_t page_base = *(uint32_t *)arg;
+    int index = 0;
+    if (hart_instance->nr_dirty_code_pages > MAX_DIRTY_CODE_PAGES) {
+        return;
+    }
+    for (; index < hart_instance->nr_dirty_code_pages; index++) {
+        if (hart_instance->dirty_code_pages[index] == page_base) {
+            return;
+        }
+    }
+    if (hart_instance->nr_dirty_code_pages == MAX_DIRTY_CODE_PAGES) {
+        hart_instance->nr_dirty_code_pages = MAX_DIRTY_CODE_PAGES + 1;
+        return;
+    }
+    hart_instance->dirty_code_pages[hart_instance->nr_dirty_code_pages++] =
+        page_base;
+}
+
+// the slow path of a store which hits a page holding decoded code. every
+// thread sharing the address space may have decoded the page, mark it dirty in
+// all of them, it's invalidated when the thread issues a FENCE.I.
+void
+code_page_written(struct hart * hart_instance, uint32_t location)
+{
+    struct virtual_machine * vm = get_linked_vm(hart_instance->native_vmptr,
+                                                LINKAGE_HINT_VM);
+    uint32_t page = location >> 12;
+    uint32_t page_base = location & ~4095;
+    // NOTE: the store is carried out by guest code, the other threads are
+    // marked in the vmm.
+    vmm_enter();
+    vm->code_pages_bitmap[page >> 3] &= ~(1 << (page & 7));
+    for_each_thread_in_address_space(hart_instance, mark_code_page_dirty,
+                                     &page_base);
+    vmm_leave();
+}
+
+struct guest_range {
+    uint32_t addr_low;
+    uint32_t addr_high;
+};
+
+static void
+invalidate_thread_range(struct hart * hart_instance, void * arg)
+{
+    struct guest_range * range = arg;
+    invalidate_translation_range(hart_instance, range->addr_low,
+                                 range->addr_high);
+}
+
+// the mapping of guest range [addr_low, addr_high) changes, e.g. munmap,
+// mprotect, brk shrinking and new regions. the translations of the range are
+// discarded in all threads sharing the address space, translations of other
+// ranges are not affected.
+void
+invalidate_guest_range(struct hart * hart_instance, uint32_t addr_low,
+                       uint32_t addr_high)
+{
+    struct virtual_machine * vm = get_linked_vm(hart_instance->native_vmptr,
+                                                LINKAGE_HINT_VM);
+    struct guest_range range = {
+        .addr_low = addr_low,
+        .addr_high = addr_high
+    };
+    if (vm->code_pages_bitmap) {
+        uint32_t page = addr_low >> 12;
+        uint32_t page_end = (uint32_t)((((uint64_t)addr_high) + 4095) >> 12);
+        for (; page < page_end; page++) {
+            vm->code_pages_bitmap[page >> 3] &= ~(1 << (page & 7));
+        }
+    }
+    for_each_thread_in_address_space(hart_instance, invalidate_thread_range,
+                                     &range);
+}
+
 #if 0
 static int
 comparing_mapping_item(const void *a, const void * b)
@@ -106,7 +356,9 @@ comparing_mapping_item(const void *a, const void * b)
 #else
 // MACRO is much more quick
     #define comparing_mapping_item(pa, pb)({                                   \
-        (int)((pa)->guest_pc - (pb)->guest_pc);                                \
+        (pa)->context != (pb)->context ?                                       \
+            ((pa)->context < (pb)->context ? -1 : 1) :                         \
+            (int)((pa)->guest_pc - (pb)->guest_pc);                            \
     })
 #endif
 // @return zero upon success, otherwise, non-zero is returned
@@ -129,11 +381,20 @@ add_translation_item(struct hart * hart_instance,
            translation_instruction_block, instruction_block_length);
     hart_instance->translation_cache_ptr += instruction_block_length;
 
+    // XXX: a template may be prefixed to the translation of an instruction,
+    // e.g. the head of a loop idiom, which falls through into it. the mapping
+    // of the prefix is kept.
+    if (search_translation_item(hart_instance, guest_instruction_address)) {
+        return 0;
+    }
+
     // insert one mapping entry into per-hart pc mapping array
     struct program_counter_mapping_item * mappings = hart_instance->pc_mappings;
     mappings[hart_instance->nr_translated_instructions].guest_pc =
         guest_instruction_address;
     mappings[hart_instance->nr_translated_instructions].tc_offset = tc_offset;
+    mappings[hart_instance->nr_translated_instructions].context =
+        translation_context(hart_instance);
     hart_instance->nr_translated_instructions ++;
 
     INSERTION_SORT(struct program_counter_mapping_item,
@@ -154,7 +415,8 @@ search_translation_item(struct hart * hart_instance,
                         uint32_t guest_instruction_address)
 {
     struct program_counter_mapping_item key = {
-        .guest_pc = guest_instruction_address
+        .guest_pc = guest_instruction_address,
+        .context = translation_context(hart_instance)
     };
     return SEARCH(struct program_counter_mapping_item,
                   hart_instance->pc_mappings,
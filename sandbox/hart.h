@@ -30,6 +30,15 @@ struct virtual_machine;
 struct program_counter_mapping_item {
     uint32_t guest_pc;
     uint32_t tc_offset;
+    // see translation_context()
+    uint32_t context;
+}__attribute__((packed));
+
+// empty entries hold an impossible guest pc
+#define DISPATCH_CACHE_EMPTY 0xffffffff
+struct dispatch_cache_entry {
+    uint32_t guest_pc;
+    uint32_t tc_offset;
 }__attribute__((packed));
 
 union interrupt_control_blob {
@@ -88,8 +97,38 @@ struct hart {
     void * translation_cache;
     int translation_cache_ptr;
 
+    // pre-decoded blocks of the interpreter tier.
+    void * interp_blocks;
+    // decoded guest pages
+    void * decoded_pages;
+    // code pages written since they were decoded, they are invalidated upon
+    // fence.i. nr_dirty_code_pages > MAX_DIRTY_CODE_PAGES indicates overflow.
+    int nr_dirty_code_pages;
+    uint32_t dirty_code_pages[MAX_DIRTY_CODE_PAGES];
+
     void * vmm_stack_ptr;
-    
+
+    // direct-mapped cache of guest pc to translation cache offset, looked up
+    // by vmm_entry_point. see struct dispatch_cache_entry
+    void * dispatch_cache;
+
+    // the LR/SC reservation of the hart, a SC succeeds only when the reserved
+    // word still holds the value loaded by the LR.
+    uint32_t reservation_address;
+    uint32_t reservation_value;
+    int reservation_valid;
+
+    // consecutive iterations of guest spin-wait loops, see spin_wait.c
+    uint32_t spin_iterations;
+
+    // the floating-point registers, single-precision values are NaN-boxed.
+    uint64_t fregisters[32];
+    // fcsr: the dynamic rounding mode and the accrued exception flags, the
+    // flags raised by the host since the last fpu_sync_flags() are still in
+    // MXCSR. see hart_fpu.c
+    uint8_t frm;
+    uint8_t fflags;
+
     void * csrs_base;
     uint32_t hart_magic;
 
@@ -112,6 +151,8 @@ struct hart {
     // =================== fields above are not cared by APP-LEVEL emulation====
 
     struct x86_64_cpustate * host_cpustate;
+    // vmm_nesting of the host cpu when the task is switched out.
+    int vmm_nesting;
 
     enum task_state state;
     enum task_state non_stop_state;
@@ -124,6 +165,16 @@ struct hart {
     uint8_t wait_state_continued:1;
 
     struct list_elem list;   
+
+    // a task in nanosleep() is queued by its deadline, see task_sched.c
+    uint64_t sleep_deadline;
+    struct list_elem sleep_list;
+
+    // the weighted cpu time the task has received and when it was switched
+    // in, both in nanoseconds, see task_sched.c
+    uint64_t vruntime;
+    uint64_t exec_start;
+    int nice;
 }__attribute__((aligned(64)));
 
 static inline void
@@ -155,16 +206,11 @@ struct prefetch_blob {
 static inline int
 unoccupied_cache_size(struct hart * hart_instance)
 {
-    extern void * vmm_jumper_begin;
-    extern void * vmm_jumper_end;
-    uint8_t * jumper_code_begin = (uint8_t *)&vmm_jumper_begin;
-    uint8_t * jumper_code_end = (uint8_t *)&vmm_jumper_end;
-    
     int ret = 0;
     if (hart_instance->nr_translated_instructions <
         MAX_INSTRUCTIONS_TOTRANSLATE) {
-        ret = TRANSLATION_CACHE_SIZE - hart_instance->translation_cache_ptr -
-              (jumper_code_end - jumper_code_begin);
+        ret = TRANSLATION_CACHE_HOT_SIZE -
+              hart_instance->translation_cache_ptr - TRANSLATION_UNIT_EXIT_SIZE;
     }
     //ASSERT(ret >= 0);
     return ret;
@@ -176,6 +222,39 @@ hart_init(struct hart * hart_instance, int hart_id);
 void
 flush_translation_cache(struct hart * hart_instance);
 
+void
+flush_dispatch_cache(struct hart * hart_instance);
+
+void
+fill_dispatch_cache(struct hart * hart_instance, uint32_t guest_pc,
+                    uint32_t tc_offset);
+
+void
+invalidate_translation_range(struct hart * hart_instance, uint32_t addr_low,
+                             uint32_t addr_high);
+
+void
+invalidate_translation_page(struct hart * hart_instance, uint32_t page_base);
+
+void
+invalidate_guest_range(struct hart * hart_instance, uint32_t addr_low,
+                       uint32_t addr_high);
+
+void
+invalidate_dirty_code_pages(struct hart * hart_instance);
+
+void
+mark_code_page(struct hart * hart_instance, uint32_t instruction_va);
+
+void
+code_page_written(struct hart * hart_instance, uint32_t location);
+
+
+uint32_t
+translation_context(struct hart * hart_instance);
+
+void
+invalidate_translation_asid(struct hart * hart_instance, uint32_t asid);
 
 int
 add_translation_item(struct hart * hart_instance,
@@ -14,9 +14,47 @@
 
 // XXX: make it big, so it doesn't need to be flushed when debuging the TC
 #define TRANSLATION_CACHE_SIZE (1024 * 64)
+// the tail of the translation cache is the cold area: the shared exit stub and
+// the helper call thunk live there and survive flushing. the hot area below it
+// is filled with translation units only, each one begins at a 16-byte boundary.
+#define TRANSLATION_CACHE_STUBS_SIZE 64
+#define TRANSLATION_CACHE_HOT_SIZE                                             \
+    (TRANSLATION_CACHE_SIZE - TRANSLATION_CACHE_STUBS_SIZE)
+#define TC_HELPER_THUNK_OFFSET TRANSLATION_CACHE_HOT_SIZE
+#define TC_EXIT_STUB_OFFSET (TRANSLATION_CACHE_HOT_SIZE + 48)
+#define TRANSLATION_UNIT_ALIGNMENT 16
+// a translation unit ends with `jmp rel32` to the exit stub.
+#define TRANSLATION_UNIT_EXIT_SIZE 5
 // XXX: make it not that big, because it takes too much to search translated instruction.
 #define MAX_INSTRUCTIONS_TOTRANSLATE 512
 
+// a guest block is interpreted this many times before it's translated.
+#define INTERPRETER_PROMOTION_THRESHOLD 32
+// number of pre-decoded blocks per hart, must be power of 2
+#define INTERPRETER_BLOCK_CACHE_SIZE 512
+#define INTERPRETER_MAX_BLOCK_INSTRUCTIONS 32
+
+// number of decoded guest pages cached per hart, must be power of 2
+#define DECODED_PAGE_CACHE_SIZE 16
+
+// number of written code pages a hart tracks, fence.i falls back to flushing
+// the whole translation cache once it overflows.
+#define MAX_DIRTY_CODE_PAGES 16
+
+// a guest spin-wait loop yields the host cpu after this many iterations, a
+// pause hint counts as one iteration.
+#define SPIN_WAIT_ITERATIONS 16
+
+// number of entries of the dispatch cache which the vmm entry point looks up
+// before it enters C, must be power of 2
+#define DISPATCH_CACHE_SIZE 1024
+
+// the most host threads running guest tasks in SMP mode, see vmm_smp.h
+#define VMM_MAX_HOST_CPUS 64
+
+// the preemption ticker kicks the host cpus every VMM_SCHED_MSECONDS.
+#define VMM_SCHED_MSECONDS 5
+
 // reserve a small trunk of space to transfer control to vmm
 #define VMM_STACK_SIZE (1024 * 8)
 
@@ -53,7 +91,15 @@
 #define CSR_ADDRESS_SEPC                0x141
 #define CSR_ADDRESS_SSCRATCH            0x140
 
+#define CSR_ADDRESS_CYCLE               0xC00
 #define CSR_ADDRESS_TIME                0xC01
+#define CSR_ADDRESS_INSTRET             0xC02
+#define CSR_ADDRESS_CYCLEH              0xC80
 #define CSR_ADDRESS_TIMEH               0xC81
+#define CSR_ADDRESS_INSTRETH            0xC82
+
+#define CSR_ADDRESS_FFLAGS              0x001
+#define CSR_ADDRESS_FRM                 0x002
+#define CSR_ADDRESS_FCSR                0x003
 
 #endif
@@ -0,0 +1,679 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      The floating-point state of a hart is partly kept by the host: the
+ *      guest runs with MXCSR holding the dynamic rounding mode of the hart,
+ *      the exception flags are accumulated by the host in MXCSR and they are
+ *      folded into fflags when fcsr is read or the task is switched out.
+ */
+
+#include <hart_fpu.h>
+#include <csr.h>
+#include <mmu.h>
+#include <util.h>
+#include <math.h>
+#include <string.h>
+
+#define MXCSR_FLAGS_MASK        0x003f
+#define MXCSR_ROUNDING_MASK     0x6000
+
+static inline uint32_t
+read_mxcsr(void)
+{
+    uint32_t mxcsr;
+    __asm__ volatile("stmxcsr %0;"
+                     :"=m"(mxcsr)
+                     :
+                     :"memory");
+    return mxcsr;
+}
+
+static inline void
+write_mxcsr(uint32_t mxcsr)
+{
+    __asm__ volatile("ldmxcsr %0;"
+                     :
+                     :"m"(mxcsr)
+                     :"memory");
+}
+
+// XXX: RMM has no host counterpart, it's approximated by RNE. a reserved frm
+// is loaded as RNE too, but no instruction runs with it, see
+// fpu_raise_illegal_instruction().
+static inline uint32_t
+mxcsr_rounding_mode(uint32_t rm)
+{
+    switch (rm)
+    {
+        case FRM_RTZ:
+            return 0x6000;
+        case FRM_RDN:
+            return 0x2000;
+        case FRM_RUP:
+            return 0x4000;
+        default:
+            break;
+    }
+    return 0x0;
+}
+
+// NOTE: the host denormal-operand flag has no RISC-V counterpart.
+static inline uint32_t
+mxcsr_to_fflags(uint32_t mxcsr)
+{
+    uint32_t fflags = 0;
+    fflags |= (mxcsr & 0x01) ? FFLAGS_NV : 0;
+    fflags |= (mxcsr & 0x04) ? FFLAGS_DZ : 0;
+    fflags |= (mxcsr & 0x08) ? FFLAGS_OF : 0;
+    fflags |= (mxcsr & 0x10) ? FFLAGS_UF : 0;
+    fflags |= (mxcsr & 0x20) ? FFLAGS_NX : 0;
+    return fflags;
+}
+
+void
+fpu_sync_flags(struct hart * hartptr)
+{
+    uint32_t mxcsr = read_mxcsr();
+    if (mxcsr & MXCSR_FLAGS_MASK) {
+        hartptr->fflags |= mxcsr_to_fflags(mxcsr);
+        write_mxcsr(mxcsr & ~MXCSR_FLAGS_MASK);
+    }
+}
+
+void
+fpu_load_state(struct hart * hartptr)
+{
+    uint32_t mxcsr = read_mxcsr() & ~(MXCSR_FLAGS_MASK | MXCSR_ROUNDING_MASK);
+    write_mxcsr(mxcsr | mxcsr_rounding_mode(hartptr->frm));
+}
+
+void
+fpu_reset_state(struct hart * hartptr)
+{
+    memset(hartptr->fregisters, 0x0, sizeof(hartptr->fregisters));
+    hartptr->frm = FRM_RNE;
+    hartptr->fflags = 0;
+    // the flags pending in MXCSR belong to the old image too.
+    fpu_load_state(hartptr);
+}
+
+// a static rounding mode in the instruction overrides the dynamic one, the
+// flags raised meanwhile are kept.
+static inline uint32_t
+enter_rounding_mode(uint32_t rm)
+{
+    uint32_t mxcsr = read_mxcsr();
+    if (rm != FRM_DYN) {
+        write_mxcsr((mxcsr & ~MXCSR_ROUNDING_MASK) | mxcsr_rounding_mode(rm));
+    }
+    return mxcsr;
+}
+
+static inline void
+leave_rounding_mode(uint32_t saved_mxcsr)
+{
+    write_mxcsr((read_mxcsr() & MXCSR_FLAGS_MASK) |
+                (saved_mxcsr & ~MXCSR_FLAGS_MASK));
+}
+
+static inline uint32_t
+read_f32_bits(struct hart * hartptr, int index)
+{
+    uint64_t value = hartptr->fregisters[index];
+    // a single-precision value which is not properly NaN-boxed is treated as
+    // the canonical NaN.
+    if ((value & NAN_BOX32) != NAN_BOX32) {
+        return CANONICAL_NAN32;
+    }
+    return (uint32_t)value;
+}
+
+static inline float
+read_f32(struct hart * hartptr, int index)
+{
+    uint32_t bits = read_f32_bits(hartptr, index);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline double
+read_f64(struct hart * hartptr, int index)
+{
+    double value;
+    memcpy(&value, &hartptr->fregisters[index], sizeof(value));
+    return value;
+}
+
+static inline void
+write_f32_bits(struct hart * hartptr, int index, uint32_t bits)
+{
+    hartptr->fregisters[index] = NAN_BOX32 | bits;
+}
+
+// the arithmetic results are NaN-canonicalized, the host NaN is negative.
+static inline void
+write_f32(struct hart * hartptr, int index, float value)
+{
+    uint32_t bits = CANONICAL_NAN32;
+    if (!isnan(value)) {
+        memcpy(&bits, &value, sizeof(bits));
+    }
+    write_f32_bits(hartptr, index, bits);
+}
+
+static inline void
+write_f64(struct hart * hartptr, int index, double value)
+{
+    uint64_t bits = CANONICAL_NAN64;
+    if (!isnan(value)) {
+        memcpy(&bits, &value, sizeof(bits));
+    }
+    hartptr->fregisters[index] = bits;
+}
+
+static inline int
+is_signaling_nan32(uint32_t bits)
+{
+    return (bits & 0x7fc00000) == 0x7f800000 && (bits & 0x003fffff);
+}
+
+static inline int
+is_signaling_nan64(uint64_t bits)
+{
+    return (bits & 0x7ff8000000000000ULL) == 0x7ff0000000000000ULL &&
+           (bits & 0x0007ffffffffffffULL);
+}
+
+static inline float
+host_sqrt32(float value)
+{
+    float result;
+    __asm__ volatile("sqrtss %1, %0;"
+                     :"=x"(result)
+                     :"x"(value));
+    return result;
+}
+
+static inline double
+host_sqrt64(double value)
+{
+    double result;
+    __asm__ volatile("sqrtsd %1, %0;"
+                     :"=x"(result)
+                     :"x"(value));
+    return result;
+}
+
+// the instructions which carry a rounding mode in funct3, the others use the
+// field as a part of the opcode.
+static inline int
+has_rounding_mode(uint8_t operation)
+{
+    switch (operation)
+    {
+        case RISCV_OP_FMADD_S ... RISCV_OP_FSQRT_S:
+        case RISCV_OP_FCVT_W_S:
+        case RISCV_OP_FCVT_WU_S:
+        case RISCV_OP_FCVT_S_W:
+        case RISCV_OP_FCVT_S_WU:
+        case RISCV_OP_FMADD_D ... RISCV_OP_FSQRT_D:
+        case RISCV_OP_FCVT_S_D:
+        case RISCV_OP_FCVT_D_S:
+        case RISCV_OP_FCVT_W_D:
+        case RISCV_OP_FCVT_WU_D:
+        case RISCV_OP_FCVT_D_W:
+        case RISCV_OP_FCVT_D_WU:
+            return 1;
+        default:
+            break;
+    }
+    return 0;
+}
+
+// rm 5 and 6 are reserved, so are they in frm when rm is dynamic.
+static inline int
+is_reserved_rounding_mode(struct hart * hartptr, uint32_t rm)
+{
+    if (rm == FRM_DYN) {
+        rm = hartptr->frm;
+    }
+    return rm > FRM_RMM;
+}
+
+void
+fpu_raise_illegal_instruction(struct hart * hartptr)
+{
+    raise_exception_with_tvalue(hartptr, EXCEPTION_ILLEEGAL_INSTRUCTION,
+                                mmu_instruction_read32(hartptr, hartptr->pc));
+    __not_reach();
+}
+
+// fmin/fmax: a NaN operand yields the other one, -0.0 is less than +0.0.
+// single-precision operands are widened losslessly.
+static double
+fpu_min_max(double a, double b, int is_max)
+{
+    if (isnan(a)) {
+        return b;
+    }
+    if (isnan(b)) {
+        return a;
+    }
+    if (a == b) {
+        return (!!signbit(a)) ^ is_max ? a : b;
+    }
+    return (a < b) ^ is_max ? a : b;
+}
+
+static uint32_t
+fpu_classify(uint64_t bits, int exponent_bits, int mantissa_bits)
+{
+    uint64_t sign = (bits >> (exponent_bits + mantissa_bits)) & 0x1;
+    uint64_t exponent = (bits >> mantissa_bits) &
+                        ((1ULL << exponent_bits) - 1);
+    uint64_t mantissa = bits & ((1ULL << mantissa_bits) - 1);
+    if (exponent == (1ULL << exponent_bits) - 1) {
+        if (!mantissa) {
+            return sign ? (1 << 0) : (1 << 7);
+        }
+        return (mantissa >> (mantissa_bits - 1)) ? (1 << 9) : (1 << 8);
+    }
+    if (!exponent) {
+        if (!mantissa) {
+            return sign ? (1 << 3) : (1 << 4);
+        }
+        return sign ? (1 << 2) : (1 << 5);
+    }
+    return sign ? (1 << 1) : (1 << 6);
+}
+
+// fcvt.w[u].[sd]: the out-of-range and NaN inputs saturate instead of
+// yielding the host integer indefinite value. the rounding is done here, so
+// that RMM is exact too.
+static uint32_t
+fpu_to_integer(struct hart * hartptr, double value, uint32_t rm,
+               int is_unsigned)
+{
+    uint32_t mxcsr = read_mxcsr();
+    double truncated = value;
+    double rounded;
+    double diff;
+    if (rm == FRM_DYN) {
+        rm = hartptr->frm;
+    }
+    if (isnan(value)) {
+        hartptr->fflags |= FFLAGS_NV;
+        return is_unsigned ? 0xffffffff : 0x7fffffff;
+    }
+    // the values no less than 2^52 in magnitude are integral already.
+    if (value < 4503599627370496.0 && value > -4503599627370496.0) {
+        truncated = (double)(int64_t)value;
+    }
+    rounded = truncated;
+    diff = value - truncated;
+    if (diff != 0.0) {
+        switch (rm)
+        {
+            case FRM_RTZ:
+                break;
+            case FRM_RDN:
+                rounded -= diff < 0.0 ? 1.0 : 0.0;
+                break;
+            case FRM_RUP:
+                rounded += diff > 0.0 ? 1.0 : 0.0;
+                break;
+            case FRM_RMM:
+                if (diff >= 0.5 || diff <= -0.5) {
+                    rounded += diff > 0.0 ? 1.0 : -1.0;
+                }
+                break;
+            default:
+                if (diff > 0.5 || diff < -0.5 ||
+                    ((diff == 0.5 || diff == -0.5) &&
+                     (((int64_t)truncated) & 0x1))) {
+                    rounded += diff > 0.0 ? 1.0 : -1.0;
+                }
+                break;
+        }
+    }
+    // the host flags raised by the conversions above are not the guest's.
+    write_mxcsr(mxcsr);
+    if (rounded < (is_unsigned ? 0.0 : -2147483648.0)) {
+        hartptr->fflags |= FFLAGS_NV;
+        return is_unsigned ? 0 : 0x80000000;
+    }
+    if (rounded > (is_unsigned ? 4294967295.0 : 2147483647.0)) {
+        hartptr->fflags |= FFLAGS_NV;
+        return is_unsigned ? 0xffffffff : 0x7fffffff;
+    }
+    if (diff != 0.0) {
+        hartptr->fflags |= FFLAGS_NX;
+    }
+    return is_unsigned ? (uint32_t)(int64_t)rounded :
+                         (uint32_t)(int32_t)rounded;
+}
+
+void
+fpu_execute(struct hart * hartptr, struct decoded_instruction * dinstr)
+{
+    #define RS1 HART_REG(hartptr, dinstr->rs1_index)
+    #define RD HART_REG(hartptr, dinstr->rd_index)
+    #define F32(index) read_f32(hartptr, dinstr->index)
+    #define F64(index) read_f64(hartptr, dinstr->index)
+    #define RS3_INDEX (dinstr->imm >> 3)
+    #define ROUNDED(statement) {                                               \
+        uint32_t saved_mxcsr = enter_rounding_mode(dinstr->imm & 0x7);        \
+        statement;                                                             \
+        leave_rounding_mode(saved_mxcsr);                                      \
+    }
+    int rd = dinstr->rd_index;
+    if (has_rounding_mode(dinstr->operation) &&
+        is_reserved_rounding_mode(hartptr, dinstr->imm & 0x7)) {
+        fpu_raise_illegal_instruction(hartptr);
+    }
+    switch (dinstr->operation)
+    {
+        // loads and stores
+        case RISCV_OP_FLW:
+            write_f32_bits(hartptr, rd, mmu_read32(hartptr, RS1 + dinstr->imm));
+            break;
+        case RISCV_OP_FLD:
+            hartptr->fregisters[rd] = mmu_read64(hartptr, RS1 + dinstr->imm);
+            break;
+        case RISCV_OP_FSW:
+            mmu_write32(hartptr, RS1 + dinstr->imm,
+                        (uint32_t)hartptr->fregisters[dinstr->rs2_index]);
+            break;
+        case RISCV_OP_FSD:
+            mmu_write64(hartptr, RS1 + dinstr->imm,
+                        hartptr->fregisters[dinstr->rs2_index]);
+            break;
+
+        // single-precision
+        case RISCV_OP_FMADD_S:
+            ROUNDED(write_f32(hartptr, rd, fmaf(F32(rs1_index), F32(rs2_index),
+                                                read_f32(hartptr, RS3_INDEX))));
+            break;
+        case RISCV_OP_FMSUB_S:
+            ROUNDED(write_f32(hartptr, rd, fmaf(F32(rs1_index), F32(rs2_index),
+                                                -read_f32(hartptr, RS3_INDEX))));
+            break;
+        case RISCV_OP_FNMSUB_S:
+            ROUNDED(write_f32(hartptr, rd, fmaf(-F32(rs1_index), F32(rs2_index),
+                                                read_f32(hartptr, RS3_INDEX))));
+            break;
+        case RISCV_OP_FNMADD_S:
+            ROUNDED(write_f32(hartptr, rd, fmaf(-F32(rs1_index), F32(rs2_index),
+                                                -read_f32(hartptr, RS3_INDEX))));
+            break;
+        case RISCV_OP_FADD_S:
+            ROUNDED(write_f32(hartptr, rd, F32(rs1_index) + F32(rs2_index)));
+            break;
+        case RISCV_OP_FSUB_S:
+            ROUNDED(write_f32(hartptr, rd, F32(rs1_index) - F32(rs2_index)));
+            break;
+        case RISCV_OP_FMUL_S:
+            ROUNDED(write_f32(hartptr, rd, F32(rs1_index) * F32(rs2_index)));
+            break;
+        case RISCV_OP_FDIV_S:
+            ROUNDED(write_f32(hartptr, rd, F32(rs1_index) / F32(rs2_index)));
+            break;
+        case RISCV_OP_FSQRT_S:
+            ROUNDED(write_f32(hartptr, rd, host_sqrt32(F32(rs1_index))));
+            break;
+        case RISCV_OP_FSGNJ_S:
+            write_f32_bits(hartptr, rd,
+                (read_f32_bits(hartptr, dinstr->rs1_index) & 0x7fffffff) |
+                (read_f32_bits(hartptr, dinstr->rs2_index) & 0x80000000));
+            break;
+        case RISCV_OP_FSGNJN_S:
+            write_f32_bits(hartptr, rd,
+                (read_f32_bits(hartptr, dinstr->rs1_index) & 0x7fffffff) |
+                (~read_f32_bits(hartptr, dinstr->rs2_index) & 0x80000000));
+            break;
+        case RISCV_OP_FSGNJX_S:
+            write_f32_bits(hartptr, rd,
+                read_f32_bits(hartptr, dinstr->rs1_index) ^
+                (read_f32_bits(hartptr, dinstr->rs2_index) & 0x80000000));
+            break;
+        case RISCV_OP_FMIN_S:
+        case RISCV_OP_FMAX_S:
+            if (is_signaling_nan32(read_f32_bits(hartptr, dinstr->rs1_index)) ||
+                is_signaling_nan32(read_f32_bits(hartptr, dinstr->rs2_index))) {
+                hartptr->fflags |= FFLAGS_NV;
+            }
+            write_f32(hartptr, rd, fpu_min_max(F32(rs1_index), F32(rs2_index),
+                                               dinstr->operation ==
+                                               RISCV_OP_FMAX_S));
+            break;
+        case RISCV_OP_FCVT_W_S:
+            RD = fpu_to_integer(hartptr, F32(rs1_index), dinstr->imm, 0);
+            break;
+        case RISCV_OP_FCVT_WU_S:
+            RD = fpu_to_integer(hartptr, F32(rs1_index), dinstr->imm, 1);
+            break;
+        case RISCV_OP_FMV_X_W:
+            RD = (uint32_t)hartptr->fregisters[dinstr->rs1_index];
+            break;
+        case RISCV_OP_FEQ_S:
+            // a quiet comparison, the host raises invalid on signaling NaNs
+            // only.
+            RD = F32(rs1_index) == F32(rs2_index);
+            break;
+        case RISCV_OP_FLT_S:
+        case RISCV_OP_FLE_S:
+            {
+                float a = F32(rs1_index);
+                float b = F32(rs2_index);
+                if (isnan(a) || isnan(b)) {
+                    hartptr->fflags |= FFLAGS_NV;
+                    RD = 0;
+                } else {
+                    RD = dinstr->operation == RISCV_OP_FLT_S ? a < b : a <= b;
+                }
+            }
+            break;
+        case RISCV_OP_FCLASS_S:
+            RD = fpu_classify(read_f32_bits(hartptr, dinstr->rs1_index), 8, 23);
+            break;
+        case RISCV_OP_FCVT_S_W:
+            ROUNDED(write_f32(hartptr, rd, (float)(int32_t)RS1));
+            break;
+        case RISCV_OP_FCVT_S_WU:
+            ROUNDED(write_f32(hartptr, rd, (float)RS1));
+            break;
+        case RISCV_OP_FMV_W_X:
+            write_f32_bits(hartptr, rd, RS1);
+            break;
+
+        // double-precision
+        case RISCV_OP_FMADD_D:
+            ROUNDED(write_f64(hartptr, rd, fma(F64(rs1_index), F64(rs2_index),
+                                               read_f64(hartptr, RS3_INDEX))));
+            break;
+        case RISCV_OP_FMSUB_D:
+            ROUNDED(write_f64(hartptr, rd, fma(F64(rs1_index), F64(rs2_index),
+                                               -read_f64(hartptr, RS3_INDEX))));
+            break;
+        case RISCV_OP_FNMSUB_D:
+            ROUNDED(write_f64(hartptr, rd, fma(-F64(rs1_index), F64(rs2_index),
+                                               read_f64(hartptr, RS3_INDEX))));
+            break;
+        case RISCV_OP_FNMADD_D:
+            ROUNDED(write_f64(hartptr, rd, fma(-F64(rs1_index), F64(rs2_index),
+                                               -read_f64(hartptr, RS3_INDEX))));
+            break;
+        case RISCV_OP_FADD_D:
+            ROUNDED(write_f64(hartptr, rd, F64(rs1_index) + F64(rs2_index)));
+            break;
+        case RISCV_OP_FSUB_D:
+            ROUNDED(write_f64(hartptr, rd, F64(rs1_index) - F64(rs2_index)));
+            break;
+        case RISCV_OP_FMUL_D:
+            ROUNDED(write_f64(hartptr, rd, F64(rs1_index) * F64(rs2_index)));
+            break;
+        case RISCV_OP_FDIV_D:
+            ROUNDED(write_f64(hartptr, rd, F64(rs1_index) / F64(rs2_index)));
+            break;
+        case RISCV_OP_FSQRT_D:
+            ROUNDED(write_f64(hartptr, rd, host_sqrt64(F64(rs1_index))));
+            break;
+        case RISCV_OP_FSGNJ_D:
+            hartptr->fregisters[rd] =
+                (hartptr->fregisters[dinstr->rs1_index] & ~(1ULL << 63)) |
+                (hartptr->fregisters[dinstr->rs2_index] & (1ULL << 63));
+            break;
+        case RISCV_OP_FSGNJN_D:
+            hartptr->fregisters[rd] =
+                (hartptr->fregisters[dinstr->rs1_index] & ~(1ULL << 63)) |
+                (~hartptr->fregisters[dinstr->rs2_index] & (1ULL << 63));
+            break;
+        case RISCV_OP_FSGNJX_D:
+            hartptr->fregisters[rd] =
+                hartptr->fregisters[dinstr->rs1_index] ^
+                (hartptr->fregisters[dinstr->rs2_index] & (1ULL << 63));
+            break;
+        case RISCV_OP_FMIN_D:
+        case RISCV_OP_FMAX_D:
+            if (is_signaling_nan64(hartptr->fregisters[dinstr->rs1_index]) ||
+                is_signaling_nan64(hartptr->fregisters[dinstr->rs2_index])) {
+                hartptr->fflags |= FFLAGS_NV;
+            }
+            write_f64(hartptr, rd, fpu_min_max(F64(rs1_index), F64(rs2_index),
+                                               dinstr->operation ==
+                                               RISCV_OP_FMAX_D));
+            break;
+        case RISCV_OP_FCVT_S_D:
+            ROUNDED(write_f32(hartptr, rd, (float)F64(rs1_index)));
+            break;
+        case RISCV_OP_FCVT_D_S:
+            write_f64(hartptr, rd, (double)F32(rs1_index));
+            break;
+        case RISCV_OP_FEQ_D:
+            if (is_signaling_nan64(hartptr->fregisters[dinstr->rs1_index]) ||
+                is_signaling_nan64(hartptr->fregisters[dinstr->rs2_index])) {
+                hartptr->fflags |= FFLAGS_NV;
+            }
+            RD = F64(rs1_index) == F64(rs2_index);
+            break;
+        case RISCV_OP_FLT_D:
+        case RISCV_OP_FLE_D:
+            {
+                double a = F64(rs1_index);
+                double b = F64(rs2_index);
+                if (isnan(a) || isnan(b)) {
+                    hartptr->fflags |= FFLAGS_NV;
+                    RD = 0;
+                } else {
+                    RD = dinstr->operation == RISCV_OP_FLT_D ? a < b : a <= b;
+                }
+            }
+            break;
+        case RISCV_OP_FCLASS_D:
+            RD = fpu_classify(hartptr->fregisters[dinstr->rs1_index], 11, 52);
+            break;
+        case RISCV_OP_FCVT_W_D:
+            RD = fpu_to_integer(hartptr, F64(rs1_index), dinstr->imm, 0);
+            break;
+        case RISCV_OP_FCVT_WU_D:
+            RD = fpu_to_integer(hartptr, F64(rs1_index), dinstr->imm, 1);
+            break;
+        case RISCV_OP_FCVT_D_W:
+            write_f64(hartptr, rd, (double)(int32_t)RS1);
+            break;
+        case RISCV_OP_FCVT_D_WU:
+            write_f64(hartptr, rd, (double)RS1);
+            break;
+        default:
+            __not_reach();
+            break;
+    }
+    HART_REG(hartptr, 0) = 0;
+    #undef ROUNDED
+    #undef RS3_INDEX
+    #undef F64
+    #undef F32
+    #undef RD
+    #undef RS1
+}
+
+static uint32_t
+csr_fflags_read(struct hart * hartptr, struct csr_entry * csr)
+{
+    fpu_sync_flags(hartptr);
+    return hartptr->fflags;
+}
+
+static void
+csr_fflags_write(struct hart * hartptr, struct csr_entry * csr, uint32_t value)
+{
+    // the pending host flags are discarded along with the old ones.
+    fpu_sync_flags(hartptr);
+    hartptr->fflags = value & 0x1f;
+}
+
+static uint32_t
+csr_frm_read(struct hart * hartptr, struct csr_entry * csr)
+{
+    return hartptr->frm;
+}
+
+static void
+csr_frm_write(struct hart * hartptr, struct csr_entry * csr, uint32_t value)
+{
+    fpu_sync_flags(hartptr);
+    hartptr->frm = value & 0x7;
+    fpu_load_state(hartptr);
+}
+
+static uint32_t
+csr_fcsr_read(struct hart * hartptr, struct csr_entry * csr)
+{
+    fpu_sync_flags(hartptr);
+    return (hartptr->frm << 5) | hartptr->fflags;
+}
+
+static void
+csr_fcsr_write(struct hart * hartptr, struct csr_entry * csr, uint32_t value)
+{
+    fpu_sync_flags(hartptr);
+    hartptr->fflags = value & 0x1f;
+    hartptr->frm = (value >> 5) & 0x7;
+    fpu_load_state(hartptr);
+}
+
+static struct csr_registery_entry fflags_csr_entry = {
+    .csr_addr = CSR_ADDRESS_FFLAGS,
+    .csr_registery = {
+        .wpri_mask = 0x1f,
+        .read = csr_fflags_read,
+        .write = csr_fflags_write
+    }
+};
+
+static struct csr_registery_entry frm_csr_entry = {
+    .csr_addr = CSR_ADDRESS_FRM,
+    .csr_registery = {
+        .wpri_mask = 0x7,
+        .read = csr_frm_read,
+        .write = csr_frm_write
+    }
+};
+
+static struct csr_registery_entry fcsr_csr_entry = {
+    .csr_addr = CSR_ADDRESS_FCSR,
+    .csr_registery = {
+        .wpri_mask = 0xff,
+        .read = csr_fcsr_read,
+        .write = csr_fcsr_write
+    }
+};
+
+__attribute__((constructor)) static void
+hart_fpu_init(void)
+{
+    register_unprivileged_csr_entry(&fflags_csr_entry);
+    register_unprivileged_csr_entry(&frm_csr_entry);
+    register_unprivileged_csr_entry(&fcsr_csr_entry);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      The F and D extensions: the floating-point state of a hart and the
+ *      reference semantics of the floating-point instructions.
+ */
+
+#ifndef _HART_FPU_H
+#define _HART_FPU_H
+#include <hart.h>
+#include <decoder.h>
+
+// fflags
+#define FFLAGS_NX               0x01
+#define FFLAGS_UF               0x02
+#define FFLAGS_OF               0x04
+#define FFLAGS_DZ               0x08
+#define FFLAGS_NV               0x10
+
+// rounding modes
+#define FRM_RNE                 0x0
+#define FRM_RTZ                 0x1
+#define FRM_RDN                 0x2
+#define FRM_RUP                 0x3
+#define FRM_RMM                 0x4
+#define FRM_DYN                 0x7
+
+#define CANONICAL_NAN32         0x7fc00000
+#define CANONICAL_NAN64         0x7ff8000000000000ULL
+#define NAN_BOX32               0xffffffff00000000ULL
+
+// fold the exception flags raised by the host into the hart.
+void
+fpu_sync_flags(struct hart * hartptr);
+
+// the host MXCSR takes the rounding mode of the hart, its flags are cleared.
+void
+fpu_load_state(struct hart * hartptr);
+
+// the initial state of a new program image: the registers are zeroed and so is
+// fcsr, run by the calling host cpu.
+void
+fpu_reset_state(struct hart * hartptr);
+
+// raise the illegal instruction exception for the instruction at pc, it's for
+// a reserved rounding mode.
+void
+fpu_raise_illegal_instruction(struct hart * hartptr);
+
+// execute any F/D instruction, this is the interpreter tier of them and the
+// slow path of the translated ones.
+void
+fpu_execute(struct hart * hartptr, struct decoded_instruction * dinstr);
+
+#endif
@@ -3,6 +3,7 @@
  */
 #include <hart_trap.h>
 #include <csr.h>
+#include <vmm_smp.h>
 
 static void
 setup_mmode_trap(struct hart * hartptr, uint32_t cause, uint32_t tval)
@@ -87,6 +88,7 @@ extern void vmm_entry_point(void);
 static void
 do_trap(struct hart * hartptr)
 {
+    vmm_return_to_guest();
     __asm__ volatile("movq %%rax, %%r15;"
                      "movq %%rbx, %%r14;"
                      "movq %%rcx, %%r13;"
@@ -124,9 +126,10 @@ raise_trap_raw(struct hart * hartptr, uint8_t target_privilege_level,
               target_privilege_level, cause, tval,
               previous_pc, previous_pl,
               hartptr->pc, hartptr->privilege_level);
-    // XXX: when trap is taken, the addressing manner may chnage, so
-    // the translation cache must be flushed.
-    flush_translation_cache(hartptr);
+    // XXX: when trap is taken, the addressing manner may chnage, the
+    // translations are tagged with the privilege level and the address space,
+    // so the translation cache doesn't have to be flushed.
+    flush_dispatch_cache(hartptr);
     do_trap(hartptr);
 }
 
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      High-level emulation of guest libc routines. the routines are found
+ *      by name in the symbol table of the program, a call to one of them is
+ *      carried out by the host libc which works on the host pointers of the
+ *      guest memory, the host libc picks its best vectorized version.
+ */
+
+#include <hle.h>
+#include <vm.h>
+#include <util.h>
+#include <log.h>
+#include <mmu.h>
+#include <string.h>
+#include <stdlib.h>
+
+static const char * hle_routine_names[HLE_ROUTINE_MAX] = {
+    [HLE_MEMCPY] = "memcpy",
+    [HLE_MEMMOVE] = "memmove",
+    [HLE_MEMSET] = "memset",
+    [HLE_STRLEN] = "strlen",
+    [HLE_STRCMP] = "strcmp",
+    [HLE_MEMCMP] = "memcmp",
+    [HLE_MEMCHR] = "memchr",
+};
+
+static void
+hle_resolve_symbols(struct virtual_machine * vm, int fd,
+                    const struct elf32_elf_header * elf_hdr,
+                    const struct elf32_section_header * symtab_hdr)
+{
+    struct elf32_section_header strtab_hdr;
+    if (!symtab_hdr->sh_size ||
+        elf_section_header(fd, elf_hdr, &strtab_hdr, symtab_hdr->sh_link)) {
+        return;
+    }
+    struct elf32_symbol * symbols = malloc(symtab_hdr->sh_size);
+    char * strings = malloc(strtab_hdr.sh_size + 1);
+    ASSERT(symbols && strings);
+    if (elf_read(fd, symbols, symtab_hdr->sh_offset, symtab_hdr->sh_size) ||
+        elf_read(fd, strings, strtab_hdr.sh_offset, strtab_hdr.sh_size)) {
+        goto out;
+    }
+    strings[strtab_hdr.sh_size] = '\0';
+    int nr_symbols = symtab_hdr->sh_size / sizeof(struct elf32_symbol);
+    int index = 0;
+    for (; index < nr_symbols; index++) {
+        // NOTE: an indirect function symbol points to the resolver, only the
+        // plain functions are taken.
+        if (SYMBOL_TYPE(symbols[index].st_info) != SYMBOL_TYPE_FUNC ||
+            symbols[index].st_shndx == SYMBOL_SECTION_UNDEFINED ||
+            !symbols[index].st_value ||
+            symbols[index].st_name >= strtab_hdr.sh_size) {
+            continue;
+        }
+        const char * name = strings + symbols[index].st_name;
+        int routine = 0;
+        for (; routine < HLE_ROUTINE_MAX; routine++) {
+            if (!strcmp(name, hle_routine_names[routine])) {
+                vm->hle_entries[routine] = symbols[index].st_value;
+                log_debug("emulating %s at 0x%x\n", name,
+                          symbols[index].st_value);
+            }
+        }
+    }
+    out:
+        free(symbols);
+        free(strings);
+}
+
+void
+hle_init(struct virtual_machine * vm, int fd,
+         const struct elf32_elf_header * elf_hdr)
+{
+    memset(vm->hle_entries, 0x0, sizeof(vm->hle_entries));
+    int index = 0;
+    for (; index < elf_hdr->e_shnum; index++) {
+        struct elf32_section_header sect_hdr;
+        if (elf_section_header(fd, elf_hdr, &sect_hdr, index)) {
+            break;
+        }
+        if (sect_hdr.sh_type == SECTION_TYPE_SYMTAB) {
+            hle_resolve_symbols(vm, fd, elf_hdr, &sect_hdr);
+            break;
+        }
+    }
+}
+
+int
+hle_lookup(struct hart * hartptr, uint32_t guest_pc)
+{
+    struct virtual_machine * vm = get_linked_vm(hartptr->native_vmptr,
+                                                LINKAGE_HINT_VM);
+    // an entry of zero is a routine which is not resolved.
+    if (!guest_pc) {
+        return -1;
+    }
+    int routine = 0;
+    for (; routine < HLE_ROUTINE_MAX; routine++) {
+        if (vm->hle_entries[routine] == guest_pc) {
+            return routine;
+        }
+    }
+    return -1;
+}
+
+// the host pointer of the NUL-terminated guest string, its length is stored.
+static const char *
+guest_string_pointer(struct hart * hartptr, uint32_t addr, uint32_t * len)
+{
+    struct virtual_machine * vm = get_linked_vm(hartptr->native_vmptr,
+                                                LINKAGE_HINT_VM);
+    struct pm_region_operation * pmr = search_pm_region_callback(vm, addr);
+    if (!pmr || !pmr->pmr_direct) {
+        return NULL;
+    }
+    const char * str = pmr->pmr_direct(addr, hartptr, pmr);
+    const char * nul = memchr(str, '\0', pmr->addr_high - addr);
+    if (!nul) {
+        return NULL;
+    }
+    *len = nul - str;
+    return mmu_direct_range(hartptr, addr, *len + 1, 0) ? str : NULL;
+}
+
+int
+hle_call(struct hart * hartptr, int routine)
+{
+    uint32_t a0 = hartptr->registers.a0;
+    uint32_t a1 = hartptr->registers.a1;
+    uint32_t a2 = hartptr->registers.a2;
+    uint32_t result = a0;
+    switch (routine)
+    {
+        case HLE_MEMCPY:
+        case HLE_MEMMOVE:
+            if (a2) {
+                void * dst = mmu_direct_range(hartptr, a0, a2, 1);
+                void * src = mmu_direct_range(hartptr, a1, a2, 0);
+                if (!dst || !src) {
+                    return 0;
+                }
+                // XXX: overlapping memcpy is undefined, it behaves as memmove.
+                memmove(dst, src, a2);
+            }
+            break;
+        case HLE_MEMSET:
+            if (a2) {
+                void * dst = mmu_direct_range(hartptr, a0, a2, 1);
+                if (!dst) {
+                    return 0;
+                }
+                memset(dst, a1 & 0xff, a2);
+            }
+            break;
+        case HLE_STRLEN:
+            if (!guest_string_pointer(hartptr, a0, &result)) {
+                return 0;
+            }
+            break;
+        case HLE_STRCMP:
+            {
+                uint32_t len0 = 0;
+                uint32_t len1 = 0;
+                const char * str0 = guest_string_pointer(hartptr, a0, &len0);
+                const char * str1 = guest_string_pointer(hartptr, a1, &len1);
+                if (!str0 || !str1) {
+                    return 0;
+                }
+                int diff = strcmp(str0, str1);
+                result = (diff > 0) - (diff < 0);
+            }
+            break;
+        case HLE_MEMCMP:
+            result = 0;
+            if (a2) {
+                void * ptr0 = mmu_direct_range(hartptr, a0, a2, 0);
+                void * ptr1 = mmu_direct_range(hartptr, a1, a2, 0);
+                if (!ptr0 || !ptr1) {
+                    return 0;
+                }
+                int diff = memcmp(ptr0, ptr1, a2);
+                result = (diff > 0) - (diff < 0);
+            }
+            break;
+        case HLE_MEMCHR:
+            result = 0;
+            if (a2) {
+                uint8_t * ptr = mmu_direct_range(hartptr, a0, a2, 0);
+                if (!ptr) {
+                    return 0;
+                }
+                uint8_t * found = memchr(ptr, a1 & 0xff, a2);
+                result = found ? a0 + (uint32_t)(found - ptr) : 0;
+            }
+            break;
+        default:
+            return 0;
+    }
+    hartptr->registers.a0 = result;
+    hartptr->pc = hartptr->registers.ra;
+    return 1;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      High-level emulation of guest libc routines: the calls to well-known
+ *      memory and string routines of a statically linked guest are carried
+ *      out by their host counterparts instead of translated byte loops.
+ */
+
+#ifndef _HLE_H
+#define _HLE_H
+#include <stdint.h>
+#include <elf.h>
+
+enum hle_routine {
+    HLE_MEMCPY = 0,
+    HLE_MEMMOVE,
+    HLE_MEMSET,
+    HLE_STRLEN,
+    HLE_STRCMP,
+    HLE_MEMCMP,
+    HLE_MEMCHR,
+    HLE_ROUTINE_MAX
+};
+
+struct hart;
+struct virtual_machine;
+struct decoded_instruction;
+struct prefetch_blob;
+
+// look the routines up in the symbol table of the program, the entries of the
+// address space are reset first.
+void
+hle_init(struct virtual_machine * vm, int fd,
+         const struct elf32_elf_header * elf_hdr);
+
+// @return the routine whose entry is at guest pc, -1 is returned if none.
+int
+hle_lookup(struct hart * hartptr, uint32_t guest_pc);
+
+// carry out the routine on behalf of the guest and return to the caller.
+// @return zero if the arguments are not eligible, e.g. a range crosses memory
+// regions, the guest code must be executed then.
+int
+hle_call(struct hart * hartptr, int routine);
+
+// the routine entry in the translation cache, see translate_hle.c
+void
+riscv_hle_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob, int routine);
+
+#endif
@@ -0,0 +1,557 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ */
+
+#include <interpreter.h>
+#include <decoder.h>
+#include <translation.h>
+#include <syscall.h>
+#include <debug.h>
+#include <mmu.h>
+#include <csr.h>
+#include <hart_fpu.h>
+#include <hle.h>
+#include <spin_wait.h>
+#include <util.h>
+#include <log.h>
+#include <string.h>
+#include <stdio.h>
+
+struct interp_block {
+    uint32_t guest_pc;
+    // see translation_context()
+    uint32_t context;
+    uint16_t nr_instructions;
+    uint16_t is_valid;
+    uint32_t execution_count;
+    // whether any instruction of the block is a breakpoint, it's decided at
+    // decoding time like the translated breakpoint prologue.
+    uint32_t has_breakpoint;
+    // the emulated routine whose entry the block is, -1 if none. see hle.h
+    int32_t hle_routine;
+    struct decoded_instruction instructions[INTERPRETER_MAX_BLOCK_INSTRUCTIONS];
+};
+
+void
+amo_instruction_slowpath(struct hart * hartptr, uint8_t rs1_index,
+                         uint8_t rs2_index, uint8_t rd_index, uint32_t funct5);
+
+// the terminators are exactly the same as those which stop a translation unit.
+static inline int
+is_block_terminator(uint8_t operation)
+{
+    return (operation >= RISCV_OP_JAL && operation <= RISCV_OP_BGEU) ||
+           (operation >= RISCV_OP_FENCE_I && operation <= RISCV_OP_CSRRCI) ||
+           operation == RISCV_OP_ILLEGAL;
+}
+
+static void
+decode_block(struct hart * hartptr, struct interp_block * block,
+             uint32_t guest_pc)
+{
+    uint32_t pc = guest_pc;
+    block->guest_pc = guest_pc;
+    block->context = translation_context(hartptr);
+    block->nr_instructions = 0;
+    block->execution_count = 0;
+    block->is_valid = 1;
+    block->has_breakpoint = 0;
+    block->hle_routine = hle_lookup(hartptr, guest_pc);
+    while (block->nr_instructions < INTERPRETER_MAX_BLOCK_INSTRUCTIONS) {
+        struct decoded_instruction * dinstr =
+            &block->instructions[block->nr_instructions++];
+        fetch_decoded_instruction(hartptr, pc, dinstr);
+#if defined(NATIVE_DEBUGER)
+        block->has_breakpoint |= is_address_breakpoint(pc);
+#endif
+        if (is_block_terminator(dinstr->operation)) {
+            break;
+        }
+        pc += dinstr->length;
+    }
+}
+
+static void
+interpret_block(struct hart * hartptr, struct interp_block * block)
+{
+    // NOTE: the instructions which are not supported by the interpreter are
+    // not necessarily illegal, they complain only when executed.
+    static void * dispatch_table[RISCV_OP_MAX] = {
+        [0 ... RISCV_OP_MAX - 1] = &&op_illegal,
+        [RISCV_OP_LUI] = &&op_lui,
+        [RISCV_OP_AUIPC] = &&op_auipc,
+        [RISCV_OP_JAL] = &&op_jal,
+        [RISCV_OP_JALR] = &&op_jalr,
+        [RISCV_OP_BEQ] = &&op_beq,
+        [RISCV_OP_BNE] = &&op_bne,
+        [RISCV_OP_BLT] = &&op_blt,
+        [RISCV_OP_BGE] = &&op_bge,
+        [RISCV_OP_BLTU] = &&op_bltu,
+        [RISCV_OP_BGEU] = &&op_bgeu,
+        [RISCV_OP_LB] = &&op_lb,
+        [RISCV_OP_LH] = &&op_lh,
+        [RISCV_OP_LW] = &&op_lw,
+        [RISCV_OP_LBU] = &&op_lbu,
+        [RISCV_OP_LHU] = &&op_lhu,
+        [RISCV_OP_SB] = &&op_sb,
+        [RISCV_OP_SH] = &&op_sh,
+        [RISCV_OP_SW] = &&op_sw,
+        [RISCV_OP_ADDI] = &&op_addi,
+        [RISCV_OP_SLTI] = &&op_slti,
+        [RISCV_OP_SLTIU] = &&op_sltiu,
+        [RISCV_OP_XORI] = &&op_xori,
+        [RISCV_OP_ORI] = &&op_ori,
+        [RISCV_OP_ANDI] = &&op_andi,
+        [RISCV_OP_SLLI] = &&op_slli,
+        [RISCV_OP_SRLI] = &&op_srli,
+        [RISCV_OP_SRAI] = &&op_srai,
+        [RISCV_OP_ADD] = &&op_add,
+        [RISCV_OP_SUB] = &&op_sub,
+        [RISCV_OP_SLL] = &&op_sll,
+        [RISCV_OP_SLT] = &&op_slt,
+        [RISCV_OP_SLTU] = &&op_sltu,
+        [RISCV_OP_XOR] = &&op_xor,
+        [RISCV_OP_SRL] = &&op_srl,
+        [RISCV_OP_SRA] = &&op_sra,
+        [RISCV_OP_OR] = &&op_or,
+        [RISCV_OP_AND] = &&op_and,
+        [RISCV_OP_MUL] = &&op_mul,
+        [RISCV_OP_MULH] = &&op_mulh,
+        [RISCV_OP_MULHSU] = &&op_mulhsu,
+        [RISCV_OP_MULHU] = &&op_mulhu,
+        [RISCV_OP_DIV] = &&op_div,
+        [RISCV_OP_DIVU] = &&op_divu,
+        [RISCV_OP_REM] = &&op_rem,
+        [RISCV_OP_REMU] = &&op_remu,
+        [RISCV_OP_FENCE] = &&op_fence,
+        [RISCV_OP_FENCE_I] = &&op_fence_i,
+        [RISCV_OP_PAUSE] = &&op_pause,
+        [RISCV_OP_ECALL] = &&op_ecall,
+        [RISCV_OP_LR_W] = &&op_amo,
+        [RISCV_OP_SC_W] = &&op_amo,
+        [RISCV_OP_AMOSWAP_W] = &&op_amo,
+        [RISCV_OP_AMOADD_W] = &&op_amo,
+        [RISCV_OP_AMOXOR_W] = &&op_amo,
+        [RISCV_OP_AMOAND_W] = &&op_amo,
+        [RISCV_OP_AMOOR_W] = &&op_amo,
+        [RISCV_OP_AMOMAXU_W] = &&op_amo,
+        [RISCV_OP_CSRRW] = &&op_csr,
+        [RISCV_OP_CSRRS] = &&op_csr,
+        [RISCV_OP_CSRRC] = &&op_csr,
+        [RISCV_OP_CSRRWI] = &&op_csr,
+        [RISCV_OP_CSRRSI] = &&op_csr,
+        [RISCV_OP_CSRRCI] = &&op_csr,
+        [RISCV_OP_SH1ADD] = &&op_sh1add,
+        [RISCV_OP_SH2ADD] = &&op_sh2add,
+        [RISCV_OP_SH3ADD] = &&op_sh3add,
+        [RISCV_OP_ANDN] = &&op_andn,
+        [RISCV_OP_ORN] = &&op_orn,
+        [RISCV_OP_XNOR] = &&op_xnor,
+        [RISCV_OP_CLZ] = &&op_clz,
+        [RISCV_OP_CTZ] = &&op_ctz,
+        [RISCV_OP_CPOP] = &&op_cpop,
+        [RISCV_OP_MINS] = &&op_mins,
+        [RISCV_OP_MINU] = &&op_minu,
+        [RISCV_OP_MAXS] = &&op_maxs,
+        [RISCV_OP_MAXU] = &&op_maxu,
+        [RISCV_OP_SEXT_B] = &&op_sext_b,
+        [RISCV_OP_SEXT_H] = &&op_sext_h,
+        [RISCV_OP_ZEXT_H] = &&op_zext_h,
+        [RISCV_OP_ROL] = &&op_rol,
+        [RISCV_OP_ROR] = &&op_ror,
+        [RISCV_OP_RORI] = &&op_rori,
+        [RISCV_OP_ORC_B] = &&op_orc_b,
+        [RISCV_OP_REV8] = &&op_rev8,
+        [RISCV_OP_FLW ... RISCV_OP_FCVT_D_WU] = &&op_fp
+    };
+    uint32_t * regs = (uint32_t *)&hartptr->registers;
+    struct decoded_instruction * insn = block->instructions;
+    struct decoded_instruction * insn_end = insn + block->nr_instructions;
+
+#if defined(NATIVE_DEBUGER)
+    #define DISPATCH() {                                                       \
+        if (block->has_breakpoint) {                                           \
+            check_breakpoint(hartptr);                                         \
+        }                                                                      \
+        goto *dispatch_table[insn->operation];                                 \
+    }
+#else
+    #define DISPATCH()                                                         \
+        goto *dispatch_table[insn->operation]
+#endif
+    // the pc is always kept up to date, because the callee(e.g. clone) may
+    // rely on it.
+    #define NEXT_INSTRUCTION() {                                               \
+        regs[0] = 0;                                                           \
+        hartptr->pc += insn->length;                                           \
+        if (++insn == insn_end) {                                              \
+            return;                                                            \
+        }                                                                      \
+        DISPATCH();                                                            \
+    }
+    #define RS1 regs[insn->rs1_index]
+    #define RS2 regs[insn->rs2_index]
+    #define RD regs[insn->rd_index]
+    #define BRANCH_IF(cond) {                                                  \
+        hartptr->pc += (cond) ? insn->imm : insn->length;                      \
+        return;                                                                \
+    }
+
+    DISPATCH();
+op_lui:
+    RD = insn->imm;
+    NEXT_INSTRUCTION();
+op_auipc:
+    RD = hartptr->pc + insn->imm;
+    NEXT_INSTRUCTION();
+op_jal:
+    RD = hartptr->pc + insn->length;
+    regs[0] = 0;
+    hartptr->pc += insn->imm;
+    return;
+op_jalr: {
+        uint32_t target = (RS1 + insn->imm) & ~1;
+        RD = hartptr->pc + insn->length;
+        regs[0] = 0;
+        hartptr->pc = target;
+        return;
+    }
+op_beq:
+    BRANCH_IF(RS1 == RS2);
+op_bne:
+    BRANCH_IF(RS1 != RS2);
+op_blt:
+    BRANCH_IF((int32_t)RS1 < (int32_t)RS2);
+op_bge:
+    BRANCH_IF((int32_t)RS1 >= (int32_t)RS2);
+op_bltu:
+    BRANCH_IF(RS1 < RS2);
+op_bgeu:
+    BRANCH_IF(RS1 >= RS2);
+op_lb:
+    RD = (int32_t)(int8_t)mmu_read8(hartptr, RS1 + insn->imm);
+    NEXT_INSTRUCTION();
+op_lh:
+    RD = (int32_t)(int16_t)mmu_read16(hartptr, RS1 + insn->imm);
+    NEXT_INSTRUCTION();
+op_lw:
+    RD = mmu_read32(hartptr, RS1 + insn->imm);
+    NEXT_INSTRUCTION();
+op_lbu:
+    RD = mmu_read8(hartptr, RS1 + insn->imm);
+    NEXT_INSTRUCTION();
+op_lhu:
+    RD = mmu_read16(hartptr, RS1 + insn->imm);
+    NEXT_INSTRUCTION();
+op_sb:
+    mmu_write8(hartptr, RS1 + insn->imm, RS2);
+    NEXT_INSTRUCTION();
+op_sh:
+    mmu_write16(hartptr, RS1 + insn->imm, RS2);
+    NEXT_INSTRUCTION();
+op_sw:
+    mmu_write32(hartptr, RS1 + insn->imm, RS2);
+    NEXT_INSTRUCTION();
+op_addi:
+    RD = RS1 + insn->imm;
+    NEXT_INSTRUCTION();
+op_slti:
+    RD = (int32_t)RS1 < insn->imm;
+    NEXT_INSTRUCTION();
+op_sltiu:
+    RD = RS1 < (uint32_t)insn->imm;
+    NEXT_INSTRUCTION();
+op_xori:
+    RD = RS1 ^ insn->imm;
+    NEXT_INSTRUCTION();
+op_ori:
+    RD = RS1 | insn->imm;
+    NEXT_INSTRUCTION();
+op_andi:
+    RD = RS1 & insn->imm;
+    NEXT_INSTRUCTION();
+op_slli:
+    RD = RS1 << insn->imm;
+    NEXT_INSTRUCTION();
+op_srli:
+    RD = RS1 >> insn->imm;
+    NEXT_INSTRUCTION();
+op_srai:
+    RD = (int32_t)RS1 >> insn->imm;
+    NEXT_INSTRUCTION();
+op_add:
+    RD = RS1 + RS2;
+    NEXT_INSTRUCTION();
+op_sub:
+    RD = RS1 - RS2;
+    NEXT_INSTRUCTION();
+op_sll:
+    RD = RS1 << (RS2 & 0x1f);
+    NEXT_INSTRUCTION();
+op_slt:
+    RD = (int32_t)RS1 < (int32_t)RS2;
+    NEXT_INSTRUCTION();
+op_sltu:
+    RD = RS1 < RS2;
+    NEXT_INSTRUCTION();
+op_xor:
+    RD = RS1 ^ RS2;
+    NEXT_INSTRUCTION();
+op_srl:
+    RD = RS1 >> (RS2 & 0x1f);
+    NEXT_INSTRUCTION();
+op_sra:
+    RD = (int32_t)RS1 >> (RS2 & 0x1f);
+    NEXT_INSTRUCTION();
+op_or:
+    RD = RS1 | RS2;
+    NEXT_INSTRUCTION();
+op_and:
+    RD = RS1 & RS2;
+    NEXT_INSTRUCTION();
+op_mul:
+    RD = RS1 * RS2;
+    NEXT_INSTRUCTION();
+op_mulh:
+    RD = ((int64_t)(int32_t)RS1 * (int64_t)(int32_t)RS2) >> 32;
+    NEXT_INSTRUCTION();
+op_mulhsu:
+    RD = ((int64_t)(int32_t)RS1 * (int64_t)(uint64_t)RS2) >> 32;
+    NEXT_INSTRUCTION();
+op_mulhu:
+    RD = ((uint64_t)RS1 * (uint64_t)RS2) >> 32;
+    NEXT_INSTRUCTION();
+op_div:
+    if (!RS2) {
+        RD = 0xffffffff;
+    } else if (RS1 == 0x80000000 && RS2 == 0xffffffff) {
+        RD = 0x80000000;
+    } else {
+        RD = (int32_t)RS1 / (int32_t)RS2;
+    }
+    NEXT_INSTRUCTION();
+op_divu:
+    RD = RS2 ? RS1 / RS2 : 0xffffffff;
+    NEXT_INSTRUCTION();
+op_rem:
+    if (!RS2) {
+        RD = RS1;
+    } else if (RS1 == 0x80000000 && RS2 == 0xffffffff) {
+        RD = 0;
+    } else {
+        RD = (int32_t)RS1 % (int32_t)RS2;
+    }
+    NEXT_INSTRUCTION();
+op_remu:
+    RD = RS2 ? RS1 % RS2 : RS1;
+    NEXT_INSTRUCTION();
+op_sh1add:
+    RD = (RS1 << 1) + RS2;
+    NEXT_INSTRUCTION();
+op_sh2add:
+    RD = (RS1 << 2) + RS2;
+    NEXT_INSTRUCTION();
+op_sh3add:
+    RD = (RS1 << 3) + RS2;
+    NEXT_INSTRUCTION();
+op_andn:
+    RD = RS1 & ~RS2;
+    NEXT_INSTRUCTION();
+op_orn:
+    RD = RS1 | ~RS2;
+    NEXT_INSTRUCTION();
+op_xnor:
+    RD = ~(RS1 ^ RS2);
+    NEXT_INSTRUCTION();
+op_clz:
+    RD = RS1 ? __builtin_clz(RS1) : 32;
+    NEXT_INSTRUCTION();
+op_ctz:
+    RD = RS1 ? __builtin_ctz(RS1) : 32;
+    NEXT_INSTRUCTION();
+op_cpop:
+    RD = __builtin_popcount(RS1);
+    NEXT_INSTRUCTION();
+op_mins:
+    RD = (int32_t)RS1 < (int32_t)RS2 ? RS1 : RS2;
+    NEXT_INSTRUCTION();
+op_minu:
+    RD = RS1 < RS2 ? RS1 : RS2;
+    NEXT_INSTRUCTION();
+op_maxs:
+    RD = (int32_t)RS1 > (int32_t)RS2 ? RS1 : RS2;
+    NEXT_INSTRUCTION();
+op_maxu:
+    RD = RS1 > RS2 ? RS1 : RS2;
+    NEXT_INSTRUCTION();
+op_sext_b:
+    RD = (int32_t)(int8_t)RS1;
+    NEXT_INSTRUCTION();
+op_sext_h:
+    RD = (int32_t)(int16_t)RS1;
+    NEXT_INSTRUCTION();
+op_zext_h:
+    RD = (uint16_t)RS1;
+    NEXT_INSTRUCTION();
+op_rol:
+    RD = (RS1 << (RS2 & 0x1f)) | (RS1 >> ((32 - (RS2 & 0x1f)) & 0x1f));
+    NEXT_INSTRUCTION();
+op_ror:
+    RD = (RS1 >> (RS2 & 0x1f)) | (RS1 << ((32 - (RS2 & 0x1f)) & 0x1f));
+    NEXT_INSTRUCTION();
+op_rori:
+    RD = (RS1 >> insn->imm) | (RS1 << ((32 - insn->imm) & 0x1f));
+    NEXT_INSTRUCTION();
+op_orc_b:
+    {
+        uint32_t value = RS1;
+        uint32_t result = 0;
+        int index = 0;
+        for (; index < 32; index += 8) {
+            if ((value >> index) & 0xff) {
+                result |= 0xffu << index;
+            }
+        }
+        RD = result;
+    }
+    NEXT_INSTRUCTION();
+op_rev8:
+    RD = __builtin_bswap32(RS1);
+    NEXT_INSTRUCTION();
+op_fence:
+    if (FENCE_ORDERS_STORE_LOAD(insn->imm)) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    NEXT_INSTRUCTION();
+op_fence_i:
+    invalidate_dirty_code_pages(hartptr);
+    hartptr->pc += insn->length;
+    return;
+op_pause:
+    spin_wait_pause(hartptr);
+    hartptr->pc += insn->length;
+    return;
+op_ecall:
+    hartptr->registers.a0 = do_syscall(hartptr, hartptr->registers.a7,
+                                       hartptr->registers.a0,
+                                       hartptr->registers.a1,
+                                       hartptr->registers.a2,
+                                       hartptr->registers.a3,
+                                       hartptr->registers.a4,
+                                       hartptr->registers.a5);
+    hartptr->pc += insn->length;
+    return;
+op_amo:
+    amo_instruction_slowpath(hartptr, insn->rs1_index, insn->rs2_index,
+                             insn->rd_index, insn->imm);
+    NEXT_INSTRUCTION();
+op_csr:
+    {
+        int shift = csr_counter_shift(insn->operation, insn->rs1_index,
+                                      insn->imm);
+        if (shift >= 0) {
+            RD = (uint32_t)(get_host_tsc() >> shift);
+        } else {
+            riscv_generic_csr_callback(hartptr, insn->operation,
+                                       insn->rd_index, insn->rs1_index,
+                                       insn->imm);
+        }
+    }
+    NEXT_INSTRUCTION();
+op_fp:
+    fpu_execute(hartptr, insn);
+    NEXT_INSTRUCTION();
+op_illegal:
+    printf("No translator found for instruction:%08x at:0x%x\n",
+           mmu_instruction_read32(hartptr, hartptr->pc), hartptr->pc);
+    dump_hart(hartptr);
+    __not_reach();
+    return;
+
+    #undef BRANCH_IF
+    #undef RD
+    #undef RS2
+    #undef RS1
+    #undef NEXT_INSTRUCTION
+    #undef DISPATCH
+}
+
+static struct interp_block *
+lookup_block(struct hart * hartptr)
+{
+    struct interp_block * block =
+        &((struct interp_block *)hartptr->interp_blocks)[
+            (hartptr->pc >> 1) & (INTERPRETER_BLOCK_CACHE_SIZE - 1)];
+    if (!block->is_valid || block->guest_pc != hartptr->pc ||
+        block->context != translation_context(hartptr)) {
+        decode_block(hartptr, block, hartptr->pc);
+    }
+    return block;
+}
+
+int
+interpret_cold_block(struct hart * hartptr)
+{
+    struct interp_block * block = lookup_block(hartptr);
+    if (block->execution_count >= INTERPRETER_PROMOTION_THRESHOLD) {
+        return 1;
+    }
+    block->execution_count++;
+    #if defined(DEBUG_TRACE)
+        log_trace("interpreting block 0x%x {nr:%d, count:%d}\n",
+                  block->guest_pc, block->nr_instructions,
+                  block->execution_count);
+    #endif
+    if (block->hle_routine >= 0 && !block->has_breakpoint &&
+        hle_call(hartptr, block->hle_routine)) {
+        return 0;
+    }
+    interpret_block(hartptr, block);
+    return 0;
+}
+
+void
+interpret_block_once(struct hart * hartptr)
+{
+    interpret_block(hartptr, lookup_block(hartptr));
+}
+
+void
+interpreter_flush(struct hart * hartptr)
+{
+    struct interp_block * blocks = hartptr->interp_blocks;
+    int index = 0;
+    for (; index < INTERPRETER_BLOCK_CACHE_SIZE; index++) {
+        blocks[index].is_valid = 0;
+    }
+}
+
+// a block is allowed to run across the page boundary, drop all blocks which
+// overlap the range.
+void
+interpreter_invalidate_range(struct hart * hartptr, uint32_t addr_low,
+                             uint32_t addr_high)
+{
+    struct interp_block * blocks = hartptr->interp_blocks;
+    int index = 0;
+    for (; index < INTERPRETER_BLOCK_CACHE_SIZE; index++) {
+        // an upper bound if the block holds compressed instructions.
+        uint32_t block_end = blocks[index].guest_pc +
+                             blocks[index].nr_instructions * 4;
+        if (blocks[index].is_valid &&
+            blocks[index].guest_pc < addr_high &&
+            block_end > addr_low) {
+            blocks[index].is_valid = 0;
+        }
+    }
+}
+
+void
+interpreter_init(struct hart * hartptr)
+{
+    hartptr->interp_blocks =
+        aligned_alloc(64, INTERPRETER_BLOCK_CACHE_SIZE *
+                          sizeof(struct interp_block));
+    ASSERT(hartptr->interp_blocks);
+    interpreter_flush(hartptr);
+}
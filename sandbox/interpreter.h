@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ */
+#ifndef _INTERPRETER_H
+#define _INTERPRETER_H
+#include <hart.h>
+
+// XXX: tier 0 of the execution engine. a guest basic block is pre-decoded and
+// interpreted until it has been executed INTERPRETER_PROMOTION_THRESHOLD
+// times, after that it's translated into the translation cache(tier 1).
+// this prevents run-once code from polluting the translation cache.
+
+void
+interpreter_init(struct hart * hartptr);
+
+void
+interpreter_flush(struct hart * hartptr);
+
+void
+interpreter_invalidate_range(struct hart * hartptr, uint32_t addr_low,
+                             uint32_t addr_high);
+
+// @return non-zero if the block at hartptr->pc is warm and should be
+// translated, otherwise the block is interpreted and zero is returned.
+int
+interpret_cold_block(struct hart * hartptr);
+
+// interpret the block at hartptr->pc once no matter how warm it is.
+void
+interpret_block_once(struct hart * hartptr);
+
+#endif
@@ -0,0 +1,537 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      Loop idioms. a loop is recognized if its body is one block which ends
+ *      with the back edge to its head, and which is made of element accesses
+ *      off induction registers, `addi r, r, step` of them and at most one
+ *      accumulation or early exit. all its iterations are then carried out by
+ *      the host on the pmr_direct pointers of the guest memory: a copy or fill
+ *      resolves to the host libc, compares and reductions are done by SSE2
+ *      with scalar remainders.
+ */
+
+#include <loop_idiom.h>
+#include <translation.h>
+#include <decoder.h>
+#include <mmu.h>
+#include <csr.h>
+#include <util.h>
+#include <string.h>
+#include <emmintrin.h>
+
+static int
+access_width(uint8_t operation, int * is_signed, int * is_store)
+{
+    *is_signed = operation == RISCV_OP_LB || operation == RISCV_OP_LH;
+    *is_store = operation == RISCV_OP_SB || operation == RISCV_OP_SH ||
+                operation == RISCV_OP_SW;
+    switch (operation)
+    {
+        case RISCV_OP_LB:
+        case RISCV_OP_LBU:
+        case RISCV_OP_SB:
+            return 1;
+        case RISCV_OP_LH:
+        case RISCV_OP_LHU:
+        case RISCV_OP_SH:
+            return 2;
+        case RISCV_OP_LW:
+        case RISCV_OP_SW:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+static inline int
+is_branch(uint8_t operation)
+{
+    return operation >= RISCV_OP_BEQ && operation <= RISCV_OP_BGEU;
+}
+
+static inline int
+is_body_operation(uint8_t operation)
+{
+    return is_branch(operation) ||
+           (operation >= RISCV_OP_LB && operation <= RISCV_OP_ADDI) ||
+           operation == RISCV_OP_ADD || operation == RISCV_OP_XOR;
+}
+
+static int
+induction_slot(struct loop_idiom * idiom, uint8_t reg_index)
+{
+    int slot = 0;
+    for (; slot < idiom->nr_inductions; slot++) {
+        if (idiom->induction_index[slot] == reg_index) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+int
+loop_idiom_recognize(struct prefetch_blob * blob,
+                     struct decoded_instruction * dec,
+                     struct loop_idiom * idiom)
+{
+    struct decoded_instruction body[LOOP_MAX_INSTRUCTIONS];
+    uint32_t pcs[LOOP_MAX_INSTRUCTIONS];
+    uint32_t head = blob->next_instruction_to_fetch;
+    struct hart * hartptr = blob->opaque;
+    // XXX: with paging on, mmu_direct_range() never gives the host pointers,
+    // loop_idiom_run() would always fail, such a loop is translated as usual.
+    struct csr_entry * csr =
+        &((struct csr_entry *)hartptr->csrs_base)[CSR_ADDRESS_SATP];
+    if (hartptr->privilege_level < PRIVILEGE_LEVEL_MACHINE &&
+        csr->csr_blob & 0x80000000) {
+        return 0;
+    }
+#if defined(NATIVE_DEBUGER)
+    // the head keeps the breakpoint prologue of its own translation only.
+    if (is_address_breakpoint(head)) {
+        return 0;
+    }
+#endif
+    int nr_instructions = 1;
+    body[0] = *dec;
+    pcs[0] = head;
+    // the body is fetched up to the back edge, an early exit may precede it.
+    while (1) {
+        struct decoded_instruction * last = &body[nr_instructions - 1];
+        uint32_t last_pc = pcs[nr_instructions - 1];
+        if (is_branch(last->operation) && last_pc + last->imm == head) {
+            break;
+        }
+        if (!is_body_operation(last->operation)) {
+            return 0;
+        }
+        if (nr_instructions == LOOP_MAX_INSTRUCTIONS ||
+            !fetch_fusible_instruction(blob, last_pc + last->length,
+                                       &body[nr_instructions])) {
+            return 0;
+        }
+        pcs[nr_instructions] = last_pc + last->length;
+        nr_instructions++;
+    }
+    uint32_t back_edge_pc = pcs[nr_instructions - 1];
+    memset(idiom, 0x0, sizeof(struct loop_idiom));
+    idiom->next_pc = back_edge_pc + body[nr_instructions - 1].length;
+
+    // the inductions are found first, an element may be accessed off a base
+    // before it's stepped.
+    int induction_position[LOOP_MAX_INDUCTIONS];
+    int index = 0;
+    for (; index < nr_instructions; index++) {
+        struct decoded_instruction * insn = &body[index];
+        if (insn->operation != RISCV_OP_ADDI) {
+            continue;
+        }
+        if (!insn->rd_index || insn->rd_index != insn->rs1_index ||
+            !insn->imm || insn->imm < -128 || insn->imm > 127 ||
+            induction_slot(idiom, insn->rd_index) >= 0 ||
+            idiom->nr_inductions == LOOP_MAX_INDUCTIONS) {
+            return 0;
+        }
+        induction_position[idiom->nr_inductions] = index;
+        idiom->induction_index[idiom->nr_inductions] = insn->rd_index;
+        idiom->induction_step[idiom->nr_inductions] = insn->imm;
+        idiom->nr_inductions++;
+    }
+
+    // XXX: a register read before it's written in the body carries a value
+    // over iterations, only the inductions and the accumulator may do that.
+    uint32_t inductions = 0;
+    for (index = 0; index < idiom->nr_inductions; index++) {
+        inductions |= 1 << idiom->induction_index[index];
+    }
+    uint32_t written = 0;
+    uint32_t read = 0;
+    uint32_t invariant = 0;
+    uint32_t loaded = 0;
+    int nr_loads = 0;
+    int nr_stores = 0;
+    int has_exit = 0;
+    for (index = 0; index < nr_instructions; index++) {
+        struct decoded_instruction * insn = &body[index];
+        uint32_t rd_bit = 1 << insn->rd_index;
+        uint32_t rs1_bit = 1 << insn->rs1_index;
+        uint32_t rs2_bit = 1 << insn->rs2_index;
+        int is_signed = 0;
+        int is_store = 0;
+        int width = access_width(insn->operation, &is_signed, &is_store);
+        if (insn->operation == RISCV_OP_ADDI) {
+            written |= rd_bit;
+        } else if (width) {
+            int slot = induction_slot(idiom, insn->rs1_index);
+            if (slot < 0 || idiom->nr_accesses == 2 ||
+                (idiom->width && idiom->width != width)) {
+                return 0;
+            }
+            struct loop_access * access = &idiom->accesses[idiom->nr_accesses++];
+            access->base_slot = slot;
+            access->displacement = insn->imm;
+            if (induction_position[slot] < index) {
+                access->displacement += idiom->induction_step[slot];
+            }
+            idiom->width = width;
+            read |= rs1_bit;
+            if (is_store) {
+                if (nr_stores++) {
+                    return 0;
+                }
+                access->value_index = insn->rs2_index;
+                if (!(loaded & rs2_bit)) {
+                    invariant |= rs2_bit;
+                }
+                read |= rs2_bit;
+            } else {
+                if (!insn->rd_index || (inductions | written | read) & rd_bit ||
+                    (nr_loads++ && idiom->is_signed != is_signed)) {
+                    return 0;
+                }
+                access->value_index = insn->rd_index;
+                idiom->is_signed = is_signed;
+                written |= rd_bit;
+                loaded |= rd_bit;
+            }
+        } else if (insn->operation == RISCV_OP_XOR ||
+                   insn->operation == RISCV_OP_ADD) {
+            uint8_t element_index = insn->rs1_index == insn->rd_index ?
+                                    insn->rs2_index : insn->rs1_index;
+            if (idiom->accumulate_operation || !insn->rd_index ||
+                (insn->rs1_index != insn->rd_index &&
+                 insn->rs2_index != insn->rd_index) ||
+                !(loaded & (1 << element_index)) ||
+                (inductions | written | read) & rd_bit) {
+                return 0;
+            }
+            idiom->accumulate_operation = insn->operation;
+            idiom->accumulator_index = insn->rd_index;
+            written |= rd_bit;
+            read |= 1 << element_index;
+        } else if (index < nr_instructions - 1) {
+            // the early exit of a compare: the elements just loaded differ.
+            uint32_t target = pcs[index] + insn->imm;
+            if (insn->operation != RISCV_OP_BNE || has_exit ||
+                insn->rs1_index == insn->rs2_index ||
+                !(loaded & rs1_bit) || !(loaded & rs2_bit) ||
+                (target >= head && target <= back_edge_pc)) {
+                return 0;
+            }
+            has_exit = 1;
+            idiom->exit_pc = target;
+            int slot = 0;
+            for (; slot < idiom->nr_inductions; slot++) {
+                if (induction_position[slot] < index) {
+                    idiom->exit_stepped_mask |= 1 << slot;
+                }
+            }
+            read |= rs1_bit | rs2_bit;
+        } else {
+            // the back edge: an induction is tested against an invariant.
+            int rs1_slot = induction_slot(idiom, insn->rs1_index);
+            int rs2_slot = induction_slot(idiom, insn->rs2_index);
+            if (insn->operation == RISCV_OP_BEQ ||
+                (rs1_slot >= 0) == (rs2_slot >= 0)) {
+                return 0;
+            }
+            idiom->branch_operation = insn->operation;
+            idiom->is_counter_rs1 = rs1_slot >= 0;
+            idiom->counter_slot = rs1_slot >= 0 ? rs1_slot : rs2_slot;
+            idiom->bound_index = rs1_slot >= 0 ? insn->rs2_index :
+                                                 insn->rs1_index;
+            invariant |= 1 << idiom->bound_index;
+            read |= rs1_bit | rs2_bit;
+        }
+    }
+    if (invariant & written) {
+        return 0;
+    }
+    // the accumulator is not read by anything else.
+    if (idiom->accumulate_operation &&
+        read & (1 << idiom->accumulator_index)) {
+        return 0;
+    }
+    if (nr_loads == 1 && nr_stores == 1 && !has_exit &&
+        !idiom->accumulate_operation &&
+        idiom->accesses[1].value_index == idiom->accesses[0].value_index) {
+        idiom->kind = LOOP_IDIOM_COPY;
+    } else if (nr_loads == 0 && nr_stores == 1 && !has_exit &&
+               !idiom->accumulate_operation) {
+        idiom->kind = LOOP_IDIOM_FILL;
+    } else if (nr_loads == 2 && nr_stores == 0 && has_exit &&
+               !idiom->accumulate_operation) {
+        idiom->kind = LOOP_IDIOM_COMPARE;
+    } else if (nr_loads == 1 && nr_stores == 0 && !has_exit &&
+               idiom->accumulate_operation) {
+        idiom->kind = LOOP_IDIOM_REDUCE;
+    } else {
+        return 0;
+    }
+    // the elements are contiguous and they are visited in the same direction.
+    int32_t step = idiom->induction_step[idiom->accesses[0].base_slot];
+    if (step != idiom->width && step != -idiom->width) {
+        return 0;
+    }
+    for (index = 1; index < idiom->nr_accesses; index++) {
+        if (idiom->induction_step[idiom->accesses[index].base_slot] != step) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// the number of iterations until the back edge falls through, it's counted
+// as if the counter had infinite precision, zero is returned if the counter
+// wraps before that or if it never meets the bound.
+static uint64_t
+loop_trip_count(const uint32_t * regs, const struct loop_idiom * idiom)
+{
+    int64_t step = idiom->induction_step[idiom->counter_slot];
+    // the counter is stepped before the back edge.
+    uint32_t counter = regs[idiom->induction_index[idiom->counter_slot]] +
+                       (uint32_t)step;
+    uint32_t bound = regs[idiom->bound_index];
+    uint8_t operation = idiom->branch_operation;
+    if (operation == RISCV_OP_BNE) {
+        uint32_t distance = bound - counter;
+        uint32_t stride = step > 0 ? step : -step;
+        if (step < 0) {
+            distance = -distance;
+        }
+        if (distance % stride) {
+            return 0;
+        }
+        return (uint64_t)(distance / stride) + 1;
+    }
+    int is_signed = operation == RISCV_OP_BLT || operation == RISCV_OP_BGE;
+    int64_t first = is_signed ? (int64_t)(int32_t)counter : (int64_t)counter;
+    int64_t limit = is_signed ? (int64_t)(int32_t)bound : (int64_t)bound;
+    int64_t lowest = is_signed ? INT32_MIN : 0;
+    int64_t highest = is_signed ? INT32_MAX : UINT32_MAX;
+    int is_less = operation == RISCV_OP_BLT || operation == RISCV_OP_BLTU;
+    // normalized: the loop goes on while counter < limit if it's ascending,
+    // or while counter > limit if it's descending.
+    int is_ascending = is_less == idiom->is_counter_rs1;
+    if (!is_less) {
+        limit += is_ascending ? 1 : -1;
+    }
+    if ((step > 0) != is_ascending) {
+        return 0;
+    }
+    uint64_t taken = 0;
+    if (is_ascending) {
+        if (first < limit) {
+            taken = (limit - first + step - 1) / step;
+        }
+        if (first + (int64_t)taken * step > highest) {
+            return 0;
+        }
+    } else {
+        if (first > limit) {
+            taken = (first - limit - step - 1) / -step;
+        }
+        if (first + (int64_t)taken * step < lowest) {
+            return 0;
+        }
+    }
+    return taken + 1;
+}
+
+static uint32_t
+load_element(const uint8_t * ptr, int width, int is_signed)
+{
+    uint16_t half;
+    uint32_t word;
+    switch (width)
+    {
+        case 1:
+            return is_signed ? (uint32_t)(int32_t)(int8_t)*ptr : *ptr;
+        case 2:
+            memcpy(&half, ptr, 2);
+            return is_signed ? (uint32_t)(int32_t)(int16_t)half : half;
+        default:
+            memcpy(&word, ptr, 4);
+            return word;
+    }
+}
+
+static void
+fill_elements(uint8_t * ptr, uint32_t len, int width, uint32_t value)
+{
+    if (width == 1) {
+        memset(ptr, value & 0xff, len);
+        return;
+    }
+    // the pattern repeats every 4 bytes from the lowest element.
+    uint32_t pattern = width == 2 ? (value & 0xffff) * 0x10001 : value;
+    __m128i patterns = _mm_set1_epi32(pattern);
+    uint32_t offset = 0;
+    for (; offset + 16 <= len; offset += 16) {
+        _mm_storeu_si128((__m128i *)(ptr + offset), patterns);
+    }
+    for (; offset < len; offset += width) {
+        memcpy(ptr + offset, &pattern, width);
+    }
+}
+
+static uint32_t
+reduce_elements(const uint8_t * ptr, uint32_t len, int width, int is_signed,
+                uint8_t operation, uint32_t accumulator)
+{
+    int is_xor = operation == RISCV_OP_XOR;
+    uint32_t offset = 0;
+    if (width == 4 || (width == 1 && !is_signed)) {
+        __m128i sum = _mm_setzero_si128();
+        for (; offset + 16 <= len; offset += 16) {
+            __m128i elements = _mm_loadu_si128((const __m128i *)(ptr + offset));
+            if (is_xor) {
+                sum = _mm_xor_si128(sum, elements);
+            } else if (width == 4) {
+                sum = _mm_add_epi32(sum, elements);
+            } else {
+                // two 64-bit sums of eight bytes each.
+                sum = _mm_add_epi64(sum,
+                                    _mm_sad_epu8(elements,
+                                                 _mm_setzero_si128()));
+            }
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, sum);
+        if (is_xor) {
+            uint32_t folded = lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3];
+            if (width == 1) {
+                folded ^= folded >> 16;
+                folded = (folded ^ (folded >> 8)) & 0xff;
+            }
+            accumulator ^= folded;
+        } else if (width == 4) {
+            accumulator += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        } else {
+            accumulator += lanes[0] + lanes[2];
+        }
+    }
+    for (; offset < len; offset += width) {
+        uint32_t element = load_element(ptr + offset, width, is_signed);
+        accumulator = is_xor ? accumulator ^ element : accumulator + element;
+    }
+    return accumulator;
+}
+
+// the index of the first differing element in iteration order, nr_elements
+// is returned if there is none.
+static uint32_t
+compare_elements(const uint8_t * ptr0, const uint8_t * ptr1, uint32_t len,
+                 int width, int is_ascending)
+{
+    uint32_t nr_elements = len / width;
+    if (!memcmp(ptr0, ptr1, len)) {
+        return nr_elements;
+    }
+    uint32_t offset = 0;
+    if (is_ascending) {
+        for (; offset + 16 <= len && !memcmp(ptr0 + offset, ptr1 + offset, 16);
+             offset += 16);
+        for (; ptr0[offset] == ptr1[offset]; offset++);
+        return offset / width;
+    }
+    offset = len;
+    for (; offset >= 16 && !memcmp(ptr0 + offset - 16, ptr1 + offset - 16, 16);
+         offset -= 16);
+    for (; ptr0[offset - 1] == ptr1[offset - 1]; offset--);
+    return nr_elements - 1 - (offset - 1) / width;
+}
+
+int
+loop_idiom_run(struct hart * hartptr, const struct loop_idiom * idiom)
+{
+    uint32_t * regs = (uint32_t *)&hartptr->registers;
+    uint64_t nr_iterations = loop_trip_count(regs, idiom);
+    uint64_t len = nr_iterations * idiom->width;
+    if (!nr_iterations || len > 0x40000000) {
+        return 0;
+    }
+    int width = idiom->width;
+    int32_t step = idiom->induction_step[idiom->accesses[0].base_slot];
+    int is_ascending = step > 0;
+    // the lowest element of each access.
+    uint32_t lows[2];
+    uint8_t * ptrs[2];
+    int index = 0;
+    for (; index < idiom->nr_accesses; index++) {
+        const struct loop_access * access = &idiom->accesses[index];
+        uint32_t first = regs[idiom->induction_index[access->base_slot]] +
+                         access->displacement;
+        if (is_ascending ? (uint64_t)first + len > 0x100000000ULL :
+                           (uint64_t)first + width < len) {
+            return 0;
+        }
+        lows[index] = is_ascending ? first : first + width - (uint32_t)len;
+        int is_write = (idiom->kind == LOOP_IDIOM_COPY && index == 1) ||
+                       idiom->kind == LOOP_IDIOM_FILL;
+        ptrs[index] = mmu_direct_range(hartptr, lows[index], len, is_write);
+        if (!ptrs[index]) {
+            return 0;
+        }
+    }
+    // the offset of the element loaded in the last iteration.
+    uint32_t last = is_ascending ? len - width : 0;
+    uint64_t nr_stepped = nr_iterations;
+    int is_exited = 0;
+    switch (idiom->kind)
+    {
+        case LOOP_IDIOM_COPY:
+            // NOTE: the loop propagates the elements if the destination runs
+            // behind the source, memmove does not.
+            if (lows[1] != lows[0] &&
+                lows[1] < (uint64_t)lows[0] + len &&
+                lows[0] < (uint64_t)lows[1] + len &&
+                (lows[1] > lows[0]) == is_ascending) {
+                return 0;
+            }
+            regs[idiom->accesses[0].value_index] =
+                load_element(ptrs[0] + last, width, idiom->is_signed);
+            memmove(ptrs[1], ptrs[0], len);
+            break;
+        case LOOP_IDIOM_FILL:
+            fill_elements(ptrs[0], len, width,
+                          regs[idiom->accesses[0].value_index]);
+            break;
+        case LOOP_IDIOM_COMPARE:
+            {
+                uint32_t differing = compare_elements(ptrs[0], ptrs[1], len,
+                                                      width, is_ascending);
+                if (differing < nr_iterations) {
+                    last = (is_ascending ? differing :
+                            nr_iterations - 1 - differing) * width;
+                    nr_stepped = differing;
+                    is_exited = 1;
+                }
+                regs[idiom->accesses[0].value_index] =
+                    load_element(ptrs[0] + last, width, idiom->is_signed);
+                regs[idiom->accesses[1].value_index] =
+                    load_element(ptrs[1] + last, width, idiom->is_signed);
+            }
+            break;
+        case LOOP_IDIOM_REDUCE:
+            regs[idiom->accumulator_index] =
+                reduce_elements(ptrs[0], len, width, idiom->is_signed,
+                                idiom->accumulate_operation,
+                                regs[idiom->accumulator_index]);
+            regs[idiom->accesses[0].value_index] =
+                load_element(ptrs[0] + last, width, idiom->is_signed);
+            break;
+        default:
+            __not_reach();
+    }
+    for (index = 0; index < idiom->nr_inductions; index++) {
+        uint32_t nr_steps = nr_stepped;
+        if (is_exited && idiom->exit_stepped_mask & (1 << index)) {
+            nr_steps += 1;
+        }
+        regs[idiom->induction_index[index]] +=
+            nr_steps * (uint32_t)(int32_t)idiom->induction_step[index];
+    }
+    hartptr->pc = is_exited ? idiom->exit_pc : idiom->next_pc;
+    return 1;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      Counted guest loops over memory which copy, fill, compare or reduce
+ *      (xor/add) elements are recognized at translation time, the whole loop
+ *      is carried out by the host at once instead of iteration by iteration.
+ */
+
+#ifndef _LOOP_IDIOM_H
+#define _LOOP_IDIOM_H
+#include <stdint.h>
+
+// the loop body is a single block at most this long, the back edge included.
+#define LOOP_MAX_INSTRUCTIONS   8
+#define LOOP_MAX_INDUCTIONS     4
+
+enum loop_idiom_kind {
+    LOOP_IDIOM_COPY = 1,
+    LOOP_IDIOM_FILL,
+    LOOP_IDIOM_COMPARE,
+    LOOP_IDIOM_REDUCE,
+};
+
+// an element is accessed at base + displacement + i * step in iteration i, the
+// step of the base is the width of the element or its negation.
+struct loop_access {
+    uint8_t base_slot;          // the induction slot of the base register
+    uint8_t value_index;        // the register loaded or stored
+    int16_t displacement;       // relative to the base at the iteration begin
+};
+
+// XXX: the descriptor is carried by the parameters of the translated template,
+// so it's made of 32-bit words, see translate_loop_idiom.c
+struct loop_idiom {
+    uint8_t kind;
+    uint8_t width;              // bytes of an element: 1, 2 or 4
+    uint8_t is_signed;          // whether the loaded elements are sign-extended
+    uint8_t nr_inductions;
+    // the registers stepped by `addi r, r, step` once per iteration.
+    uint8_t induction_index[LOOP_MAX_INDUCTIONS];
+    int8_t induction_step[LOOP_MAX_INDUCTIONS];
+    // the back edge `branch_operation counter, bound` or swapped operands.
+    uint8_t branch_operation;
+    uint8_t counter_slot;
+    uint8_t bound_index;
+    uint8_t is_counter_rs1;
+    // the inductions which are stepped before the early exit of a compare.
+    uint8_t exit_stepped_mask;
+    uint8_t accumulator_index;
+    uint8_t accumulate_operation;
+    uint8_t nr_accesses;
+    // the load or the store of a fill first, then the store of a copy or the
+    // second load of a compare.
+    struct loop_access accesses[2];
+    uint32_t exit_pc;
+    uint32_t next_pc;
+};
+
+#define LOOP_IDIOM_WORDS    (sizeof(struct loop_idiom) / sizeof(uint32_t))
+
+struct hart;
+struct decoded_instruction;
+struct prefetch_blob;
+
+// whether the instruction being translated is the head of a loop idiom, the
+// descriptor is filled if so.
+int
+loop_idiom_recognize(struct prefetch_blob * blob,
+                     struct decoded_instruction * dec,
+                     struct loop_idiom * idiom);
+
+// run the loop from its head until it exits.
+// @return zero if it's not eligible, e.g. the trip count is not known or the
+// memory is not directly accessible, the guest code must be executed then.
+int
+loop_idiom_run(struct hart * hartptr, const struct loop_idiom * idiom);
+
+// the loop head in the translation cache, see translate_loop_idiom.c. the
+// head instruction must be translated right behind it.
+void
+riscv_loop_idiom_translator(struct decoded_instruction * dec,
+                            struct prefetch_blob * blob,
+                            struct loop_idiom * idiom);
+
+#endif
@@ -14,6 +14,7 @@
 #include <app.h>
 #include <vmm_sched.h>
 #include <task_sched.h>
+#include <vmm_smp.h>
 
 static void
 log_init(void)
@@ -54,6 +55,9 @@ main(int argc, char ** argv)
                         sandbox_vm.hartptr);
     schedule_task(sandbox_vm.hartptr);
 
+    preemption_timer_init();
+    // the calling thread is the first host cpu, the others are started here.
+    vmm_smp_init();
     // initialize idle task which is the first task to run.
     schedule_idle_task();
     __not_reach();
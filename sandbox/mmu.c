@@ -5,16 +5,64 @@
 #include <mmu_tlb.h>
 #include <hart_exception.h>
 #include <csr.h>
+#include <debug.h>
+
+// XXX: all guest stores go through here, check whether the page holds decoded
+// code so that self-modifying code is detected. an unaligned store may hit two
+// pages.
+__attribute__((always_inline)) static inline void
+check_code_page_write(struct hart * hartptr, uint32_t location, int size)
+{
+    struct virtual_machine * vm =
+        get_linked_vm(hartptr->native_vmptr, LINKAGE_HINT_VM);
+    uint8_t * bitmap = vm->code_pages_bitmap;
+    if (!bitmap) {
+        return;
+    }
+    uint32_t first_page = location >> 12;
+    uint32_t last_page = (location + size - 1) >> 12;
+    if (bitmap[first_page >> 3] & (1 << (first_page & 7))) {
+        code_page_written(hartptr, location);
+    }
+    if (last_page != first_page &&
+        bitmap[last_page >> 3] & (1 << (last_page & 7))) {
+        code_page_written(hartptr, location + size - 1);
+    }
+}
+
+#if defined(NATIVE_DEBUGER)
+// XXX: only accesses to watched pages take the slow path, the others pay a
+// bitmap test once any watchpoint is set.
+__attribute__((always_inline)) static inline void
+check_watched_access(struct hart * hartptr, uint32_t location, int size,
+                     uint32_t access)
+{
+    uint8_t * bitmap = watched_pages_bitmap;
+    if (!bitmap) {
+        return;
+    }
+    uint32_t first_page = location >> 12;
+    uint32_t last_page = (location + size - 1) >> 12;
+    if (bitmap[first_page >> 3] & (1 << (first_page & 7)) ||
+        bitmap[last_page >> 3] & (1 << (last_page & 7))) {
+        watched_page_accessed(hartptr, location, size, access);
+    }
+}
+#else
+#define check_watched_access(hartptr, location, size, access)
+#endif
 
 uint8_t
 mmu_read8(struct hart * hartptr, uint32_t location)
 {
+    check_watched_access(hartptr, location, 1, WATCH_READ);
     return vmread8(hartptr, location);
 }
 
 uint16_t
 mmu_read16(struct hart * hartptr, uint32_t location)
 {
+    check_watched_access(hartptr, location, 2, WATCH_READ);
     return vmread16(hartptr, location);
 }
 
@@ -22,9 +70,17 @@ mmu_read16(struct hart * hartptr, uint32_t location)
 uint32_t
 mmu_read32(struct hart * hartptr, uint32_t location)
 {
+    check_watched_access(hartptr, location, 4, WATCH_READ);
     return vmread32(hartptr, location);
 }
 
+uint64_t
+mmu_read64(struct hart * hartptr, uint32_t location)
+{
+    check_watched_access(hartptr, location, 8, WATCH_READ);
+    return vmread64(hartptr, location);
+}
+
 uint32_t
 mmu_read32_aligned(struct hart * hartptr, uint32_t location)
 {
@@ -32,6 +88,7 @@ mmu_read32_aligned(struct hart * hartptr, uint32_t location)
         raise_exception_with_tvalue(hartptr, EXCEPTION_LOAD_ADDRESS_MISALIGN,
                                     location);
     }
+    check_watched_access(hartptr, location, 4, WATCH_READ);
     return vmread32(hartptr, location);
 }
 
@@ -41,12 +98,16 @@ void
 mmu_write8(struct hart * hartptr, uint32_t location, uint8_t value)
 {
     vmwrite8(hartptr, location, value);
+    check_code_page_write(hartptr, location, 1);
+    check_watched_access(hartptr, location, 1, WATCH_WRITE);
 }
 
 void
 mmu_write16(struct hart * hartptr, uint32_t location, uint16_t value)
 {
     vmwrite16(hartptr, location, value);
+    check_code_page_write(hartptr, location, 2);
+    check_watched_access(hartptr, location, 2, WATCH_WRITE);
 }
 
 
@@ -54,9 +115,44 @@ void
 mmu_write32(struct hart * hartptr, uint32_t location, uint32_t value)
 {
     vmwrite32(hartptr, location, value);
+    check_code_page_write(hartptr, location, 4);
+    check_watched_access(hartptr, location, 4, WATCH_WRITE);
 }
 
 
+void
+mmu_write64(struct hart * hartptr, uint32_t location, uint64_t value)
+{
+    vmwrite64(hartptr, location, value);
+    check_code_page_write(hartptr, location, 8);
+    check_watched_access(hartptr, location, 8, WATCH_WRITE);
+}
+
+
+// XXX: two adjacent words are accessed at once if they are in the same page,
+// otherwise the words may be translated differently, they're accessed apart.
+// the low word is at the location.
+uint64_t
+mmu_read32x2(struct hart * hartptr, uint32_t location)
+{
+    if ((location & 4095) <= 4088) {
+        return mmu_read64(hartptr, location);
+    }
+    uint64_t low = mmu_read32(hartptr, location);
+    return low | ((uint64_t)mmu_read32(hartptr, location + 4) << 32);
+}
+
+void
+mmu_write32x2(struct hart * hartptr, uint32_t location, uint64_t value)
+{
+    if ((location & 4095) <= 4088) {
+        mmu_write64(hartptr, location, value);
+        return;
+    }
+    mmu_write32(hartptr, location, (uint32_t)value);
+    mmu_write32(hartptr, location + 4, (uint32_t)(value >> 32));
+}
+
 void
 mmu_write32_aligned(struct hart * hartptr, uint32_t location, uint32_t value)
 {
@@ -65,6 +161,110 @@ mmu_write32_aligned(struct hart * hartptr, uint32_t location, uint32_t value)
                                     location);
     }
     vmwrite32(hartptr, location, value);
+    check_code_page_write(hartptr, location, 4);
+    check_watched_access(hartptr, location, 4, WATCH_WRITE);
+}
+
+// XXX: resolve the host address of an aligned guest word, AMOs are then
+// performed by host atomic instructions on it. NULL is returned for a word in
+// a region which is not directly addressable, the caller falls back to a
+// read-modify-write through the mmu. lr.w is a load, it raises the load
+// exceptions, the AMOs and sc.w raise the store ones.
+void *
+mmu_atomic_address(struct hart * hartptr, uint32_t location, int is_load)
+{
+    if (location & 0x3) {
+        raise_exception_with_tvalue(hartptr,
+                                    is_load ? EXCEPTION_LOAD_ADDRESS_MISALIGN :
+                                    EXCEPTION_STORE_ADDRESS_MISALIGN,
+                                    location);
+    }
+    struct pm_region_operation * pmr;
+    uint64_t addr = location;
+    struct csr_entry * csr = &((struct csr_entry *)hartptr->csrs_base)[CSR_ADDRESS_SATP];
+    if (hartptr->privilege_level < PRIVILEGE_LEVEL_MACHINE &&
+        csr->csr_blob & 0x80000000) {
+        struct tlb_entry * entry = VA_TO_TLB_ENTRY(hartptr->dtlb,
+                                                   hartptr->dtlb_cap,
+                                                   location);
+        if (!entry) {
+            walk_page_table(hartptr, location, hartptr->dtlb,
+                            hartptr->dtlb_cap);
+            entry = VA_TO_TLB_ENTRY(hartptr->dtlb, hartptr->dtlb_cap,
+                                    location);
+        }
+        if (!entry) {
+            raise_exception_with_tvalue(hartptr,
+                                        is_load ? EXCEPTION_LOAD_PAGE_FAULT :
+                                        EXCEPTION_STORE_PAGE_FAULT,
+                                        location);
+            __not_reach();
+        }
+        pmr = entry->pmr;
+        addr = entry->pa_tag | (location & ~(entry->page_mask));
+    } else {
+        pmr = search_pm_region_callback(get_linked_vm(hartptr->native_vmptr,
+                                                      LINKAGE_HINT_VM),
+                                        location);
+    }
+    if (!pmr || !pmr->pmr_direct) {
+        return NULL;
+    }
+    if (is_load) {
+        check_watched_access(hartptr, location, 4, WATCH_READ);
+    } else {
+        // an AMO is both a read and a write.
+        check_watched_access(hartptr, location, 4, WATCH_READ | WATCH_WRITE);
+        check_code_page_write(hartptr, location, 4);
+    }
+    return pmr->pmr_direct(addr, hartptr, pmr);
+}
+
+static int
+is_page_marked(uint8_t * bitmap, uint32_t addr, uint32_t len)
+{
+    if (!bitmap) {
+        return 0;
+    }
+    uint32_t page = addr >> 12;
+    uint32_t last_page = (addr + len - 1) >> 12;
+    for (; page <= last_page; page++) {
+        if (bitmap[page >> 3] & (1 << (page & 7))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// the host pointer of guest range [location, location + len), NULL is returned
+// if the range is not in one directly accessible region. the pages which hold
+// decoded code or watchpoints are left to the guest code, which takes care of
+// them, so is any range if paging is enabled.
+void *
+mmu_direct_range(struct hart * hartptr, uint32_t location, uint32_t len,
+                 int is_write)
+{
+    struct csr_entry * csr = &((struct csr_entry *)hartptr->csrs_base)[CSR_ADDRESS_SATP];
+    if (hartptr->privilege_level < PRIVILEGE_LEVEL_MACHINE &&
+        csr->csr_blob & 0x80000000) {
+        return NULL;
+    }
+    struct virtual_machine * vm = get_linked_vm(hartptr->native_vmptr,
+                                                LINKAGE_HINT_VM);
+    struct pm_region_operation * pmr = search_pm_region_callback(vm, location);
+    if (!pmr || !pmr->pmr_direct ||
+        ((uint64_t)location + len) > pmr->addr_high) {
+        return NULL;
+    }
+    if (is_write && is_page_marked(vm->code_pages_bitmap, location, len)) {
+        return NULL;
+    }
+#if defined(NATIVE_DEBUGER)
+    if (is_page_marked(watched_pages_bitmap, location, len)) {
+        return NULL;
+    }
+#endif
+    return pmr->pmr_direct(location, hartptr, pmr);
 }
 
 /*
@@ -149,6 +149,9 @@ mmu_read16(struct hart * hartptr, uint32_t location);
 uint32_t
 mmu_read32(struct hart * hartptr, uint32_t location);
 
+uint64_t
+mmu_read64(struct hart * hartptr, uint32_t location);
+
 uint32_t
 mmu_read32_aligned(struct hart * hartptr, uint32_t location);
 
@@ -165,7 +168,24 @@ mmu_write16(struct hart * hartptr, uint32_t location, uint16_t value);
 void
 mmu_write32(struct hart * hartptr, uint32_t location, uint32_t value);
 
+void
+mmu_write64(struct hart * hartptr, uint32_t location, uint64_t value);
+
 void
 mmu_write32_aligned(struct hart * hartptr, uint32_t location, uint32_t value);
 
+// a pair of adjacent words, the word at the location is the low half.
+uint64_t
+mmu_read32x2(struct hart * hartptr, uint32_t location);
+
+void
+mmu_write32x2(struct hart * hartptr, uint32_t location, uint64_t value);
+
+void *
+mmu_atomic_address(struct hart * hartptr, uint32_t location, int is_load);
+
+void *
+mmu_direct_range(struct hart * hartptr, uint32_t location, uint32_t len,
+                 int is_write);
+
 #endif
@@ -9,6 +9,10 @@
 
 #define MAX_NR_PM_REGIONS 256
 
+// a flag of VMA besides the PROGRAM_* permissions: the host memory is shared
+// by all the address spaces instead of being duplicated on fork.
+#define PROGRAM_SHARED (1 << 8)
+
 struct pm_region_operation;
 
 typedef uint64_t pm_region_read_callback(uint64_t addr, int access_size,
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      Spin-wait loops and pause hints. the back edge of a recognized loop
+ *      counts its taken iterations in the hart, see translate_branch.c, and
+ *      the host cpu is yielded once the count reaches SPIN_WAIT_ITERATIONS.
+ */
+
+#include <spin_wait.h>
+#include <translation.h>
+#include <decoder.h>
+#include <vmm_sched.h>
+#include <vmm_smp.h>
+#include <util.h>
+
+static inline int
+is_memory_read(uint8_t operation)
+{
+    // NOTE: SC and AMOs write memory, but only the polled locations.
+    return (operation >= RISCV_OP_LB && operation <= RISCV_OP_LHU) ||
+           (operation >= RISCV_OP_LR_W && operation <= RISCV_OP_AMOMAXU_W);
+}
+
+static inline int
+is_register_operation(uint8_t operation)
+{
+    return (operation >= RISCV_OP_ADDI && operation <= RISCV_OP_AND) ||
+           operation == RISCV_OP_LUI;
+}
+
+static inline int
+is_branch(uint8_t operation)
+{
+    return operation >= RISCV_OP_BEQ && operation <= RISCV_OP_BGEU;
+}
+
+// the source registers of an instruction accepted in a spin loop body.
+static inline uint32_t
+source_registers(struct decoded_instruction * insn)
+{
+    if (is_branch(insn->operation) ||
+        (insn->operation >= RISCV_OP_ADD && insn->operation <= RISCV_OP_AND)) {
+        return (1 << insn->rs1_index) | (1 << insn->rs2_index);
+    } else if (insn->operation >= RISCV_OP_ADDI &&
+               insn->operation <= RISCV_OP_SRAI) {
+        return 1 << insn->rs1_index;
+    }
+    return 0;
+}
+
+int
+spin_loop_recognize(struct prefetch_blob * blob,
+                    struct decoded_instruction * branch)
+{
+    uint32_t branch_pc = blob->next_instruction_to_fetch;
+    uint32_t head = branch_pc + branch->imm;
+    if (branch->imm >= 0 ||
+        branch_pc - head > 4 * (SPIN_LOOP_MAX_INSTRUCTIONS - 1)) {
+        return 0;
+    }
+    // NOTE: the body may be made of compressed instructions.
+    struct decoded_instruction body[2 * SPIN_LOOP_MAX_INSTRUCTIONS];
+    int nr_instructions = 0;
+    uint32_t written = 0;
+    uint32_t bases = 0;
+    int nr_reads = 0;
+    uint32_t pc = head;
+    while (pc < branch_pc) {
+        struct decoded_instruction * insn = &body[nr_instructions++];
+        if (!fetch_fusible_instruction(blob, pc, insn)) {
+            return 0;
+        }
+        if (is_memory_read(insn->operation)) {
+            bases |= 1 << insn->rs1_index;
+            nr_reads++;
+        } else if (!is_register_operation(insn->operation) &&
+                   !is_branch(insn->operation) &&
+                   insn->operation != RISCV_OP_FENCE &&
+                   insn->operation != RISCV_OP_PAUSE) {
+            return 0;
+        }
+        if (!is_branch(insn->operation)) {
+            written |= 1 << insn->rd_index;
+        }
+        pc += insn->length;
+    }
+    // XXX: a base which is stepped in the body walks memory, e.g. strlen or
+    // a list traversal, that's not polling.
+    if (pc != branch_pc || !nr_reads || bases & written & ~1) {
+        return 0;
+    }
+    // XXX: a spin loop exits on a value it loads. a register written in the
+    // body carries its value over iterations if it's read before it's written,
+    // a branch which depends on such a register is a counted loop, e.g.
+    // `lw t1, 0(a0); addi t0, t0, -1; bnez t0, loop`.
+    uint32_t carried = written & ~1;
+    int index = 0;
+    for (; index < nr_instructions; index++) {
+        struct decoded_instruction * insn = &body[index];
+        uint32_t sources = source_registers(insn);
+        if (is_branch(insn->operation)) {
+            if (sources & carried) {
+                return 0;
+            }
+            continue;
+        }
+        uint32_t rd_bit = (1 << insn->rd_index) & ~1;
+        if (!is_memory_read(insn->operation) && sources & carried) {
+            carried |= rd_bit;
+        } else {
+            carried &= ~rd_bit;
+        }
+    }
+    return !(source_registers(branch) & carried);
+}
+
+void
+spin_wait_yield(struct hart * hartptr)
+{
+    hartptr->spin_iterations = 0;
+    __asm__ volatile("pause;");
+    vmm_enter();
+    yield_cpu();
+    vmm_leave();
+}
+
+void
+spin_wait_pause(struct hart * hartptr)
+{
+    __asm__ volatile("pause;");
+    if (++hartptr->spin_iterations >= SPIN_WAIT_ITERATIONS) {
+        hartptr->spin_iterations = 0;
+        vmm_enter();
+        yield_cpu();
+        vmm_leave();
+    }
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      Guest spin-wait loops. the guest threads are multiplexed on one host
+ *      thread, a thread spinning on a lock can't see it released until the
+ *      holder runs, so a spinning thread yields the host cpu after a few
+ *      iterations instead of burning its whole time slice.
+ */
+
+#ifndef _SPIN_WAIT_H
+#define _SPIN_WAIT_H
+#include <stdint.h>
+
+// the body of a spin-wait loop is at most this long, the back edge included.
+#define SPIN_LOOP_MAX_INSTRUCTIONS  8
+
+struct hart;
+struct decoded_instruction;
+struct prefetch_blob;
+
+// whether the conditional branch being translated is the back edge of a
+// spin-wait loop: the body polls the same memory locations and writes memory
+// only by atomics, so only another thread can make it exit.
+int
+spin_loop_recognize(struct prefetch_blob * blob,
+                    struct decoded_instruction * branch);
+
+// the back edge of a spin-wait loop has been taken SPIN_WAIT_ITERATIONS times.
+void
+spin_wait_yield(struct hart * hartptr);
+
+// the guest issues a pause hint.
+void
+spin_wait_pause(struct hart * hartptr);
+
+#endif
@@ -15,9 +15,13 @@
 #include <sys/select.h>
 #include <task.h>
 #include <tinyprintf.h>
+#include <vmm_smp.h>
+#include <vmm_sched.h>
 
 static sys_handler handlers[NR_SYSCALL_LINUX];
 static char * handler_name[NR_SYSCALL_LINUX];
+static uint8_t is_fast_handler[NR_SYSCALL_LINUX];
+static uint8_t is_exclusive_handler[NR_SYSCALL_LINUX];
 
 
 
@@ -33,7 +37,13 @@ do_syscall(struct hart * hartptr, uint32_t syscall_number_a7,
                   hartptr->pc, syscall_number_a7);
         __not_reach();
     }
+    if (is_exclusive_handler[syscall_number_a7]) {
+        vmm_start_exclusive();
+    }
     uint32_t ret = handler(hartptr, arg_a0, arg_a1, arg_a2, arg_a3, arg_a4, arg_a5);
+    if (is_exclusive_handler[syscall_number_a7]) {
+        vmm_end_exclusive();
+    }
     log_trace("pc:%x syscall:(%s no.%d) args[a0:%08x, a1:%08x, a2:%08x, "
               "a3:%08x, a4:%08x, a5:%08x] ret:%08x errno:%d\n",
               hartptr->pc, handler_name[syscall_number_a7], syscall_number_a7,
@@ -41,6 +51,16 @@ do_syscall(struct hart * hartptr, uint32_t syscall_number_a7,
     return ret;
 }
 
+sys_handler
+fast_syscall_handler(uint32_t syscall_number)
+{
+    if (syscall_number >= NR_SYSCALL_LINUX ||
+        !is_fast_handler[syscall_number]) {
+        return NULL;
+    }
+    return handlers[syscall_number];
+}
+
 static uint32_t
 call_getuid(struct hart * hartptr)
 {
@@ -52,9 +72,15 @@ static uint32_t
 call_brk(struct hart * hartptr, uint32_t addr)
 {
     struct virtual_machine * vm = get_linked_vm(hartptr->native_vmptr, LINKAGE_HINT_VM);
-    if (!addr || addr <= vm->vma_heap->addr_high) {
+    if (!addr || addr == vm->vma_heap->addr_high ||
+        addr < vm->vma_heap->addr_low) {
         // return currnet location of program break.
         return vm->vma_heap->addr_high;
+    } else if (addr < vm->vma_heap->addr_high) {
+        // shrink the heap, the host memory is kept as it is.
+        uint32_t addr_high_bak = vm->vma_heap->addr_high;
+        vm->vma_heap->addr_high = addr;
+        invalidate_guest_range(hartptr, addr, addr_high_bak);
     } else {
         ASSERT(addr > vm->vma_heap->addr_high);
         uint32_t addr_high_bak = vm->vma_heap->addr_high;
@@ -63,11 +89,18 @@ call_brk(struct hart * hartptr, uint32_t addr)
             vm->vma_heap->addr_high = addr_high_bak;
             return -ENOMEM;
         }
-        vm->vma_heap->host_base = realloc(vm->vma_heap->host_base,
-                                          vm->vma_heap->addr_high - vm->vma_heap->addr_low);
-        if (!vm->vma_heap->host_base) {
+        void * host_base = realloc(vm->vma_heap->host_base,
+                                   vm->vma_heap->addr_high - vm->vma_heap->addr_low);
+        if (!host_base) {
+            vm->vma_heap->addr_high = addr_high_bak;
             return -ENOMEM;
         }
+        vm->vma_heap->host_base = host_base;
+        // XXX: the memory above the old break is fresh to the guest, it may
+        // hold the data of a previous shrink, or code decoded from there.
+        memset(host_base + (addr_high_bak - vm->vma_heap->addr_low), 0x0,
+               addr - addr_high_bak);
+        invalidate_guest_range(hartptr, addr_high_bak, addr);
     }
     // we have to extend the vma.
     return addr;
@@ -85,6 +118,7 @@ call_uname(struct hart * hartptr, uint32_t utsname_addr)
     strcpy(utsname + 3 * 65, "v2020.03"); //version
     strcpy(utsname + 4 * 65, "riscv32"); //machine
     strcpy(utsname + 5 * 65, "castle"); //domain
+    user_range_written(hartptr, utsname_addr, 6 * 65);
     return 0;
 }
 
@@ -100,8 +134,7 @@ static uint32_t
 call_writev(struct hart * hartptr, uint32_t fd, uint32_t iov_addr,
             uint32_t iovcnt)
 {
-    struct iovec32 * iov_base = user_world_pointer(hartptr, iov_addr);
-    return do_writev(hartptr, fd, iov_base, iovcnt);
+    return do_writev(hartptr, fd, iov_addr, iovcnt);
 }
 
 __attribute__((unused))
@@ -117,7 +150,10 @@ call_statx(struct hart * hartptr, uint32_t dirfd, uint32_t pathname_addr,
 {
     char * pathname = user_world_pointer(hartptr, pathname_addr);
     void * statxbuf = user_world_pointer(hartptr, statxbuf_addr);
-    return do_statx(hartptr, dirfd, pathname, flags, mask, statxbuf);
+    uint32_t ret = do_statx(hartptr, dirfd, pathname, flags, mask, statxbuf);
+    // struct statx is 256 bytes long
+    user_range_written(hartptr, statxbuf_addr, 256);
+    return ret;
 }
 
 
@@ -125,8 +161,7 @@ static uint32_t
 call_write(struct hart * hartptr, uint32_t fd, uint32_t buf_addr,
            uint32_t nr_to_write)
 {
-    void * buf = user_world_pointer(hartptr, buf_addr);
-    return do_write(hartptr, fd, buf, nr_to_write);
+    return do_write(hartptr, fd, buf_addr, nr_to_write);
 }
 
 static uint32_t
@@ -150,6 +185,14 @@ call_exit_group(struct hart * hartptr, uint32_t status)
     return 0;
 }
 
+static uint32_t
+call_sched_yield(struct hart * hartptr)
+{
+    // the task stays runnable, it's queued behind the other runnable tasks.
+    yield_cpu();
+    return 0;
+}
+
 
 static uint32_t
 call_mmap(struct hart * hartptr, uint32_t proposal_addr, uint32_t len,
@@ -169,7 +212,16 @@ call_gettimeofday(struct hart * hartptr, uint32_t tv_addr, uint32_t tz_addr)
 {
     void * tv = tv_addr ? user_world_pointer(hartptr, tv_addr) : NULL; 
     void * tz = tz_addr ? user_world_pointer(hartptr, tz_addr) : NULL;
-    return gettimeofday(tv, tz);
+    uint32_t ret = ERRNO(gettimeofday(tv, NULL));
+    if (tv) {
+        user_range_written(hartptr, tv_addr, sizeof(struct timeval));
+    }
+    // the timezone is obsolete, Linux reports zeros for it as well.
+    if (tz) {
+        memset(tz, 0x0, sizeof(struct timezone));
+        user_range_written(hartptr, tz_addr, sizeof(struct timezone));
+    }
+    return ret;
 }
 
 static uint32_t
@@ -182,8 +234,11 @@ call_ioctl(struct hart * hartptr, uint32_t fd, uint32_t request,
 static uint32_t
 call_read(struct hart * hartptr, uint32_t fd, uint32_t buf_addr, uint32_t count)
 {
-    void * buf = user_world_pointer(hartptr, buf_addr);
-    return do_read(hartptr, fd, buf, count);
+    uint32_t ret = do_read(hartptr, fd, buf_addr, count);
+    if ((int32_t)ret > 0) {
+        user_range_written(hartptr, buf_addr, ret);
+    }
+    return ret;
 }
 
 static uint32_t
@@ -205,7 +260,9 @@ call_clock_gettime(struct hart * hartptr, uint32_t clk_id,
                    uint32_t timespec_addr)
 {
     void * timespec_ptr = user_world_pointer(hartptr, timespec_addr);
-    return clock_gettime(clk_id, timespec_ptr);
+    uint32_t ret = clock_gettime(clk_id, timespec_ptr);
+    user_range_written(hartptr, timespec_addr, sizeof(struct timespec));
+    return ret;
 }
 
 static uint32_t
@@ -221,7 +278,11 @@ call_readlinkat(struct hart * hartptr, uint32_t dirfd, uint32_t pathname_addr,
 {
     char * pathname = user_world_pointer(hartptr, pathname_addr);
     void * buff = user_world_pointer(hartptr, buff_addr);
-    return do_readlinkat(hartptr, dirfd, pathname, buff, buf_size);
+    uint32_t ret = do_readlinkat(hartptr, dirfd, pathname, buff, buf_size);
+    if ((int32_t)ret > 0) {
+        user_range_written(hartptr, buff_addr, ret);
+    }
+    return ret;
 }
 
 static uint32_t
@@ -232,7 +293,11 @@ call_sendfile(struct hart * hartptr, uint32_t out_fd, uint32_t fd,
     if (offset_addr) {
         offset = user_world_pointer(hartptr, offset_addr);
     }
-    return do_sendfile(hartptr, out_fd, fd, offset, count);
+    uint32_t ret = do_sendfile(hartptr, out_fd, fd, offset, count);
+    if (offset) {
+        user_range_written(hartptr, offset_addr, sizeof(off_t));
+    }
+    return ret;
 }
 
 static uint32_t
@@ -283,6 +348,7 @@ call_getcwd(struct hart * hartptr, uint32_t buf_addr, uint32_t size)
 
     uint32_t nchar = strlen(vm->cwd);
     memcpy(buf, vm->cwd, nchar + 1);
+    user_range_written(hartptr, buf_addr, nchar + 1);
     log_debug("cwd of pid %d: %s\n", vm->pid, vm->cwd);
     return nchar + 1;
 }
@@ -338,7 +404,9 @@ static uint32_t
 call_getrlimit(struct hart * hartptr, uint32_t resource, uint32_t rlim_addr)
 {
     void * rlim = user_world_pointer(hartptr, rlim_addr);
-    return ERRNO(getrlimit(resource, rlim));
+    uint32_t ret = ERRNO(getrlimit(resource, rlim));
+    user_range_written(hartptr, rlim_addr, sizeof(struct rlimit));
+    return ret;
 }
 
 static uint32_t
@@ -395,6 +463,9 @@ call_mprotect(struct hart * hartptr, uint32_t addr_addr, uint32_t len,
               uint32_t prot)
 {
     // FIXME: modify pm region attributes
+    // XXX: a guest JIT usually flips the protection of its code buffer around
+    // writing code, drop the translations of the range.
+    invalidate_guest_range(hartptr, addr_addr, addr_addr + len);
     return 0;
 }
 
@@ -437,8 +508,13 @@ syscall_init(void)
     _(94, call_exit_group);
     _(96, call_set_tid_address);
     _(99, call_set_robust_list);
+    _(101, call_nanosleep);
     _(113, call_clock_gettime);
+    _(115, call_clock_nanosleep);
+    _(124, call_sched_yield);
     _(129, call_kill);
+    _(140, call_setpriority);
+    _(141, call_getpriority);
     _(134, call_sigaction);
     _(135, call_sigprocmask);
     _(155, call_getpgid);
@@ -463,4 +539,27 @@ syscall_init(void)
     _(260, call_wait4);
     _(291, call_statx);
 #undef _
+
+    // pure reads, see fast_syscall_handler()
+    memset(is_fast_handler, 0x0, sizeof(is_fast_handler));
+#define _(num) is_fast_handler[num] = 1
+    _(113); // clock_gettime
+    _(169); // gettimeofday
+    _(172); // getpid
+    _(173); // getppid
+    _(174); // getuid
+    _(175); // geteuid
+    _(176); // getgid
+    _(177); // getegid
+#undef _
+
+    // the address space is changed, see vmm_start_exclusive()
+    memset(is_exclusive_handler, 0x0, sizeof(is_exclusive_handler));
+#define _(num) is_exclusive_handler[num] = 1
+    _(214); // brk
+    _(215); // munmap
+    _(220); // clone
+    _(222); // mmap
+    _(226); // mprotect
+#undef _
 }
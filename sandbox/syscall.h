@@ -14,4 +14,12 @@ do_syscall(struct hart * hartptr, uint32_t syscall_number_a7,
            uint32_t arg_a0, uint32_t arg_a1, uint32_t arg_a2,
            uint32_t arg_a3, uint32_t arg_a4, uint32_t arg_a5);
 
+// the handler of a syscall which only reads the state of the vm or the host
+// and takes at most three arguments. it never blocks, yields or redirects the
+// hart, so it may be called from the translation cache directly without
+// leaving it, see riscv_ecall_translator().
+// @return NULL if the syscall must go through do_syscall()
+sys_handler
+fast_syscall_handler(uint32_t syscall_number);
+
 #endif
@@ -17,6 +17,8 @@
 #include <tinyprintf.h>
 #include <app.h>
 #include <wait_queue.h>
+#include <hart_fpu.h>
+#include <vmm_smp.h>
 
 static struct list_elem global_task_list_head;
 
@@ -75,6 +77,38 @@ dump_threads(struct hart * hartptr)
     LIST_FOREACH_END();
 }
 
+void
+for_each_thread_in_address_space(struct hart * hartptr,
+                                 void (*callback)(struct hart *, void *),
+                                 void * arg)
+{
+    struct virtual_machine * vm = get_linked_vm(hartptr->native_vmptr,
+                                                LINKAGE_HINT_VM);
+    // the current task is not necessarily in the global task list.
+    callback(hartptr, arg);
+    struct list_elem * list;
+    LIST_FOREACH_START(&global_task_list_head, list) {
+        struct virtual_machine * _vm = CONTAINER_OF(list, struct virtual_machine, list_node);
+        if (_vm->hartptr == hartptr ||
+            get_linked_vm(_vm, LINKAGE_HINT_VM) != vm) {
+            continue;
+        }
+        callback(_vm->hartptr, arg);
+    }
+    LIST_FOREACH_END();
+}
+
+void
+for_each_task(void (*callback)(struct hart *, void *), void * arg)
+{
+    struct list_elem * list;
+    LIST_FOREACH_START(&global_task_list_head, list) {
+        struct virtual_machine * _vm = CONTAINER_OF(list, struct virtual_machine, list_node);
+        callback(_vm->hartptr, arg);
+    }
+    LIST_FOREACH_END();
+}
+
 static struct virtual_machine *
 allocate_virtual_machine_descriptor(void)
 {
@@ -98,8 +132,17 @@ task_cpu_init(struct virtual_machine * current_vm,
     memcpy(&child_vm->hartptr->registers,
            &current_vm->hartptr->registers,
            sizeof(struct integer_register_profile));
+    fpu_sync_flags(current_vm->hartptr);
+    memcpy(child_vm->hartptr->fregisters, current_vm->hartptr->fregisters,
+           sizeof(child_vm->hartptr->fregisters));
+    child_vm->hartptr->frm = current_vm->hartptr->frm;
+    child_vm->hartptr->fflags = current_vm->hartptr->fflags;
     child_vm->hartptr->registers.a0 = 0;
     child_vm->hartptr->pc = current_vm->hartptr->pc + 4;
+    // the child starts where the parent is in cpu time, a fork bomb gains no
+    // share of the cpu this way.
+    child_vm->hartptr->nice = current_vm->hartptr->nice;
+    child_vm->hartptr->vruntime = current_vm->hartptr->vruntime;
 }
 
 static void
@@ -107,6 +150,8 @@ duplicate_virtual_memory(struct virtual_machine * current_vm,
                          struct virtual_machine * child_vm)
 {
     int idx = 0;
+    memcpy(child_vm->hle_entries, current_vm->hle_entries,
+           sizeof(child_vm->hle_entries));
     child_vm->nr_pmr_ops = current_vm->nr_pmr_ops;
     for (idx = 0; idx < current_vm->nr_pmr_ops; idx++) {
         // XXX: COW semantics are not implemented here for that No single page
@@ -114,6 +159,9 @@ duplicate_virtual_memory(struct virtual_machine * current_vm,
         memcpy(&child_vm->pmr_ops[idx],
                &current_vm->pmr_ops[idx],
                sizeof(struct pm_region_operation));
+        if (child_vm->pmr_ops[idx].flags & PROGRAM_SHARED) {
+            continue;
+        }
         int pmr_len = child_vm->pmr_ops[idx].addr_high - child_vm->pmr_ops[idx].addr_low;
         child_vm->pmr_ops[idx].host_base = preallocate_physical_memory(pmr_len);
         ASSERT(child_vm->pmr_ops[idx].host_base);
@@ -375,11 +423,14 @@ call_clone(struct hart * hartptr, uint32_t flags, uint32_t child_stack_addr,
 #define MAX_NR_ARGV 128
 #define MAX_NR_ENVP 128
 
-uint32_t
-call_execve(struct hart * hartptr,
-            uint32_t filename_addr,
-            uint32_t argv_addr,
-            uint32_t envp_addr)
+// the arguments are copied and the address space is replaced by the new
+// program. the paths and the argument vectors take a large frame, it's left
+// before the new program is resumed, see call_execve()
+static void
+execve_load_program(struct hart * hartptr,
+                    uint32_t filename_addr,
+                    uint32_t argv_addr,
+                    uint32_t envp_addr)
 {
     // XXX: we only receive binary executable file
     char * filename = strdup(user_world_pointer(hartptr, filename_addr));
@@ -409,6 +460,9 @@ call_execve(struct hart * hartptr,
     struct virtual_machine * vm_vm = get_linked_vm(hartptr->native_vmptr, LINKAGE_HINT_VM);
     // Now it's safe to release the virtual memory allocated for previous task,
     // because we do backup all these strings.
+    // NOTE: no other host cpu may access guest memory while the address space
+    // is being replaced.
+    vmm_start_exclusive();
     reclaim_virtual_memory(vm_vm);
 
 
@@ -434,10 +488,14 @@ call_execve(struct hart * hartptr,
     // XXX: MUST flush the translation cache because the instruction stream has
     // changed.
     reset_registers(hartptr);
+    fpu_reset_state(hartptr);
     flush_translation_cache(hartptr);
+    // the whole address space is replaced, so are the code pages.
+    invalidate_guest_range(hartptr, 0, 0xffffffff);
 
     program_init(vm_vm, host_cpath);
     env_setup(vm_vm, host_argv, host_envp);
+    vmm_end_exclusive();
     
     free(filename);
     for (idx = 0; idx < MAX_NR_ARGV && host_argv[idx]; idx++) {
@@ -448,7 +506,15 @@ call_execve(struct hart * hartptr,
     }
 
     log_debug("execve %s in process:%d\n", host_cpath, hartptr->native_vmptr->pid);
-     
+}
+
+uint32_t
+call_execve(struct hart * hartptr,
+            uint32_t filename_addr,
+            uint32_t argv_addr,
+            uint32_t envp_addr)
+{
+    execve_load_program(hartptr, filename_addr, argv_addr, envp_addr);
     // you might yield cpu here, but it's not necessary.
     yield_cpu(); 
     // note a successful execve() will never return.
@@ -570,3 +636,119 @@ call_wait4(struct hart * hartptr,
 
     return ret;
 }
+
+#define PRIO_PROCESS_WHICH  0
+
+static struct hart *
+find_task_by_pid(struct hart * hartptr, uint32_t pid)
+{
+    if (!pid) {
+        return hartptr;
+    }
+    struct list_elem * list;
+    LIST_FOREACH_START(&global_task_list_head, list) {
+        struct virtual_machine * _vm = CONTAINER_OF(list,
+                                                    struct virtual_machine,
+                                                    list_node);
+        if (_vm->pid == pid) {
+            return _vm->hartptr;
+        }
+    }
+    LIST_FOREACH_END();
+    return NULL;
+}
+
+// XXX: only PRIO_PROCESS is supported, the nice value is per task, just like
+// Linux where it's per thread.
+uint32_t
+call_setpriority(struct hart * hartptr, uint32_t which, uint32_t who,
+                 int32_t nice)
+{
+    if (which != PRIO_PROCESS_WHICH) {
+        return -EINVAL;
+    }
+    struct hart * task = find_task_by_pid(hartptr, who);
+    if (!task) {
+        return -ESRCH;
+    }
+    set_task_nice(task, nice);
+    return 0;
+}
+
+uint32_t
+call_getpriority(struct hart * hartptr, uint32_t which, uint32_t who)
+{
+    if (which != PRIO_PROCESS_WHICH) {
+        return -EINVAL;
+    }
+    struct hart * task = find_task_by_pid(hartptr, who);
+    if (!task) {
+        return -ESRCH;
+    }
+    // the raw syscall returns 20 - nice, which is never negative.
+    return 20 - task->nice;
+}
+
+#define NANOSECONDS(ts) ((ts)->tv_sec * 1000000000ull + (ts)->tv_nsec)
+
+// the time left is stored at rem_addr if the task is woken up before the
+// deadline, -EINTR is returned then.
+static uint32_t
+do_nanosleep(struct hart * hartptr, uint64_t deadline, uint32_t rem_addr)
+{
+    // the task is parked on the sleeping list only, nothing scans it until
+    // the deadline, see process_sleeping_list().
+    enqueue_sleeping_task(hartptr, deadline);
+    transit_state(hartptr, TASK_STATE_INTERRUPTIBLE);
+    yield_cpu();
+    dequeue_sleeping_task(hartptr);
+    uint64_t now = monotonic_nanoseconds();
+    if (now >= deadline) {
+        return 0;
+    }
+    if (rem_addr) {
+        struct timespec * rem = user_world_pointer(hartptr, rem_addr);
+        rem->tv_sec = (deadline - now) / 1000000000;
+        rem->tv_nsec = (deadline - now) % 1000000000;
+        user_range_written(hartptr, rem_addr, sizeof(struct timespec));
+    }
+    return -EINTR;
+}
+
+uint32_t
+call_nanosleep(struct hart * hartptr, uint32_t req_addr, uint32_t rem_addr)
+{
+    struct timespec * req = user_world_pointer(hartptr, req_addr);
+    if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000) {
+        return -EINVAL;
+    }
+    return do_nanosleep(hartptr, monotonic_nanoseconds() + NANOSECONDS(req),
+                        rem_addr);
+}
+
+#define TIMER_ABSTIME_MASK  0x1
+
+uint32_t
+call_clock_nanosleep(struct hart * hartptr, uint32_t clk_id, uint32_t flags,
+                     uint32_t req_addr, uint32_t rem_addr)
+{
+    struct timespec * req = user_world_pointer(hartptr, req_addr);
+    if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000) {
+        return -EINVAL;
+    }
+    if (clk_id != CLOCK_REALTIME && clk_id != CLOCK_MONOTONIC) {
+        return -EINVAL;
+    }
+    uint64_t now = monotonic_nanoseconds();
+    uint64_t deadline = now + NANOSECONDS(req);
+    // NOTE: an absolute sleep has nothing to report in rem.
+    if (flags & TIMER_ABSTIME_MASK) {
+        rem_addr = 0;
+        // the sleeping list is driven by the monotonic clock.
+        struct timespec clock_now;
+        clock_gettime(clk_id, &clock_now);
+        deadline = NANOSECONDS(req) > NANOSECONDS(&clock_now) ?
+                   now + NANOSECONDS(req) - NANOSECONDS(&clock_now) : now;
+    }
+    return do_nanosleep(hartptr, deadline, rem_addr);
+}
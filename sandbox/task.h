@@ -15,6 +15,17 @@ dump_threads(struct hart * hartptr);
 void
 raw_task_wake_up(struct hart * task);
 
+// invoke the callback against every thread sharing the address space with
+// hartptr, hartptr itself included.
+void
+for_each_thread_in_address_space(struct hart * hartptr,
+                                 void (*callback)(struct hart *, void *),
+                                 void * arg);
+
+// invoke the callback against every registered task.
+void
+for_each_task(void (*callback)(struct hart *, void *), void * arg);
+
 void
 register_task(struct virtual_machine * vm);
 
@@ -32,6 +43,20 @@ call_wait4(struct hart * hartptr,
            uint32_t options,
            uint32_t rusage_addr);
 
+uint32_t
+call_setpriority(struct hart * hartptr, uint32_t which, uint32_t who,
+                 int32_t nice);
+
+uint32_t
+call_getpriority(struct hart * hartptr, uint32_t which, uint32_t who);
+
+uint32_t
+call_nanosleep(struct hart * hartptr, uint32_t req_addr, uint32_t rem_addr);
+
+uint32_t
+call_clock_nanosleep(struct hart * hartptr, uint32_t clk_id, uint32_t flags,
+                     uint32_t req_addr, uint32_t rem_addr);
+
 uint32_t
 call_execve(struct hart * hartptr,
             uint32_t filename_addr,
@@ -5,14 +5,53 @@
 #include <task_sched.h>
 #include <vm.h>
 #include <task.h>
+#include <vmm_smp.h>
 
 // REF: https://github.com/chillancezen/ZeldaOS/blob/master/kernel/task.c
 
-struct hart * current;
+__thread struct hart * current;
 
-static struct list_elem running_tasks;
-static struct list_elem blocking_tasks;
+// every host cpu has its own run queue, a task is queued on the host cpu
+// which makes it runnable and an idle host cpu steals tasks from the others.
+// all of them are guarded by the vmm lock, see vmm_smp.h
+// a run queue is a min-heap of the tasks keyed by their virtual runtime, the
+// task which has received the least cpu time for its weight runs next.
+struct run_queue {
+    struct hart ** tasks;
+    int nr_tasks;
+    int capacity;
+    // it never goes backwards, a woken or stolen task is placed relative to it.
+    uint64_t min_vruntime;
+};
+
+#define NICE_0_WEIGHT   1024
+
+// REF: kernel/sched/core.c, each nice level is about 10% of cpu time apart.
+static const uint32_t nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15,
+};
+
+// a woken task is placed this much ahead of min_vruntime, so that a task
+// which mostly sleeps gets the cpu soon after its wake-up.
+#define SCHED_WAKEUP_BONUS_NS   (VMM_SCHED_MSECONDS * 1000000ull / 2)
+// the current task is preempted by a woken task only if it's ahead by more
+// than this, it keeps the task switches from ping-ponging.
+#define SCHED_WAKEUP_GRANULARITY_NS 1000000ull
+
+static struct run_queue run_queues[VMM_MAX_HOST_CPUS];
 static struct list_elem exiting_tasks;
+// the sleeping tasks are sorted by their deadlines, only the expired ones at
+// the head are looked at when a task is picked.
+static struct list_elem sleeping_tasks;
+// the deadline at the head of the sleeping list, it's read without the lock.
+static uint64_t earliest_sleep_deadline = UINT64_MAX;
 
 static enum task_state transition_table[TASK_STATE_MAX][TASK_STATE_MAX];
 
@@ -76,20 +115,152 @@ transit_state(struct hart * hartptr, enum task_state target_state)
               hartptr->native_vmptr->pid,
               task_state_to_string(prev_state),
               task_state_to_string(target_state));
+    // XXX: a parked task being woken up is queued right now, so picking the
+    // next task never has to scan the blocked tasks. the current task is
+    // queued when it yields cpu.
+    if (hartptr != current &&
+        (prev_state == TASK_STATE_INTERRUPTIBLE ||
+         prev_state == TASK_STATE_UNINTERRUPTIBLE) &&
+        (target_state == TASK_STATE_RUNNING ||
+         target_state == TASK_STATE_EXITING)) {
+        schedule_task(hartptr);
+    }
+}
+
+
+static void
+run_queue_sift_up(struct run_queue * rq, int idx)
+{
+    struct hart * task = rq->tasks[idx];
+    while (idx) {
+        int parent = (idx - 1) / 2;
+        if (rq->tasks[parent]->vruntime <= task->vruntime) {
+            break;
+        }
+        rq->tasks[idx] = rq->tasks[parent];
+        idx = parent;
+    }
+    rq->tasks[idx] = task;
+}
+
+static void
+run_queue_sift_down(struct run_queue * rq, int idx)
+{
+    struct hart * task = rq->tasks[idx];
+    while (1) {
+        int child = idx * 2 + 1;
+        if (child >= rq->nr_tasks) {
+            break;
+        }
+        if (child + 1 < rq->nr_tasks &&
+            rq->tasks[child + 1]->vruntime < rq->tasks[child]->vruntime) {
+            child++;
+        }
+        if (task->vruntime <= rq->tasks[child]->vruntime) {
+            break;
+        }
+        rq->tasks[idx] = rq->tasks[child];
+        idx = child;
+    }
+    rq->tasks[idx] = task;
+}
+
+static void
+run_queue_push(struct run_queue * rq, struct hart * hartptr)
+{
+    if (rq->nr_tasks == rq->capacity) {
+        rq->capacity = rq->capacity ? rq->capacity * 2 : 64;
+        rq->tasks = realloc(rq->tasks, rq->capacity * sizeof(struct hart *));
+        ASSERT(rq->tasks);
+    }
+    rq->tasks[rq->nr_tasks++] = hartptr;
+    run_queue_sift_up(rq, rq->nr_tasks - 1);
+}
+
+static struct hart *
+run_queue_pop_min(struct run_queue * rq)
+{
+    if (!rq->nr_tasks) {
+        return NULL;
+    }
+    struct hart * hartptr = rq->tasks[0];
+    rq->tasks[0] = rq->tasks[--rq->nr_tasks];
+    if (rq->nr_tasks) {
+        run_queue_sift_down(rq, 0);
+    }
+    rq->min_vruntime = MAX(rq->min_vruntime, hartptr->vruntime);
+    return hartptr;
+}
+
+static void
+update_task_runtime(struct hart * hartptr)
+{
+    uint64_t now = monotonic_nanoseconds();
+    if (hartptr->exec_start && now > hartptr->exec_start) {
+        // a heavier task's virtual runtime advances more slowly.
+        hartptr->vruntime += (now - hartptr->exec_start) * NICE_0_WEIGHT /
+                             nice_to_weight[hartptr->nice - NICE_MIN];
+    }
+    hartptr->exec_start = now;
+}
+
+void
+task_switched_in(struct hart * hartptr)
+{
+    hartptr->exec_start = monotonic_nanoseconds();
+}
+
+void
+task_switched_out(struct hart * hartptr)
+{
+    update_task_runtime(hartptr);
+    hartptr->exec_start = 0;
+}
+
+void
+set_task_nice(struct hart * hartptr, int nice)
+{
+    hartptr->nice = MIN(MAX(nice, NICE_MIN), NICE_MAX);
 }
 
+// the current task of the host cpu is preempted at its next dispatch if the
+// woken task has received much less cpu time.
+static void
+check_wakeup_preemption(struct hart * hartptr)
+{
+    if (!current || !current->native_vmptr ||
+        current->state != TASK_STATE_RUNNING) {
+        return;
+    }
+    update_task_runtime(current);
+    if (hartptr->vruntime + SCHED_WAKEUP_GRANULARITY_NS < current->vruntime) {
+        vmm_request_resched();
+    }
+}
 
 void
 schedule_task(struct hart * hartptr)
 {
+    struct run_queue * rq = &run_queues[host_cpu_id];
     switch(hartptr->state)
     {
         case TASK_STATE_RUNNING:
-            list_append(&running_tasks, &hartptr->list);
+            if (hartptr != current) {
+                // a woken or a new task: it may have slept for long, its
+                // virtual runtime is caught up with the run queue but it
+                // still gets a little bonus.
+                uint64_t floor = rq->min_vruntime > SCHED_WAKEUP_BONUS_NS ?
+                                 rq->min_vruntime - SCHED_WAKEUP_BONUS_NS : 0;
+                hartptr->vruntime = MAX(hartptr->vruntime, floor);
+                check_wakeup_preemption(hartptr);
+            }
+            run_queue_push(rq, hartptr);
+            vmm_task_runnable();
             break;
         case TASK_STATE_INTERRUPTIBLE:
         case TASK_STATE_UNINTERRUPTIBLE:
-            list_append(&blocking_tasks, &hartptr->list);
+            // a blocked task is parked on its wait queues only, it's put back
+            // onto a run queue when it's woken up.
             break;
         case TASK_STATE_EXITING:
             list_append(&exiting_tasks, &hartptr->list);
@@ -103,29 +274,77 @@ schedule_task(struct hart * hartptr)
               task_state_to_string(hartptr->state));
 }
 
+static void
+update_earliest_sleep_deadline(void)
+{
+    struct list_elem * list = list_first_elem(&sleeping_tasks);
+    uint64_t deadline = UINT64_MAX;
+    if (list) {
+        struct hart * hartptr = CONTAINER_OF(list, struct hart, sleep_list);
+        deadline = hartptr->sleep_deadline;
+    }
+    __atomic_store_n(&earliest_sleep_deadline, deadline, __ATOMIC_RELAXED);
+}
+
 void
-process_blocking_list(void)
+enqueue_sleeping_task(struct hart * hartptr, uint64_t deadline)
 {
-    struct list_elem * _list = NULL;
-    struct hart * hartptr = NULL;
-    LIST_FOREACH_START(&blocking_tasks, _list) {
-        hartptr = CONTAINER_OF(_list, struct hart, list);
-        switch(hartptr->state)
-        {
-            case TASK_STATE_RUNNING:
-            case TASK_STATE_EXITING:
-                list_delete(&blocking_tasks, _list);
-                schedule_task(hartptr);
-                break;
-            case TASK_STATE_INTERRUPTIBLE:
-            case TASK_STATE_UNINTERRUPTIBLE:
-                break;
-            default:
-                __not_reach();
-                break;
+    struct list_elem * list = NULL;
+    hartptr->sleep_deadline = deadline;
+    // NOTE: the queue is walked from the tail, a later deadline is more common.
+    for (list = list_last_elem(&sleeping_tasks); list; list = list->prev) {
+        struct hart * task = CONTAINER_OF(list, struct hart, sleep_list);
+        if (task->sleep_deadline <= deadline) {
+            break;
         }
     }
-    LIST_FOREACH_END();
+    if (!list) {
+        list_prepend(&sleeping_tasks, &hartptr->sleep_list);
+    } else if (!list->next) {
+        list_append(&sleeping_tasks, &hartptr->sleep_list);
+    } else {
+        hartptr->sleep_list.prev = list;
+        hartptr->sleep_list.next = list->next;
+        list->next->prev = &hartptr->sleep_list;
+        list->next = &hartptr->sleep_list;
+    }
+    update_earliest_sleep_deadline();
+}
+
+void
+dequeue_sleeping_task(struct hart * hartptr)
+{
+    if (element_in_list(&sleeping_tasks, &hartptr->sleep_list)) {
+        list_delete(&sleeping_tasks, &hartptr->sleep_list);
+        update_earliest_sleep_deadline();
+    }
+}
+
+int
+sleeping_task_due(uint64_t now)
+{
+    return __atomic_load_n(&earliest_sleep_deadline, __ATOMIC_RELAXED) <= now;
+}
+
+void
+process_sleeping_list(void)
+{
+    if (list_empty(&sleeping_tasks)) {
+        return;
+    }
+    struct list_elem * list = NULL;
+    uint64_t now = monotonic_nanoseconds();
+    while ((list = list_first_elem(&sleeping_tasks))) {
+        struct hart * hartptr = CONTAINER_OF(list, struct hart, sleep_list);
+        if (hartptr->sleep_deadline > now) {
+            break;
+        }
+        list_fetch(&sleeping_tasks);
+        if (hartptr->state == TASK_STATE_INTERRUPTIBLE) {
+            transit_state(hartptr, TASK_STATE_RUNNING);
+        }
+    }
+    update_earliest_sleep_deadline();
 }
 
 void
@@ -142,14 +361,47 @@ process_exiting_list(void)
     }
 }
 
+// move half of the tasks of the busiest run queue to the local one, they are
+// taken from the tail of the heap which keeps the heap valid, these are the
+// leaves which tend to have received more cpu time. the virtual runtime is
+// carried over relative to min_vruntime of either run queue.
+static void
+steal_tasks(struct run_queue * local)
+{
+    struct run_queue * victim = NULL;
+    int nr_cpus = vmm_nr_host_cpus();
+    int idx = 0;
+    for (idx = 0; idx < nr_cpus; idx++) {
+        if (&run_queues[idx] != local && run_queues[idx].nr_tasks &&
+            (!victim || run_queues[idx].nr_tasks > victim->nr_tasks)) {
+            victim = &run_queues[idx];
+        }
+    }
+    if (!victim) {
+        return;
+    }
+    int nr_stolen = (victim->nr_tasks + 1) / 2;
+    log_trace("host cpu %d steals %d task(s) from host cpu %d\n", host_cpu_id,
+              nr_stolen, (int)(victim - run_queues));
+    for (idx = 0; idx < nr_stolen; idx++) {
+        struct hart * hartptr = victim->tasks[--victim->nr_tasks];
+        uint64_t lag = hartptr->vruntime > victim->min_vruntime ?
+                       hartptr->vruntime - victim->min_vruntime : 0;
+        hartptr->vruntime = local->min_vruntime + lag;
+        run_queue_push(local, hartptr);
+    }
+}
+
 struct hart *
 process_running_list(void)
 {
-    struct list_elem * list = NULL;
     struct hart * hartptr = NULL;
     struct hart * next_task = NULL;
-    while ((list = list_fetch(&running_tasks))) {
-        hartptr = CONTAINER_OF(list, struct hart, list);
+    struct run_queue * local = &run_queues[host_cpu_id];
+    if (!local->nr_tasks) {
+        steal_tasks(local);
+    }
+    while ((hartptr = run_queue_pop_min(local))) {
         if (hartptr->state == TASK_STATE_RUNNING) {
             next_task = hartptr;
             break;
@@ -163,7 +415,7 @@ process_running_list(void)
 __attribute__((constructor)) void
 sched_pre_init(void)
 {
-    list_init(&running_tasks);
-    list_init(&blocking_tasks);
+    memset(run_queues, 0x0, sizeof(run_queues));
     list_init(&exiting_tasks);
+    list_init(&sleeping_tasks);
 }
@@ -5,18 +5,44 @@
 #define _TASK_SCHED_H
 #include <hart.h>
 
-// The only one `current`: task indicator
-extern struct hart * current;
+// `current`: the task running on the host cpu, see vmm_smp.h
+extern __thread struct hart * current;
 
 void
 schedule_task(struct hart * hartptr);
 
+// the cpu time of a task is accounted from the moment it's switched in until
+// it's switched out, weighted by its nice value.
 void
-process_blocking_list(void);
+task_switched_in(struct hart * hartptr);
+
+void
+task_switched_out(struct hart * hartptr);
+
+#define NICE_MIN    -20
+#define NICE_MAX    19
+
+void
+set_task_nice(struct hart * hartptr, int nice);
 
 void
 process_exiting_list(void);
 
+// queue the task until the monotonic clock reaches the deadline (in
+// nanoseconds), it's woken up by process_sleeping_list().
+void
+enqueue_sleeping_task(struct hart * hartptr, uint64_t deadline);
+
+void
+dequeue_sleeping_task(struct hart * hartptr);
+
+void
+process_sleeping_list(void);
+
+// whether a sleeping task is due, it's called without the vmm lock.
+int
+sleeping_task_due(uint64_t now);
+
 void
 task_vmm_sched_init(struct hart * hartptr,
                     void (*next_func)(void * opaque),
@@ -5,6 +5,50 @@
 #include <translation.h>
 #include <util.h>
 #include <mmu.h>
+#include <vmm_smp.h>
+
+// NOTE: the slow paths serve the interpreter tier and LR/SC, they operate on
+// the host address of the guest word with host atomics as the translated AMOs
+// do, so both tiers are atomic against each other.
+
+// XXX: a word outside the directly addressable regions, e.g. in the vvar page,
+// has no host address. the AMO is then a read-modify-write through the mmu
+// under the vmm lock, the old value is returned.
+static uint32_t
+amo_emulated(struct hart * hartptr, uint32_t funct5, uint32_t location,
+             uint32_t rs2)
+{
+    vmm_enter();
+    uint32_t value = mmu_read32(hartptr, location);
+    uint32_t result = 0;
+    switch (funct5)
+    {
+        case 0x0:
+            result = value + rs2;
+            break;
+        case 0x1:
+            result = rs2;
+            break;
+        case 0x4:
+            result = value ^ rs2;
+            break;
+        case 0x8:
+            result = value | rs2;
+            break;
+        case 0xc:
+            result = value & rs2;
+            break;
+        case 0x1c:
+            result = value > rs2 ? value : rs2;
+            break;
+        default:
+            __not_reach();
+            break;
+    }
+    mmu_write32(hartptr, location, result);
+    vmm_leave();
+    return value;
+}
 
 static void
 amoadd_slowpath(struct hart * hartptr, uint8_t rs1_index, uint8_t rs2_index,
@@ -15,8 +59,9 @@ amoadd_slowpath(struct hart * hartptr, uint8_t rs1_index, uint8_t rs2_index,
     // getting wrong.
     uint32_t rs1 = regs[rs1_index];
     uint32_t rs2 = regs[rs2_index];
-    regs[rd_index]= mmu_read32_aligned(hartptr, rs1);
-    mmu_write32_aligned(hartptr, rs1, regs[rd_index] + rs2);
+    uint32_t * word = mmu_atomic_address(hartptr, rs1, 0);
+    regs[rd_index] = word ? __atomic_fetch_add(word, rs2, __ATOMIC_SEQ_CST) :
+                     amo_emulated(hartptr, 0x0, rs1, rs2);
 }
 
 
@@ -27,39 +72,34 @@ amoswap_slowpath(struct hart * hartptr, uint8_t rs1_index, uint8_t rs2_index,
     uint32_t * regs = (uint32_t *)&hartptr->registers;
     uint32_t rs1 = regs[rs1_index];
     uint32_t rs2 = regs[rs2_index];
-    regs[rd_index]= mmu_read32_aligned(hartptr, rs1);
-    mmu_write32_aligned(hartptr, rs1, rs2);
+    uint32_t * word = mmu_atomic_address(hartptr, rs1, 0);
+    regs[rd_index] = word ? __atomic_exchange_n(word, rs2, __ATOMIC_SEQ_CST) :
+                     amo_emulated(hartptr, 0x1, rs1, rs2);
 }
 
-struct address_reservation_item {
-    uint32_t addr;
-    uint32_t valid:1;
-    uint32_t hartid:8;
-};
-// FIXME: GUARD ALL THE CRITICAL RESOURCE IF WE ARE GOING TO REALIZE SMP
-#define MAX_RESERVATION_ITEMS   16
-static struct address_reservation_item reservations[MAX_RESERVATION_ITEMS];
-static int next_pointer = 0;
-
+// XXX: the reservation is per hart and remembers the loaded value, the SC is a
+// compare-and-swap against that value. a store of the same value by another
+// hart in between is not detected, which is harmless for lock-free algorithms
+// built on LR/SC in practice.
 static void
 lr_slowpath(struct hart * hartptr, uint8_t rs1_index, uint8_t rs2_index,
                 uint8_t rd_index)
 {
     uint32_t * regs = (uint32_t *)&hartptr->registers;
     uint32_t rs1 = regs[rs1_index];
-    regs[rd_index]= mmu_read32_aligned(hartptr, rs1);
-    // MAKE A RESERVATION FOR ADDRESS RS1
-    int idx = 0;
-    for (idx = 0; idx < MAX_RESERVATION_ITEMS; idx++) {
-        if (!reservations[idx].valid) {
-            next_pointer = idx;
-            break;
-        }
+    uint32_t * word = mmu_atomic_address(hartptr, rs1, 1);
+    uint32_t value;
+    if (word) {
+        value = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+    } else {
+        vmm_enter();
+        value = mmu_read32(hartptr, rs1);
+        vmm_leave();
     }
-    reservations[next_pointer].addr = rs1;
-    reservations[next_pointer].valid = 1;
-    reservations[next_pointer].hartid = hartptr->hart_id;
-    next_pointer = (next_pointer + 1) % MAX_RESERVATION_ITEMS;
+    hartptr->reservation_address = rs1;
+    hartptr->reservation_value = value;
+    hartptr->reservation_valid = 1;
+    regs[rd_index] = value;
     log_trace("lr.w address reservation:0x%08x\n", rs1);
 }
 
@@ -70,23 +110,26 @@ sc_slowpath(struct hart * hartptr, uint8_t rs1_index, uint8_t rs2_index,
     uint32_t * regs = (uint32_t *)&hartptr->registers;
     uint32_t rs1 = regs[rs1_index];
     uint32_t rs2 = regs[rs2_index];
-    int idx = 0;
-    for (; idx < MAX_RESERVATION_ITEMS; idx++) {
-        if (reservations[idx].valid &&
-            reservations[idx].addr == rs1 &&
-            reservations[idx].hartid == hartptr->hart_id) {
-            break;
-        } 
-    }
-    if (idx < MAX_RESERVATION_ITEMS) {
-        // FOUND A VALID RESERVATION ITEM
-        regs[rd_index] = 0x0;
-        mmu_write32_aligned(hartptr, rs1, rs2);
-        // CLEAR ADDRESS RESERVATION
-        reservations[idx].valid = 0;
-    } else {
-        regs[rd_index] = 0x1;
+    int success = 0;
+    if (hartptr->reservation_valid && hartptr->reservation_address == rs1) {
+        uint32_t * word = mmu_atomic_address(hartptr, rs1, 0);
+        uint32_t expected = hartptr->reservation_value;
+        if (word) {
+            success = __atomic_compare_exchange_n(word, &expected, rs2, 0,
+                                                  __ATOMIC_SEQ_CST,
+                                                  __ATOMIC_SEQ_CST);
+        } else {
+            vmm_enter();
+            success = mmu_read32(hartptr, rs1) == expected;
+            if (success) {
+                mmu_write32(hartptr, rs1, rs2);
+            }
+            vmm_leave();
+        }
     }
+    // CLEAR ADDRESS RESERVATION whatever the result is.
+    hartptr->reservation_valid = 0;
+    regs[rd_index] = success ? 0x0 : 0x1;
 
     log_trace("lr.w address reservation:0x%08x %s\n", rs1, regs[rd_index] == 0 ? "succees" : "failure");
 }
@@ -98,8 +141,9 @@ amoxor_slowpath(struct hart * hartptr, uint8_t rs1_index, uint8_t rs2_index,
     uint32_t * regs = (uint32_t *)&hartptr->registers;
     uint32_t rs1 = regs[rs1_index];
     uint32_t rs2 = regs[rs2_index];
-    regs[rd_index]= mmu_read32_aligned(hartptr, rs1);
-    mmu_write32_aligned(hartptr, rs1, regs[rd_index] ^ rs2);
+    uint32_t * word = mmu_atomic_address(hartptr, rs1, 0);
+    regs[rd_index] = word ? __atomic_fetch_xor(word, rs2, __ATOMIC_SEQ_CST) :
+                     amo_emulated(hartptr, 0x4, rs1, rs2);
 }
 
 static void
@@ -109,8 +153,9 @@ amoor_slowpath(struct hart * hartptr, uint8_t rs1_index, uint8_t rs2_index,
     uint32_t * regs = (uint32_t *)&hartptr->registers;
     uint32_t rs1 = regs[rs1_index];
     uint32_t rs2 = regs[rs2_index];
-    regs[rd_index]= mmu_read32_aligned(hartptr, rs1);
-    mmu_write32_aligned(hartptr, rs1, regs[rd_index] | rs2);
+    uint32_t * word = mmu_atomic_address(hartptr, rs1, 0);
+    regs[rd_index] = word ? __atomic_fetch_or(word, rs2, __ATOMIC_SEQ_CST) :
+                     amo_emulated(hartptr, 0x8, rs1, rs2);
 }
 
 static void
@@ -120,8 +165,9 @@ amoand_slowpath(struct hart * hartptr, uint8_t rs1_index, uint8_t rs2_index,
     uint32_t * regs = (uint32_t *)&hartptr->registers;
     uint32_t rs1 = regs[rs1_index];
     uint32_t rs2 = regs[rs2_index];
-    regs[rd_index]= mmu_read32_aligned(hartptr, rs1);
-    mmu_write32_aligned(hartptr, rs1, regs[rd_index] & rs2);
+    uint32_t * word = mmu_atomic_address(hartptr, rs1, 0);
+    regs[rd_index] = word ? __atomic_fetch_and(word, rs2, __ATOMIC_SEQ_CST) :
+                     amo_emulated(hartptr, 0xc, rs1, rs2);
 }
 
 static void
@@ -131,8 +177,16 @@ amomaxu_slowpath(struct hart * hartptr, uint8_t rs1_index, uint8_t rs2_index,
     uint32_t * regs = (uint32_t *)&hartptr->registers;
     uint32_t rs1 = regs[rs1_index];
     uint32_t rs2 = regs[rs2_index];
-    regs[rd_index]= mmu_read32_aligned(hartptr, rs1);
-    mmu_write32_aligned(hartptr, rs1, regs[rd_index] > rs2 ? regs[rd_index] : rs2);
+    uint32_t * word = mmu_atomic_address(hartptr, rs1, 0);
+    if (!word) {
+        regs[rd_index] = amo_emulated(hartptr, 0x1c, rs1, rs2);
+        return;
+    }
+    uint32_t value = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+    while (!__atomic_compare_exchange_n(word, &value, value > rs2 ? value : rs2,
+                                        0, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_SEQ_CST));
+    regs[rd_index] = value;
 }
 
 void
@@ -159,9 +213,11 @@ amo_instruction_slowpath(struct hart * hartptr, uint8_t rs1_index,
     }
 #undef _
 }
+// LR/SC are translated into calls to their slow paths which maintain the
+// reservation.
 static void
-riscv_amo_translator(struct decoding * dec, struct prefetch_blob * blob,
-                        uint32_t instruction)
+riscv_amo_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -179,9 +235,7 @@ riscv_amo_translator(struct decoding * dec, struct prefetch_blob * blob,
                      "movl "PIC_PARAM(2)", %%ecx;"
                      "movl "PIC_PARAM(3)", %%r8d;"
                      "movq $amo_instruction_slowpath, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;"
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE()
                      RESET_ZERO_REGISTER()
                      PROCEED_TO_NEXT_INSTRUCTION()
                      END_INSTRUCTION(amo_instruction)
@@ -199,40 +253,272 @@ riscv_amo_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rs1_index,
             dec->rs2_index,
             dec->rd_index,
-            dec->funct7 >> 2
+            dec->imm
         END_PARAM()
     COMMIT_TRANSLATION(amo_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
-static instruction_sub_translator per_funct5_handlers[32];
 
-void
-riscv_amo_instructions_translation_entry(struct prefetch_blob * blob,
-                                         uint32_t instruction)
-{
-    struct decoding dec;
-    instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_R);
-    uint8_t funct5 = dec.funct7 >> 2;
-    if (!per_funct5_handlers[funct5]) {
-        printf("instruction_linear_address:%x\n", blob->next_instruction_to_fetch);
-    }
-    ASSERT(per_funct5_handlers[funct5]);
-    per_funct5_handlers[funct5](&dec, blob, instruction);
+// The AMO templates resolve the host address of the word in RS1 and perform
+// the operation with a host atomic instruction in place. a word without host
+// address is left to the slow path, it jumps to the label 3 at the end.
+//  PARAM0: rs1 index, PARAM1: rs2 index, PARAM2: rd index, PARAM3: funct5
+#define AMO_RESOLVE_ADDRESS()                                                  \
+        "movl "PIC_PARAM(0)", %%esi;"                                          \
+        "shl $2, %%esi;"                                                       \
+        "addq %%r15, %%rsi;"                                                   \
+        "movl (%%rsi), %%esi;"                                                 \
+        "movq %%r12, %%rdi;"                                                   \
+        "xorl %%edx, %%edx;"                                                   \
+        "movq $mmu_atomic_address, %%rax;"                                     \
+        CALL_HELPER_OUT_OF_LINE() /*RAX: the host address*/                    \
+        "testq %%rax, %%rax;"                                                  \
+        "jnz 2f;"                                                              \
+        "movq %%r12, %%rdi;"                                                   \
+        "movl "PIC_PARAM(0)", %%esi;"                                          \
+        "movl "PIC_PARAM(1)", %%edx;"                                          \
+        "movl "PIC_PARAM(2)", %%ecx;"                                          \
+        "movl "PIC_PARAM(3)", %%r8d;"                                          \
+        "movq $amo_instruction_slowpath, %%rax;"                               \
+        CALL_HELPER_OUT_OF_LINE()                                              \
+        "jmp 3f;"                                                              \
+        "2:"                                                                   \
+        "movq %%rax, %%rsi;"                                                   \
+        "movl "PIC_PARAM(1)", %%edx;"                                          \
+        "shl $2, %%edx;"                                                       \
+        "addq %%r15, %%rdx;"                                                   \
+        "movl (%%rdx), %%edx;" /*EDX: rs2*/
+
+// the old value in EAX goes to rd
+#define AMO_WRITE_BACK()                                                       \
+        "movl "PIC_PARAM(2)", %%ecx;"                                          \
+        "shl $2, %%ecx;"                                                       \
+        "addq %%r15, %%rcx;"                                                   \
+        "movl %%eax, (%%rcx);"                                                 \
+        "3:"                                                                   \
+        RESET_ZERO_REGISTER()
+
+// x86 has no fetch-and-op for the logical operations, they are done with a
+// lock cmpxchg loop on the old value in EAX, the new value is built in ECX.
+#define AMO_CMPXCHG_LOOP(op)                                                   \
+        "movl (%%rsi), %%eax;"                                                 \
+        "1:"                                                                   \
+        "movl %%eax, %%ecx;"                                                   \
+        op                                                                     \
+        "lock cmpxchgl %%ecx, (%%rsi);"                                        \
+        "jne 1b;"
+
+static void
+riscv_amoadd_translator(struct decoded_instruction * dec,
+                        struct prefetch_blob * blob)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    PRECHECK_TRANSLATION_CACHE(amoadd_instruction, blob);
+    BEGIN_TRANSLATION(amoadd_instruction);
+    __asm__ volatile(AMO_RESOLVE_ADDRESS()
+                     "lock xaddl %%edx, (%%rsi);"
+                     "movl %%edx, %%eax;"
+                     AMO_WRITE_BACK()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     END_INSTRUCTION(amoadd_instruction)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*rs1 index*/
+            PARAM32() /*rs2 index*/
+            PARAM32() /*rd index*/
+            PARAM32() /*funct5*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(amoadd_instruction);
+        BEGIN_PARAM(amoadd_instruction)
+            dec->rs1_index,
+            dec->rs2_index,
+            dec->rd_index,
+            dec->imm
+        END_PARAM()
+    COMMIT_TRANSLATION(amoadd_instruction, hartptr, instruction_linear_address);
+    blob->next_instruction_to_fetch += dec->length;
+}
+
+static void
+riscv_amoswap_translator(struct decoded_instruction * dec,
+                         struct prefetch_blob * blob)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    PRECHECK_TRANSLATION_CACHE(amoswap_instruction, blob);
+    BEGIN_TRANSLATION(amoswap_instruction);
+    __asm__ volatile(AMO_RESOLVE_ADDRESS()
+                     "xchgl %%edx, (%%rsi);"
+                     "movl %%edx, %%eax;"
+                     AMO_WRITE_BACK()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     END_INSTRUCTION(amoswap_instruction)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*rs1 index*/
+            PARAM32() /*rs2 index*/
+            PARAM32() /*rd index*/
+            PARAM32() /*funct5*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(amoswap_instruction);
+        BEGIN_PARAM(amoswap_instruction)
+            dec->rs1_index,
+            dec->rs2_index,
+            dec->rd_index,
+            dec->imm
+        END_PARAM()
+    COMMIT_TRANSLATION(amoswap_instruction, hartptr, instruction_linear_address);
+    blob->next_instruction_to_fetch += dec->length;
+}
+
+static void
+riscv_amoxor_translator(struct decoded_instruction * dec,
+                        struct prefetch_blob * blob)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    PRECHECK_TRANSLATION_CACHE(amoxor_instruction, blob);
+    BEGIN_TRANSLATION(amoxor_instruction);
+    __asm__ volatile(AMO_RESOLVE_ADDRESS()
+                     AMO_CMPXCHG_LOOP("xorl %%edx, %%ecx;")
+                     AMO_WRITE_BACK()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     END_INSTRUCTION(amoxor_instruction)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*rs1 index*/
+            PARAM32() /*rs2 index*/
+            PARAM32() /*rd index*/
+            PARAM32() /*funct5*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(amoxor_instruction);
+        BEGIN_PARAM(amoxor_instruction)
+            dec->rs1_index,
+            dec->rs2_index,
+            dec->rd_index,
+            dec->imm
+        END_PARAM()
+    COMMIT_TRANSLATION(amoxor_instruction, hartptr, instruction_linear_address);
+    blob->next_instruction_to_fetch += dec->length;
 }
 
+static void
+riscv_amoor_translator(struct decoded_instruction * dec,
+                       struct prefetch_blob * blob)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    PRECHECK_TRANSLATION_CACHE(amoor_instruction, blob);
+    BEGIN_TRANSLATION(amoor_instruction);
+    __asm__ volatile(AMO_RESOLVE_ADDRESS()
+                     AMO_CMPXCHG_LOOP("orl %%edx, %%ecx;")
+                     AMO_WRITE_BACK()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     END_INSTRUCTION(amoor_instruction)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*rs1 index*/
+            PARAM32() /*rs2 index*/
+            PARAM32() /*rd index*/
+            PARAM32() /*funct5*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(amoor_instruction);
+        BEGIN_PARAM(amoor_instruction)
+            dec->rs1_index,
+            dec->rs2_index,
+            dec->rd_index,
+            dec->imm
+        END_PARAM()
+    COMMIT_TRANSLATION(amoor_instruction, hartptr, instruction_linear_address);
+    blob->next_instruction_to_fetch += dec->length;
+}
+
+static void
+riscv_amoand_translator(struct decoded_instruction * dec,
+                        struct prefetch_blob * blob)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    PRECHECK_TRANSLATION_CACHE(amoand_instruction, blob);
+    BEGIN_TRANSLATION(amoand_instruction);
+    __asm__ volatile(AMO_RESOLVE_ADDRESS()
+                     AMO_CMPXCHG_LOOP("andl %%edx, %%ecx;")
+                     AMO_WRITE_BACK()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     END_INSTRUCTION(amoand_instruction)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*rs1 index*/
+            PARAM32() /*rs2 index*/
+            PARAM32() /*rd index*/
+            PARAM32() /*funct5*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(amoand_instruction);
+        BEGIN_PARAM(amoand_instruction)
+            dec->rs1_index,
+            dec->rs2_index,
+            dec->rd_index,
+            dec->imm
+        END_PARAM()
+    COMMIT_TRANSLATION(amoand_instruction, hartptr, instruction_linear_address);
+    blob->next_instruction_to_fetch += dec->length;
+}
+
+static void
+riscv_amomaxu_translator(struct decoded_instruction * dec,
+                         struct prefetch_blob * blob)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    PRECHECK_TRANSLATION_CACHE(amomaxu_instruction, blob);
+    BEGIN_TRANSLATION(amomaxu_instruction);
+    __asm__ volatile(AMO_RESOLVE_ADDRESS()
+                     AMO_CMPXCHG_LOOP("cmpl %%edx, %%ecx;"
+                                      "cmovbl %%edx, %%ecx;")
+                     AMO_WRITE_BACK()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     END_INSTRUCTION(amomaxu_instruction)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*rs1 index*/
+            PARAM32() /*rs2 index*/
+            PARAM32() /*rd index*/
+            PARAM32() /*funct5*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(amomaxu_instruction);
+        BEGIN_PARAM(amomaxu_instruction)
+            dec->rs1_index,
+            dec->rs2_index,
+            dec->rd_index,
+            dec->imm
+        END_PARAM()
+    COMMIT_TRANSLATION(amomaxu_instruction, hartptr, instruction_linear_address);
+    blob->next_instruction_to_fetch += dec->length;
+}
 
 __attribute__((constructor)) static void
 amo_constructor(void)
 {
-    memset(reservations, 0x0, sizeof(reservations));
-    memset(per_funct5_handlers, 0x0, sizeof(per_funct5_handlers));
-    per_funct5_handlers[0] = riscv_amo_translator; //amoadd.w
-    per_funct5_handlers[0x1] = riscv_amo_translator; // amoswap.w
-    per_funct5_handlers[0x2] = riscv_amo_translator; // lr.w
-    per_funct5_handlers[0x3] = riscv_amo_translator; // sc.w
-    per_funct5_handlers[0x4] = riscv_amo_translator; //amoxor.w
-    per_funct5_handlers[0x8] = riscv_amo_translator; // amoor.w
-    per_funct5_handlers[0xc] = riscv_amo_translator; // amoand.w
-    per_funct5_handlers[0x1c] = riscv_amo_translator; // AMOMAXU.W
+    register_instruction_translator(RISCV_OP_AMOADD_W, riscv_amoadd_translator);
+    register_instruction_translator(RISCV_OP_AMOSWAP_W, riscv_amoswap_translator);
+    register_instruction_translator(RISCV_OP_LR_W, riscv_amo_translator);
+    register_instruction_translator(RISCV_OP_SC_W, riscv_amo_translator);
+    register_instruction_translator(RISCV_OP_AMOXOR_W, riscv_amoxor_translator);
+    register_instruction_translator(RISCV_OP_AMOOR_W, riscv_amoor_translator);
+    register_instruction_translator(RISCV_OP_AMOAND_W, riscv_amoand_translator);
+    register_instruction_translator(RISCV_OP_AMOMAXU_W, riscv_amomaxu_translator);
 }
@@ -6,8 +6,8 @@
 #include <string.h>
 #include <util.h>
 static void
-riscv_add_translator(struct decoding * dec, struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_add_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -44,12 +44,12 @@ riscv_add_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(add_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_sub_translator(struct decoding * dec, struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_sub_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -86,25 +86,12 @@ riscv_sub_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(sub_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_add_sub_translator(struct decoding * dec, struct prefetch_blob * blob,
-                         uint32_t instruction)
-{
-    if (dec->funct7 == 0x20) {
-        riscv_sub_translator(dec, blob, instruction);
-    } else {
-        ASSERT(!dec->funct7);
-        riscv_add_translator(dec, blob, instruction);
-    }
-}
-
-
-static void
-riscv_and_translator(struct decoding * dec, struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_and_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -141,12 +128,12 @@ riscv_and_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(and_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_or_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_or_translator(struct decoded_instruction * dec,
+                    struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -183,12 +170,12 @@ riscv_or_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(or_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_xor_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_xor_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -225,12 +212,12 @@ riscv_xor_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(xor_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_slt_translator(struct decoding * dec, struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_slt_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -270,12 +257,12 @@ riscv_slt_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(slt_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_sltu_translator(struct decoding * dec, struct prefetch_blob * blob,
-                      uint32_t instruction)
+riscv_sltu_translator(struct decoded_instruction * dec,
+                      struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -315,12 +302,12 @@ riscv_sltu_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(sltu_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_sll_translator(struct decoding * dec, struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_sll_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -358,15 +345,15 @@ riscv_sll_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(sll_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 
 
 
 static void
-riscv_srl_translator(struct decoding * dec, struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_srl_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -404,12 +391,12 @@ riscv_srl_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(srl_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_sra_translator(struct decoding * dec, struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_sra_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -447,50 +434,20 @@ riscv_sra_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(sra_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
-static void
-riscv_srl_sra_translator(struct decoding * dec, struct prefetch_blob * blob,
-                         uint32_t instruction)
-{
-    if (dec->funct7 == 0x20) {
-        riscv_sra_translator(dec, blob, instruction);
-    } else {
-        ASSERT(!dec->funct7);
-        riscv_srl_translator(dec, blob, instruction);
-    }
-}
-static instruction_sub_translator per_funct3_handlers[8];
-
-void
-riscv_arithmetic_instructions_class0_translation_entry(struct decoding * dec,
-                                                       struct prefetch_blob * blob,
-                                                       uint32_t instruction)
-{
-    ASSERT(per_funct3_handlers[dec->funct3]);
-    per_funct3_handlers[dec->funct3](dec, blob, instruction);
-    #if 0
-    struct decoding dec;
-    instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_R);
-    ASSERT(per_funct3_handlers[dec.funct3]);
-    per_funct3_handlers[dec.funct3](&dec, blob, instruction);
-    #endif
-}
-
-
 __attribute__((constructor)) static void
 arithmetic_constructor(void)
 {
-    memset(per_funct3_handlers, 0x0, sizeof(per_funct3_handlers));
-    per_funct3_handlers[0x0] = riscv_add_sub_translator;
-    per_funct3_handlers[0x7] = riscv_and_translator;
-    per_funct3_handlers[0x6] = riscv_or_translator;
-    per_funct3_handlers[0x4] = riscv_xor_translator;
-    per_funct3_handlers[0x2] = riscv_slt_translator;
-    per_funct3_handlers[0x3] = riscv_sltu_translator;
-    per_funct3_handlers[0x1] = riscv_sll_translator;
-    per_funct3_handlers[0x5] = riscv_srl_sra_translator;
+    register_instruction_translator(RISCV_OP_ADD, riscv_add_translator);
+    register_instruction_translator(RISCV_OP_SUB, riscv_sub_translator);
+    register_instruction_translator(RISCV_OP_AND, riscv_and_translator);
+    register_instruction_translator(RISCV_OP_OR, riscv_or_translator);
+    register_instruction_translator(RISCV_OP_XOR, riscv_xor_translator);
+    register_instruction_translator(RISCV_OP_SLT, riscv_slt_translator);
+    register_instruction_translator(RISCV_OP_SLTU, riscv_sltu_translator);
+    register_instruction_translator(RISCV_OP_SLL, riscv_sll_translator);
+    register_instruction_translator(RISCV_OP_SRL, riscv_srl_translator);
+    register_instruction_translator(RISCV_OP_SRA, riscv_sra_translator);
 }
-
-
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      Zba and Zbb bit-manipulation instructions translation. the operations
+ *      which have host counterparts are lowered to them when the host CPU
+ *      supports them, a generic sequence is used otherwise.
+ */
+
+#include <translation.h>
+#include <string.h>
+#include <util.h>
+#include <cpuid.h>
+
+// EAX: rs1, ESI: rs2 (or shamt of an immediate rotation)
+//  PARAM0: rs1 index, PARAM1: rs2 index, PARAM2: rd index
+#define LOAD_BITMANIP_OPERANDS()                                               \
+        "movl "PIC_PARAM(0)", %%edx;"                                          \
+        "shl $0x2, %%edx;"                                                     \
+        "addq %%r15, %%rdx;"                                                   \
+        "movl (%%rdx), %%eax;"                                                 \
+        "movl "PIC_PARAM(1)", %%edx;"                                          \
+        "shl $0x2, %%edx;"                                                     \
+        "addq %%r15, %%rdx;"                                                   \
+        "movl (%%rdx), %%esi;"
+
+#define LOAD_BITMANIP_OPERANDS_IMM()                                           \
+        "movl "PIC_PARAM(0)", %%edx;"                                          \
+        "shl $0x2, %%edx;"                                                     \
+        "addq %%r15, %%rdx;"                                                   \
+        "movl (%%rdx), %%eax;"                                                 \
+        "movl "PIC_PARAM(1)", %%esi;"
+
+// rd <- EAX
+#define STORE_BITMANIP_RESULT()                                                \
+        "movl "PIC_PARAM(2)", %%edx;"                                          \
+        "shl $0x2, %%edx;"                                                     \
+        "addq %%r15, %%rdx;"                                                   \
+        "movl %%eax, (%%rdx);"
+
+#define _BITMANIP_TRANSLATOR(name, load_operands, second_operand, operation)   \
+static void                                                                    \
+riscv_##name##_translator(struct decoded_instruction * dec,                    \
+                          struct prefetch_blob * blob)                         \
+{                                                                              \
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;     \
+    struct hart * hartptr = (struct hart *)blob->opaque;                       \
+    PRECHECK_TRANSLATION_CACHE(name##_instruction, blob);                      \
+    BEGIN_TRANSLATION(name##_instruction);                                     \
+    __asm__ volatile(load_operands                                             \
+                     operation                                                 \
+                     STORE_BITMANIP_RESULT()                                   \
+                     RESET_ZERO_REGISTER()                                     \
+                     PROCEED_TO_NEXT_INSTRUCTION()                             \
+                     END_INSTRUCTION(name##_instruction)                       \
+                     :                                                         \
+                     :                                                         \
+                     :"memory");                                               \
+        BEGIN_PARAM_SCHEMA()                                                   \
+            PARAM32() /*rs1 index*/                                            \
+            PARAM32() /*rs2 index or shamt*/                                   \
+            PARAM32() /*rd index*/                                             \
+        END_PARAM_SCHEMA()                                                     \
+    END_TRANSLATION(name##_instruction);                                       \
+        BEGIN_PARAM(name##_instruction)                                        \
+            dec->rs1_index,                                                    \
+            second_operand,                                                    \
+            dec->rd_index                                                      \
+        END_PARAM()                                                            \
+    COMMIT_TRANSLATION(name##_instruction, hartptr,                            \
+                       instruction_linear_address);                            \
+    blob->next_instruction_to_fetch += dec->length;                            \
+}
+
+#define BITMANIP_TRANSLATOR(name, operation)                                   \
+    _BITMANIP_TRANSLATOR(name, LOAD_BITMANIP_OPERANDS(), dec->rs2_index,       \
+                         operation)
+
+#define BITMANIP_IMM_TRANSLATOR(name, operation)                               \
+    _BITMANIP_TRANSLATOR(name, LOAD_BITMANIP_OPERANDS_IMM(), dec->imm,         \
+                         operation)
+
+// Zba
+BITMANIP_TRANSLATOR(sh1add, "leal (%%rsi, %%rax, 2), %%eax;")
+BITMANIP_TRANSLATOR(sh2add, "leal (%%rsi, %%rax, 4), %%eax;")
+BITMANIP_TRANSLATOR(sh3add, "leal (%%rsi, %%rax, 8), %%eax;")
+
+// Zbb: logical with negate
+BITMANIP_TRANSLATOR(andn_bmi1, "andnl %%eax, %%esi, %%eax;")
+BITMANIP_TRANSLATOR(andn, "notl %%esi;"
+                          "andl %%esi, %%eax;")
+BITMANIP_TRANSLATOR(orn, "notl %%esi;"
+                         "orl %%esi, %%eax;")
+BITMANIP_TRANSLATOR(xnor, "xorl %%esi, %%eax;"
+                          "notl %%eax;")
+
+// Zbb: counting bits
+BITMANIP_TRANSLATOR(clz_lzcnt, "lzcntl %%eax, %%eax;")
+BITMANIP_TRANSLATOR(clz, "movl $32, %%ecx;"
+                         "testl %%eax, %%eax;"
+                         "jz 1f;"
+                         "bsrl %%eax, %%ecx;"
+                         "xorl $31, %%ecx;"
+                         "1:"
+                         "movl %%ecx, %%eax;")
+BITMANIP_TRANSLATOR(ctz_bmi1, "tzcntl %%eax, %%eax;")
+BITMANIP_TRANSLATOR(ctz, "movl $32, %%ecx;"
+                         "testl %%eax, %%eax;"
+                         "jz 1f;"
+                         "bsfl %%eax, %%ecx;"
+                         "1:"
+                         "movl %%ecx, %%eax;")
+BITMANIP_TRANSLATOR(cpop_popcnt, "popcntl %%eax, %%eax;")
+BITMANIP_TRANSLATOR(cpop, "movl %%eax, %%ecx;"
+                          "shrl $1, %%ecx;"
+                          "andl $0x55555555, %%ecx;"
+                          "subl %%ecx, %%eax;"
+                          "movl %%eax, %%ecx;"
+                          "shrl $2, %%ecx;"
+                          "andl $0x33333333, %%eax;"
+                          "andl $0x33333333, %%ecx;"
+                          "addl %%ecx, %%eax;"
+                          "movl %%eax, %%ecx;"
+                          "shrl $4, %%ecx;"
+                          "addl %%ecx, %%eax;"
+                          "andl $0x0f0f0f0f, %%eax;"
+                          "imull $0x01010101, %%eax, %%eax;"
+                          "shrl $24, %%eax;")
+
+// Zbb: integer minimum/maximum
+BITMANIP_TRANSLATOR(mins, "cmpl %%esi, %%eax;"
+                          "cmovgl %%esi, %%eax;")
+BITMANIP_TRANSLATOR(minu, "cmpl %%esi, %%eax;"
+                          "cmoval %%esi, %%eax;")
+BITMANIP_TRANSLATOR(maxs, "cmpl %%esi, %%eax;"
+                          "cmovll %%esi, %%eax;")
+BITMANIP_TRANSLATOR(maxu, "cmpl %%esi, %%eax;"
+                          "cmovbl %%esi, %%eax;")
+
+// Zbb: sign and zero extension
+BITMANIP_TRANSLATOR(sext_b, "movsbl %%al, %%eax;")
+BITMANIP_TRANSLATOR(sext_h, "movswl %%ax, %%eax;")
+BITMANIP_TRANSLATOR(zext_h, "movzwl %%ax, %%eax;")
+
+// Zbb: rotation, the count is taken modulo 32 by the host as well.
+BITMANIP_TRANSLATOR(rol, "movl %%esi, %%ecx;"
+                         "roll %%cl, %%eax;")
+BITMANIP_TRANSLATOR(ror, "movl %%esi, %%ecx;"
+                         "rorl %%cl, %%eax;")
+BITMANIP_IMM_TRANSLATOR(rori, "movl %%esi, %%ecx;"
+                              "rorl %%cl, %%eax;")
+
+// Zbb: byte-wise operations. orc.b: the high bit of each byte is set iff the
+// byte is not zero, the byte is then filled from it.
+BITMANIP_TRANSLATOR(orc_b, "movl %%eax, %%ecx;"
+                           "andl $0x7f7f7f7f, %%ecx;"
+                           "addl $0x7f7f7f7f, %%ecx;"
+                           "orl %%eax, %%ecx;"
+                           "andl $0x80808080, %%ecx;"
+                           "shrl $7, %%ecx;"
+                           "imull $0xff, %%ecx, %%eax;")
+BITMANIP_TRANSLATOR(rev8, "bswapl %%eax;")
+
+struct host_bitmanip_features {
+    uint32_t lzcnt:1;
+    uint32_t popcnt:1;
+    uint32_t bmi1:1;
+};
+
+static void
+detect_host_bitmanip_features(struct host_bitmanip_features * features)
+{
+    uint32_t eax, ebx, ecx, edx;
+    memset(features, 0x0, sizeof(struct host_bitmanip_features));
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        features->popcnt = !!(ecx & (1 << 23));
+    }
+    if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx)) {
+        features->lzcnt = !!(ecx & (1 << 5));
+    }
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        features->bmi1 = !!(ebx & (1 << 3));
+    }
+    log_debug("host bit-manipulation: lzcnt:%d popcnt:%d bmi1:%d\n",
+              features->lzcnt, features->popcnt, features->bmi1);
+}
+
+__attribute__((constructor)) static void
+bitmanip_constructor(void)
+{
+    struct host_bitmanip_features features;
+    detect_host_bitmanip_features(&features);
+    register_instruction_translator(RISCV_OP_SH1ADD, riscv_sh1add_translator);
+    register_instruction_translator(RISCV_OP_SH2ADD, riscv_sh2add_translator);
+    register_instruction_translator(RISCV_OP_SH3ADD, riscv_sh3add_translator);
+    register_instruction_translator(RISCV_OP_ANDN, features.bmi1 ?
+                                    riscv_andn_bmi1_translator :
+                                    riscv_andn_translator);
+    register_instruction_translator(RISCV_OP_ORN, riscv_orn_translator);
+    register_instruction_translator(RISCV_OP_XNOR, riscv_xnor_translator);
+    register_instruction_translator(RISCV_OP_CLZ, features.lzcnt ?
+                                    riscv_clz_lzcnt_translator :
+                                    riscv_clz_translator);
+    register_instruction_translator(RISCV_OP_CTZ, features.bmi1 ?
+                                    riscv_ctz_bmi1_translator :
+                                    riscv_ctz_translator);
+    register_instruction_translator(RISCV_OP_CPOP, features.popcnt ?
+                                    riscv_cpop_popcnt_translator :
+                                    riscv_cpop_translator);
+    register_instruction_translator(RISCV_OP_MINS, riscv_mins_translator);
+    register_instruction_translator(RISCV_OP_MINU, riscv_minu_translator);
+    register_instruction_translator(RISCV_OP_MAXS, riscv_maxs_translator);
+    register_instruction_translator(RISCV_OP_MAXU, riscv_maxu_translator);
+    register_instruction_translator(RISCV_OP_SEXT_B, riscv_sext_b_translator);
+    register_instruction_translator(RISCV_OP_SEXT_H, riscv_sext_h_translator);
+    register_instruction_translator(RISCV_OP_ZEXT_H, riscv_zext_h_translator);
+    register_instruction_translator(RISCV_OP_ROL, riscv_rol_translator);
+    register_instruction_translator(RISCV_OP_ROR, riscv_ror_translator);
+    register_instruction_translator(RISCV_OP_RORI, riscv_rori_translator);
+    register_instruction_translator(RISCV_OP_ORC_B, riscv_orc_b_translator);
+    register_instruction_translator(RISCV_OP_REV8, riscv_rev8_translator);
+}
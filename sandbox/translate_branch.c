@@ -3,17 +3,90 @@
  */
 
 #include <translation.h>
+#include <spin_wait.h>
 #include <util.h>
 #include <string.h>
+#include <stddef.h>
+
+// the back edge of a spin-wait loop counts its taken iterations in the hart and
+// yields the host cpu once they reach SPIN_WAIT_ITERATIONS, leaving the loop
+// resets the count. exit_jcc jumps when the branch is not taken upon
+// `cmpl rs2, rs1`.
+#define SPIN_BRANCH_TRANSLATOR(name, exit_jcc)                                 \
+static void                                                                    \
+riscv_spin_##name##_translator(struct decoded_instruction * dec,               \
+                               struct prefetch_blob * blob)                    \
+{                                                                              \
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;     \
+    struct hart * hartptr = (struct hart *)blob->opaque;                       \
+    int32_t branch_taken_target = instruction_linear_address + dec->imm;       \
+    PRECHECK_TRANSLATION_CACHE(spin_##name##_instruction, blob);               \
+    BEGIN_TRANSLATION(spin_##name##_instruction);                              \
+        __asm__ volatile("movl "PIC_PARAM(0)", %%edx;"                         \
+                         "shl $2, %%edx;"                                      \
+                         "addq %%r15, %%rdx;"                                  \
+                         "movl (%%rdx), %%esi;"                                \
+                         "movl "PIC_PARAM(1)", %%edx;"                         \
+                         "shl $2, %%edx;"                                      \
+                         "addq %%r15, %%rdx;"                                  \
+                         "movl (%%rdx), %%edi;"                                \
+                         "movl (%%r14), %%edx;"                                \
+                         "addl "INSTRUCTION_LENGTH_PARAM", %%edx;"             \
+                         "cmpl %%edi, %%esi;"                                  \
+                         exit_jcc" 1f;"                                        \
+                         "movl "PIC_PARAM(2)", %%edx;"                         \
+                         "incl %c[spins](%%r12);"                              \
+                         "cmpl $"TC_STRINGIFY(SPIN_WAIT_ITERATIONS)", "        \
+                             "%c[spins](%%r12);"                               \
+                         "jb 2f;"                                              \
+                         "movl %%edx, (%%r14);"                                \
+                         "movq %%r12, %%rdi;"                                  \
+                         "movq $spin_wait_yield, %%rax;"                       \
+                         CALL_HELPER_OUT_OF_LINE()                             \
+                         "jmp 3f;"                                             \
+                         "1:"                                                  \
+                         "movl $0x0, %c[spins](%%r12);"                        \
+                         "2:"                                                  \
+                         "movl %%edx, (%%r14);"                                \
+                         "3:"                                                  \
+                         TRAP_TO_VMM(spin_##name##_instruction)                \
+                         :                                                     \
+                         :[spins]"i"(offsetof(struct hart, spin_iterations))   \
+                         :"memory");                                           \
+        BEGIN_PARAM_SCHEMA()                                                   \
+            PARAM32() /*rs1 index*/                                            \
+            PARAM32() /*rs2 index*/                                            \
+            PARAM32() /*branch taken target*/                                  \
+        END_PARAM_SCHEMA()                                                     \
+    END_TRANSLATION(spin_##name##_instruction);                                \
+        BEGIN_PARAM(spin_##name##_instruction)                                 \
+            dec->rs1_index,                                                    \
+            dec->rs2_index,                                                    \
+            branch_taken_target                                                \
+        END_PARAM()                                                            \
+    COMMIT_TRANSLATION(spin_##name##_instruction, hartptr,                     \
+                       instruction_linear_address);                            \
+    blob->is_to_stop = 1;                                                      \
+}
+
+SPIN_BRANCH_TRANSLATOR(beq, "jne")
+SPIN_BRANCH_TRANSLATOR(bne, "je")
+SPIN_BRANCH_TRANSLATOR(blt, "jge")
+SPIN_BRANCH_TRANSLATOR(bge, "jl")
+SPIN_BRANCH_TRANSLATOR(bltu, "jae")
+SPIN_BRANCH_TRANSLATOR(bgeu, "jb")
 
 static void
-riscv_beq_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_beq_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t branch_taken_target = instruction_linear_address +
-                                  sign_extend32(dec->imm << 1, 12);
+    int32_t branch_taken_target = instruction_linear_address + dec->imm;
+    if (spin_loop_recognize(blob, dec)) {
+        riscv_spin_beq_translator(dec, blob);
+        return;
+    }
     PRECHECK_TRANSLATION_CACHE(beq_instruction, blob);
     BEGIN_TRANSLATION(beq_instruction);
         __asm__ volatile("movl "PIC_PARAM(0)", %%edx;"
@@ -25,7 +98,7 @@ riscv_beq_translator(struct decoding * dec, struct prefetch_blob * blob,
                          "addq %%r15, %%rdx;"
                          "movl (%%rdx), %%edi;"
                          "movl (%%r14), %%edx;" // <=== Let edx always keep the branch target
-                         "addl $0x4, %%edx;"
+                         "addl "INSTRUCTION_LENGTH_PARAM", %%edx;"
                          "cmpl %%esi, %%edi;"
                          "jne 1f;"
                          "movl "PIC_PARAM(2)", %%edx;"
@@ -51,13 +124,16 @@ riscv_beq_translator(struct decoding * dec, struct prefetch_blob * blob,
 }
 
 static void
-riscv_bne_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_bne_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t branch_taken_target = instruction_linear_address +
-                                  sign_extend32(dec->imm << 1, 12);
+    int32_t branch_taken_target = instruction_linear_address + dec->imm;
+    if (spin_loop_recognize(blob, dec)) {
+        riscv_spin_bne_translator(dec, blob);
+        return;
+    }
     PRECHECK_TRANSLATION_CACHE(bne_instruction, blob);
     BEGIN_TRANSLATION(bne_instruction);
         __asm__ volatile("movl "PIC_PARAM(0)", %%edx;"
@@ -69,7 +145,7 @@ riscv_bne_translator(struct decoding * dec, struct prefetch_blob * blob,
                          "addq %%r15, %%rdx;"
                          "movl (%%rdx), %%edi;"
                          "movl (%%r14), %%edx;" // <=== Let edx always keep the branch target
-                         "addl $0x4, %%edx;"
+                         "addl "INSTRUCTION_LENGTH_PARAM", %%edx;"
                          "cmpl %%esi, %%edi;"
                          "je 1f;"
                          "movl "PIC_PARAM(2)", %%edx;"
@@ -96,13 +172,16 @@ riscv_bne_translator(struct decoding * dec, struct prefetch_blob * blob,
 
 
 static void
-riscv_blt_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_blt_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t branch_taken_target = instruction_linear_address +
-                                  sign_extend32(dec->imm << 1, 12);
+    int32_t branch_taken_target = instruction_linear_address + dec->imm;
+    if (spin_loop_recognize(blob, dec)) {
+        riscv_spin_blt_translator(dec, blob);
+        return;
+    }
     PRECHECK_TRANSLATION_CACHE(blt_instruction, blob);
     BEGIN_TRANSLATION(blt_instruction);
         __asm__ volatile("movl "PIC_PARAM(0)", %%edx;"
@@ -114,7 +193,7 @@ riscv_blt_translator(struct decoding * dec, struct prefetch_blob * blob,
                          "addq %%r15, %%rdx;"
                          "movl (%%rdx), %%edi;"
                          "movl (%%r14), %%edx;" // <=== Let edx always keep the branch target
-                         "addl $0x4, %%edx;"
+                         "addl "INSTRUCTION_LENGTH_PARAM", %%edx;"
                          "cmpl %%edi, %%esi;" // rs1 - rs2 : rs1 < rs2
                          "jge 1f;"
                          "movl "PIC_PARAM(2)", %%edx;"
@@ -140,13 +219,16 @@ riscv_blt_translator(struct decoding * dec, struct prefetch_blob * blob,
 }
 
 static void
-riscv_bltu_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_bltu_translator(struct decoded_instruction * dec,
+                      struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t branch_taken_target = instruction_linear_address +
-                                  sign_extend32(dec->imm << 1, 12);
+    int32_t branch_taken_target = instruction_linear_address + dec->imm;
+    if (spin_loop_recognize(blob, dec)) {
+        riscv_spin_bltu_translator(dec, blob);
+        return;
+    }
     PRECHECK_TRANSLATION_CACHE(bltu_instruction, blob);
     BEGIN_TRANSLATION(bltu_instruction);
         __asm__ volatile("movl "PIC_PARAM(0)", %%edx;"
@@ -158,7 +240,7 @@ riscv_bltu_translator(struct decoding * dec, struct prefetch_blob * blob,
                          "addq %%r15, %%rdx;"
                          "movl (%%rdx), %%edi;"
                          "movl (%%r14), %%edx;" // <=== Let edx always keep the branch target
-                         "addl $0x4, %%edx;"
+                         "addl "INSTRUCTION_LENGTH_PARAM", %%edx;"
                          "cmpl %%edi, %%esi;" // rs1 - rs2 : rs1 < rs2
                          "jae 1f;"
                          "movl "PIC_PARAM(2)", %%edx;"
@@ -184,13 +266,16 @@ riscv_bltu_translator(struct decoding * dec, struct prefetch_blob * blob,
 }
 
 static void
-riscv_bge_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_bge_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t branch_taken_target = instruction_linear_address +
-                                  sign_extend32(dec->imm << 1, 12);
+    int32_t branch_taken_target = instruction_linear_address + dec->imm;
+    if (spin_loop_recognize(blob, dec)) {
+        riscv_spin_bge_translator(dec, blob);
+        return;
+    }
     PRECHECK_TRANSLATION_CACHE(bge_instruction, blob);
     BEGIN_TRANSLATION(bge_instruction);
         __asm__ volatile("movl "PIC_PARAM(0)", %%edx;"
@@ -202,7 +287,7 @@ riscv_bge_translator(struct decoding * dec, struct prefetch_blob * blob,
                          "addq %%r15, %%rdx;"
                          "movl (%%rdx), %%edi;"
                          "movl (%%r14), %%edx;" // <=== Let edx always keep the branch target
-                         "addl $0x4, %%edx;"
+                         "addl "INSTRUCTION_LENGTH_PARAM", %%edx;"
                          "cmpl %%edi, %%esi;" // rs1 - rs2 : rs1 < rs2
                          "jl 1f;"
                          "movl "PIC_PARAM(2)", %%edx;"
@@ -228,13 +313,16 @@ riscv_bge_translator(struct decoding * dec, struct prefetch_blob * blob,
 }
 
 static void
-riscv_bgeu_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_bgeu_translator(struct decoded_instruction * dec,
+                      struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t branch_taken_target = instruction_linear_address +
-                                  sign_extend32(dec->imm << 1, 12);
+    int32_t branch_taken_target = instruction_linear_address + dec->imm;
+    if (spin_loop_recognize(blob, dec)) {
+        riscv_spin_bgeu_translator(dec, blob);
+        return;
+    }
     PRECHECK_TRANSLATION_CACHE(bgeu_instruction, blob);
     BEGIN_TRANSLATION(bgeu_instruction);
         __asm__ volatile("movl "PIC_PARAM(0)", %%edx;"
@@ -246,7 +334,7 @@ riscv_bgeu_translator(struct decoding * dec, struct prefetch_blob * blob,
                          "addq %%r15, %%rdx;"
                          "movl (%%rdx), %%edi;"
                          "movl (%%r14), %%edx;" // <=== Let edx always keep the branch target
-                         "addl $0x4, %%edx;"
+                         "addl "INSTRUCTION_LENGTH_PARAM", %%edx;"
                          "cmpl %%edi, %%esi;" // rs1 - rs2 : rs1 < rs2
                          "jb 1f;"
                          "movl "PIC_PARAM(2)", %%edx;"
@@ -271,27 +359,13 @@ riscv_bgeu_translator(struct decoding * dec, struct prefetch_blob * blob,
     blob->is_to_stop = 1;
 }
 
-static instruction_sub_translator per_funct3_handlers[8];
-
-void
-riscv_branch_instructions_translation_entry(struct prefetch_blob * blob,
-                                            uint32_t instruction)
-{
-    struct decoding dec;
-    instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_B);
-    ASSERT(per_funct3_handlers[dec.funct3]);
-    per_funct3_handlers[dec.funct3](&dec, blob, instruction);
-}
-
-
 __attribute__((constructor)) static void
 branch_constructor(void)
 {
-    memset(per_funct3_handlers, 0x0, sizeof(per_funct3_handlers));
-    per_funct3_handlers[0x0] = riscv_beq_translator;
-    per_funct3_handlers[0x1] = riscv_bne_translator;
-    per_funct3_handlers[0x4] = riscv_blt_translator;
-    per_funct3_handlers[0x6] = riscv_bltu_translator;
-    per_funct3_handlers[0x5] = riscv_bge_translator;
-    per_funct3_handlers[0x7] = riscv_bgeu_translator;
+    register_instruction_translator(RISCV_OP_BEQ, riscv_beq_translator);
+    register_instruction_translator(RISCV_OP_BNE, riscv_bne_translator);
+    register_instruction_translator(RISCV_OP_BLT, riscv_blt_translator);
+    register_instruction_translator(RISCV_OP_BLTU, riscv_bltu_translator);
+    register_instruction_translator(RISCV_OP_BGE, riscv_bge_translator);
+    register_instruction_translator(RISCV_OP_BGEU, riscv_bgeu_translator);
 }
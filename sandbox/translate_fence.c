@@ -3,24 +3,34 @@
  */
 
 #include <translation.h>
+#include <spin_wait.h>
 #include <util.h>
+#include <vmm_smp.h>
 
 // FENCE.I instruction order instruction cache and data cache, any guest JIT
 // system should issue a FENCE.I instruction at its end of self-modifying code
-// LIKE JAVA.
+// LIKE JAVA. stores to decoded pages are tracked, only these dirty pages are
+// invalidated here.
+__attribute__((unused)) static void
+fence_i_callback(struct hart * hartptr)
+{
+    // the dirty pages are recorded by other threads as well.
+    vmm_enter();
+    invalidate_dirty_code_pages(hartptr);
+    vmm_leave();
+}
+
 static void
-riscv_fence_i_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_fence_i_translator(struct decoded_instruction * dec,
+                         struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
     PRECHECK_TRANSLATION_CACHE(fence_i_instruction, blob);
     BEGIN_TRANSLATION(fence_i_instruction);
         __asm__ volatile("movq %%r12, %%rdi;"
-                         "movq $flush_translation_cache, %%rax;"
-                         SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                         "call *%%rax;"
-                         RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                         "movq $fence_i_callback, %%rax;"
+                         CALL_HELPER_OUT_OF_LINE()
                          PROCEED_TO_NEXT_INSTRUCTION()
                          TRAP_TO_VMM(fence_i_instruction)
                          :
@@ -34,20 +44,43 @@ riscv_fence_i_translator(struct decoding * dec, struct prefetch_blob * blob,
             instruction_linear_address
         END_PARAM()
     COMMIT_TRANSLATION(fence_i_instruction, hartptr, instruction_linear_address);
-    // Stop translation because after the fence.i instruction, the 
-    // translation cache will be flushed
+    // Stop translation because after the fence.i instruction, the
+    // translation of the following instructions may be invalidated
     blob->is_to_stop = 1;
 }
 
 
-// FENCE instruction is to order memeroy Read/Write and Device Input/Ouput
-// in our hart implementation(emulation), all instructions are exactly in order.
+// FENCE instruction is to order memeroy Read/Write and Device Input/Ouput.
+// guest memory is accessed by host loads and stores which are ordered by
+// x86-TSO already, except that a later load may pass an earlier store, only
+// such a fence is translated into MFENCE.
 static void
-riscv_fence_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_fence_translator(struct decoded_instruction * dec,
+                       struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
+    if (FENCE_ORDERS_STORE_LOAD(dec->imm)) {
+        PRECHECK_TRANSLATION_CACHE(fence_rw_instruction, blob);
+        BEGIN_TRANSLATION(fence_rw_instruction);
+            __asm__ volatile("mfence;"
+                             PROCEED_TO_NEXT_INSTRUCTION()
+                             END_INSTRUCTION(fence_rw_instruction)
+                             :
+                             :
+                             :"memory");
+            BEGIN_PARAM_SCHEMA()
+                PARAM32()
+            END_PARAM_SCHEMA()
+        END_TRANSLATION(fence_rw_instruction);
+            BEGIN_PARAM(fence_rw_instruction)
+                instruction_linear_address
+            END_PARAM()
+        COMMIT_TRANSLATION(fence_rw_instruction, hartptr,
+                           instruction_linear_address);
+        blob->next_instruction_to_fetch += dec->length;
+        return;
+    }
     PRECHECK_TRANSLATION_CACHE(fence_instruction, blob);
     BEGIN_TRANSLATION(fence_instruction);
         __asm__ volatile(PROCEED_TO_NEXT_INSTRUCTION()
@@ -63,32 +96,42 @@ riscv_fence_translator(struct decoding * dec, struct prefetch_blob * blob,
             instruction_linear_address
         END_PARAM()
     COMMIT_TRANSLATION(fence_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
-static instruction_sub_translator per_funct3_handlers[8];
-
-
-void
-riscv_fence_instructions_translation_entry(struct prefetch_blob * blob,
-                                           uint32_t instruction)
+// PAUSE (Zihintpause) is issued by the guest in spin-wait loops, the host
+// issues one as well and the guest thread may yield the host cpu.
+static void
+riscv_pause_translator(struct decoded_instruction * dec,
+                       struct prefetch_blob * blob)
 {
-    struct decoding dec;
-    instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_S);
-    if (!per_funct3_handlers[dec.funct3]) {
-        log_fatal("no handler for fence_instructions:%d @0x%x\n",
-                  dec.funct3, blob->next_instruction_to_fetch);
-    }
-    ASSERT(per_funct3_handlers[dec.funct3]);
-    per_funct3_handlers[dec.funct3](&dec, blob, instruction);
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    PRECHECK_TRANSLATION_CACHE(pause_instruction, blob);
+    BEGIN_TRANSLATION(pause_instruction);
+        __asm__ volatile("movq %%r12, %%rdi;"
+                         "movq $spin_wait_pause, %%rax;"
+                         CALL_HELPER_OUT_OF_LINE()
+                         PROCEED_TO_NEXT_INSTRUCTION()
+                         TRAP_TO_VMM(pause_instruction)
+                         :
+                         :
+                         :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32()
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(pause_instruction);
+        BEGIN_PARAM(pause_instruction)
+            instruction_linear_address
+        END_PARAM()
+    COMMIT_TRANSLATION(pause_instruction, hartptr, instruction_linear_address);
+    blob->is_to_stop = 1;
 }
 
-
 __attribute__((constructor)) static void
 fence_constructor(void)
 {
-    memset(per_funct3_handlers, 0x0, sizeof(per_funct3_handlers));
-    per_funct3_handlers[0x0] = riscv_fence_translator;
-    per_funct3_handlers[0x1] = riscv_fence_i_translator;
+    register_instruction_translator(RISCV_OP_FENCE, riscv_fence_translator);
+    register_instruction_translator(RISCV_OP_FENCE_I, riscv_fence_i_translator);
+    register_instruction_translator(RISCV_OP_PAUSE, riscv_pause_translator);
 }
-
@@ -0,0 +1,597 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      F and D extensions translation. the operations are lowered to host
+ *      SSE2 scalar instructions(and FMA3 if the host supports it) which run
+ *      with MXCSR holding the dynamic rounding mode of the hart, so the
+ *      exception flags are accrued by the host as well. see hart_fpu.c
+ *
+ *      the instructions which have no exact host counterpart or which carry
+ *      a static rounding mode are translated into a call to fpu_execute().
+ */
+
+#include <translation.h>
+#include <hart_fpu.h>
+#include <stddef.h>
+#include <string.h>
+#include <util.h>
+#include <cpuid.h>
+
+#define FP_OPERANDS [fregs]"i"(offsetof(struct hart, fregisters)),             \
+                    [frm]"i"(offsetof(struct hart, frm))
+
+// RCX: the floating-point register file of the hart.
+#define FP_REGISTER_FILE()                                                     \
+        "leaq %c[fregs](%%r12), %%rcx;"
+
+// xmm <- the register indexed by RDX. a single-precision value which is not
+// properly NaN-boxed is taken as the canonical NaN, like read_f32_bits().
+#define LOAD_FP_REGISTER_S(xmm)                                                \
+        "movl $0x7fc00000, %%eax;"                                             \
+        "cmpl $0xffffffff, 4(%%rcx, %%rdx, 8);"                                \
+        "cmovel (%%rcx, %%rdx, 8), %%eax;"                                     \
+        "movd %%eax, " xmm ";"
+
+#define LOAD_FP_REGISTER_D(xmm)                                                \
+        "movsd (%%rcx, %%rdx, 8), " xmm ";"
+
+// XMM0: frs1, XMM1: frs2, XMM2: frs3
+//  PARAM0: rd index, PARAM1: rs1 index, PARAM2: rs2 index, PARAM3: rs3 index
+#define LOAD_FP_OPERANDS(precision)                                            \
+        FP_REGISTER_FILE()                                                     \
+        "movl "PIC_PARAM(1)", %%edx;"                                          \
+        LOAD_FP_REGISTER_##precision("%%xmm0")                                 \
+        "movl "PIC_PARAM(2)", %%edx;"                                          \
+        LOAD_FP_REGISTER_##precision("%%xmm1")                                 \
+        "movl "PIC_PARAM(3)", %%edx;"                                          \
+        LOAD_FP_REGISTER_##precision("%%xmm2")
+
+#define LOAD_FP_OPERANDS_S() LOAD_FP_OPERANDS(S)
+#define LOAD_FP_OPERANDS_D() LOAD_FP_OPERANDS(D)
+
+// the translations of the rounded instructions run with the dynamic rounding
+// mode in MXCSR, a reserved frm is trapped instead.
+#define CHECK_DYNAMIC_ROUNDING_MODE()                                          \
+        "cmpb $4, %c[frm](%%r12);"                                             \
+        "jbe 1f;"                                                              \
+        "movq %%r12, %%rdi;"                                                   \
+        "movq $fpu_raise_illegal_instruction, %%rax;"                          \
+        CALL_HELPER_OUT_OF_LINE()                                              \
+        "1:"
+
+// EAX: rs1 of the integer register file
+#define LOAD_INT_OPERAND()                                                     \
+        FP_REGISTER_FILE()                                                     \
+        "movl "PIC_PARAM(1)", %%edx;"                                          \
+        "movl (%%r15, %%rdx, 4), %%eax;"
+
+// frd <- XMM0, a single-precision result is NaN-boxed.
+#define STORE_FP_RESULT_S()                                                    \
+        "movl "PIC_PARAM(0)", %%edx;"                                          \
+        "movss %%xmm0, (%%rcx, %%rdx, 8);"                                     \
+        "movl $0xffffffff, 4(%%rcx, %%rdx, 8);"
+
+#define STORE_FP_RESULT_D()                                                    \
+        "movl "PIC_PARAM(0)", %%edx;"                                          \
+        "movsd %%xmm0, (%%rcx, %%rdx, 8);"
+
+// rd <- EAX
+#define STORE_INT_RESULT()                                                     \
+        "movl "PIC_PARAM(0)", %%edx;"                                          \
+        "movl %%eax, (%%r15, %%rdx, 4);"                                       \
+        RESET_ZERO_REGISTER()
+
+// the host default NaN is negative, the RISC-V canonical NaN is positive.
+#define CANONICALIZE_NAN_S()                                                   \
+        "ucomiss %%xmm0, %%xmm0;"                                              \
+        "jnp 1f;"                                                              \
+        "movl $0x7fc00000, %%eax;"                                             \
+        "movd %%eax, %%xmm0;"                                                  \
+        "1:"
+
+#define CANONICALIZE_NAN_D()                                                   \
+        "ucomisd %%xmm0, %%xmm0;"                                              \
+        "jnp 1f;"                                                              \
+        "movabsq $0x7ff8000000000000, %%rax;"                                  \
+        "movq %%rax, %%xmm0;"                                                  \
+        "1:"
+
+#define FP_TRANSLATOR(name, load_operands, operation, store_result)            \
+static void                                                                    \
+riscv_##name##_translator(struct decoded_instruction * dec,                    \
+                          struct prefetch_blob * blob)                         \
+{                                                                              \
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;     \
+    struct hart * hartptr = (struct hart *)blob->opaque;                       \
+    PRECHECK_TRANSLATION_CACHE(name##_instruction, blob);                      \
+    BEGIN_TRANSLATION(name##_instruction);                                     \
+    __asm__ volatile(load_operands                                             \
+                     operation                                                 \
+                     store_result                                              \
+                     PROCEED_TO_NEXT_INSTRUCTION()                             \
+                     END_INSTRUCTION(name##_instruction)                       \
+                     :                                                         \
+                     :FP_OPERANDS                                              \
+                     :"memory");                                               \
+        BEGIN_PARAM_SCHEMA()                                                   \
+            PARAM32() /*rd index*/                                             \
+            PARAM32() /*rs1 index*/                                            \
+            PARAM32() /*rs2 index*/                                            \
+            PARAM32() /*rs3 index*/                                            \
+        END_PARAM_SCHEMA()                                                     \
+    END_TRANSLATION(name##_instruction);                                       \
+        BEGIN_PARAM(name##_instruction)                                        \
+            dec->rd_index,                                                     \
+            dec->rs1_index,                                                    \
+            dec->rs2_index,                                                    \
+            dec->imm >> 3                                                      \
+        END_PARAM()                                                            \
+    COMMIT_TRANSLATION(name##_instruction, hartptr,                            \
+                       instruction_linear_address);                            \
+    blob->next_instruction_to_fetch += dec->length;                            \
+}
+
+#define FP_ARITHMETIC_TRANSLATOR(name, precision, operation)                   \
+    FP_TRANSLATOR(name, CHECK_DYNAMIC_ROUNDING_MODE()                          \
+                  LOAD_FP_OPERANDS_##precision(),                              \
+                  operation CANONICALIZE_NAN_##precision(),                    \
+                  STORE_FP_RESULT_##precision())
+
+// frs1 <- XMM0, frs2 <- XMM1: the sign is injected with integer operations.
+#define FP_SIGN_INJECTION_TRANSLATOR(name, precision, operation)               \
+    FP_TRANSLATOR(name, LOAD_FP_OPERANDS_##precision(), operation,             \
+                  STORE_FP_RESULT_##precision())
+
+#define FP_COMPARISON_TRANSLATOR(name, precision, operation)                   \
+    FP_TRANSLATOR(name, LOAD_FP_OPERANDS_##precision(), operation,             \
+                  STORE_INT_RESULT())
+
+// the integer to floating-point conversions, they are exact except for the
+// single-precision ones which are rounded.
+#define FP_FROM_INTEGER_TRANSLATOR(name, precision, operation)                 \
+    FP_TRANSLATOR(name, LOAD_INT_OPERAND(), operation,                         \
+                  STORE_FP_RESULT_##precision())
+
+#define FP_ROUNDED_FROM_INTEGER_TRANSLATOR(name, operation)                    \
+    FP_TRANSLATOR(name, CHECK_DYNAMIC_ROUNDING_MODE() LOAD_INT_OPERAND(),      \
+                  operation, STORE_FP_RESULT_S())
+
+// arithmetic
+FP_ARITHMETIC_TRANSLATOR(fadd_s, S, "addss %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fsub_s, S, "subss %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fmul_s, S, "mulss %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fdiv_s, S, "divss %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fsqrt_s, S, "sqrtss %%xmm0, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fadd_d, D, "addsd %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fsub_d, D, "subsd %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fmul_d, D, "mulsd %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fdiv_d, D, "divsd %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fsqrt_d, D, "sqrtsd %%xmm0, %%xmm0;")
+
+// fused multiply-add, FMA3 only: XMM0 <- XMM1 * XMM0 +/- XMM2. note the
+// host fnmadd is the RISC-V fnmsub and vice versa.
+FP_ARITHMETIC_TRANSLATOR(fmadd_s, S, "vfmadd213ss %%xmm2, %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fmsub_s, S, "vfmsub213ss %%xmm2, %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fnmsub_s, S, "vfnmadd213ss %%xmm2, %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fnmadd_s, S, "vfnmsub213ss %%xmm2, %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fmadd_d, D, "vfmadd213sd %%xmm2, %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fmsub_d, D, "vfmsub213sd %%xmm2, %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fnmsub_d, D, "vfnmadd213sd %%xmm2, %%xmm1, %%xmm0;")
+FP_ARITHMETIC_TRANSLATOR(fnmadd_d, D, "vfnmsub213sd %%xmm2, %%xmm1, %%xmm0;")
+
+// precision conversions
+FP_TRANSLATOR(fcvt_s_d, CHECK_DYNAMIC_ROUNDING_MODE() LOAD_FP_OPERANDS_D(),
+              "cvtsd2ss %%xmm0, %%xmm0;"
+              CANONICALIZE_NAN_S(),
+              STORE_FP_RESULT_S())
+FP_TRANSLATOR(fcvt_d_s, LOAD_FP_OPERANDS_S(),
+              "cvtss2sd %%xmm0, %%xmm0;"
+              CANONICALIZE_NAN_D(),
+              STORE_FP_RESULT_D())
+
+// sign injection, they are also the fmv, fneg and fabs pseudo instructions.
+FP_SIGN_INJECTION_TRANSLATOR(fsgnj_s, S, "movd %%xmm0, %%eax;"
+                                         "movd %%xmm1, %%esi;"
+                                         "andl $0x7fffffff, %%eax;"
+                                         "andl $0x80000000, %%esi;"
+                                         "orl %%esi, %%eax;"
+                                         "movd %%eax, %%xmm0;")
+FP_SIGN_INJECTION_TRANSLATOR(fsgnjn_s, S, "movd %%xmm0, %%eax;"
+                                          "movd %%xmm1, %%esi;"
+                                          "notl %%esi;"
+                                          "andl $0x7fffffff, %%eax;"
+                                          "andl $0x80000000, %%esi;"
+                                          "orl %%esi, %%eax;"
+                                          "movd %%eax, %%xmm0;")
+FP_SIGN_INJECTION_TRANSLATOR(fsgnjx_s, S, "movd %%xmm0, %%eax;"
+                                          "movd %%xmm1, %%esi;"
+                                          "andl $0x80000000, %%esi;"
+                                          "xorl %%esi, %%eax;"
+                                          "movd %%eax, %%xmm0;")
+FP_SIGN_INJECTION_TRANSLATOR(fsgnj_d, D, "movq %%xmm0, %%rax;"
+                                         "movq %%xmm1, %%rsi;"
+                                         "btrq $63, %%rax;"
+                                         "shrq $63, %%rsi;"
+                                         "shlq $63, %%rsi;"
+                                         "orq %%rsi, %%rax;"
+                                         "movq %%rax, %%xmm0;")
+FP_SIGN_INJECTION_TRANSLATOR(fsgnjn_d, D, "movq %%xmm0, %%rax;"
+                                          "movq %%xmm1, %%rsi;"
+                                          "notq %%rsi;"
+                                          "btrq $63, %%rax;"
+                                          "shrq $63, %%rsi;"
+                                          "shlq $63, %%rsi;"
+                                          "orq %%rsi, %%rax;"
+                                          "movq %%rax, %%xmm0;")
+FP_SIGN_INJECTION_TRANSLATOR(fsgnjx_d, D, "movq %%xmm0, %%rax;"
+                                          "movq %%xmm1, %%rsi;"
+                                          "shrq $63, %%rsi;"
+                                          "shlq $63, %%rsi;"
+                                          "xorq %%rsi, %%rax;"
+                                          "movq %%rax, %%xmm0;")
+
+// comparisons: feq is quiet, flt and fle signal on any NaN like comis*. an
+// unordered comparison sets ZF, PF and CF, so seta/setae yield 0.
+FP_COMPARISON_TRANSLATOR(feq_s, S, "xorl %%eax, %%eax;"
+                                   "ucomiss %%xmm1, %%xmm0;"
+                                   "jp 1f;"
+                                   "sete %%al;"
+                                   "1:")
+FP_COMPARISON_TRANSLATOR(flt_s, S, "xorl %%eax, %%eax;"
+                                   "comiss %%xmm0, %%xmm1;"
+                                   "seta %%al;")
+FP_COMPARISON_TRANSLATOR(fle_s, S, "xorl %%eax, %%eax;"
+                                   "comiss %%xmm0, %%xmm1;"
+                                   "setae %%al;")
+FP_COMPARISON_TRANSLATOR(feq_d, D, "xorl %%eax, %%eax;"
+                                   "ucomisd %%xmm1, %%xmm0;"
+                                   "jp 1f;"
+                                   "sete %%al;"
+                                   "1:")
+FP_COMPARISON_TRANSLATOR(flt_d, D, "xorl %%eax, %%eax;"
+                                   "comisd %%xmm0, %%xmm1;"
+                                   "seta %%al;")
+FP_COMPARISON_TRANSLATOR(fle_d, D, "xorl %%eax, %%eax;"
+                                   "comisd %%xmm0, %%xmm1;"
+                                   "setae %%al;")
+
+// moves between the register files, fmv.x.w moves the bits as they are, it's
+// the one which doesn't check the NaN-boxing.
+FP_TRANSLATOR(fmv_x_w, FP_REGISTER_FILE() "movl "PIC_PARAM(1)", %%edx;",
+              "movl (%%rcx, %%rdx, 8), %%eax;",
+              STORE_INT_RESULT())
+FP_TRANSLATOR(fmv_w_x, LOAD_INT_OPERAND(), "movd %%eax, %%xmm0;",
+              STORE_FP_RESULT_S())
+
+// integer to floating-point conversions, the unsigned ones are converted
+// from the zero-extended 64-bit integer.
+FP_ROUNDED_FROM_INTEGER_TRANSLATOR(fcvt_s_w, "cvtsi2ssl %%eax, %%xmm0;")
+FP_ROUNDED_FROM_INTEGER_TRANSLATOR(fcvt_s_wu, "movl %%eax, %%eax;"
+                                              "cvtsi2ssq %%rax, %%xmm0;")
+FP_FROM_INTEGER_TRANSLATOR(fcvt_d_w, D, "cvtsi2sdl %%eax, %%xmm0;")
+FP_FROM_INTEGER_TRANSLATOR(fcvt_d_wu, D, "movl %%eax, %%eax;"
+                                         "cvtsi2sdq %%rax, %%xmm0;")
+
+void
+fpu_instruction_slowpath(struct hart * hartptr, uint32_t fields, int32_t imm)
+{
+    struct decoded_instruction dinstr = {
+        .operation = fields & 0xff,
+        .rd_index = (fields >> 8) & 0xff,
+        .rs1_index = (fields >> 16) & 0xff,
+        .rs2_index = (fields >> 24) & 0xff,
+        .imm = imm
+    };
+    fpu_execute(hartptr, &dinstr);
+}
+
+static inline uint32_t
+pack_decoded_fields(struct decoded_instruction * dec)
+{
+    return dec->operation | (dec->rd_index << 8) | (dec->rs1_index << 16) |
+           (dec->rs2_index << 24);
+}
+
+// PARAM0: the packed operation and register indexes, PARAM1: imm
+#define CALL_FPU_SLOWPATH()                                                    \
+        "movq %%r12, %%rdi;"                                                   \
+        "movl "PIC_PARAM(0)", %%esi;"                                          \
+        "movl "PIC_PARAM(1)", %%edx;"                                          \
+        "movq $fpu_instruction_slowpath, %%rax;"                               \
+        CALL_HELPER_OUT_OF_LINE()
+
+static void
+riscv_fp_slowpath_translator(struct decoded_instruction * dec,
+                             struct prefetch_blob * blob)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    PRECHECK_TRANSLATION_CACHE(fp_slowpath_instruction, blob);
+    BEGIN_TRANSLATION(fp_slowpath_instruction);
+    __asm__ volatile(CALL_FPU_SLOWPATH()
+                     RESET_ZERO_REGISTER()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     END_INSTRUCTION(fp_slowpath_instruction)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*operation and register indexes*/
+            PARAM32() /*imm*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(fp_slowpath_instruction);
+        BEGIN_PARAM(fp_slowpath_instruction)
+            pack_decoded_fields(dec),
+            dec->imm
+        END_PARAM()
+    COMMIT_TRANSLATION(fp_slowpath_instruction, hartptr,
+                       instruction_linear_address);
+    blob->next_instruction_to_fetch += dec->length;
+}
+
+// fcvt.w[u].[sd] with rtz(the C casts): the 64-bit truncation is exact for
+// any value in range of the 32-bit result, the others(including NaN) take the
+// slow path to saturate.
+//  PARAM0: packed fields, PARAM1: imm, PARAM2: rd index, PARAM3: rs1 index
+#define FP_TO_INTEGER_TRANSLATOR(name, precision, truncate, extend)            \
+static void                                                                    \
+riscv_##name##_translator(struct decoded_instruction * dec,                    \
+                          struct prefetch_blob * blob)                         \
+{                                                                              \
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;     \
+    struct hart * hartptr = (struct hart *)blob->opaque;                       \
+    PRECHECK_TRANSLATION_CACHE(name##_instruction, blob);                      \
+    BEGIN_TRANSLATION(name##_instruction);                                     \
+    __asm__ volatile(FP_REGISTER_FILE()                                        \
+                     "movl "PIC_PARAM(3)", %%edx;"                             \
+                     LOAD_FP_REGISTER_##precision("%%xmm0")                    \
+                     truncate " %%xmm0, %%rax;"                                \
+                     extend                                                    \
+                     "cmpq %%rax, %%rdx;"                                      \
+                     "jne 1f;"                                                 \
+                     "movl "PIC_PARAM(2)", %%edx;"                             \
+                     "movl %%eax, (%%r15, %%rdx, 4);"                          \
+                     "jmp 2f;"                                                 \
+                     "1:"                                                      \
+                     CALL_FPU_SLOWPATH()                                       \
+                     "2:"                                                      \
+                     RESET_ZERO_REGISTER()                                     \
+                     PROCEED_TO_NEXT_INSTRUCTION()                             \
+                     END_INSTRUCTION(name##_instruction)                       \
+                     :                                                         \
+                     :FP_OPERANDS                                              \
+                     :"memory");                                               \
+        BEGIN_PARAM_SCHEMA()                                                   \
+            PARAM32() /*operation and register indexes*/                       \
+            PARAM32() /*imm*/                                                  \
+            PARAM32() /*rd index*/                                             \
+            PARAM32() /*rs1 index*/                                            \
+        END_PARAM_SCHEMA()                                                     \
+    END_TRANSLATION(name##_instruction);                                       \
+        BEGIN_PARAM(name##_instruction)                                        \
+            pack_decoded_fields(dec),                                          \
+            dec->imm,                                                          \
+            dec->rd_index,                                                     \
+            dec->rs1_index                                                     \
+        END_PARAM()                                                            \
+    COMMIT_TRANSLATION(name##_instruction, hartptr,                            \
+                       instruction_linear_address);                            \
+    blob->next_instruction_to_fetch += dec->length;                            \
+}
+
+FP_TO_INTEGER_TRANSLATOR(fcvt_w_s, S, "cvttss2siq",
+                         "movslq %%eax, %%rdx;")
+FP_TO_INTEGER_TRANSLATOR(fcvt_wu_s, S, "cvttss2siq",
+                         "movl %%eax, %%edx;")
+FP_TO_INTEGER_TRANSLATOR(fcvt_w_d, D, "cvttsd2siq",
+                         "movslq %%eax, %%rdx;")
+FP_TO_INTEGER_TRANSLATOR(fcvt_wu_d, D, "cvttsd2siq",
+                         "movl %%eax, %%edx;")
+
+// loads and stores, the 32-bit ones are not required to be aligned like
+// lw/sw.
+//  PARAM0: frd(or frs2) index, PARAM1: rs1 index, PARAM2: imm
+#define FP_LOAD_TRANSLATOR(name, reader, store_value)                          \
+static void                                                                    \
+riscv_##name##_translator(struct decoded_instruction * dec,                    \
+                          struct prefetch_blob * blob)                         \
+{                                                                              \
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;     \
+    struct hart * hartptr = (struct hart *)blob->opaque;                       \
+    PRECHECK_TRANSLATION_CACHE(name##_instruction, blob);                      \
+    BEGIN_TRANSLATION(name##_instruction);                                     \
+    __asm__ volatile("movl "PIC_PARAM(1)", %%edx;"                             \
+                     "movl (%%r15, %%rdx, 4), %%esi;"                          \
+                     "addl "PIC_PARAM(2)", %%esi;"                             \
+                     "movq %%r12, %%rdi;"                                      \
+                     "movq $"#reader", %%rax;"                                 \
+                     CALL_HELPER_OUT_OF_LINE()                                 \
+                     FP_REGISTER_FILE()                                        \
+                     "movl "PIC_PARAM(0)", %%edx;"                             \
+                     store_value                                               \
+                     PROCEED_TO_NEXT_INSTRUCTION()                             \
+                     END_INSTRUCTION(name##_instruction)                       \
+                     :                                                         \
+                     :FP_OPERANDS                                              \
+                     :"memory");                                               \
+        BEGIN_PARAM_SCHEMA()                                                   \
+            PARAM32() /*frd index*/                                            \
+            PARAM32() /*rs1 index*/                                            \
+            PARAM32() /*imm*/                                                  \
+        END_PARAM_SCHEMA()                                                     \
+    END_TRANSLATION(name##_instruction);                                       \
+        BEGIN_PARAM(name##_instruction)                                        \
+            dec->rd_index,                                                     \
+            dec->rs1_index,                                                    \
+            dec->imm                                                           \
+        END_PARAM()                                                            \
+    COMMIT_TRANSLATION(name##_instruction, hartptr,                            \
+                       instruction_linear_address);                            \
+    blob->next_instruction_to_fetch += dec->length;                            \
+}
+
+#define FP_STORE_TRANSLATOR(name, writer, load_value)                          \
+static void                                                                    \
+riscv_##name##_translator(struct decoded_instruction * dec,                    \
+                          struct prefetch_blob * blob)                         \
+{                                                                              \
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;     \
+    struct hart * hartptr = (struct hart *)blob->opaque;                       \
+    PRECHECK_TRANSLATION_CACHE(name##_instruction, blob);                      \
+    BEGIN_TRANSLATION(name##_instruction);                                     \
+    __asm__ volatile("movl "PIC_PARAM(1)", %%edx;"                             \
+                     "movl (%%r15, %%rdx, 4), %%esi;"                          \
+                     "addl "PIC_PARAM(2)", %%esi;"                             \
+                     FP_REGISTER_FILE()                                        \
+                     "movl "PIC_PARAM(0)", %%edx;"                             \
+                     load_value                                                \
+                     "movq %%r12, %%rdi;"                                      \
+                     "movq $"#writer", %%rax;"                                 \
+                     CALL_HELPER_OUT_OF_LINE()                                 \
+                     PROCEED_TO_NEXT_INSTRUCTION()                             \
+                     END_INSTRUCTION(name##_instruction)                       \
+                     :                                                         \
+                     :FP_OPERANDS                                              \
+                     :"memory");                                               \
+        BEGIN_PARAM_SCHEMA()                                                   \
+            PARAM32() /*frs2 index*/                                           \
+            PARAM32() /*rs1 index*/                                            \
+            PARAM32() /*imm*/                                                  \
+        END_PARAM_SCHEMA()                                                     \
+    END_TRANSLATION(name##_instruction);                                       \
+        BEGIN_PARAM(name##_instruction)                                        \
+            dec->rs2_index,                                                    \
+            dec->rs1_index,                                                    \
+            dec->imm                                                           \
+        END_PARAM()                                                            \
+    COMMIT_TRANSLATION(name##_instruction, hartptr,                            \
+                       instruction_linear_address);                            \
+    blob->next_instruction_to_fetch += dec->length;                            \
+}
+
+FP_LOAD_TRANSLATOR(flw, mmu_read32, "movl %%eax, (%%rcx, %%rdx, 8);"
+                                    "movl $0xffffffff, 4(%%rcx, %%rdx, 8);")
+FP_LOAD_TRANSLATOR(fld, mmu_read64, "movq %%rax, (%%rcx, %%rdx, 8);")
+FP_STORE_TRANSLATOR(fsw, mmu_write32, "movl (%%rcx, %%rdx, 8), %%edx;")
+FP_STORE_TRANSLATOR(fsd, mmu_write64, "movq (%%rcx, %%rdx, 8), %%rdx;")
+
+struct fp_translator {
+    instruction_translator translator;
+    // the translation runs with the dynamic rounding mode, an instruction with
+    // a static one takes the slow path.
+    int is_rounded;
+    // the translation is for the RTZ conversions only
+    int is_truncating;
+    // the conversion is exact whatever the rounding mode is, but a reserved
+    // one is still illegal: a static one takes the slow path and so does the
+    // dynamic one, frm is checked there.
+    int is_exact;
+};
+
+static struct fp_translator fp_translators[RISCV_OP_MAX];
+
+static void
+riscv_fp_translator(struct decoded_instruction * dec,
+                    struct prefetch_blob * blob)
+{
+    struct fp_translator * fpt = &fp_translators[dec->operation];
+    uint32_t rm = dec->imm & 0x7;
+    if (!fpt->translator ||
+        (fpt->is_rounded && rm != FRM_DYN) ||
+        (fpt->is_truncating && rm != FRM_RTZ) ||
+        (fpt->is_exact && rm > FRM_RMM)) {
+        riscv_fp_slowpath_translator(dec, blob);
+    } else {
+        fpt->translator(dec, blob);
+    }
+}
+
+static void
+register_fp_translator(uint8_t operation, instruction_translator translator,
+                       int is_rounded, int is_truncating, int is_exact)
+{
+    fp_translators[operation].translator = translator;
+    fp_translators[operation].is_rounded = is_rounded;
+    fp_translators[operation].is_truncating = is_truncating;
+    fp_translators[operation].is_exact = is_exact;
+}
+
+// VEX encoded instructions require the OS to preserve the AVX state as well.
+static int
+host_supports_fma(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t xcr0_low, xcr0_high;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+        !(ecx & (1 << 12)) || !(ecx & (1 << 27)) || !(ecx & (1 << 28))) {
+        return 0;
+    }
+    __asm__ volatile("xgetbv;"
+                     :"=a"(xcr0_low), "=d"(xcr0_high)
+                     :"c"(0));
+    return (xcr0_low & 0x6) == 0x6;
+}
+
+__attribute__((constructor)) static void
+float_constructor(void)
+{
+    int fma = host_supports_fma();
+    int op;
+    log_debug("host floating-point: fma:%d\n", fma);
+    #define _(op, name, is_rounded, is_truncating, is_exact)                   \
+        register_fp_translator(RISCV_OP_##op, riscv_##name##_translator,       \
+                               is_rounded, is_truncating, is_exact)
+    _(FLW, flw, 0, 0, 0);
+    _(FLD, fld, 0, 0, 0);
+    _(FSW, fsw, 0, 0, 0);
+    _(FSD, fsd, 0, 0, 0);
+    _(FADD_S, fadd_s, 1, 0, 0);
+    _(FSUB_S, fsub_s, 1, 0, 0);
+    _(FMUL_S, fmul_s, 1, 0, 0);
+    _(FDIV_S, fdiv_s, 1, 0, 0);
+    _(FSQRT_S, fsqrt_s, 1, 0, 0);
+    _(FADD_D, fadd_d, 1, 0, 0);
+    _(FSUB_D, fsub_d, 1, 0, 0);
+    _(FMUL_D, fmul_d, 1, 0, 0);
+    _(FDIV_D, fdiv_d, 1, 0, 0);
+    _(FSQRT_D, fsqrt_d, 1, 0, 0);
+    if (fma) {
+        _(FMADD_S, fmadd_s, 1, 0, 0);
+        _(FMSUB_S, fmsub_s, 1, 0, 0);
+        _(FNMSUB_S, fnmsub_s, 1, 0, 0);
+        _(FNMADD_S, fnmadd_s, 1, 0, 0);
+        _(FMADD_D, fmadd_d, 1, 0, 0);
+        _(FMSUB_D, fmsub_d, 1, 0, 0);
+        _(FNMSUB_D, fnmsub_d, 1, 0, 0);
+        _(FNMADD_D, fnmadd_d, 1, 0, 0);
+    }
+    _(FCVT_S_D, fcvt_s_d, 1, 0, 0);
+    _(FCVT_D_S, fcvt_d_s, 0, 0, 1);
+    _(FSGNJ_S, fsgnj_s, 0, 0, 0);
+    _(FSGNJN_S, fsgnjn_s, 0, 0, 0);
+    _(FSGNJX_S, fsgnjx_s, 0, 0, 0);
+    _(FSGNJ_D, fsgnj_d, 0, 0, 0);
+    _(FSGNJN_D, fsgnjn_d, 0, 0, 0);
+    _(FSGNJX_D, fsgnjx_d, 0, 0, 0);
+    _(FEQ_S, feq_s, 0, 0, 0);
+    _(FLT_S, flt_s, 0, 0, 0);
+    _(FLE_S, fle_s, 0, 0, 0);
+    _(FEQ_D, feq_d, 0, 0, 0);
+    _(FLT_D, flt_d, 0, 0, 0);
+    _(FLE_D, fle_d, 0, 0, 0);
+    _(FMV_X_W, fmv_x_w, 0, 0, 0);
+    _(FMV_W_X, fmv_w_x, 0, 0, 0);
+    _(FCVT_S_W, fcvt_s_w, 1, 0, 0);
+    _(FCVT_S_WU, fcvt_s_wu, 1, 0, 0);
+    _(FCVT_D_W, fcvt_d_w, 0, 0, 1);
+    _(FCVT_D_WU, fcvt_d_wu, 0, 0, 1);
+    _(FCVT_W_S, fcvt_w_s, 0, 1, 0);
+    _(FCVT_WU_S, fcvt_wu_s, 0, 1, 0);
+    _(FCVT_W_D, fcvt_w_d, 0, 1, 0);
+    _(FCVT_WU_D, fcvt_wu_d, 0, 1, 0);
+    #undef _
+    // fmin/fmax and fclass always take the slow path.
+    for (op = RISCV_OP_FLW; op <= RISCV_OP_FCVT_D_WU; op++) {
+        register_instruction_translator(op, riscv_fp_translator);
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      The entry of an emulated libc routine in the translation cache: the
+ *      host carries out the routine, or the first guest block of it is
+ *      interpreted if the arguments are not eligible, control goes back to
+ *      the vmm in either case.
+ */
+
+#include <translation.h>
+#include <interpreter.h>
+#include <hle.h>
+#include <util.h>
+#include <vmm_smp.h>
+
+__attribute__((unused)) static void
+hle_callback(struct hart * hartptr, int routine)
+{
+    if (!hle_call(hartptr, routine)) {
+        // the interpreter may carry out a syscall, it runs in the vmm.
+        vmm_enter();
+        interpret_block_once(hartptr);
+        vmm_leave();
+    }
+}
+
+void
+riscv_hle_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob, int routine)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    PRECHECK_TRANSLATION_CACHE(hle_instruction, blob);
+    BEGIN_TRANSLATION(hle_instruction);
+    __asm__ volatile("movq %%r12, %%rdi;"
+                     "movl "PIC_PARAM(0)", %%esi;"
+                     "movq $hle_callback, %%rax;"
+                     CALL_HELPER_OUT_OF_LINE()
+                     RESET_ZERO_REGISTER()
+                     TRAP_TO_VMM(hle_instruction)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*routine*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(hle_instruction);
+        BEGIN_PARAM(hle_instruction)
+            routine
+        END_PARAM()
+    COMMIT_TRANSLATION(hle_instruction, hartptr, instruction_linear_address);
+    blob->is_to_stop = 1;
+}
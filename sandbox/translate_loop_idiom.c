@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      The head of a loop idiom in the translation cache: the host runs the
+ *      loop to its end and control goes back to the vmm, or if it's not
+ *      eligible the template falls through into the translation of the head
+ *      instruction, i.e. the loop is executed as translated code.
+ */
+
+#include <translation.h>
+#include <loop_idiom.h>
+#include <util.h>
+#include <string.h>
+
+// NOTE: room is made for the translation of the head instruction too.
+#define LOOP_IDIOM_HEAD_ROOM 4096
+
+void
+riscv_loop_idiom_translator(struct decoded_instruction * dec,
+                            struct prefetch_blob * blob,
+                            struct loop_idiom * idiom)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    // NOTE: the parameters below must cover the whole descriptor.
+    ASSERT(LOOP_IDIOM_WORDS == 9);
+    uint32_t words[LOOP_IDIOM_WORDS];
+    memcpy(words, idiom, sizeof(words));
+    // XXX: the fall-through must never reach the exit of the unit, the vmm
+    // would dispatch the head again.
+    if (TRANSLATION_SIZE(loop_idiom_instruction) + LOOP_IDIOM_HEAD_ROOM >
+        unoccupied_cache_size(hartptr)) {
+        if (!blob->is_flushable) {
+            blob->is_to_stop = 1;
+            return;
+        }
+        flush_translation_cache(hartptr);
+    }
+    blob->is_flushable = 0;
+    BEGIN_TRANSLATION(loop_idiom_instruction);
+    __asm__ volatile("movq %%r12, %%rdi;"
+                     "leaq "PIC_PARAM(0)", %%rsi;"
+                     "movq $loop_idiom_run, %%rax;"
+                     CALL_HELPER_OUT_OF_LINE()
+                     "testl %%eax, %%eax;"
+                     "jz loop_idiom_instruction_translation_end;"
+                     RESET_ZERO_REGISTER()
+                     TRAP_TO_VMM(loop_idiom_instruction)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*struct loop_idiom*/
+            PARAM32()
+            PARAM32()
+            PARAM32()
+            PARAM32()
+            PARAM32()
+            PARAM32()
+            PARAM32()
+            PARAM32()
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(loop_idiom_instruction);
+        BEGIN_PARAM(loop_idiom_instruction)
+            words[0], words[1], words[2], words[3], words[4],
+            words[5], words[6], words[7], words[8]
+        END_PARAM()
+    COMMIT_TRANSLATION(loop_idiom_instruction, hartptr,
+                       instruction_linear_address);
+}
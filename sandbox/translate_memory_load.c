@@ -8,13 +8,13 @@
 #include <mmu.h>
 
 static void
-riscv_lb_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_lb_translator(struct decoded_instruction * dec,
+                    struct prefetch_blob * blob)
 
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t signed_offset = sign_extend32(dec->imm, 11);
+    int32_t signed_offset = dec->imm;
 
     PRECHECK_TRANSLATION_CACHE(lb_instruction, blob);
     BEGIN_TRANSLATION(lb_instruction);
@@ -26,9 +26,7 @@ riscv_lb_translator(struct decoding * dec, struct prefetch_blob * blob,
                      "addl %%edx, %%esi;" // ESI: the memory location
                      "movq %%r12, %%rdi;"
                      "movq $mmu_read8, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;" // EAX: the memory read from the location
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE() // EAX: the memory read from the location
                      "movl "PIC_PARAM(2)", %%edx;"
                      "shl $2, %%edx;"
                      "addq %%r15, %%rdx;"
@@ -52,17 +50,17 @@ riscv_lb_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(lb_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_lbu_translator(struct decoding * dec, struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_lbu_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t signed_offset = sign_extend32(dec->imm, 11);
+    int32_t signed_offset = dec->imm;
 
     PRECHECK_TRANSLATION_CACHE(lbu_instruction, blob);
     BEGIN_TRANSLATION(lbu_instruction);
@@ -74,9 +72,7 @@ riscv_lbu_translator(struct decoding * dec, struct prefetch_blob * blob,
                      "addl %%edx, %%esi;" // ESI: the memory location
                      "movq %%r12, %%rdi;"
                      "movq $mmu_read8, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;" // EAX: the memory read from the location
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE() // EAX: the memory read from the location
                      "movl "PIC_PARAM(2)", %%edx;"
                      "shl $2, %%edx;"
                      "addq %%r15, %%rdx;"
@@ -100,18 +96,18 @@ riscv_lbu_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(lbu_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 
 static void
-riscv_lh_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_lh_translator(struct decoded_instruction * dec,
+                    struct prefetch_blob * blob)
 
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t signed_offset = sign_extend32(dec->imm, 11);
+    int32_t signed_offset = dec->imm;
 
     PRECHECK_TRANSLATION_CACHE(lh_instruction, blob);
     BEGIN_TRANSLATION(lh_instruction);
@@ -123,9 +119,7 @@ riscv_lh_translator(struct decoding * dec, struct prefetch_blob * blob,
                      "addl %%edx, %%esi;" // ESI: the memory location
                      "movq %%r12, %%rdi;"
                      "movq $mmu_read16, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;" // EAX: the memory read from the location
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE() // EAX: the memory read from the location
                      "movl "PIC_PARAM(2)", %%edx;"
                      "shl $2, %%edx;"
                      "addq %%r15, %%rdx;"
@@ -149,17 +143,17 @@ riscv_lh_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(lh_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_lhu_translator(struct decoding * dec, struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_lhu_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t signed_offset = sign_extend32(dec->imm, 11);
+    int32_t signed_offset = dec->imm;
 
     PRECHECK_TRANSLATION_CACHE(lhu_instruction, blob);
     BEGIN_TRANSLATION(lhu_instruction);
@@ -171,9 +165,7 @@ riscv_lhu_translator(struct decoding * dec, struct prefetch_blob * blob,
                      "addl %%edx, %%esi;" // ESI: the memory location
                      "movq %%r12, %%rdi;"
                      "movq $mmu_read16, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;" // EAX: the memory read from the location
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE() // EAX: the memory read from the location
                      "movl "PIC_PARAM(2)", %%edx;"
                      "shl $2, %%edx;"
                      "addq %%r15, %%rdx;"
@@ -197,17 +189,86 @@ riscv_lhu_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(lhu_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
+// two loads of adjacent words off the same base are done by one 64-bit access,
+// e.g. the callee-saved registers restored in an epilogue.
 static void
-riscv_lw_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_lw_pair_translator(struct decoded_instruction * first,
+                         struct decoded_instruction * second,
+                         struct prefetch_blob * blob)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    // the template stands for both instructions.
+    struct decoded_instruction pair = *first;
+    struct decoded_instruction * dec = &pair;
+    pair.length += second->length;
+    int is_first_low = first->imm < second->imm;
+    int32_t signed_offset = is_first_low ? first->imm : second->imm;
+
+    PRECHECK_TRANSLATION_CACHE(lw_pair_instruction, blob);
+    BEGIN_TRANSLATION(lw_pair_instruction);
+    __asm__ volatile("movl "PIC_PARAM(1)", %%edx;"
+                     "shl $2, %%edx;"
+                     "addq %%r15, %%rdx;"
+                     "movl (%%rdx), %%esi;"
+                     "movl "PIC_PARAM(0)", %%edx;"
+                     "addl %%edx, %%esi;" // ESI: the location of the low word
+                     "movq %%r12, %%rdi;"
+                     "movq $mmu_read32x2, %%rax;"
+                     CALL_HELPER_OUT_OF_LINE() // RAX: the two words
+                     "movl "PIC_PARAM(2)", %%edx;"
+                     "movl %%eax, (%%r15, %%rdx, 4);"
+                     "shrq $32, %%rax;"
+                     "movl "PIC_PARAM(3)", %%edx;"
+                     "movl %%eax, (%%r15, %%rdx, 4);"
+                     RESET_ZERO_REGISTER()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     END_INSTRUCTION(lw_pair_instruction)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*imm: signed offset of the low word*/
+            PARAM32() /*rs1_index*/
+            PARAM32() /*rd_index of the low word*/
+            PARAM32() /*rd_index of the high word*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(lw_pair_instruction);
+        BEGIN_PARAM(lw_pair_instruction)
+            signed_offset,
+            first->rs1_index,
+            is_first_low ? first->rd_index : second->rd_index,
+            is_first_low ? second->rd_index : first->rd_index
+        END_PARAM()
+    COMMIT_TRANSLATION(lw_pair_instruction, hartptr,
+                       instruction_linear_address);
+    blob->next_instruction_to_fetch += dec->length;
+}
+
+static void
+riscv_lw_translator(struct decoded_instruction * dec,
+                    struct prefetch_blob * blob)
 
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t signed_offset = sign_extend32(dec->imm, 11);
+    int32_t signed_offset = dec->imm;
+    struct decoded_instruction next;
+    // NOTE: the first load must not change the base, and the destinations must
+    // differ so that the order of the register writes doesn't matter.
+    if (fetch_fusible_instruction(blob, instruction_linear_address +
+                                  dec->length, &next) &&
+        next.operation == RISCV_OP_LW &&
+        next.rs1_index == dec->rs1_index &&
+        dec->rd_index != dec->rs1_index &&
+        next.rd_index != dec->rd_index &&
+        (next.imm - dec->imm == 4 || dec->imm - next.imm == 4)) {
+        riscv_lw_pair_translator(dec, &next, blob);
+        return;
+    }
 
     PRECHECK_TRANSLATION_CACHE(lw_instruction, blob);
     BEGIN_TRANSLATION(lw_instruction);
@@ -219,9 +280,7 @@ riscv_lw_translator(struct decoding * dec, struct prefetch_blob * blob,
                      "addl %%edx, %%esi;" // ESI: the memory location
                      "movq %%r12, %%rdi;"
                      "movq $mmu_read32, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;" // EAX: the memory read from the location
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE() // EAX: the memory read from the location
                      "movl "PIC_PARAM(2)", %%edx;"
                      "shl $2, %%edx;"
                      "addq %%r15, %%rdx;"
@@ -244,29 +303,15 @@ riscv_lw_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(lw_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
-static instruction_sub_translator per_funct3_handlers[8];
-
-void
-riscv_memory_load_instructions_translation_entry(struct prefetch_blob * blob,
-                                                  uint32_t instruction)
-{
-    struct decoding dec;
-    instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_I);
-    ASSERT(per_funct3_handlers[dec.funct3]);
-    per_funct3_handlers[dec.funct3](&dec, blob, instruction);
-}
-
-
 __attribute__((constructor)) static void
 memory_load_constructor(void)
 {
-    memset(per_funct3_handlers, 0x0, sizeof(per_funct3_handlers));
-    per_funct3_handlers[2] = riscv_lw_translator;
-    per_funct3_handlers[1] = riscv_lh_translator;
-    per_funct3_handlers[5] = riscv_lhu_translator;
-    per_funct3_handlers[0] = riscv_lb_translator;
-    per_funct3_handlers[4] = riscv_lbu_translator;
+    register_instruction_translator(RISCV_OP_LW, riscv_lw_translator);
+    register_instruction_translator(RISCV_OP_LH, riscv_lh_translator);
+    register_instruction_translator(RISCV_OP_LHU, riscv_lhu_translator);
+    register_instruction_translator(RISCV_OP_LB, riscv_lb_translator);
+    register_instruction_translator(RISCV_OP_LBU, riscv_lbu_translator);
 }
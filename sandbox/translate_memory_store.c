@@ -9,12 +9,12 @@
 
 
 static void
-riscv_sb_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_sb_translator(struct decoded_instruction * dec,
+                    struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t signed_offset = sign_extend32(dec->imm, 11);
+    int32_t signed_offset = dec->imm;
     PRECHECK_TRANSLATION_CACHE(sb_instruction, blob);
     BEGIN_TRANSLATION(sb_instruction);
     __asm__ volatile("movl "PIC_PARAM(1)", %%edx;"
@@ -30,9 +30,7 @@ riscv_sb_translator(struct decoding * dec, struct prefetch_blob * blob,
                      "andl $0xff, %%edx;"
                      "movq %%r12, %%rdi;"
                      "movq $mmu_write8, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;"
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE()
                      PROCEED_TO_NEXT_INSTRUCTION()
                      END_INSTRUCTION(sb_instruction)
                      :
@@ -50,17 +48,17 @@ riscv_sb_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rs2_index
         END_PARAM()
     COMMIT_TRANSLATION(sb_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 
 static void
-riscv_sh_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_sh_translator(struct decoded_instruction * dec,
+                    struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t signed_offset = sign_extend32(dec->imm, 11);
+    int32_t signed_offset = dec->imm;
     PRECHECK_TRANSLATION_CACHE(sh_instruction, blob);
     BEGIN_TRANSLATION(sh_instruction);
     __asm__ volatile("movl "PIC_PARAM(1)", %%edx;"
@@ -76,9 +74,7 @@ riscv_sh_translator(struct decoding * dec, struct prefetch_blob * blob,
                      "andl $0xffff, %%edx;"
                      "movq %%r12, %%rdi;"
                      "movq $mmu_write16, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;"
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE()
                      PROCEED_TO_NEXT_INSTRUCTION()
                      END_INSTRUCTION(sh_instruction)
                      :
@@ -96,17 +92,81 @@ riscv_sh_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rs2_index
         END_PARAM()
     COMMIT_TRANSLATION(sh_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 
+// two stores of adjacent words off the same base are done by one 64-bit access,
+// e.g. the callee-saved registers spilled in a prologue.
 static void
-riscv_sw_translator(struct decoding * dec, struct prefetch_blob * blob,
-                    uint32_t instruction)
+riscv_sw_pair_translator(struct decoded_instruction * first,
+                         struct decoded_instruction * second,
+                         struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    int32_t signed_offset = sign_extend32(dec->imm, 11);
+    // the template stands for both instructions.
+    struct decoded_instruction pair = *first;
+    struct decoded_instruction * dec = &pair;
+    pair.length += second->length;
+    int is_first_low = first->imm < second->imm;
+    int32_t signed_offset = is_first_low ? first->imm : second->imm;
+    PRECHECK_TRANSLATION_CACHE(sw_pair_instruction, blob);
+    BEGIN_TRANSLATION(sw_pair_instruction);
+    __asm__ volatile("movl "PIC_PARAM(1)", %%edx;"
+                     "shl $2, %%edx;"
+                     "addq %%r15, %%rdx;"
+                     "movl (%%rdx), %%esi;"
+                     "movl "PIC_PARAM(0)", %%edx;"
+                     "addl %%edx, %%esi;"          // ESI: location of the low word
+                     "movl "PIC_PARAM(2)", %%edx;"
+                     "movl (%%r15, %%rdx, 4), %%eax;"
+                     "movl "PIC_PARAM(3)", %%edx;"
+                     "movl (%%r15, %%rdx, 4), %%edx;"
+                     "shlq $32, %%rdx;"
+                     "orq %%rax, %%rdx;"           // RDX: the two words
+                     "movq %%r12, %%rdi;"
+                     "movq $mmu_write32x2, %%rax;"
+                     CALL_HELPER_OUT_OF_LINE()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     END_INSTRUCTION(sw_pair_instruction)
+                     :
+                     :
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32() /*imm: signed offset of the low word*/
+            PARAM32() /*rs1_index: memory base register*/
+            PARAM32() /*rs2_index of the low word*/
+            PARAM32() /*rs2_index of the high word*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(sw_pair_instruction);
+        BEGIN_PARAM(sw_pair_instruction)
+            signed_offset,
+            first->rs1_index,
+            is_first_low ? first->rs2_index : second->rs2_index,
+            is_first_low ? second->rs2_index : first->rs2_index
+        END_PARAM()
+    COMMIT_TRANSLATION(sw_pair_instruction, hartptr,
+                       instruction_linear_address);
+    blob->next_instruction_to_fetch += dec->length;
+}
+
+static void
+riscv_sw_translator(struct decoded_instruction * dec,
+                    struct prefetch_blob * blob)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    int32_t signed_offset = dec->imm;
+    struct decoded_instruction next;
+    if (fetch_fusible_instruction(blob, instruction_linear_address +
+                                  dec->length, &next) &&
+        next.operation == RISCV_OP_SW &&
+        next.rs1_index == dec->rs1_index &&
+        (next.imm - dec->imm == 4 || dec->imm - next.imm == 4)) {
+        riscv_sw_pair_translator(dec, &next, blob);
+        return;
+    }
     PRECHECK_TRANSLATION_CACHE(sw_instruction, blob);
     BEGIN_TRANSLATION(sw_instruction);
     __asm__ volatile("movl "PIC_PARAM(1)", %%edx;"
@@ -121,9 +181,7 @@ riscv_sw_translator(struct decoding * dec, struct prefetch_blob * blob,
                      "movl (%%rdx), %%edx;"        // EDX: mmeory store source value
                      "movq %%r12, %%rdi;"
                      "movq $mmu_write32, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;"
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE()
                      PROCEED_TO_NEXT_INSTRUCTION()
                      END_INSTRUCTION(sw_instruction)
                      :
@@ -141,27 +199,13 @@ riscv_sw_translator(struct decoding * dec, struct prefetch_blob * blob,
             dec->rs2_index
         END_PARAM()
     COMMIT_TRANSLATION(sw_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
-}
-
-static instruction_sub_translator per_funct3_handlers[8];
-
-void
-riscv_memory_store_instructions_translation_entry(struct prefetch_blob * blob,
-                                                  uint32_t instruction)
-{
-    struct decoding dec;
-    instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_S);
-    ASSERT(per_funct3_handlers[dec.funct3]);
-    per_funct3_handlers[dec.funct3](&dec, blob, instruction);
+    blob->next_instruction_to_fetch += dec->length;
 }
 
-
 __attribute__((constructor)) static void
 memory_store_constructor(void)
 {
-    memset(per_funct3_handlers, 0x0, sizeof(per_funct3_handlers));
-    per_funct3_handlers[0] = riscv_sb_translator;
-    per_funct3_handlers[1] = riscv_sh_translator;
-    per_funct3_handlers[2] = riscv_sw_translator;
+    register_instruction_translator(RISCV_OP_SB, riscv_sb_translator);
+    register_instruction_translator(RISCV_OP_SH, riscv_sh_translator);
+    register_instruction_translator(RISCV_OP_SW, riscv_sw_translator);
 }
@@ -7,12 +7,9 @@
 #include <string.h>
 #include <hart_exception.h>
 
-static instruction_sub_translator per_funct3_handlers[8];
-
 static void
-riscv_mul_translator(struct decoding * dec,
-                     struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_mul_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -49,14 +46,13 @@ riscv_mul_translator(struct decoding * dec,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(mul_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 
 static void
-riscv_mulh_translator(struct decoding * dec,
-                      struct prefetch_blob * blob,
-                      uint32_t instruction)
+riscv_mulh_translator(struct decoded_instruction * dec,
+                      struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -93,13 +89,12 @@ riscv_mulh_translator(struct decoding * dec,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(mulh_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_mulhu_translator(struct decoding * dec,
-                       struct prefetch_blob * blob,
-                       uint32_t instruction)
+riscv_mulhu_translator(struct decoded_instruction * dec,
+                       struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -136,13 +131,12 @@ riscv_mulhu_translator(struct decoding * dec,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(mulhu_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_mulhsu_translator(struct decoding * dec,
-                        struct prefetch_blob * blob,
-                        uint32_t instruction)
+riscv_mulhsu_translator(struct decoded_instruction * dec,
+                        struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -181,7 +175,7 @@ riscv_mulhsu_translator(struct decoding * dec,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(mulhsu_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 
@@ -193,9 +187,8 @@ riscv_mulhsu_translator(struct decoding * dec,
 // rbx = 0xffffffff
 // VMM: Floating point exception
 static void
-riscv_div_translator(struct decoding * dec,
-                     struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_div_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -239,13 +232,12 @@ riscv_div_translator(struct decoding * dec,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(div_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_rem_translator(struct decoding * dec,
-                     struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_rem_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -284,13 +276,12 @@ riscv_rem_translator(struct decoding * dec,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(rem_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_divu_translator(struct decoding * dec,
-                      struct prefetch_blob * blob,
-                      uint32_t instruction)
+riscv_divu_translator(struct decoded_instruction * dec,
+                      struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -333,13 +324,12 @@ riscv_divu_translator(struct decoding * dec,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(divu_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_remu_translator(struct decoding * dec,
-                      struct prefetch_blob * blob,
-                      uint32_t instruction)
+riscv_remu_translator(struct decoded_instruction * dec,
+                      struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -377,32 +367,20 @@ riscv_remu_translator(struct decoding * dec,
             dec->rd_index
         END_PARAM()
     COMMIT_TRANSLATION(remu_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
-}
-
-void
-riscv_mul_div_instructions_translation_entry(struct decoding * dec,
-                                             struct prefetch_blob * blob,
-                                             uint32_t instruction)
-{
-    ASSERT(per_funct3_handlers[dec->funct3]);
-    per_funct3_handlers[dec->funct3](dec, blob, instruction);
+    blob->next_instruction_to_fetch += dec->length;
 }
 
-
-
 __attribute__((constructor)) static void
 mul_and_div_constructor(void)
 {
-    memset(per_funct3_handlers, 0x0, sizeof(per_funct3_handlers));
-    per_funct3_handlers[0x0] = riscv_mul_translator;
-    per_funct3_handlers[0x1] = riscv_mulh_translator;
-    per_funct3_handlers[0x3] = riscv_mulhu_translator;
-    per_funct3_handlers[0x2] = riscv_mulhsu_translator;
-    per_funct3_handlers[0x4] = riscv_div_translator;
-    per_funct3_handlers[0x5] = riscv_divu_translator;
-    per_funct3_handlers[0x6] = riscv_rem_translator;
-    per_funct3_handlers[0x7] = riscv_remu_translator;
+    register_instruction_translator(RISCV_OP_MUL, riscv_mul_translator);
+    register_instruction_translator(RISCV_OP_MULH, riscv_mulh_translator);
+    register_instruction_translator(RISCV_OP_MULHU, riscv_mulhu_translator);
+    register_instruction_translator(RISCV_OP_MULHSU, riscv_mulhsu_translator);
+    register_instruction_translator(RISCV_OP_DIV, riscv_div_translator);
+    register_instruction_translator(RISCV_OP_DIVU, riscv_divu_translator);
+    register_instruction_translator(RISCV_OP_REM, riscv_rem_translator);
+    register_instruction_translator(RISCV_OP_REMU, riscv_remu_translator);
 }
 #include <fenv.h>
 __attribute__((constructor)) static void
@@ -18,8 +18,8 @@ ebreak_callback(struct hart * hartptr)
 }
 
 void
-riscv_ebreak_translator(struct decoding * dec, struct prefetch_blob * blob,
-                        uint32_t instruction)
+riscv_ebreak_translator(struct decoded_instruction * dec,
+                        struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -27,9 +27,7 @@ riscv_ebreak_translator(struct decoding * dec, struct prefetch_blob * blob,
     BEGIN_TRANSLATION(ebreak_instruction);
         __asm__ volatile("movq %%r12, %%rdi;"
                          "movq $ebreak_callback, %%rax;"
-                         SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                         "call *%%rax;"
-                         RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                         CALL_HELPER_OUT_OF_LINE()
                          PROCEED_TO_NEXT_INSTRUCTION()
                          END_INSTRUCTION(ebreak_instruction)
                          :
@@ -43,7 +41,7 @@ riscv_ebreak_translator(struct decoding * dec, struct prefetch_blob * blob,
             instruction_linear_address
         END_PARAM()
     COMMIT_TRANSLATION(ebreak_instruction, hartptr, instruction_linear_address);
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 __attribute__((unused)) static void
@@ -52,15 +50,14 @@ mret_callback(struct hart * hartptr)
     assert_hart_running_in_mmode(hartptr);
     adjust_mstatus_upon_mret(hartptr);
     adjust_pc_upon_mret(hartptr);
-    // translation cache must be flushed, because adjusted privilege level may
-    // diff in addressing space
-    flush_translation_cache(hartptr);
-    
+    // XXX: translations are tagged with the privilege level and the address
+    // space, there is no need to flush the translation cache.
+    flush_dispatch_cache(hartptr);
 }
 
 void
-riscv_mret_translator(struct decoding * dec, struct prefetch_blob * blob,
-                      uint32_t instruction)
+riscv_mret_translator(struct decoded_instruction * dec,
+                      struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -68,9 +65,7 @@ riscv_mret_translator(struct decoding * dec, struct prefetch_blob * blob,
     BEGIN_TRANSLATION(mret_instruction);
     __asm__ volatile("movq %%r12, %%rdi;"
                      "movq $mret_callback, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;"
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE()
                      TRAP_TO_VMM(mret_instruction)
                      :
                      :
@@ -92,13 +87,12 @@ sret_callback(struct hart * hartptr)
     assert_hart_running_in_smode(hartptr);
     adjust_mstatus_upon_sret(hartptr);
     adjust_pc_upon_sret(hartptr);
-    flush_translation_cache(hartptr);
-
+    flush_dispatch_cache(hartptr);
 }
 
 void
-riscv_sret_translator(struct decoding * dec, struct prefetch_blob * blob,
-                      uint32_t instruction)
+riscv_sret_translator(struct decoded_instruction * dec,
+                      struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
@@ -106,9 +100,7 @@ riscv_sret_translator(struct decoding * dec, struct prefetch_blob * blob,
     BEGIN_TRANSLATION(sret_instruction);
     __asm__ volatile("movq %%r12, %%rdi;"
                      "movq $sret_callback, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;"
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE()
                      TRAP_TO_VMM(sret_instruction)
                      :
                      :
@@ -125,28 +117,36 @@ riscv_sret_translator(struct decoding * dec, struct prefetch_blob * blob,
 }
 
 __attribute__((unused)) static void
-sfence_vma_callback(struct hart * hartptr)
+sfence_vma_callback(struct hart * hartptr, uint32_t rs1_index,
+                    uint32_t rs2_index)
 {
     // flush tlb cache
     invalidate_tlb(hartptr->itlb, hartptr->itlb_cap);
     invalidate_tlb(hartptr->dtlb, hartptr->dtlb_cap);
-    // and finlally, flush translation cache
-    flush_translation_cache(hartptr);
+    // and finlally, invalidate the translations of the affected address space
+    // or address, flush the translation cache only if neither is specified.
+    if (rs2_index) {
+        invalidate_translation_asid(hartptr, HART_REG(hartptr, rs2_index));
+    } else if (rs1_index) {
+        invalidate_translation_page(hartptr, HART_REG(hartptr, rs1_index));
+    } else {
+        flush_translation_cache(hartptr);
+    }
 }
 
 void
-riscv_sfence_vma_translator(struct decoding * dec, struct prefetch_blob * blob,
-                            uint32_t instruction)
+riscv_sfence_vma_translator(struct decoded_instruction * dec,
+                            struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
     PRECHECK_TRANSLATION_CACHE(sfence_vma_instruction, blob);
     BEGIN_TRANSLATION(sfence_vma_instruction);
     __asm__ volatile("movq %%r12, %%rdi;"
+                     "movl "PIC_PARAM(1)", %%esi;"
+                     "movl "PIC_PARAM(2)", %%edx;"
                      "movq $sfence_vma_callback, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;"
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE()
                      PROCEED_TO_NEXT_INSTRUCTION()
                      TRAP_TO_VMM(sfence_vma_instruction)
                      :
@@ -154,10 +154,14 @@ riscv_sfence_vma_translator(struct decoding * dec, struct prefetch_blob * blob,
                      :"memory");
         BEGIN_PARAM_SCHEMA()
             PARAM32()
+            PARAM32() /*rs1_index*/
+            PARAM32() /*rs2_index*/
         END_PARAM_SCHEMA()
     END_TRANSLATION(sfence_vma_instruction);
         BEGIN_PARAM(sfence_vma_instruction)
-            instruction_linear_address
+            instruction_linear_address,
+            dec->rs1_index,
+            dec->rs2_index
         END_PARAM()
     COMMIT_TRANSLATION(sfence_vma_instruction, hartptr, instruction_linear_address);
     blob->is_to_stop = 1;
@@ -168,9 +172,12 @@ riscv_sfence_vma_translator(struct decoding * dec, struct prefetch_blob * blob,
 // return :a
 #include <hart_exception.h>
 #include <syscall.h>
+#include <stddef.h>
+#include <vmm_smp.h>
 __attribute__((unused)) static void
 ecall_callback(struct hart * hartptr)
 {
+    vmm_enter();
     hartptr->registers.a0 = do_syscall(hartptr, hartptr->registers.a7,
                                        hartptr->registers.a0,
                                        hartptr->registers.a1,
@@ -178,21 +185,103 @@ ecall_callback(struct hart * hartptr)
                                        hartptr->registers.a3,
                                        hartptr->registers.a4,
                                        hartptr->registers.a5);
+    vmm_leave();
+}
+
+// the syscall number is usually loaded by `li a7, number` right before the
+// ecall. it's only a guess: the ecall may be reached by a jump as well, the
+// translated ecall checks a7 again at runtime.
+static int
+guess_syscall_number(struct prefetch_blob * blob, uint32_t * syscall_number)
+{
+    uint32_t ecall_pc = blob->next_instruction_to_fetch;
+    struct decoded_instruction prev;
+    int length = 4;
+    for (; length >= 2; length -= 2) {
+        if (fetch_fusible_instruction(blob, ecall_pc - length, &prev) &&
+            prev.length == length && prev.operation == RISCV_OP_ADDI &&
+            prev.rd_index == 17 && prev.rs1_index == 0) {
+            *syscall_number = prev.imm;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// a syscall with a fast handler is carried out in the translation cache and
+// the translation unit goes on, any other syscall number falls back to the
+// ecall_callback() slow path which traps to the vmm.
+static void
+riscv_fast_ecall_translator(struct decoded_instruction * dec,
+                            struct prefetch_blob * blob,
+                            uint32_t syscall_number,
+                            sys_handler handler)
+{
+    uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
+    struct hart * hartptr = (struct hart *)blob->opaque;
+    // NOTE: the handler address is carried by a 32-bit parameter, the vmm is
+    // linked at a low address like the `movq $symbol` in the templates assume.
+    ASSERT((uint64_t)handler == (uint32_t)(uint64_t)handler);
+    PRECHECK_TRANSLATION_CACHE(fast_ecall_instruction, blob);
+    BEGIN_TRANSLATION(fast_ecall_instruction);
+    __asm__ volatile("movl "PIC_PARAM(1)", %%eax;"
+                     "cmpl %%eax, %c[a7](%%r15);"
+                     "jne 1f;"
+                     "movq %%r12, %%rdi;"
+                     "movl %c[a0](%%r15), %%esi;"
+                     "movl %c[a1](%%r15), %%edx;"
+                     "movl %c[a2](%%r15), %%ecx;"
+                     "movl "PIC_PARAM(2)", %%eax;"
+                     CALL_HELPER_OUT_OF_LINE()
+                     "movl %%eax, %c[a0](%%r15);"
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     END_INSTRUCTION(fast_ecall_instruction)
+                     "1:"
+                     "movq %%r12, %%rdi;"
+                     "movq $ecall_callback, %%rax;"
+                     CALL_HELPER_OUT_OF_LINE()
+                     PROCEED_TO_NEXT_INSTRUCTION()
+                     TRAP_TO_VMM(fast_ecall_instruction)
+                     :
+                     :[a0]"i"(offsetof(struct integer_register_profile, a0)),
+                      [a1]"i"(offsetof(struct integer_register_profile, a1)),
+                      [a2]"i"(offsetof(struct integer_register_profile, a2)),
+                      [a7]"i"(offsetof(struct integer_register_profile, a7))
+                     :"memory");
+        BEGIN_PARAM_SCHEMA()
+            PARAM32()
+            PARAM32() /*syscall number*/
+            PARAM32() /*fast handler*/
+        END_PARAM_SCHEMA()
+    END_TRANSLATION(fast_ecall_instruction);
+        BEGIN_PARAM(fast_ecall_instruction)
+            instruction_linear_address,
+            syscall_number,
+            (uint32_t)(uint64_t)handler
+        END_PARAM()
+    COMMIT_TRANSLATION(fast_ecall_instruction, hartptr,
+                       instruction_linear_address);
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_ecall_translator(struct decoding * dec, struct prefetch_blob * blob,
-                       uint32_t instruction)
+riscv_ecall_translator(struct decoded_instruction * dec,
+                       struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
+    uint32_t syscall_number;
+    sys_handler handler;
+    if (guess_syscall_number(blob, &syscall_number) &&
+        (handler = fast_syscall_handler(syscall_number))) {
+        riscv_fast_ecall_translator(dec, blob, syscall_number, handler);
+        return;
+    }
     PRECHECK_TRANSLATION_CACHE(ecall_instruction, blob);
     BEGIN_TRANSLATION(ecall_instruction);
     __asm__ volatile("movq %%r12, %%rdi;"
                      "movq $ecall_callback, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;"
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE()
                      PROCEED_TO_NEXT_INSTRUCTION()
                      TRAP_TO_VMM(ecall_instruction)
                      :
@@ -221,19 +310,16 @@ wfi_callback(struct hart * hartptr)
     __not_reach();
 }
 void
-riscv_wfi_translator(struct decoding * dec, struct prefetch_blob * blob,
-                     uint32_t instruction)
+riscv_wfi_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
-    ASSERT(0x8 == (dec->imm >> 5));
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
     PRECHECK_TRANSLATION_CACHE(wfi_instruction, blob);
     BEGIN_TRANSLATION(wfi_instruction);
     __asm__ volatile("movq %%r12, %%rdi;"
                      "movq $wfi_callback, %%rax;"
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()
-                     "call *%%rax;"
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()
+                     CALL_HELPER_OUT_OF_LINE()
                      PROCEED_TO_NEXT_INSTRUCTION()
                      TRAP_TO_VMM(wfi_instruction)
                      :
@@ -249,74 +335,25 @@ riscv_wfi_translator(struct decoding * dec, struct prefetch_blob * blob,
     COMMIT_TRANSLATION(wfi_instruction, hartptr, instruction_linear_address);
     blob->is_to_stop = 1;
 }
-static void
-riscv_funct3_000_translator(struct decoding * dec, struct prefetch_blob * blob,
-                            uint32_t instruction)
-{
-#if 0
-    if (((dec->imm >> 5) & 0x7f) == 0x9) {
-        riscv_sfence_vma_translator(dec, blob, instruction);
-    } else if (dec->rs2_index == 0x5) {
-        riscv_wfi_translator(dec, blob, instruction);
-    } else if (dec->rs2_index == 0x1) {
-        riscv_ebreak_translator(dec, blob, instruction); 
-    } else if (dec->rs2_index == 0x2) {
-        if ((dec->imm >> 5) == 0x18) {
-            riscv_mret_translator(dec, blob, instruction);
-        } else if ((dec->imm >> 5) == 0x8) {
-            riscv_sret_translator(dec, blob, instruction);
-        } else {
-            __not_reach();
-        }
-    } else 
-    #endif
-    if (dec->rs2_index == 0x0) {
-        riscv_ecall_translator(dec, blob, instruction); 
-    } else {
-        log_fatal("can not translate:0x%x at 0x%x\n", instruction, blob->next_instruction_to_fetch);
-        __not_reach();
-    }
-}
-
-
-static instruction_sub_translator per_funct3_handlers[8];
-
-
 void
-riscv_supervisor_level_instructions_translation_entry(struct prefetch_blob * blob,
-                                                      uint32_t instruction)
-{
-    struct decoding dec;
-    // FIXED: only funct3:000 is encoded with type-S, others are not.
-    if (!((instruction >> 12) & 0x7)) {
-        instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_S);
-    } else {
-        instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_I);
-    }
-    if (!per_funct3_handlers[dec.funct3]) {
-        dump_hart(blob->opaque);
-        log_fatal("dec.funct3:0x%x\n", dec.funct3);
-    }
-    ASSERT(per_funct3_handlers[dec.funct3]);
-    per_funct3_handlers[dec.funct3](&dec, blob, instruction);
-}
-
-
-void
-riscv_generic_csr_instructions_translator(struct decoding * dec,
-                                          struct prefetch_blob * blob,
-                                          uint32_t instruction);
+riscv_generic_csr_instructions_translator(struct decoded_instruction * dec,
+                                          struct prefetch_blob * blob);
 
 __attribute__((constructor)) static void
 supervisor_level_constructor(void)
 {
-    memset(per_funct3_handlers, 0x0, sizeof(per_funct3_handlers));
-    per_funct3_handlers[0x0] = riscv_funct3_000_translator;
-    //per_funct3_handlers[0x1] = riscv_generic_csr_instructions_translator;
-    //per_funct3_handlers[0x2] = riscv_generic_csr_instructions_translator;
-    //per_funct3_handlers[0x3] = riscv_generic_csr_instructions_translator;
-    //per_funct3_handlers[0x5] = riscv_generic_csr_instructions_translator;
-    //per_funct3_handlers[0x6] = riscv_generic_csr_instructions_translator;
-    //per_funct3_handlers[0x7] = riscv_generic_csr_instructions_translator;
+#if 0
+    register_instruction_translator(RISCV_OP_SFENCE_VMA, riscv_sfence_vma_translator);
+    register_instruction_translator(RISCV_OP_WFI, riscv_wfi_translator);
+    register_instruction_translator(RISCV_OP_EBREAK, riscv_ebreak_translator);
+    register_instruction_translator(RISCV_OP_MRET, riscv_mret_translator);
+    register_instruction_translator(RISCV_OP_SRET, riscv_sret_translator);
+#endif
+    register_instruction_translator(RISCV_OP_ECALL, riscv_ecall_translator);
+    register_instruction_translator(RISCV_OP_CSRRW, riscv_generic_csr_instructions_translator);
+    register_instruction_translator(RISCV_OP_CSRRS, riscv_generic_csr_instructions_translator);
+    register_instruction_translator(RISCV_OP_CSRRC, riscv_generic_csr_instructions_translator);
+    register_instruction_translator(RISCV_OP_CSRRWI, riscv_generic_csr_instructions_translator);
+    register_instruction_translator(RISCV_OP_CSRRSI, riscv_generic_csr_instructions_translator);
+    register_instruction_translator(RISCV_OP_CSRRCI, riscv_generic_csr_instructions_translator);
 }
-
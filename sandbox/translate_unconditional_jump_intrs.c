@@ -6,15 +6,13 @@
 #include <stdio.h>
 #include <string.h>
 
-void
-riscv_jal_translator(struct prefetch_blob * blob, uint32_t instruction)
+static void
+riscv_jal_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    struct decoding dec;
-    instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_UJ);
-    int jump_target = instruction_linear_address +
-                      sign_extend32(dec.imm << 1, 20);
+    int jump_target = instruction_linear_address + dec->imm;
 
     {
         PRECHECK_TRANSLATION_CACHE(jal_instruction_without_target, blob);
@@ -34,13 +32,13 @@ riscv_jal_translator(struct prefetch_blob * blob, uint32_t instruction)
                          :"memory", "%rax", "%rdx");
             BEGIN_PARAM_SCHEMA()
                 PARAM32() /*rd*/
-                PARAM32() /*pc + 4*/
+                PARAM32() /*pc + length*/
                 PARAM32() /*unconditional jump_target of guest*/
             END_PARAM_SCHEMA()
         END_TRANSLATION(jal_instruction_without_target);
             BEGIN_PARAM(jal_instruction_without_target)
-                dec.rd_index,
-                instruction_linear_address + 4,
+                dec->rd_index,
+                instruction_linear_address + dec->length,
                 jump_target
             END_PARAM()
         COMMIT_TRANSLATION(jal_instruction_without_target, hartptr,
@@ -50,15 +48,14 @@ riscv_jal_translator(struct prefetch_blob * blob, uint32_t instruction)
     blob->is_to_stop = 1;
 }
 
-void
-riscv_jalr_translator(struct prefetch_blob * blob, uint32_t instruction)
+static void
+riscv_jalr_translator(struct decoded_instruction * dec,
+                      struct prefetch_blob * blob)
 {
     // for riscv jalr instruction, the jump target is calculated only at runtime
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    struct decoding dec;
-    instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_I);
-    int32_t signed_offset = sign_extend32(dec.imm, 11);
+    int32_t signed_offset = dec->imm;
     PRECHECK_TRANSLATION_CACHE(jalr_instruction, blob);
     BEGIN_TRANSLATION(jalr_instruction);
     __asm__ volatile("movl "PIC_PARAM(2)", %%edx;"
@@ -81,17 +78,24 @@ riscv_jalr_translator(struct prefetch_blob * blob, uint32_t instruction)
                      :"memory", "%eax", "%ebx", "%ecx", "%edx");
         BEGIN_PARAM_SCHEMA()
             PARAM32() /*rd index*/
-            PARAM32() /*pc + 4*/
+            PARAM32() /*pc + length*/
             PARAM32() /*rs1 index*/
             PARAM32() /*imm: signed*/
         END_PARAM_SCHEMA()
     END_TRANSLATION(jalr_instruction);
         BEGIN_PARAM(jalr_instruction)
-        dec.rd_index,
-        instruction_linear_address + 4,
-        dec.rs1_index,
+        dec->rd_index,
+        instruction_linear_address + dec->length,
+        dec->rs1_index,
         signed_offset
         END_PARAM()
     COMMIT_TRANSLATION(jalr_instruction, hartptr, instruction_linear_address);
     blob->is_to_stop = 1;
 }
+
+__attribute__((constructor)) static void
+unconditional_jump_constructor(void)
+{
+    register_instruction_translator(RISCV_OP_JAL, riscv_jal_translator);
+    register_instruction_translator(RISCV_OP_JALR, riscv_jalr_translator);
+}
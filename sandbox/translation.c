@@ -7,10 +7,15 @@
 #include <mmu.h>
 #include <string.h>
 #include <util.h>
-#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <interpreter.h>
+#include <loop_idiom.h>
+#include <vmm_smp.h>
+#include <task_sched.h>
 
 
-static instruction_translator translators[128];
+static instruction_translator translators[RISCV_OP_MAX];
 
 /*
  * XXX: before control is transfered to guest cache code, the following registers
@@ -23,78 +28,25 @@ static instruction_translator translators[128];
 
 
 void
-instruction_decoding_per_type(struct decoding * dec, 
-                              uint32_t intrs,
-                              enum INSTRUCTION_ENCODING_TYPE encoding_type)
+register_instruction_translator(uint8_t operation,
+                                instruction_translator translator)
 {
-    memset(dec, 0x0, sizeof(struct decoding));
-    dec->opcode = intrs & 0x7f;
-    dec->instr_encoding_type = encoding_type;
-    switch(encoding_type)
-    {
-        case ENCODING_TYPE_U:
-            dec->rd_index = (intrs >> 7) & 0x1f;
-            // IMM 31:12
-            dec->imm = (intrs >> 12) & 0xfffff;
-            break;
-        case ENCODING_TYPE_UJ:
-            dec->rd_index = (intrs >> 7) & 0x1f;
-            // IMM 20:1
-            dec->imm = (intrs >> 21) & 0x3ff; // 10 bits
-            dec->imm |= ((intrs >> 20) & 0x1) << 10; // 1 bit
-            dec->imm |= ((intrs >> 12) & 0xff) << 11; // 8 bit
-            dec->imm |= ((intrs >> 31) & 0x1) << 19; // 1 bit
-            break;
-        case ENCODING_TYPE_I:
-            dec->rd_index = (intrs >> 7) & 0x1f;
-            dec->funct3 = (intrs >> 12) & 7;
-            dec->rs1_index = (intrs >> 15) & 0x1f;
-            // IMM 11:0
-            dec->imm = (intrs >> 20) & 0xfff;  
-            break;
-        case ENCODING_TYPE_S:
-            dec->funct3 = (intrs >> 12) & 7;
-            dec->rs1_index = (intrs >> 15) & 0x1f;
-            dec->rs2_index = (intrs >> 20) & 0x1f;
-            dec->imm = (intrs >> 7) & 0x1f;
-            dec->imm |= ((intrs >> 25) & 0x7f) << 5;
-            break;
-        case ENCODING_TYPE_B:
-            dec->funct3 = (intrs >> 12) & 0x7;
-            dec->rs1_index = (intrs >> 15) & 0x1f;
-            dec->rs2_index = (intrs >> 20) & 0x1f;
-            dec->imm = (intrs >> 8) & 0xf; // 4 bits
-            dec->imm |= ((intrs >> 25) & 0x3f) << 4; // 6 bits
-            dec->imm |= ((intrs >> 7) & 0x1) << 10; // 1 bit
-            dec->imm |= ((intrs >> 31) & 0x1) << 11; // 1 bit
-            break;
-        case ENCODING_TYPE_R:
-            dec->funct3 = (intrs >> 12) & 0x7;
-            dec->rd_index = (intrs >> 7) & 0x1f;
-            dec->rs1_index = (intrs >> 15) & 0x1f;
-            dec->rs2_index = (intrs >> 20) & 0x1f;
-            dec->funct7 = (intrs >> 25) & 0x7f;
-            break;
-        default:
-            ASSERT(0);
-            break;
-    }
+    ASSERT(operation < RISCV_OP_MAX);
+    ASSERT(!translators[operation]);
+    translators[operation] = translator;
 }
 
 static void
-riscv_lui_translator(struct prefetch_blob * blob, uint32_t instruction)
+riscv_lui_translator(struct decoded_instruction * dec,
+                     struct prefetch_blob * blob)
 {
-    
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    struct decoding dec;
 
-    instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_U);
     PRECHECK_TRANSLATION_CACHE(lui_instruction, blob);
     BEGIN_TRANSLATION(lui_instruction);
     __asm__ volatile("movl "PIC_PARAM(0)", %%eax;"
                      "movl "PIC_PARAM(1)", %%edx;"
-                     "shl $12, %%eax;"
                      "shl $2, %%edx;"
                      "addq %%r15, %%rdx;"
                      "movl %%eax, (%%rdx);"
@@ -113,30 +65,28 @@ riscv_lui_translator(struct prefetch_blob * blob, uint32_t instruction)
     END_TRANSLATION(lui_instruction);
 
         BEGIN_PARAM(lui_instruction)
-            dec.imm,
-            dec.rd_index
+            dec->imm,
+            dec->rd_index
         END_PARAM()
 
     COMMIT_TRANSLATION(lui_instruction, hartptr, instruction_linear_address);
 
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 static void
-riscv_auipc_translator(struct prefetch_blob * blob, uint32_t instruction)
+riscv_auipc_translator(struct decoded_instruction * dec,
+                       struct prefetch_blob * blob)
 {
     uint32_t instruction_linear_address = blob->next_instruction_to_fetch;
     struct hart * hartptr = (struct hart *)blob->opaque;
-    struct decoding dec;
 
-    instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_U);
     PRECHECK_TRANSLATION_CACHE(auipc_instruction, blob);
     BEGIN_TRANSLATION(auipc_instruction);
         __asm__ volatile("movl "PIC_PARAM(1)", %%edx;"
                          "shl $2, %%edx;"
                          "addq %%r15, %%rdx;"
                          "movl "PIC_PARAM(0)", %%eax;"
-                         "shl $12, %%eax;"
                          "movl "PIC_PARAM(2)", %%ecx;"
                          "addl %%ecx, %%eax;"
                          "movl %%eax, (%%rdx);"
@@ -153,37 +103,72 @@ riscv_auipc_translator(struct prefetch_blob * blob, uint32_t instruction)
         END_PARAM_SCHEMA()
     END_TRANSLATION(auipc_instruction);
         BEGIN_PARAM(auipc_instruction)
-            dec.imm,
-            dec.rd_index,
+            dec->imm,
+            dec->rd_index,
             instruction_linear_address
         END_PARAM()
     COMMIT_TRANSLATION(auipc_instruction, hartptr, instruction_linear_address);
 
-    blob->next_instruction_to_fetch += 4;
+    blob->next_instruction_to_fetch += dec->length;
 }
 
 
+int
+fetch_fusible_instruction(struct prefetch_blob * blob, uint32_t guest_pc,
+                          struct decoded_instruction * dec)
+{
+    struct hart * hartptr = blob->opaque;
+    if ((guest_pc ^ hartptr->pc) & ~4095) {
+        return 0;
+    }
+#if defined(NATIVE_DEBUGER)
+    // the instruction is not given its own breakpoint prologue.
+    if (is_address_breakpoint(guest_pc)) {
+        return 0;
+    }
+#endif
+    fetch_decoded_instruction(hartptr, guest_pc, dec);
+    return dec->length == 2 || (guest_pc & 4095) != 4094;
+}
+
 static void
 prefetch_one_instruction(struct prefetch_blob * blob)
 {
     struct hart * hartptr = blob->opaque;
-    uint32_t instruction = mmu_instruction_read32(hartptr, blob->next_instruction_to_fetch);
-    uint8_t opcode = instruction & 0x7f;
-    instruction_translator per_category_translator = translators[opcode];
+    struct decoded_instruction dec;
+    fetch_decoded_instruction(hartptr, blob->next_instruction_to_fetch, &dec);
+    if (dec.length == 4 &&
+        (blob->next_instruction_to_fetch & 4095) == 4094 &&
+        blob->next_instruction_to_fetch != hartptr->pc) {
+        blob->is_to_stop = 1;
+        return;
+    }
+    int hle_routine = hle_lookup(hartptr, blob->next_instruction_to_fetch);
+    if (hle_routine >= 0) {
+        riscv_hle_translator(&dec, blob, hle_routine);
+        return;
+    }
+    struct loop_idiom idiom;
+    if (loop_idiom_recognize(blob, &dec, &idiom)) {
+        // the head instruction itself is translated right behind.
+        riscv_loop_idiom_translator(&dec, blob, &idiom);
+        if (blob->is_to_stop) {
+            return;
+        }
+    }
+    instruction_translator translator = translators[dec.operation];
     // NOTE: if ASSERTion takes true, it indicates the instruction is not recognized
-    if (!per_category_translator) {
+    if (!translator) {
         printf("No translator found for instruction:%08x at:0x%x\n",
-               instruction, blob->next_instruction_to_fetch);
+               mmu_instruction_read32(hartptr, blob->next_instruction_to_fetch),
+               blob->next_instruction_to_fetch);
         dump_hart(hartptr);
         __not_reach();
     }
-    ASSERT(per_category_translator);
-    per_category_translator(blob, instruction);
+    ASSERT(translator);
+    translator(&dec, blob);
 }
 
-extern void * vmm_jumper_begin;
-extern void * vmm_jumper_end;
-
 void
 prefetch_instructions(struct hart * hartptr)
 {
@@ -193,6 +178,17 @@ prefetch_instructions(struct hart * hartptr)
         .is_flushable = 1,
         .opaque = hartptr
     };
+    // translation units begin at a 16-byte boundary in the hot area, the gap
+    // is filled with int3.
+    int aligned_ptr = (hartptr->translation_cache_ptr +
+                       TRANSLATION_UNIT_ALIGNMENT - 1) &
+                      ~(TRANSLATION_UNIT_ALIGNMENT - 1);
+    if (aligned_ptr <=
+        TRANSLATION_CACHE_HOT_SIZE - TRANSLATION_UNIT_EXIT_SIZE) {
+        memset(hartptr->translation_cache + hartptr->translation_cache_ptr,
+               0xcc, aligned_ptr - hartptr->translation_cache_ptr);
+        hartptr->translation_cache_ptr = aligned_ptr;
+    }
     int old_trans_ptr = hartptr->translation_cache_ptr;
     while (1) {
         // See whether the instruction has already been in the translation cache
@@ -200,6 +196,14 @@ prefetch_instructions(struct hart * hartptr)
         if (search_translation_item(hartptr, blob.next_instruction_to_fetch)) {
             break;
         }
+        // A translation unit never crosses a guest page boundary, so a page
+        // is invalidated by dropping its own mapping items only, no stale code
+        // is reachable by falling through from the preceding page. a 32-bit
+        // instruction which straddles two pages is translated alone, see
+        // prefetch_one_instruction().
+        if ((blob.next_instruction_to_fetch ^ hartptr->pc) & ~4095) {
+            break;
+        }
         prefetch_one_instruction(&blob);
         if (blob.is_to_stop) {
             break;
@@ -207,8 +211,8 @@ prefetch_instructions(struct hart * hartptr)
     }
     int new_trans_ptr = hartptr->translation_cache_ptr;
     if (old_trans_ptr != new_trans_ptr) {
-        // translation cache updated, append the jumper which directs control
-        // to vmm
+        // translation cache updated, append the jump to the exit stub which
+        // directs control to vmm
         // FIXED: always put a jumper here. otherwise, the control is transfered
         // to the next instruction unintentionally. a case is given as below:
         // [trace] 0x100108 lw_instruction
@@ -227,26 +231,71 @@ prefetch_instructions(struct hart * hartptr)
         // [trace] 0x100144 lw_instruction
         // [trace] 0x100148 addi_instruction
         // [trace] 0x10014c jalr_instruction
-        uint8_t * jumper_code_begin = (uint8_t *)&vmm_jumper_begin;
-        uint8_t * jumper_code_end = (uint8_t *)&vmm_jumper_end;
-        memcpy(hartptr->translation_cache_ptr + hartptr->translation_cache,
-               jumper_code_begin, jumper_code_end - jumper_code_begin);
-        hartptr->translation_cache_ptr += jumper_code_end - jumper_code_begin;
+        uint8_t * jumper = hartptr->translation_cache +
+                           hartptr->translation_cache_ptr;
+        int32_t displacement = TC_EXIT_STUB_OFFSET -
+                               (hartptr->translation_cache_ptr +
+                                TRANSLATION_UNIT_EXIT_SIZE);
+        jumper[0] = 0xe9;
+        memcpy(jumper + 1, &displacement, sizeof(displacement));
+        hartptr->translation_cache_ptr += TRANSLATION_UNIT_EXIT_SIZE;
+    }
+}
+
+// XXX: set by the preemption ticker every VMM_SCHED_MSECONDS, vmm_entry_point
+// polls it before dispatching the next translation. each host cpu has its own.
+__thread volatile int vmm_resched_requested = 0;
+
+static void *
+preemption_ticker(void * arg)
+{
+    int nr_ticks = 0;
+    while (1) {
+        usleep(1000);
+        // NOTE: a sleeping task is woken up at a task switch, the host cpus
+        // are kicked as soon as it's due rather than at the end of the slice.
+        if (++nr_ticks >= VMM_SCHED_MSECONDS ||
+            sleeping_task_due(monotonic_nanoseconds())) {
+            nr_ticks = 0;
+            vmm_kick_host_cpus();
+        }
+    }
+    return NULL;
+}
+
+static void
+yield_cpu_on_timeslice(void)
+{
+    // XXX: note this must be in multi-task context, so call yield_cpu() is ok.
+    // Yield CPU like a hardware timer interrupt delivery.
+    if (vmm_resched_requested) {
+        vmm_resched_requested = 0;
+        yield_cpu();
     }
 }
 
 void
 vmresume(struct hart * hartptr)
 {
+    // Cold code is executed by the interpreter tier, it's translated only when
+    // it's proven to be warm, so run-once code never occupies the translation
+    // cache.
+    while (!search_translation_item(hartptr, hartptr->pc) &&
+           !interpret_cold_block(hartptr)) {
+        yield_cpu_on_timeslice();
+    }
     prefetch_instructions(hartptr);
     // transfer control to guest code by jumping into translation cache
     struct program_counter_mapping_item * ti;
     ASSERT(ti = search_translation_item(hartptr, hartptr->pc));
+    // next time the pc is dispatched by vmm_entry_point without entering C.
+    fill_dispatch_cache(hartptr, hartptr->pc, ti->tc_offset);
     
     #if defined(DEBUG_TRACE)
         log_trace(ANSI_COLOR_MAGENTA"[trap out of translation cache]"ANSI_COLOR_RESET"\n");
     #endif
 
+    vmm_return_to_guest();
     __asm__ volatile("movq %%rax, %%r15;"
                      "movq %%rbx, %%r14;"
                      "movq %%rcx, %%r13;"
@@ -260,22 +309,11 @@ vmresume(struct hart * hartptr)
                      :"memory");
 }
 
-#define VMM_SCHED_MSECONDS  5
-__thread clock_t physical_thread_timestamp_counter = 0;
-
 void
 vmexit(struct hart * hartptr)
 {
-    // XXX: note this must be in multi-task context, so call yield_cpu() is ok.
-    // Yield CPU like a hardware timer interrupt delivery.
-    clock_t now = clock();
-    clock_t diff = now - physical_thread_timestamp_counter;
-    clock_t diff_in_mseconds = diff / (CLOCKS_PER_SEC / 1000);
-    if (diff_in_mseconds >= VMM_SCHED_MSECONDS) {
-        physical_thread_timestamp_counter = now;
-        yield_cpu();
-    }
-
+    vmm_enter();
+    yield_cpu_on_timeslice();
     vmresume(hartptr);
 }
 
@@ -295,38 +333,19 @@ trace_riscv_instruction(const char * instr_desc, uint32_t instrunction_address)
     #endif
 }
 
-static void
-riscv_arithmetic_instructions_translation_entry(struct prefetch_blob * blob,
-                                                uint32_t instruction)
+// NOTE: a ticker thread instead of a timer signal, a signal would interrupt
+// blocking host syscalls issued on behalf of the guest with EINTR.
+void
+preemption_timer_init(void)
 {
-    struct decoding dec;
-    instruction_decoding_per_type(&dec, instruction, ENCODING_TYPE_R);
-    if (!(dec.funct7 & 0x3)) {
-        riscv_arithmetic_instructions_class0_translation_entry(&dec,
-                                                               blob,
-                                                               instruction);
-    } else {
-        ASSERT((dec.funct7 & 0x3) == 0x1);
-        riscv_mul_div_instructions_translation_entry(&dec,
-                                                     blob,
-                                                     instruction);
-    }
+    pthread_t ticker;
+    ASSERT(!pthread_create(&ticker, NULL, preemption_ticker, NULL));
+    ASSERT(!pthread_detach(ticker));
 }
 
 __attribute__((constructor)) void
 translation_init(void)
 {
-    memset(translators, 0x0, sizeof(translators));
-    translators[RISCV_OPCODE_LUI] = riscv_lui_translator;
-    translators[RISCV_OPCODE_AUIPC] = riscv_auipc_translator;
-    translators[RISCV_OPCODE_JAL] = riscv_jal_translator;
-    translators[RISCV_OPCODE_JARL] = riscv_jalr_translator;
-    translators[RISCV_OPCODE_OP_IMM] = riscv_arithmetic_immediate_instructions_translation_entry;
-    translators[RISCV_OPCODE_STORE] = riscv_memory_store_instructions_translation_entry;
-    translators[RISCV_OPCODE_LOAD] = riscv_memory_load_instructions_translation_entry;
-    translators[RISCV_OPCODE_BRANCH] = riscv_branch_instructions_translation_entry;
-    translators[RISCV_OPCODE_OP] = riscv_arithmetic_instructions_translation_entry;
-    translators[RISCV_OPCODE_FENCE] = riscv_fence_instructions_translation_entry;
-    translators[RISCV_OPCODE_SUPERVISOR_LEVEL] = riscv_supervisor_level_instructions_translation_entry;
-    translators[RISCV_OPCODE_AMO] = riscv_amo_instructions_translation_entry;
+    register_instruction_translator(RISCV_OP_LUI, riscv_lui_translator);
+    register_instruction_translator(RISCV_OP_AUIPC, riscv_auipc_translator);
 }
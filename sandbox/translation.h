@@ -5,62 +5,35 @@
 #define _TRANSLATION_H
 #include <vm.h>
 #include <stdlib.h>
-
-enum RISCV_OPCODE {
-    RISCV_OPCODE_LUI = 0x37,
-    RISCV_OPCODE_AUIPC = 0x17,
-    RISCV_OPCODE_JAL = 0x6f,
-    RISCV_OPCODE_JARL = 0x67,
-    RISCV_OPCODE_BRANCH = 0x63,
-    RISCV_OPCODE_LOAD = 0x03,
-    RISCV_OPCODE_STORE = 0x23,
-    RISCV_OPCODE_OP_IMM = 0x13,
-    RISCV_OPCODE_OP = 0x33,
-    RISCV_OPCODE_FENCE = 0x0f,
-    RISCV_OPCODE_SUPERVISOR_LEVEL = 0x73, // FIXME: rename to privileged.
-    RISCV_OPCODE_AMO = 0x2f
-};
-
-// FIXME: This is really important, clear zero register for all the registers
-// which has a RD operand
-enum INSTRUCTION_ENCODING_TYPE {
-    ENCODING_TYPE_UNKNOWN = 0,
-    ENCODING_TYPE_U = 1,
-    ENCODING_TYPE_I,
-    ENCODING_TYPE_UJ,
-    ENCODING_TYPE_S,
-    ENCODING_TYPE_B,
-    ENCODING_TYPE_R
-};
-
-struct decoding {
-    enum INSTRUCTION_ENCODING_TYPE instr_encoding_type;
-    uint8_t opcode;
-    uint8_t funct3;
-    uint8_t rd_index;
-    uint8_t rs1_index;
-    uint8_t rs2_index;
-    uint8_t funct7;
-    uint32_t imm;
-};
+#include <decoder.h>
 
 void
 vmresume(struct hart * hartptr);
-#define SAVE_GUEST_CONTEXT_SWITCH_REGS()                                       \
-        "pushq %%r15;"                                                         \
-        "pushq %%r14;"                                                         \
-        "pushq %%r13;"                                                         \
-        "pushq %%r12;"
-
-#define RESTORE_GUEST_CONTEXT_SWITCH_REGS()                                    \
-        "popq %%r12;"                                                          \
-        "popq %%r13;"                                                          \
-        "popq %%r14;"                                                          \
-        "popq %%r15;"
+
+// start the ticker which requests the host cpus to reschedule, it's done once
+// the first task is ready to run.
+void
+preemption_timer_init(void);
+#define _TC_STRINGIFY(x) #x
+#define TC_STRINGIFY(x) _TC_STRINGIFY(x)
+
+// XXX: the helper in RAX is called through the thunk at the tail of the
+// translation cache, which preserves the context switch registers and aligns
+// the stack, see vmm_trap.S. R11 is clobbered.
+#define CALL_HELPER_OUT_OF_LINE()                                              \
+        "leaq "TC_STRINGIFY(TC_HELPER_THUNK_OFFSET)"(%%r13), %%r11;"           \
+        "call *%%r11;"
 
 // before entering translation cache, the RBX is set to the address of the hart
 // registers group
 #if defined(NATIVE_DEBUGER)
+#include <debug.h>
+// XXX: every template carries a breakpoint prologue which is copied into the
+// translation cache only when the instruction address is a breakpoint, other
+// instructions are translated from the body and pay nothing. the prologue
+// evaluates the breakpoint condition inline: it's hit when the guest register
+// indexed by the first parameter equals the second one, an unconditional
+// breakpoint is `x0 == 0`.
 #define BEGIN_TRANSLATION(indicator)                                           \
 __asm__ volatile ("movq $" #indicator "_translation_end, %%rdx;"               \
                   "jmpq *%%rdx;"                                               \
@@ -68,14 +41,38 @@ __asm__ volatile ("movq $" #indicator "_translation_end, %%rdx;"               \
                   :                                                            \
                   :"%rdx");                                                    \
 __asm__ volatile (#indicator  "_translation_begin:"                            \
+                  "movl " #indicator "_breakpoint_params(%%rip), %%edx;"       \
+                  "movl (%%r15, %%rdx, 4), %%eax;"                             \
+                  "cmpl " #indicator "_breakpoint_params + 4(%%rip), %%eax;"   \
+                  "jne " #indicator "_translation_body;"                       \
                   "movq %%r12, %%rdi;"                                         \
-                  "movq $1, %%rsi;"                                            \
+                  "xorq %%rsi, %%rsi;"                                         \
                   "movq $enter_vmm_dbg_shell, %%rax;"                          \
-                  SAVE_GUEST_CONTEXT_SWITCH_REGS()                             \
-                  "callq *%%rax;"                                              \
-                  RESTORE_GUEST_CONTEXT_SWITCH_REGS()                          \
+                  CALL_HELPER_OUT_OF_LINE()                                    \
+                  "jmp " #indicator "_translation_body;"                       \
+                  ".align 4;"                                                  \
+                  #indicator "_breakpoint_params:"                             \
+                  ".int 0x0;"                                                  \
+                  ".int 0x0;"                                                  \
+                  #indicator "_translation_body:"                              \
                   :::"memory");
 
+#define TRANSLATION_ENTRY_ADDR(indicator, instruction_linear_addr)             \
+    (is_address_breakpoint(instruction_linear_addr) ?                          \
+     TRANSLATION_BEGIN_ADDR(indicator) : TRANSLATION_BODY_ADDR(indicator))
+
+#define PATCH_BREAKPOINT(indicator, block, instruction_linear_addr)            \
+{                                                                              \
+    struct breakpoint * __bp = lookup_breakpoint(instruction_linear_addr);     \
+    if (__bp) {                                                                \
+        uint32_t * __bp_params = (uint32_t *)((uint8_t *)(block) +             \
+            (TRANSLATION_BP_PARAMS_ADDR(indicator) -                           \
+             TRANSLATION_BEGIN_ADDR(indicator)));                              \
+        __bp_params[0] = __bp->reg_index;                                      \
+        __bp_params[1] = __bp->reg_value;                                      \
+    }                                                                          \
+}
+
 #else
 #define BEGIN_TRANSLATION(indicator)                                           \
 __asm__ volatile ("movq $" #indicator "_translation_end, %%rdx;"               \
@@ -83,7 +80,13 @@ __asm__ volatile ("movq $" #indicator "_translation_end, %%rdx;"               \
                   :                                                            \
                   :                                                            \
                   :"%rdx");                                                    \
-__asm__ volatile (#indicator  "_translation_begin:\n")
+__asm__ volatile (#indicator  "_translation_begin:\n"                          \
+                  #indicator  "_translation_body:\n")
+
+#define TRANSLATION_ENTRY_ADDR(indicator, instruction_linear_addr)             \
+    TRANSLATION_BODY_ADDR(indicator)
+
+#define PATCH_BREAKPOINT(indicator, block, instruction_linear_addr)
 #endif
 
 //#define DEBUG_TRANSLATION
@@ -100,8 +103,11 @@ __asm__ volatile (#indicator  "_translation_end:\n")
 
 #define COMMIT_TRANSLATION(indicator, hart_instance, instruction_linear_addr)  \
 {                                                                              \
-    int __instruction_block_len = TRANSLATION_SIZE(indicator);                 \
-    void * __instruction_block_begin = TRANSLATION_BEGIN_ADDR(indicator);      \
+    void * __instruction_block_begin =                                         \
+        TRANSLATION_ENTRY_ADDR(indicator, instruction_linear_addr);            \
+    int __instruction_block_len = (int)(TRANSLATION_END_ADDR(indicator) -      \
+                                        __instruction_block_begin);            \
+    int __tc_offset = hart_instance->translation_cache_ptr;                    \
     ASSERT(!add_translation_item(hart_instance, instruction_linear_addr,       \
                                  __instruction_block_begin,                    \
                                  __instruction_block_len));                    \
@@ -111,14 +117,15 @@ __asm__ volatile (#indicator  "_translation_end:\n")
     int __nr_param = (int)(sizeof(indicator##_params)/                         \
                            sizeof(indicator##_params[0]));                     \
     void * __instruction_block_end = hart_instance->translation_cache +        \
-                                     __item->tc_offset +                       \
+                                     __tc_offset +                             \
                                      __instruction_block_len;                  \
     void * __ptr = __instruction_block_end - (__nr_param * sizeof(uint32_t));  \
     int __index = 0;                                                           \
     for (; __index < __nr_param; __index++) {                                  \
         *(__index + ((uint32_t *)__ptr)) = indicator##_params[__index];        \
     }                                                                          \
-    __ptr = hart_instance->translation_cache + __item->tc_offset;              \
+    __ptr = hart_instance->translation_cache + __tc_offset;                    \
+    PATCH_BREAKPOINT(indicator, __ptr, instruction_linear_addr);               \
     TRANS_DEBUG(ANSI_COLOR_CYAN"[translate] %s at 0x%x {len:%d, tc:%p}: "ANSI_COLOR_RESET,\
                 #indicator,                                                    \
                 instruction_linear_addr, __instruction_block_len, __ptr);      \
@@ -135,9 +142,7 @@ __asm__ volatile (#indicator  "_translation_end:\n")
                      "leaq 15f(%%rip), %%rdi;"                                 \
                      "movq 16f(%%rip), %%rsi;"                                 \
                      "movq $trace_riscv_instruction, %%rax;"                   \
-                     SAVE_GUEST_CONTEXT_SWITCH_REGS()                          \
-                     "call *%%rax;"                                            \
-                     RESTORE_GUEST_CONTEXT_SWITCH_REGS()                       \
+                     CALL_HELPER_OUT_OF_LINE()                                 \
                      "jmp "#indicator"_translation_end;"                       \
                      "15: .string \"" #indicator "\""
 #else
@@ -152,14 +157,20 @@ __asm__ volatile(".align 4;"                                                   \
 #define PARAM32()                                                              \
                  ".int 0xcccccccc;"
 
+// every template carries the length of the guest instruction as its last
+// parameter, see INSTRUCTION_LENGTH_PARAM
 #if defined(DEBUG_TRACE)
     #define END_PARAM_SCHEMA()                                                 \
                     "16:"                                                      \
                     PARAM32()                                                  \
+                    "17:"                                                      \
+                    PARAM32()                                                  \
                     );
 
 #else
     #define END_PARAM_SCHEMA()                                                 \
+                    "17:"                                                      \
+                    PARAM32()                                                  \
                     );
 #endif
 
@@ -169,13 +180,17 @@ __attribute__((unused)) uint32_t indicator##_params[] = {                      \
 
 #if defined(DEBUG_TRACE)
     #define END_PARAM()                                                        \
-        , instruction_linear_address};
+        , instruction_linear_address, dec->length};
 
 #else
     #define END_PARAM()                                                        \
-        };
+        , dec->length};
 #endif
 
+// the length in bytes of the guest instruction being translated: 2 for a
+// compressed instruction, 4 otherwise.
+#define INSTRUCTION_LENGTH_PARAM "17f(%%rip)"
+
 #define TRANSLATION_BEGIN_ADDR(indicator) ({                                   \
     uint64_t translation_begin_addr = 0;                                       \
     __asm__ volatile("movq $" #indicator "_translation_begin, %%rax;"          \
@@ -185,6 +200,24 @@ __attribute__((unused)) uint32_t indicator##_params[] = {                      \
     (void *)translation_begin_addr;                                            \
 })
 
+#define TRANSLATION_BODY_ADDR(indicator) ({                                    \
+    uint64_t translation_body_addr = 0;                                        \
+    __asm__ volatile("movq $" #indicator "_translation_body, %%rax;"           \
+                     :"=a"(translation_body_addr)                              \
+                     :                                                         \
+                     :"memory");                                               \
+    (void *)translation_body_addr;                                             \
+})
+
+#define TRANSLATION_BP_PARAMS_ADDR(indicator) ({                               \
+    uint64_t translation_bp_params_addr = 0;                                   \
+    __asm__ volatile("movq $" #indicator "_breakpoint_params, %%rax;"          \
+                     :"=a"(translation_bp_params_addr)                         \
+                     :                                                         \
+                     :"memory");                                               \
+    (void *)translation_bp_params_addr;                                        \
+})
+
 #define TRANSLATION_END_ADDR(indicator) ({                                     \
     uint64_t translation_end_addr = 0;                                         \
     __asm__ volatile("movq $" #indicator "_translation_end, %%rax;"            \
@@ -207,28 +240,32 @@ __attribute__((unused)) uint32_t indicator##_params[] = {                      \
     (int)(translation_end_addr - translation_begin_addr);                      \
 })
 
+// NOTE: it's always followed by END_INSTRUCTION() or TRAP_TO_VMM(), EAX is
+// free to use.
 #define PROCEED_TO_NEXT_INSTRUCTION()                                          \
-    "addl $4, (%%r14);"
+    "movl "INSTRUCTION_LENGTH_PARAM", %%eax;"                                  \
+    "addl %%eax, (%%r14);"
 
 #define RESET_ZERO_REGISTER()                                                  \
     "movl $0x0, (%%r15);"
 
+// the trap path is the shared exit stub at the tail of the translation cache.
+#define EXIT_TO_VMM()                                                          \
+        "leaq "TC_STRINGIFY(TC_EXIT_STUB_OFFSET)"(%%r13), %%rax;"              \
+        "jmpq *%%rax;"
+
 #if defined(DEBUG_TRACE)
     #define TRAP_TO_VMM(indicator)                                             \
         "leaq 15f(%%rip), %%rdi;"                                              \
         "movq 16f(%%rip), %%rsi;"                                              \
         "movq $trace_riscv_instruction, %%rax;"                                \
-        SAVE_GUEST_CONTEXT_SWITCH_REGS()                                       \
-        "call *%%rax;"                                                         \
-        RESTORE_GUEST_CONTEXT_SWITCH_REGS()                                    \
-        "movq $vmm_entry_point, %%rax;"                                        \
-        "jmpq *%%rax;"                                                         \
+        CALL_HELPER_OUT_OF_LINE()                                              \
+        EXIT_TO_VMM()                                                          \
         "15: .string \"" #indicator "\""
 
 #else
     #define TRAP_TO_VMM(indicator)                                             \
-        "movq $vmm_entry_point, %%rax;"                                        \
-        "jmpq *%%rax;"
+        EXIT_TO_VMM()
 #endif
 
 // FIX: There is only one chance to flush the translation cache once
@@ -250,56 +287,19 @@ __attribute__((unused)) uint32_t indicator##_params[] = {                      \
 
 
 
-typedef void (*instruction_translator)(struct prefetch_blob * blob, uint32_t);
-
-typedef void (*instruction_sub_translator)(struct decoding * dec,
-                                           struct prefetch_blob * blob,
-                                           uint32_t);
-
-void
-riscv_arithmetic_immediate_instructions_translation_entry(struct prefetch_blob * blob,
-                                                          uint32_t instruction);
-
-void
-riscv_jal_translator(struct prefetch_blob * blob, uint32_t instruction);
-
-void
-riscv_jalr_translator(struct prefetch_blob * blob, uint32_t instruction);
-
-void
-instruction_decoding_per_type(struct decoding * dec,
-                              uint32_t intrs,
-                              enum INSTRUCTION_ENCODING_TYPE encoding_type);
-
-void
-riscv_memory_store_instructions_translation_entry(struct prefetch_blob * blob,
-                                                  uint32_t instruction);
-
-void
-riscv_memory_load_instructions_translation_entry(struct prefetch_blob * blob,
-                                                 uint32_t instruction);
+typedef void (*instruction_translator)(struct decoded_instruction * dec,
+                                      struct prefetch_blob * blob);
 
 void
-riscv_branch_instructions_translation_entry(struct prefetch_blob * blob,
-                                            uint32_t instruction);
+register_instruction_translator(uint8_t operation,
+                                instruction_translator translator);
 
-void
-riscv_arithmetic_instructions_class0_translation_entry(struct decoding * dec,
-                                                       struct prefetch_blob * blob,
-                                                       uint32_t instruction);
-void
-riscv_mul_div_instructions_translation_entry(struct decoding * dec,
-                                             struct prefetch_blob * blob,
-                                             uint32_t instruction);
-void
-riscv_fence_instructions_translation_entry(struct prefetch_blob * blob,
-                                           uint32_t instruction);
+// a translator may fuse the instructions which follow the one being translated
+// into its template, they are not given translation items of their own. the
+// instruction at guest_pc is fetched, non-zero is returned if it's eligible,
+// i.e. it's in the translation unit and it's not a breakpoint.
+int
+fetch_fusible_instruction(struct prefetch_blob * blob, uint32_t guest_pc,
+                          struct decoded_instruction * dec);
 
-void
-riscv_supervisor_level_instructions_translation_entry(struct prefetch_blob * blob,
-                                                      uint32_t instruction);
-
-void
-riscv_amo_instructions_translation_entry(struct prefetch_blob * blob,
-                                         uint32_t instruction);
 #endif
@@ -27,5 +27,27 @@ user_world_pointer(struct hart * hartptr, uint32_t uaddress)
     return pmr->pmr_direct(uaddress, hartptr, pmr);
 }
 
+// XXX: a store the host makes through user_world_pointer() is not seen by
+// check_code_page_write(), the syscalls that fill a guest buffer report the
+// range here so that fence.i doesn't run a stale translation of it.
+static inline void
+user_range_written(struct hart * hartptr, uint32_t uaddress, uint32_t len)
+{
+    struct virtual_machine * vm =
+        get_linked_vm(hartptr->native_vmptr, LINKAGE_HINT_VM);
+    uint8_t * bitmap = vm->code_pages_bitmap;
+    if (!bitmap || !len) {
+        return;
+    }
+    uint32_t page = uaddress >> 12;
+    uint32_t last_page = ((uint64_t)uaddress + len - 1) > 0xffffffff ?
+                         0xfffff : (uaddress + len - 1) >> 12;
+    for (; page <= last_page; page++) {
+        if (bitmap[page >> 3] & (1 << (page & 7))) {
+            code_page_written(hartptr, page << 12);
+        }
+    }
+}
+
 
 #endif
@@ -109,4 +109,13 @@ ERRNO(uint32_t host_syscall_ret)
     return ret;
 }
 
+#include <time.h>
+static inline uint64_t
+monotonic_nanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
 #endif
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      The vvar page and the vDSO image. both are allocated once and shared by
+ *      all the address spaces, the clocks are published under a sequence lock
+ *      so the guest retries a read which races with an update.
+ */
+
+#include <vdso.h>
+#include <vm.h>
+#include <elf.h>
+#include <pm_region.h>
+#include <util.h>
+#include <log.h>
+#include <app.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#define VDSO_NR_SYMBOLS     3
+#define VDSO_STRTAB_SIZE    64
+
+// XXX: the guest code is assembled by hand, it loads the vvar page with
+// `lui t1, 0xe0000` which must agree with VVAR_ADDRESS.
+struct vdso_image {
+    struct elf32_elf_header elf_hdr;
+    struct elf32_program_header prog_hdrs[2];
+    struct elf32_dynamic dynamic[6];
+    uint32_t hash[2 + 1 + VDSO_NR_SYMBOLS];
+    struct elf32_symbol symbols[VDSO_NR_SYMBOLS];
+    char strtab[VDSO_STRTAB_SIZE];
+    uint32_t clock_gettime_code[24];
+    uint32_t gettimeofday_code[23];
+};
+
+#define IMAGE_OFFSET(field) offsetof(struct vdso_image, field)
+
+static const struct vdso_image vdso_image_template = {
+    .elf_hdr = {
+        .e_ident = {0x7f, 'E', 'L', 'F', ELF32_CLASS_ELF32,
+                    ELF32_ENDIAN_LITTLE, 1},
+        .e_type = ELF32_TYPE_DYN,
+        .e_machine = ELF32_MACHINE_RISCV,
+        .e_version = 1,
+        .e_phoff = IMAGE_OFFSET(prog_hdrs),
+        .e_ehsize = sizeof(struct elf32_elf_header),
+        .e_phentsize = sizeof(struct elf32_program_header),
+        .e_phnum = 2,
+    },
+    .prog_hdrs = {
+        {
+            .p_type = PROGRAM_TYPE_LOAD,
+            .p_filesz = sizeof(struct vdso_image),
+            .p_memsz = sizeof(struct vdso_image),
+            .p_flags = PROGRAM_READ | PROGRAM_EXECUTE,
+            .p_align = 4096,
+        }, {
+            .p_type = PROGRAM_TYPE_DYNAMIC,
+            .p_offset = IMAGE_OFFSET(dynamic),
+            .p_vaddr = IMAGE_OFFSET(dynamic),
+            .p_paddr = IMAGE_OFFSET(dynamic),
+            .p_filesz = sizeof(((struct vdso_image *)0)->dynamic),
+            .p_memsz = sizeof(((struct vdso_image *)0)->dynamic),
+            .p_flags = PROGRAM_READ,
+            .p_align = 4,
+        },
+    },
+    .dynamic = {
+        {DYNAMIC_TAG_HASH, IMAGE_OFFSET(hash)},
+        {DYNAMIC_TAG_STRTAB, IMAGE_OFFSET(strtab)},
+        {DYNAMIC_TAG_SYMTAB, IMAGE_OFFSET(symbols)},
+        {DYNAMIC_TAG_STRSZ, VDSO_STRTAB_SIZE},
+        {DYNAMIC_TAG_SYMENT, sizeof(struct elf32_symbol)},
+        {DYNAMIC_TAG_NULL, 0},
+    },
+    // a single bucket chains the symbols from the last one down.
+    .hash = {1, VDSO_NR_SYMBOLS, 2, 0, 0, 1},
+    .symbols = {
+        {0},
+        {
+            .st_name = 1,
+            .st_value = IMAGE_OFFSET(clock_gettime_code),
+            .st_size = sizeof(((struct vdso_image *)0)->clock_gettime_code),
+            .st_info = SYMBOL_INFO(SYMBOL_BIND_GLOBAL, SYMBOL_TYPE_FUNC),
+            .st_shndx = 1,
+        }, {
+            .st_name = 22,
+            .st_value = IMAGE_OFFSET(gettimeofday_code),
+            .st_size = sizeof(((struct vdso_image *)0)->gettimeofday_code),
+            .st_info = SYMBOL_INFO(SYMBOL_BIND_GLOBAL, SYMBOL_TYPE_FUNC),
+            .st_shndx = 1,
+        },
+    },
+    .strtab = "\0__vdso_clock_gettime\0__vdso_gettimeofday",
+    // int __vdso_clock_gettime(clockid_t clk, struct timespec * ts)
+    .clock_gettime_code = {
+        0x00100293, // li t0, 1
+        0x04a2e863, // bltu t0, a0, syscall
+        0xe0000337, // lui t1, 0xe0000
+        0x00451393, // slli t2, a0, 4
+        0x006383b3, // add t2, t2, t1
+        0x00032e03, // retry: lw t3, 0(t1)
+        0x001e7293, // andi t0, t3, 1
+        0xfe029ce3, // bnez t0, retry
+        0x0220000f, // fence r, r
+        0x0083ae83, // lw t4, 8(t2)
+        0x00c3af03, // lw t5, 12(t2)
+        0x0103af83, // lw t6, 16(t2)
+        0x0220000f, // fence r, r
+        0x00032283, // lw t0, 0(t1)
+        0xfdc29ee3, // bne t0, t3, retry
+        0x01d5a023, // sw t4, 0(a1)
+        0x01e5a223, // sw t5, 4(a1)
+        0x01f5a423, // sw t6, 8(a1)
+        0x0005a623, // sw zero, 12(a1)
+        0x00000513, // li a0, 0
+        0x00008067, // ret
+        0x07100893, // syscall: li a7, 113
+        0x00000073, // ecall
+        0x00008067, // ret
+    },
+    // int __vdso_gettimeofday(struct timeval * tv, struct timezone * tz)
+    .gettimeofday_code = {
+        0x04050463, // beqz a0, out
+        0xe0000337, // lui t1, 0xe0000
+        0x00032e03, // retry: lw t3, 0(t1)
+        0x001e7293, // andi t0, t3, 1
+        0xfe029ce3, // bnez t0, retry
+        0x0220000f, // fence r, r
+        0x00832e83, // lw t4, 8(t1)
+        0x00c32f03, // lw t5, 12(t1)
+        0x01032f83, // lw t6, 16(t1)
+        0x0220000f, // fence r, r
+        0x00032283, // lw t0, 0(t1)
+        0xfdc29ee3, // bne t0, t3, retry
+        0x3e800293, // li t0, 1000
+        0x025fdfb3, // divu t6, t6, t0
+        0x01d52023, // sw t4, 0(a0)
+        0x01e52223, // sw t5, 4(a0)
+        0x01f52423, // sw t6, 8(a0)
+        0x00052623, // sw zero, 12(a0)
+        0x00058663, // out: beqz a1, done
+        0x0005a023, // sw zero, 0(a1)
+        0x0005a223, // sw zero, 4(a1)
+        0x00000513, // done: li a0, 0
+        0x00008067, // ret
+    },
+};
+
+static struct vvar_page * vvar_page;
+static void * vdso_page;
+
+static void
+vvar_update(void)
+{
+    static const clockid_t host_clocks[VVAR_NR_CLOCKS] = {
+        [VVAR_CLOCK_REALTIME] = CLOCK_REALTIME,
+        [VVAR_CLOCK_MONOTONIC] = CLOCK_MONOTONIC,
+    };
+    struct timespec now[VVAR_NR_CLOCKS];
+    int idx = 0;
+    for (idx = 0; idx < VVAR_NR_CLOCKS; idx++) {
+        clock_gettime(host_clocks[idx], &now[idx]);
+    }
+    __atomic_store_n(&vvar_page->sequence, vvar_page->sequence + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (idx = 0; idx < VVAR_NR_CLOCKS; idx++) {
+        vvar_page->clocks[idx].sec = now[idx].tv_sec;
+        vvar_page->clocks[idx].nsec = now[idx].tv_nsec;
+    }
+    __atomic_store_n(&vvar_page->sequence, vvar_page->sequence + 1,
+                     __ATOMIC_RELEASE);
+}
+
+static void *
+vvar_updater(void * arg)
+{
+    while (1) {
+        usleep(VVAR_UPDATE_USECONDS);
+        vvar_update();
+    }
+    return NULL;
+}
+
+static void
+vdso_write(uint64_t addr, int access_size, uint64_t value,
+           struct hart * hartptr, struct pm_region_operation * pmr)
+{
+    log_warn("write to read-only %s at 0x%x is dropped\n",
+             pmr->pmr_desc, (uint32_t)addr);
+}
+
+static void
+map_shared_page(struct virtual_machine * vm, uint32_t addr_low, uint32_t flags,
+                void * host_base, const char * name)
+{
+    // NOTE: pmr_direct is left NULL, so the guest can't write the page through
+    // a direct pointer, the accesses go through pmr_read/pmr_write instead.
+    struct pm_region_operation pmr = {
+        .addr_low = addr_low,
+        .addr_high = addr_low + 4096,
+        .flags = flags | PROGRAM_SHARED,
+        .pmr_read = vma_generic_read,
+        .pmr_write = vdso_write,
+        .pmr_direct = NULL,
+        .pmr_reclaim = NULL,
+        .host_base = host_base,
+        .opaque = NULL,
+    };
+    sprintf(pmr.pmr_desc, "%s[%08x-%08x].R%s", name, pmr.addr_low,
+            pmr.addr_high, flags & PROGRAM_EXECUTE ? "X" : "");
+    register_pm_region_operation(vm, &pmr);
+}
+
+static void
+vvar_updater_start(void)
+{
+    pthread_t updater;
+    vvar_update();
+    ASSERT(!pthread_create(&updater, NULL, vvar_updater, NULL));
+    ASSERT(!pthread_detach(updater));
+}
+
+void
+vdso_setup(struct virtual_machine * vm)
+{
+    // NOTE: the clocks are kept up to date only once a guest maps the page.
+    static pthread_once_t updater_once = PTHREAD_ONCE_INIT;
+    map_shared_page(vm, VVAR_ADDRESS, PROGRAM_READ, vvar_page, "vvar");
+    map_shared_page(vm, VDSO_ADDRESS, PROGRAM_READ | PROGRAM_EXECUTE,
+                    vdso_page, "vdso");
+    ASSERT(!pthread_once(&updater_once, vvar_updater_start));
+}
+
+__attribute__((constructor)) static void
+vdso_init(void)
+{
+    ASSERT(sizeof(struct vdso_image) <= 4096);
+    ASSERT(sizeof(struct vvar_page) <= 4096);
+    vvar_page = aligned_alloc(4096, 4096);
+    vdso_page = aligned_alloc(4096, 4096);
+    ASSERT(vvar_page && vdso_page);
+    memset(vvar_page, 0x0, 4096);
+    memset(vdso_page, 0x0, 4096);
+    memcpy(vdso_page, &vdso_image_template, sizeof(struct vdso_image));
+    vvar_update();
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      A vDSO-like pair of pages mapped into every guest address space: the
+ *      vvar page carries a snapshot of the host clocks which is refreshed by
+ *      a host thread, the vDSO page is a tiny ELF image whose routines read
+ *      the clocks without trapping into the vmm for a syscall.
+ */
+
+#ifndef _VDSO_H
+#define _VDSO_H
+#include <stdint.h>
+
+// right above the stack ceiling, see app.c
+#define VVAR_ADDRESS            0xE0000000
+#define VDSO_ADDRESS            (VVAR_ADDRESS + 4096)
+#define VVAR_UPDATE_USECONDS    1000
+
+// the auxiliary vector entry which points at the vDSO ELF header.
+#define AUX_SYSINFO_EHDR        33
+
+#define VVAR_CLOCK_REALTIME     0
+#define VVAR_CLOCK_MONOTONIC    1
+#define VVAR_NR_CLOCKS          2
+
+struct vvar_clock {
+    int64_t sec;
+    uint32_t nsec;
+    uint32_t reserved;
+};
+
+// XXX: the layout is read by the guest code in vdso.c, the sequence is odd
+// while the clocks are being updated.
+struct vvar_page {
+    uint32_t sequence;
+    uint32_t reserved;
+    struct vvar_clock clocks[VVAR_NR_CLOCKS];
+};
+
+struct virtual_machine;
+
+// map the vvar page and the vDSO image into the address space.
+void
+vdso_setup(struct virtual_machine * vm);
+
+#endif
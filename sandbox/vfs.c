@@ -13,12 +13,17 @@
 #include <app.h>
 #include <elf.h>
 #include <sys/ioctl.h>
+#include <termios.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
 #include <sys/sendfile.h>
 #include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vmm_smp.h>
+#include <util.h>
 
 
 int
@@ -291,49 +296,138 @@ do_readlinkat(struct hart * hartptr, uint32_t dirfd, const char * pathname,
     return ERRNO(readlinkat(AT_FDCWD, (const char *)host_cpath, buf, buf_size));
 }
 
-uint32_t
-do_writev(struct hart * hartptr, uint32_t fd,
-          struct iovec32 * guest_iov, uint32_t iovcnt)
+// the most a host call which may block moves at once, a short read or write
+// is fine for a tty, a pipe or a socket.
+#define BLOCKING_IO_CHUNK   (64 * 1024)
 
+// anything but a regular file or a directory may keep a read or a write
+// waiting for another party, e.g. a tty, a pipe or a socket.
+static int
+host_fd_may_block(int32_t host_fd)
+{
+    struct stat host_stat;
+    if (fstat(host_fd, &host_stat)) {
+        return 0;
+    }
+    return !S_ISREG(host_stat.st_mode) && !S_ISDIR(host_stat.st_mode);
+}
+
+// XXX: the vmm lock is dropped while the host cpu waits in a blocking write,
+// an exclusive section may remap the guest buffers meanwhile, so the data is
+// copied into a bounce buffer beforehand.
+static uint32_t
+blocking_write(int32_t host_fd, void * bounce, uint32_t nr_write)
+{
+    vmm_block_begin();
+    uint32_t ret = ERRNO(write(host_fd, bounce, nr_write));
+    vmm_block_end();
+    free(bounce);
+    return ret;
+}
+
+uint32_t
+do_writev(struct hart * hartptr, uint32_t fd, uint32_t iov_addr,
+          uint32_t iovcnt)
 {
     struct virtual_machine * vm_files = get_linked_vm(hartptr->native_vmptr, LINKAGE_HINT_FILES);
     if (fd > MAX_FILES_NR || !vm_files->files[fd].valid) {
         return -EINVAL;
     }
-    
+
+    struct iovec32 * guest_iov = user_world_pointer(hartptr, iov_addr);
+    int32_t host_fd = vm_files->files[fd].host_fd;
+    int idx = 0;
+    if (host_fd_may_block(host_fd)) {
+        uint32_t nr_write = 0;
+        for (idx = 0; idx < iovcnt; idx++) {
+            nr_write += guest_iov[idx].iov_len;
+        }
+        nr_write = MIN(nr_write, BLOCKING_IO_CHUNK);
+        uint8_t * bounce = malloc(nr_write);
+        if (!bounce && nr_write) {
+            return -ENOMEM;
+        }
+        uint32_t offset = 0;
+        for (idx = 0; idx < iovcnt && offset < nr_write; idx++) {
+            uint32_t len = MIN(guest_iov[idx].iov_len, nr_write - offset);
+            if (len) {
+                memcpy(bounce + offset,
+                       user_world_pointer(hartptr, guest_iov[idx].iov_base),
+                       len);
+            }
+            offset += len;
+        }
+        return blocking_write(host_fd, bounce, nr_write);
+    }
+
     struct iovec * host_vecbase = malloc(sizeof(struct iovec) * iovcnt);
     if (!host_vecbase) {
         return -ENOMEM;
     }
-    int idx = 0;
     for (idx = 0; idx < iovcnt; idx++) {
         host_vecbase[idx].iov_base =
             user_world_pointer(hartptr, guest_iov[idx].iov_base);
         host_vecbase[idx].iov_len = guest_iov[idx].iov_len;
     }
-    uint32_t host_rc = writev(vm_files->files[fd].host_fd, host_vecbase, iovcnt);
+    uint32_t host_rc = writev(host_fd, host_vecbase, iovcnt);
     free(host_vecbase);
     return ERRNO(host_rc);
 }
 
 uint32_t
-do_write(struct hart * hartptr, uint32_t fd, void * buf, uint32_t nr_write)
+do_write(struct hart * hartptr, uint32_t fd, uint32_t buf_addr,
+         uint32_t nr_write)
 {
     struct virtual_machine * vm_files = get_linked_vm(hartptr->native_vmptr, LINKAGE_HINT_FILES);
     if (fd > MAX_FILES_NR || !vm_files->files[fd].valid) {
         return -EBADF;
     }
-    return ERRNO(write(vm_files->files[fd].host_fd, buf, nr_write));
+    int32_t host_fd = vm_files->files[fd].host_fd;
+    void * buf = user_world_pointer(hartptr, buf_addr);
+    if (!nr_write || !host_fd_may_block(host_fd)) {
+        return ERRNO(write(host_fd, buf, nr_write));
+    }
+    nr_write = MIN(nr_write, BLOCKING_IO_CHUNK);
+    void * bounce = malloc(nr_write);
+    if (!bounce) {
+        return -ENOMEM;
+    }
+    memcpy(bounce, buf, nr_write);
+    return blocking_write(host_fd, bounce, nr_write);
 }
 
 uint32_t
-do_read(struct hart * hartptr, uint32_t fd, void * buf, uint32_t nr_read)
+do_read(struct hart * hartptr, uint32_t fd, uint32_t buf_addr,
+        uint32_t nr_read)
 {
     struct virtual_machine * vm_files = get_linked_vm(hartptr->native_vmptr, LINKAGE_HINT_FILES);
     if (fd > MAX_FILES_NR || !vm_files->files[fd].valid) {
         return -EBADF;
     }
-    return ERRNO(read(vm_files->files[fd].host_fd, buf, nr_read));
+    int32_t host_fd = vm_files->files[fd].host_fd;
+    if (!nr_read || !host_fd_may_block(host_fd)) {
+        void * buf = user_world_pointer(hartptr, buf_addr);
+        return ERRNO(read(host_fd, buf, nr_read));
+    }
+    // XXX: the same as blocking_write(), the data is read into a bounce
+    // buffer and the guest buffer is looked up again with the lock held.
+    nr_read = MIN(nr_read, BLOCKING_IO_CHUNK);
+    void * bounce = malloc(nr_read);
+    if (!bounce) {
+        return -ENOMEM;
+    }
+    vmm_block_begin();
+    uint32_t ret = ERRNO(read(host_fd, bounce, nr_read));
+    vmm_block_end();
+    if ((int32_t)ret > 0) {
+        if (user_accessible(hartptr, buf_addr)) {
+            memcpy(user_world_pointer(hartptr, buf_addr), bounce, ret);
+        } else {
+            ret = -EFAULT;
+        }
+    }
+    free(bounce);
+    return ret;
 }
 
 uint32_t
@@ -348,7 +442,15 @@ do_ioctl(struct hart * hartptr, uint32_t fd, uint32_t request,
     if (user_accessible(hartptr, argp_addr)) {
         argp = user_world_pointer(hartptr, argp_addr);
     }
-    return ERRNO(ioctl(vm_files->files[fd].host_fd, request, argp));
+    uint32_t ret = ERRNO(ioctl(vm_files->files[fd].host_fd, request, argp));
+    if (argp) {
+        // XXX: the tty requests don't encode the size of the argument, struct
+        // termios is the largest of them.
+        uint32_t size = _IOC_SIZE(request) ? _IOC_SIZE(request) :
+                        sizeof(struct termios);
+        user_range_written(hartptr, argp_addr, size);
+    }
+    return ret;
 }
 
 uint32_t
@@ -360,7 +462,12 @@ do_getdents64(struct hart * hartptr, uint32_t fd, uint32_t dirp_addr,
         return -EBADF;
     }
     void * dirp = user_world_pointer(hartptr, dirp_addr);
-    return syscall(__NR_getdents64, vm_files->files[fd].host_fd, dirp, count);
+    uint32_t ret = syscall(__NR_getdents64, vm_files->files[fd].host_fd, dirp,
+                           count);
+    if ((int32_t)ret > 0) {
+        user_range_written(hartptr, dirp_addr, ret);
+    }
+    return ret;
 }
 
 uint32_t
@@ -433,7 +540,12 @@ do_mmap(struct hart* hartptr, uint32_t proposal_addr, uint32_t len,
     }
     
     if (flags & MAP_ANONYMOUS) {
-        return allocate_mmap_region(vm, proposal_addr, len, mprot); 
+        uint32_t addr = allocate_mmap_region(vm, proposal_addr, len, mprot);
+        if (addr != (uint32_t)-ENOMEM) {
+            // words of the range were decoded as illegal before it's mapped.
+            invalidate_guest_range(hartptr, addr, addr + len);
+        }
+        return addr;
     } else {
         // FIXME: FILE BACKED MAPPING
         __not_reach();
@@ -454,11 +566,15 @@ do_munmap(struct hart * hartptr, uint32_t addr, uint32_t len)
     if (region_len != len) {
         return -EINVAL;
     }
+    uint32_t addr_low = pmr->addr_low;
+    uint32_t addr_high = pmr->addr_high;
     
     if (pmr->pmr_reclaim) {
         pmr->pmr_reclaim(pmr->opaque, hartptr, pmr);
     }
     unregister_pm_region(vm, pmr);
+    // only translations of the unmapped range are discarded.
+    invalidate_guest_range(hartptr, addr_low, addr_high);
     return 0;
 }
 
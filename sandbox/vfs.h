@@ -57,11 +57,12 @@ do_statx(struct hart * hartptr, uint32_t dirfd, char * pathname, uint32_t flag,
          uint32_t mask, void * statxbuf);
 
 uint32_t
-do_writev(struct hart * hartptr, uint32_t fd,
-          struct iovec32 * guest_iov, uint32_t iovcnt);
+do_writev(struct hart * hartptr, uint32_t fd, uint32_t iov_addr,
+          uint32_t iovcnt);
 
 uint32_t
-do_write(struct hart * hartptr, uint32_t fd, void * buf, uint32_t nr_write);
+do_write(struct hart * hartptr, uint32_t fd, uint32_t buf_addr,
+         uint32_t nr_write);
 
 uint32_t
 do_mmap(struct hart* hartptr, uint32_t proposal_addr, uint32_t len,
@@ -75,7 +76,8 @@ do_ioctl(struct hart * hartptr, uint32_t fd, uint32_t request,
          uint32_t argp_addr);
 
 uint32_t
-do_read(struct hart * hartptr, uint32_t fd, void * buf, uint32_t nr_read);
+do_read(struct hart * hartptr, uint32_t fd, uint32_t buf_addr,
+        uint32_t nr_read);
 
 uint32_t
 do_getdents64(struct hart * hartptr, uint32_t fd, uint32_t dirp_addr,
@@ -13,6 +13,7 @@
 #include <pm_region.h>
 #include <vfs.h>
 #include <list.h>
+#include <hle.h>
 
 #define MAX_VMA_NR  128
 #define MAX_FILES_NR   128
@@ -48,6 +49,12 @@ struct virtual_machine {
     //struct list_elem pmr_head;
     struct pm_region_operation * vma_heap;
     struct pm_region_operation * vma_stack;
+    // one bit per guest page, it's set once a page is decoded by any thread
+    // sharing the address space. stores check it to detect self-modifying code.
+    uint8_t * code_pages_bitmap;
+    // the guest entries of the routines which are emulated by the host, zero
+    // if the program doesn't have one. see hle.h
+    uint32_t hle_entries[HLE_ROUTINE_MAX];
     
     // XXX: CLONE_FILES shares below area
     // files operation
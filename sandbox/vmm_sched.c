@@ -6,37 +6,45 @@
 #include <util.h>
 #include <log.h>
 #include <vm.h>
+#include <hart_fpu.h>
+#include <vmm_smp.h>
 
-static struct hart idle_task;
+// each host cpu has its own idle task.
+static __thread struct hart idle_task;
+
+extern void * switch_task_entry;
 
 void
 task_vmm_sched_init(struct hart * hartptr,
                     void (*next_func)(void * opaque),
                     void * opaque)
 {
+    // the frame ends at a 16-byte boundary, so that the stack is aligned when
+    // switch_task_entry calls next_func.
     uint64_t stack = (uint64_t)hartptr->vmm_stack_ptr;
-    stack -= sizeof(struct x86_64_cpustate);
     stack &= ~15;
+    stack -= sizeof(struct x86_64_cpustate);
 
     struct x86_64_cpustate * cpu = (struct x86_64_cpustate *)stack;
     memset(cpu, 0x0, sizeof(struct x86_64_cpustate));
-    cpu->rdi = (uint64_t)opaque;
-    cpu->rip = (uint64_t)next_func;
-    cpu->trap_reason = USERSPACE_TRAP_REASON_INIT;
+    cpu->r12 = (uint64_t)opaque;
+    cpu->r13 = (uint64_t)next_func;
+    cpu->rip = (uint64_t)&switch_task_entry;
     hartptr->host_cpustate = cpu;
+    // the task starts in the vmm, see vmresume()
+    hartptr->vmm_nesting = 1;
 }
 
 void
 schedule_idle_task(void)
 {
-    // idle task reuse stack of major program
+    // idle task reuse stack of the host cpu
     current = &idle_task;
 
-    yield_cpu();
-
     while (1) {
-        // sleep for some time.
         yield_cpu();
+        // nothing is runnable, the host cpu sleeps for some time.
+        vmm_wait_for_task();
     }
 }
 uint64_t
@@ -47,23 +55,38 @@ userspace_trap_handler(struct x86_64_cpustate * cpu)
     // must keep the host cpu state in order to restore it later.
     ASSERT(current);
     current->host_cpustate = cpu;
+    current->vmm_nesting = vmm_nesting;
+    // the host MXCSR holds part of the floating-point state of the task.
+    fpu_sync_flags(current);
+    // NOTE: the expired sleepers are woken up before the current task is
+    // queued, the current task may be one of them.
+    process_sleeping_list();
     // idle task is treated specifically.
     if (current != &idle_task) {
+        task_switched_out(current);
         schedule_task(current);
     }
-   
-    process_blocking_list();
+
+    // NOTE: blocked tasks are not scanned here, a wake-up queues the task onto
+    // a run queue directly, see transit_state().
     process_exiting_list();
     next_task = process_running_list();
     if (!next_task) {
         next_task = &idle_task;
     }
     current = next_task;
+    // NOTE: the sleepers woken up above may have requested a reschedule, the
+    // task just picked is the one with the least vruntime, it must not be
+    // preempted at its first dispatch.
+    vmm_clear_resched();
     ASSERT(current && current->host_cpustate);
     next_task_stack = (uint64_t)current->host_cpustate;
+    vmm_nesting = current->vmm_nesting;
+    fpu_load_state(current);
     if (current == &idle_task) {
         log_trace("next task to run: [idle]\n");
     } else {
+        task_switched_in(current);
         log_trace("next task to run: %d\n", next_task->native_vmptr->pid);
     }
     return next_task_stack;
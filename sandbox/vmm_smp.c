@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      The big vmm lock and the host cpus. a host cpu enters the vmm through
+ *      vmm_enter() and goes back to guest code through vmm_leave(), the
+ *      address space each host cpu is running is recorded under the lock so
+ *      that an exclusive section is able to wait for the host cpus running the
+ *      same address space to leave, the others go on.
+ */
+
+#include <vmm_smp.h>
+#include <vmm_sched.h>
+#include <hart_def.h>
+#include <task_sched.h>
+#include <vm.h>
+#include <util.h>
+#include <log.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+// the vmm entry point polls it, see vmm_trap.S
+extern __thread volatile int vmm_resched_requested;
+
+__thread int vmm_nesting;
+__thread int host_cpu_id;
+
+static pthread_mutex_t vmm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t guest_quiesced = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t exclusive_done = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t task_runnable = PTHREAD_COND_INITIALIZER;
+
+// the address space which is being changed in an exclusive section.
+static struct virtual_machine * exclusive_vm;
+// the address space each host cpu is running, NULL while it's in the vmm.
+static struct virtual_machine * guest_vms[VMM_MAX_HOST_CPUS];
+
+static int nr_host_cpus;
+static volatile int * resched_flags[VMM_MAX_HOST_CPUS];
+
+static struct virtual_machine *
+current_address_space(void)
+{
+    ASSERT(current && current->native_vmptr);
+    return get_linked_vm(current->native_vmptr, LINKAGE_HINT_VM);
+}
+
+static int
+address_space_in_guest(struct virtual_machine * vm)
+{
+    int idx = 0;
+    for (idx = 0; idx < nr_host_cpus; idx++) {
+        if (guest_vms[idx] == vm) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void
+vmm_enter(void)
+{
+    if (vmm_nesting++) {
+        return;
+    }
+    pthread_mutex_lock(&vmm_lock);
+    guest_vms[host_cpu_id] = NULL;
+    if (exclusive_vm) {
+        pthread_cond_signal(&guest_quiesced);
+    }
+}
+
+void
+vmm_leave(void)
+{
+    ASSERT(vmm_nesting > 0);
+    if (--vmm_nesting) {
+        return;
+    }
+    struct virtual_machine * vm = current_address_space();
+    while (exclusive_vm == vm) {
+        pthread_cond_wait(&exclusive_done, &vmm_lock);
+    }
+    guest_vms[host_cpu_id] = vm;
+    pthread_mutex_unlock(&vmm_lock);
+}
+
+void
+vmm_return_to_guest(void)
+{
+    // XXX: a trap may be raised by a helper which runs guest code as well,
+    // there is nothing to leave then.
+    if (vmm_nesting) {
+        vmm_nesting = 1;
+        vmm_leave();
+    }
+}
+
+void
+vmm_start_exclusive(void)
+{
+    ASSERT(vmm_nesting > 0);
+    struct virtual_machine * vm = current_address_space();
+    while (exclusive_vm) {
+        pthread_cond_wait(&exclusive_done, &vmm_lock);
+    }
+    exclusive_vm = vm;
+    // only the host cpus running the address space are kicked out of it.
+    int idx = 0;
+    for (idx = 0; idx < nr_host_cpus; idx++) {
+        if (guest_vms[idx] == vm && resched_flags[idx]) {
+            *resched_flags[idx] = 1;
+        }
+    }
+    while (address_space_in_guest(vm)) {
+        pthread_cond_wait(&guest_quiesced, &vmm_lock);
+    }
+}
+
+void
+vmm_end_exclusive(void)
+{
+    ASSERT(exclusive_vm);
+    exclusive_vm = NULL;
+    pthread_cond_broadcast(&exclusive_done);
+}
+
+void
+vmm_block_begin(void)
+{
+    ASSERT(vmm_nesting > 0);
+    // the time spent waiting is not charged as cpu time of the task.
+    task_switched_out(current);
+    pthread_mutex_unlock(&vmm_lock);
+}
+
+void
+vmm_block_end(void)
+{
+    ASSERT(vmm_nesting > 0);
+    pthread_mutex_lock(&vmm_lock);
+    struct virtual_machine * vm = current_address_space();
+    while (exclusive_vm == vm) {
+        pthread_cond_wait(&exclusive_done, &vmm_lock);
+    }
+    task_switched_in(current);
+}
+
+int
+vmm_nr_host_cpus(void)
+{
+    return nr_host_cpus ? nr_host_cpus : 1;
+}
+
+void
+vmm_task_runnable(void)
+{
+    if (nr_host_cpus > 1) {
+        pthread_cond_signal(&task_runnable);
+    }
+}
+
+#define IDLE_WAIT_USECONDS  1000
+
+void
+vmm_wait_for_task(void)
+{
+    // NOTE: the wait is bounded, no task is left behind if a wake-up is missed.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += IDLE_WAIT_USECONDS * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&task_runnable, &vmm_lock, &deadline);
+}
+
+void
+vmm_kick_host_cpus(void)
+{
+    int idx = 0;
+    int nr_cpus = __atomic_load_n(&nr_host_cpus, __ATOMIC_ACQUIRE);
+    for (idx = 0; idx < nr_cpus; idx++) {
+        // a host cpu which is just started may not be registered yet.
+        volatile int * flag = __atomic_load_n(&resched_flags[idx],
+                                              __ATOMIC_ACQUIRE);
+        if (flag) {
+            *flag = 1;
+        }
+    }
+}
+
+void
+vmm_request_resched(void)
+{
+    vmm_resched_requested = 1;
+}
+
+void
+vmm_clear_resched(void)
+{
+    vmm_resched_requested = 0;
+}
+
+static void
+host_cpu_init(int cpu_id)
+{
+    // a host cpu starts in the vmm with the lock held.
+    pthread_mutex_lock(&vmm_lock);
+    vmm_nesting = 1;
+    host_cpu_id = cpu_id;
+    __atomic_store_n(&resched_flags[cpu_id], &vmm_resched_requested,
+                     __ATOMIC_RELEASE);
+}
+
+static void *
+host_cpu_main(void * arg)
+{
+    host_cpu_init((int)(uint64_t)arg);
+    schedule_idle_task();
+    __not_reach();
+    return NULL;
+}
+
+void
+vmm_smp_init(void)
+{
+    int nr_cpus = 1;
+    char * smp_string = getenv("SMP");
+    if (smp_string) {
+        nr_cpus = atoi(smp_string);
+        if (nr_cpus < 1) {
+            nr_cpus = 1;
+        } else if (nr_cpus > VMM_MAX_HOST_CPUS) {
+            nr_cpus = VMM_MAX_HOST_CPUS;
+        }
+    }
+    __atomic_store_n(&nr_host_cpus, nr_cpus, __ATOMIC_RELEASE);
+    host_cpu_init(0);
+    int idx = 1;
+    for (; idx < nr_cpus; idx++) {
+        pthread_t host_cpu;
+        ASSERT(!pthread_create(&host_cpu, NULL, host_cpu_main,
+                               (void *)(uint64_t)idx));
+        ASSERT(!pthread_detach(host_cpu));
+    }
+    log_info("%d host cpu(s) run the guest\n", nr_cpus);
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2020 Jie Zheng
+ *
+ *      SMP mode: a pool of host threads (host cpus) pick guest tasks off their
+ *      run queues and execute their translation caches concurrently. the
+ *      vmm itself is serialized by one big lock, a host cpu holds it whenever
+ *      it's not running guest code, except in a host call which may block,
+ *      see vmm_block_begin(). guest memory is accessed without the
+ *      lock, so an address space is changed in exclusive sections only, when
+ *      no host cpu is running code of it.
+ */
+
+#ifndef _VMM_SMP_H
+#define _VMM_SMP_H
+
+// how deep the host cpu is nested in the vmm, zero while it's running guest
+// code. it's kept in the task across task switches, see vmm_sched.c
+extern __thread int vmm_nesting;
+
+// the index of the calling host cpu, 0 for the first one.
+extern __thread int host_cpu_id;
+
+int
+vmm_nr_host_cpus(void);
+
+// the number of host cpus is taken from the environment variable SMP, the
+// calling thread becomes the first host cpu and the others are started.
+void
+vmm_smp_init(void);
+
+// leave guest code for the vmm, nested calls are allowed.
+void
+vmm_enter(void);
+
+// the reverse of vmm_enter(), the host cpu goes back to guest code once the
+// outermost level is left.
+void
+vmm_leave(void);
+
+// the vmm frames of the host cpu never return, e.g. a trap is delivered or a
+// task is resumed, it's going to run guest code right now.
+void
+vmm_return_to_guest(void);
+
+// wait until no other host cpu is running the address space of the current
+// task and keep them out of it until vmm_end_exclusive(). the host cpus
+// running other address spaces go on. must be called in the vmm.
+void
+vmm_start_exclusive(void);
+
+void
+vmm_end_exclusive(void);
+
+// a host call which may wait for long, e.g. a read from a tty or a pipe, is
+// made with the lock dropped so that the other host cpus go on. the host cpu
+// is still out of guest code, it must not touch guest memory in between.
+void
+vmm_block_begin(void);
+
+// the lock is taken again, an exclusive section of the address space which
+// is started meanwhile is waited for.
+void
+vmm_block_end(void);
+
+// a task is put onto a run queue, an idle host cpu may steal it.
+void
+vmm_task_runnable(void);
+
+// the idle task of the host cpu waits for a task to become runnable.
+void
+vmm_wait_for_task(void);
+
+// request all host cpus to leave guest code at their next dispatch.
+void
+vmm_kick_host_cpus(void);
+
+// the same for the calling host cpu only.
+void
+vmm_request_resched(void);
+
+// drop the pending request of the calling host cpu, a task switch satisfies it.
+void
+vmm_clear_resched(void);
+
+#endif